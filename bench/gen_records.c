@@ -0,0 +1,20 @@
+// Write about the given number of megabytes of records for the records
+// benchmarks to standard output: name,INTEGER,REAL,BOOLEAN per line
+// Usage: gen_records [megabytes]
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+  unsigned long long megabytes = argc > 1 ? strtoull(argv[1], NULL, 10) : 1024;
+  unsigned long long size = 0;
+  unsigned long long x = 88172645463325252ull;
+  static char buffer[1 << 16];
+  setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+  while(size < megabytes * 1000000) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    size += printf("student%llu,%d,%d.%02d,%s\n", x % 100000, (int)(x % 101), (int)(x % 1000), (int)((x >> 20) % 100), (x >> 33) & 1 ? "TRUE" : "FALSE");
+  }
+  return 0;
+}
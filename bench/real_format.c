@@ -0,0 +1,55 @@
+// Time real_format() against printf()'s %.17g and %g on random doubles
+// Usage: real_format [count]
+#include "../src/real.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t seed = 1234567ull;
+
+static uint64_t next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+static double now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000000;
+  double *values = malloc(sizeof(double) * count);
+  if(!values) {
+    fprintf(stderr, "malloc() failed.\n");
+    return 1;
+  }
+  // Random finite doubles
+  for(size_t i = 0; i < count; i++) {
+    do {
+      uint64_t bits = next_random();
+      memcpy(&values[i], &bits, sizeof(double));
+    } while(values[i] != values[i] || values[i] - values[i] != 0);
+  }
+
+  // The lengths are summed so none of the calls can be left out
+  char buf[64];
+  size_t total = 0;
+  double start = now();
+  for(size_t i = 0; i < count; i++) total += real_format(values[i], buf);
+  printf("real_format %6.0f ns/value\n", (now() - start) / count * 1e9);
+  start = now();
+  for(size_t i = 0; i < count; i++) total += snprintf(buf, sizeof(buf), "%.17g", values[i]);
+  printf("%%.17g       %6.0f ns/value\n", (now() - start) / count * 1e9);
+  start = now();
+  for(size_t i = 0; i < count; i++) total += snprintf(buf, sizeof(buf), "%g", values[i]);
+  printf("%%g          %6.0f ns/value\n", (now() - start) / count * 1e9);
+
+  free(values);
+  return total == 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Time the benchmark programs, each on its own with its output thrown away
+# The records benchmarks READ a records.csv made by GEN_RECORDS, of
+# RECORDS_MB megabytes, 1024 unless it's set.
+# Usage: bench/run.sh [edxp] [benchmark...]
+EDXP=$(realpath "${1:-./build/edxp}")
+[ $# -gt 0 ] && shift
+BENCH=$(cd "$(dirname "$0")" && pwd)
+GEN_RECORDS=$(realpath "$GEN_RECORDS")
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Every benchmark, unless some are named
+if [ $# -eq 0 ]; then
+  for program in "$BENCH"/*.edx; do set -- "$@" "$(basename "$program" .edx)"; done
+fi
+
+cd "$DIR"
+status=0
+for name in "$@"; do
+  case $name in
+    records_*) [ -f records.csv ] || "$GEN_RECORDS" "${RECORDS_MB:-1024}" > records.csv ;;
+  esac
+  start=$(date +%s%N)
+  if "$EDXP" "$BENCH/$name.edx" > output.txt; then
+    end=$(date +%s%N)
+    printf "%-18s %8d ms  %s\n" "$name" $(((end - start) / 1000000)) "$(head -c 40 output.txt | head -n 1)"
+  else
+    echo "FAIL  $name (exit $?)"
+    status=1
+  fi
+done
+exit $status
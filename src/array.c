@@ -0,0 +1,289 @@
+#include "array.h"
+#include "def.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of arrays that haven't been destroyed, on this thread
+static _Thread_local size_t live_arrays = 0;
+
+// Size of one element of an array of a type
+// BOOLEAN elements don't have a size in bytes, see array_data_size().
+static size_t array_elem_size(VarType type) {
+  switch(type) {
+  case VarInteger:
+    return sizeof(int32_t);
+  case VarReal:
+    return sizeof(double);
+  case VarCharacter:
+    return sizeof(char);
+  case VarString:
+    return sizeof(String);
+  default:
+    return 0;
+  }
+}
+
+// Number of bytes needed to store count elements of a type
+size_t array_data_size(VarType type, size_t count) {
+  if(type == VarBoolean) return (count + 63) / 64 * sizeof(uint64_t);
+  return count * array_elem_size(type);
+}
+
+// Copy count bits from src starting at bit src_start to dst starting at bit
+// dst_start
+// Whole words are copied when both start on a word boundary.
+static void bits_copy(uint64_t *dst, size_t dst_start, uint64_t *src, size_t src_start, size_t count) {
+  size_t i = 0;
+  if(dst_start % 64 == 0 && src_start % 64 == 0) {
+    memcpy(dst + dst_start / 64, src + src_start / 64, count / 64 * sizeof(uint64_t));
+    i = count / 64 * 64;
+  }
+
+  for(; i < count; i++) {
+    size_t from = src_start + i;
+    size_t to = dst_start + i;
+    uint64_t mask = (uint64_t)1 << (to % 64);
+    if((src[from / 64] >> (from % 64)) & 1) dst[to / 64] |= mask;
+    else dst[to / 64] &= ~mask;
+  }
+}
+
+// Copy count elements of src starting at src_start into dst starting at
+// dst_start
+// The destination elements must not hold anything that needs freeing. STRING
+// elements share their buffers with the source.
+static int copy_elems(Array *dst, size_t dst_start, Array *src, size_t src_start, size_t count) {
+  if(dst->type == VarBoolean) {
+    bits_copy(dst->bits, dst_start, src->bits, src_start, count);
+    return 0;
+  }
+
+  if(dst->type == VarString) {
+    for(size_t i = 0; i < count; i++) string_copy(&dst->strings[dst_start + i], &src->strings[src_start + i]);
+    return 0;
+  }
+
+  size_t size = array_elem_size(dst->type);
+  memcpy((char *)dst->data + dst_start * size, (char *)src->data + src_start * size, count * size);
+  return 0;
+}
+
+// Create an array of zeroed elements
+// type may be -1 for an empty array whose element type isn't known yet, like
+// the literal [].
+Array *array_create(VarType type, size_t length) {
+  if(type != -1 && type != VarBoolean && !array_elem_size(type)) {
+    PERROR("Invalid array element type %d\n", type);
+    return NULL;
+  }
+
+  Array *array = pool_calloc(sizeof(Array));
+  if(!array) {
+    PERROR("pool_calloc() failed.\n");
+    return NULL;
+  }
+
+  array->type = type;
+  array->refs = 1;
+  if(length > 0) {
+    array->data = pool_calloc(array_data_size(type, length));
+    if(!array->data) {
+      PERROR("pool_calloc() failed.\n");
+      pool_free(array);
+      return NULL;
+    }
+  }
+  array->length = length;
+  array->capacity = type == VarBoolean ? array_data_size(type, length) * 8 : length;
+  live_arrays++;
+  return array;
+}
+
+// Create a two-dimensional array of zeroed elements
+Array *array_create_2d(VarType type, size_t rows, size_t columns) {
+  if(columns == 0) {
+    PERROR("A two-dimensional array needs at least one column\n");
+    return NULL;
+  }
+  if(rows > SIZE_MAX / columns) {
+    PERROR("Array of %zu by %zu elements is too large\n", rows, columns);
+    return NULL;
+  }
+
+  Array *array = array_create(type, rows * columns);
+  if(!array) return NULL;
+  array->stride = columns;
+  return array;
+}
+
+// Release a reference to an array, destroying it once nothing refers to it
+void array_destroy(Array **array) {
+  if(!array) return;
+  Array *a = *array;
+  if(!a) return;
+  *array = NULL;
+  if(--a->refs > 0) return;
+  if(a->type == VarString) {
+    for(size_t i = 0; i < a->length; i++) string_destroy(&a->strings[i]);
+  }
+  pool_free(a->data);
+  a->data = NULL;
+  pool_free(a);
+  live_arrays--;
+}
+
+// Number of arrays created on this thread that haven't been destroyed yet
+size_t array_live_count(void) {
+  return live_arrays;
+}
+
+// Share an array, adding a reference to it
+Array *array_share(Array *array) {
+  array->refs++;
+  return array;
+}
+
+// Make sure nothing else refers to an array before it's changed
+// A shared array is replaced by a copy of its own.
+int array_make_unique(Array **array) {
+  if((*array)->refs == 1) return 0;
+
+  Array *copy = array_copy(*array);
+  if(!copy) {
+    PERROR("Failed to copy shared array.\n");
+    return 1;
+  }
+  array_destroy(array);
+  *array = copy;
+  return 0;
+}
+
+// Copy an array and its elements
+Array *array_copy(Array *array) {
+  if(!array) return NULL;
+  Array *copy = array_create(array->type, 0);
+  if(!copy) {
+    PERROR("Failed to create array copy.\n");
+    return NULL;
+  }
+  copy->stride = array->stride;
+
+  if(array_extend(copy, array) != 0) {
+    PERROR("Failed to copy array elements.\n");
+    array_destroy(&copy);
+    return NULL;
+  }
+  return copy;
+}
+
+// Make sure an array has room for at least capacity elements
+// Capacity grows geometrically, so appending one element at a time is
+// amortised O(1).
+int array_reserve(Array *array, size_t capacity) {
+  if(!array) return 1;
+  if(capacity <= array->capacity) return 0;
+
+  size_t new_capacity = array->capacity ? array->capacity * 2 : 16;
+  while(new_capacity < capacity) new_capacity *= 2;
+
+  size_t old_size = array_data_size(array->type, array->capacity);
+  size_t new_size = array_data_size(array->type, new_capacity);
+  char *new = pool_realloc(array->data, new_size);
+  if(!new) {
+    PERROR("pool_realloc() failed.\n");
+    return 1;
+  }
+
+  // Keep the bits past the end of a packed array cleared
+  if(array->type == VarBoolean) memset(new + old_size, 0, new_size - old_size);
+  array->data = new;
+  array->capacity = new_capacity;
+  return 0;
+}
+
+// Append every element of other to array
+// The element types must match, unless one of the arrays is empty.
+int array_extend(Array *array, Array *other) {
+  if(!array || !other) return 1;
+  if(other->length == 0) return 0;
+  if(array->type == -1 && array->length == 0) array->type = other->type;
+  if(array->type != other->type) {
+    PERROR("Mismatched array element types.\n");
+    return 1;
+  }
+
+  // other may be array itself, so remember its length before growing
+  size_t other_length = other->length;
+  if(array_reserve(array, array->length + other_length) != 0) {
+    PERROR("Failed to grow array.\n");
+    return 1;
+  }
+
+  if(copy_elems(array, array->length, other, 0, other_length) != 0) {
+    PERROR("Failed to copy array elements.\n");
+    return 1;
+  }
+  array->length += other_length;
+  return 0;
+}
+
+// Check if two arrays have the same shape and elements
+int array_equal(Array *a, Array *b) {
+  if(a->length != b->length || a->stride != b->stride) return 0;
+  if(a->length == 0) return 1;
+  if(a->type != b->type) return 0;
+
+  if(a->type == VarString) {
+    for(size_t i = 0; i < a->length; i++) {
+      if(string_compare(&a->strings[i], &b->strings[i]) != 0) return 0;
+    }
+    return 1;
+  }
+  return memcmp(a->data, b->data, array_data_size(a->type, a->length)) == 0;
+}
+
+// Number of rows in an array
+// A one-dimensional array is a single row of elements, but reads like a list,
+// so its length is returned.
+size_t array_rows(Array *array) {
+  return array->stride ? array->length / array->stride : array->length;
+}
+
+// Copy one row of a two-dimensional array into a new one-dimensional array
+Array *array_row(Array *array, size_t row) {
+  if(!array->stride || row >= array_rows(array)) {
+    PERROR("Row %zu is out of bounds\n", row);
+    return NULL;
+  }
+
+  Array *copy = array_create(array->type, array->stride);
+  if(!copy) {
+    PERROR("Failed to create row copy.\n");
+    return NULL;
+  }
+
+  // The new row's STRING elements are zeroed, which is an empty string
+  if(copy_elems(copy, 0, array, row * array->stride, array->stride) != 0) {
+    PERROR("Failed to copy row.\n");
+    copy->length = 0;
+    array_destroy(&copy);
+    return NULL;
+  }
+  return copy;
+}
+
+// Set count elements of an ARRAY OF BOOLEAN, starting at start, to bit
+// Whole words in the middle of the range are set at once.
+void array_fill_bits(Array *array, size_t start, size_t count, int bit) {
+  size_t end = start + count;
+  size_t i = start;
+  for(; i < end && i % 64 != 0; i++) array_set_bit(array, i, bit);
+
+  size_t words = (end - i) / 64;
+  memset(array->bits + i / 64, bit ? 0xff : 0, words * sizeof(uint64_t));
+  i += words * 64;
+
+  for(; i < end; i++) array_set_bit(array, i, bit);
+}
@@ -0,0 +1,63 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+
+// Includes
+#include "parser.h"
+#include "str.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Structs
+// A contiguous buffer of unboxed elements, all of the same type
+// BOOLEAN elements are packed 64 to a word, bit i % 64 of word i / 64. Bits
+// past the length are always 0, so packed arrays can be compared a word at a
+// time.
+// A two-dimensional array is stored row by row in the same buffer, with stride
+// elements in each row, so element [r, c] is at r * stride + c. stride is 0 for
+// a one-dimensional array.
+// Arrays are reference counted, and copies share one until it is changed. Any
+// change must go through array_make_unique() first.
+typedef struct {
+  size_t refs;
+  VarType type;
+  size_t length;
+  size_t capacity;
+  size_t stride;
+  union {
+    int32_t *ints;
+    double *reals;
+    char *chars;
+    uint64_t *bits;
+    String *strings;
+    void *data;
+  };
+} Array;
+
+// Function prototypes
+size_t array_data_size(VarType type, size_t count);
+Array *array_create(VarType type, size_t length);
+Array *array_create_2d(VarType type, size_t rows, size_t columns);
+void array_destroy(Array **array);
+Array *array_share(Array *array);
+int array_make_unique(Array **array);
+size_t array_live_count(void);
+Array *array_copy(Array *array);
+int array_reserve(Array *array, size_t capacity);
+int array_extend(Array *array, Array *other);
+int array_equal(Array *a, Array *b);
+size_t array_rows(Array *array);
+Array *array_row(Array *array, size_t row);
+void array_fill_bits(Array *array, size_t start, size_t count, int bit);
+
+// Read and write elements of an ARRAY OF BOOLEAN
+static inline int array_get_bit(Array *array, size_t index) {
+  return (array->bits[index / 64] >> (index % 64)) & 1;
+}
+
+static inline void array_set_bit(Array *array, size_t index, int bit) {
+  uint64_t mask = (uint64_t)1 << (index % 64);
+  if(bit) array->bits[index / 64] |= mask;
+  else array->bits[index / 64] &= ~mask;
+}
+
+#endif // array.h
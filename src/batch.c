@@ -0,0 +1,361 @@
+#include "batch.h"
+#include "def.h"
+#include "source.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Add a program to a batch
+static int batch_add(Batch *batch, const char *dir, const char *name, size_t length) {
+  BatchJob *jobs = realloc(batch->jobs, sizeof(BatchJob) * (batch->job_count + 1));
+  if(!jobs) {
+    PERROR("realloc() failed.\n");
+    return 1;
+  }
+  batch->jobs = jobs;
+
+  size_t dir_length = dir ? strlen(dir) + 1 : 0;
+  char *path = malloc(dir_length + length + 1);
+  if(!path) {
+    PERROR("malloc() failed.\n");
+    return 1;
+  }
+  if(dir) {
+    memcpy(path, dir, dir_length - 1);
+    path[dir_length - 1] = '/';
+  }
+  memcpy(path + dir_length, name, length);
+  path[dir_length + length] = '\0';
+
+  jobs[batch->job_count++] = (BatchJob){.path = path};
+  return 0;
+}
+
+static int has_suffix(const char *name, size_t length, const char *suffix) {
+  size_t suffix_length = strlen(suffix);
+  return length > suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+  return strcmp(((const BatchJob *)a)->path, ((const BatchJob *)b)->path);
+}
+
+// Find the programs to run, or the inputs to run the program on
+// source is either a directory, where every .edx file in it or every input is
+// run in order of name, or a file listing them one per line. The outputs of
+// earlier sweeps, and hidden files, aren't inputs.
+static int batch_list(Batch *batch, char *source) {
+  struct stat st;
+  if(stat(source, &st) != 0) {
+    PERROR("Couldn't open %s: %s\n", source, strerror(errno));
+    return 1;
+  }
+
+  if(S_ISDIR(st.st_mode)) {
+    DIR *dir = opendir(source);
+    if(!dir) {
+      PERROR("Couldn't open %s: %s\n", source, strerror(errno));
+      return 1;
+    }
+    struct dirent *entry;
+    while((entry = readdir(dir))) {
+      size_t length = strlen(entry->d_name);
+      if(entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) continue;
+      if(batch->program && (entry->d_name[0] == '.' || has_suffix(entry->d_name, length, ".out"))) continue;
+      if(!batch->program && !has_suffix(entry->d_name, length, ".edx")) continue;
+      if(batch_add(batch, source, entry->d_name, length) != 0) {
+        closedir(dir);
+        return 1;
+      }
+    }
+    closedir(dir);
+    if(batch->job_count) qsort(batch->jobs, batch->job_count, sizeof(BatchJob), compare_jobs);
+    return 0;
+  }
+
+  char *list = read_file_str(source);
+  if(!list) return 1;
+  char *line = list;
+  while(*line) {
+    char *end = strchr(line, '\n');
+    char *next = end ? end + 1 : line + strlen(line);
+    if(!end) end = next;
+    if(end > line && end[-1] == '\r') end--;
+    if(end > line && batch_add(batch, NULL, line, end - line) != 0) {
+      free(list);
+      return 1;
+    }
+    line = next;
+  }
+  free(list);
+  return 0;
+}
+
+// Read back everything a program displayed
+static char *read_output(int fd, size_t *size) {
+  off_t end = lseek(fd, 0, SEEK_END);
+  char *data = end >= 0 ? malloc(end ? end : 1) : NULL;
+  if(!data) return NULL;
+
+  size_t got = 0;
+  while(got < (size_t)end) {
+    ssize_t n = pread(fd, data + got, end - got, got);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) {
+      free(data);
+      return NULL;
+    }
+    got += n;
+  }
+  *size = got;
+  return data;
+}
+
+// Open the file an input's output goes to, next to it with .out on the end
+static int open_sweep_output(const char *path) {
+  size_t length = strlen(path);
+  char *out_path = malloc(length + 5);
+  if(!out_path) {
+    PERROR("malloc() failed.\n");
+    return -1;
+  }
+  memcpy(out_path, path, length);
+  memcpy(out_path + length, ".out", 5);
+  int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(fd < 0) PERROR("Couldn't open %s: %s\n", out_path, strerror(errno));
+  free(out_path);
+  return fd;
+}
+
+// Start a job's program, giving it its input
+// KEYBOARD gets the job's input with --inputs. Otherwise there's no one to
+// type on it, so it and any other unbound device the program reads from are at
+// the end of their input from the start.
+static Interpreter *batch_start(Batch *batch, BatchJob *job, Parser *parser, int display_fd) {
+  Interpreter *interpreter = interpreter_start(parser, batch->config, display_fd, NULL);
+  if(!interpreter) return NULL;
+
+  Input *keyboard = interpreter->devices[DEVICE_KEYBOARD].reader;
+  if(batch->program && keyboard && keyboard->fd < 0 && !keyboard->eof) {
+    char *input = read_file_str(job->path);
+    int status = !input || input_feed(keyboard, input, strlen(input)) != 0;
+    free(input);
+    if(status) {
+      PERROR("Couldn't feed %s to the program.\n", job->path);
+      interpreter_destroy(&interpreter);
+      return NULL;
+    }
+  }
+  for(size_t d = 0; d < interpreter->device_count; d++) {
+    Input *reader = interpreter->devices[d].reader;
+    if(reader && reader->fd < 0 && !reader->eof) input_feed(reader, "", 0);
+  }
+  return interpreter;
+}
+
+// Run a job, capturing what its program reports
+// With --inputs DISPLAY goes to the input's .out file, otherwise it's captured
+// too.
+static void batch_run_job(Batch *batch, BatchJob *job) {
+  job->status = ERR_CREATE_FAIL;
+  FILE *diagnostics = open_memstream(&job->diagnostics, &job->diagnostics_size);
+  if(!diagnostics) {
+    PERROR("open_memstream() failed.\n");
+    return;
+  }
+  diag_out = diagnostics;
+
+  FILE *capture = batch->program ? NULL : tmpfile();
+  int display_fd = batch->program ? open_sweep_output(job->path) : capture ? fileno(capture) : -1;
+  uint64_t start = iolog_now();
+  Parser *parser = NULL;
+  if(display_fd >= 0) parser = batch->program ? batch->program : source_parse_file(job->path);
+  Interpreter *interpreter = parser ? batch_start(batch, job, parser, display_fd) : NULL;
+  if(interpreter) {
+    int run = interpreter_run(interpreter, SIZE_MAX);
+    if(run == RUN_DONE) job->status = ERR_OKAY;
+    else if(run == RUN_FAILED) job->status = interpreter->status;
+    else job->status = ERR_INPUT;
+    interpreter_destroy(&interpreter);
+  }
+  if(parser != batch->program) parser_destroy(&parser);
+  job->time = iolog_now() - start;
+
+  if(capture) {
+    job->output = read_output(display_fd, &job->output_size);
+    if(!job->output) {
+      PERROR("Couldn't read back the output of %s.\n", job->path);
+      if(!job->status) job->status = ERR_IO;
+    }
+    fclose(capture);
+  } else if(display_fd >= 0) {
+    close(display_fd);
+  } else {
+    PERROR("Couldn't capture the output of %s.\n", job->path);
+  }
+  diag_out = NULL;
+  fclose(diagnostics);
+}
+
+// Take the next job from a worker's queue
+// A worker whose queue is empty steals the back half of the first other queue
+// that isn't. Jobs are never added once the workers start, so once every
+// queue is empty the batch is done.
+static BatchJob *batch_next_job(Batch *batch, size_t worker) {
+  BatchQueue *own = &batch->queues[worker];
+  for(size_t k = 0; k < batch->worker_count; k++) {
+    BatchQueue *queue = &batch->queues[(worker + k) % batch->worker_count];
+    pthread_mutex_lock(&queue->lock);
+    size_t head = queue->head;
+    size_t tail = queue->tail;
+    if(head < tail && queue != own) queue->tail = head + (tail - head) / 2;
+    if(head < tail && queue == own) queue->head++;
+    pthread_mutex_unlock(&queue->lock);
+    if(head >= tail) continue;
+    if(queue == own) return &batch->jobs[head];
+
+    // Keep the first stolen job, and queue up the rest
+    size_t stolen = head + (tail - head) / 2;
+    pthread_mutex_lock(&own->lock);
+    own->head = stolen + 1;
+    own->tail = tail;
+    pthread_mutex_unlock(&own->lock);
+    return &batch->jobs[stolen];
+  }
+  return NULL;
+}
+
+static void *batch_worker(void *arg) {
+  BatchWorker *worker = arg;
+  BatchJob *job;
+  while((job = batch_next_job(worker->batch, worker->index))) batch_run_job(worker->batch, job);
+  return NULL;
+}
+
+// Run a batch's jobs on a pool of threads
+// Returns how long they took in seconds, or a negative number if the workers
+// couldn't be set up.
+static double batch_execute(Batch *batch, size_t threads) {
+  batch->queues = calloc(threads, sizeof(BatchQueue));
+  BatchWorker *workers = calloc(threads, sizeof(BatchWorker));
+  if(!batch->queues || !workers) {
+    PERROR("calloc() failed.\n");
+    free(workers);
+    return -1;
+  }
+
+  // Each worker starts with an even share of the jobs, in order
+  batch->worker_count = threads;
+  for(size_t w = 0; w < threads; w++) {
+    pthread_mutex_init(&batch->queues[w].lock, NULL);
+    batch->queues[w].head = batch->job_count * w / threads;
+    batch->queues[w].tail = batch->job_count * (w + 1) / threads;
+    workers[w] = (BatchWorker){.batch = batch, .index = w};
+  }
+
+  // This thread is worker 0, and a worker that can't be started has its jobs
+  // stolen by the others
+  uint64_t start = iolog_now();
+  for(size_t w = 1; w < threads; w++) {
+    workers[w].started = pthread_create(&workers[w].thread, NULL, batch_worker, &workers[w]) == 0;
+  }
+  batch_worker(&workers[0]);
+  for(size_t w = 1; w < threads; w++) {
+    if(workers[w].started) pthread_join(workers[w].thread, NULL);
+  }
+  double seconds = (iolog_now() - start) / 1e9;
+
+  for(size_t w = 0; w < threads; w++) pthread_mutex_destroy(&batch->queues[w].lock);
+  free(workers);
+  return seconds;
+}
+
+// Find a batch's jobs and run them
+// Returns how long they took in seconds, or a negative number on an error.
+static double batch_list_and_execute(Batch *batch, char *source, size_t threads) {
+  if(batch_list(batch, source) != 0) return -1;
+  if(batch->job_count == 0) {
+    PERROR("There is nothing to run in %s.\n", source);
+    return -1;
+  }
+  if(threads > batch->job_count) threads = batch->job_count;
+  return batch_execute(batch, threads ? threads : 1);
+}
+
+// Free a batch and all its jobs
+static void batch_free(Batch *batch) {
+  for(size_t j = 0; j < batch->job_count; j++) {
+    free(batch->jobs[j].path);
+    free(batch->jobs[j].output);
+    free(batch->jobs[j].diagnostics);
+  }
+  free(batch->jobs);
+  free(batch->queues);
+}
+
+// Print a job's diagnostics, if it has any
+static void print_diagnostics(BatchJob *job) {
+  if(job->diagnostics_size == 0) return;
+  fflush(stdout);
+  fprintf(stderr, "==> %s <==\n", job->path);
+  fwrite(job->diagnostics, 1, job->diagnostics_size, stderr);
+}
+
+// Run every program in a directory or list on a pool of threads
+// Each program's output and diagnostics are printed together once they've all
+// finished, in the order they were listed, followed by the batch's throughput.
+// Returns 0 if every program succeeded.
+int batch_run(char *source, size_t threads, InterpreterConfig *config) {
+  Batch batch = {.config = config};
+  double seconds = batch_list_and_execute(&batch, source, threads);
+  if(seconds < 0) {
+    batch_free(&batch);
+    return 1;
+  }
+
+  size_t failed = 0;
+  for(size_t j = 0; j < batch.job_count; j++) {
+    BatchJob *job = &batch.jobs[j];
+    printf("==> %s <==\n", job->path);
+    fwrite(job->output, 1, job->output_size, stdout);
+    print_diagnostics(job);
+    if(job->status) failed++;
+  }
+  fflush(stdout);
+  fprintf(stderr, "Batch: %zu programs, %zu failed, %zu threads, %.3f s, %.1f programs/s\n", batch.job_count, failed, batch.worker_count, seconds, seconds > 0 ? batch.job_count / seconds : 0.0);
+  batch_free(&batch);
+  return failed > 0;
+}
+
+// Run one program on every input in a directory or list on a pool of threads
+// The program is only parsed once, and every thread runs the same copy of it.
+// What it displays for each input goes in a .out file next to the input, and
+// each input's status and time are printed once they've all finished.
+// Returns 0 if the program succeeded on every input.
+int batch_sweep(Parser *program, char *inputs, size_t threads, InterpreterConfig *config) {
+  Batch batch = {.program = program, .config = config};
+  double seconds = batch_list_and_execute(&batch, inputs, threads);
+  if(seconds < 0) {
+    batch_free(&batch);
+    return 1;
+  }
+
+  size_t failed = 0;
+  for(size_t j = 0; j < batch.job_count; j++) {
+    BatchJob *job = &batch.jobs[j];
+    if(job->status) printf("%s: status %d, %.3f ms\n", job->path, job->status, job->time / 1e6);
+    else printf("%s: ok, %.3f ms\n", job->path, job->time / 1e6);
+    print_diagnostics(job);
+    if(job->status) failed++;
+  }
+  fflush(stdout);
+  fprintf(stderr, "Inputs: %zu inputs, %zu failed, %zu threads, %.3f s, %.1f inputs/s\n", batch.job_count, failed, batch.worker_count, seconds, seconds > 0 ? batch.job_count / seconds : 0.0);
+  batch_free(&batch);
+  return failed > 0;
+}
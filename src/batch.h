@@ -0,0 +1,57 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Includes
+#include "interpreter.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Structs
+// A program run by --batch, or an input --inputs runs a program on, and what
+// happened
+typedef struct {
+  char *path;
+  int status;
+  // How long the program took to run, in nanoseconds
+  uint64_t time;
+  char *output;
+  size_t output_size;
+  char *diagnostics;
+  size_t diagnostics_size;
+} BatchJob;
+
+// The jobs waiting for one worker, a range of the batch's jobs
+// The worker takes them from the front, and workers that have run out steal
+// them from the back.
+typedef struct {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t tail;
+} BatchQueue;
+
+// Programs being run on a pool of worker threads
+// program is the one program every job runs with --inputs, and is only read
+// from while it runs. Otherwise each job is a program of its own.
+typedef struct {
+  Parser *program;
+  BatchJob *jobs;
+  size_t job_count;
+  BatchQueue *queues;
+  size_t worker_count;
+  InterpreterConfig *config;
+} Batch;
+
+// A worker thread, working through its own queue and then other workers'
+typedef struct {
+  Batch *batch;
+  size_t index;
+  pthread_t thread;
+  int started;
+} BatchWorker;
+
+// Function prototypes
+int batch_run(char *source, size_t threads, InterpreterConfig *config);
+int batch_sweep(Parser *program, char *inputs, size_t threads, InterpreterConfig *config);
+
+#endif // batch.h
@@ -0,0 +1,647 @@
+// dl_iterate_phdr(), to find the build id of the code running
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "def.h"
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// FNV-1a hash of a program's source
+uint64_t cache_hash(const char *source, size_t length) {
+  uint64_t hash = 14695981039346656037u;
+  for(size_t n = 0; n < length; n++) {
+    hash ^= (unsigned char)source[n];
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+// Hash of the build of edxp running, worked out once by cache_build_once()
+static uint64_t build_hash;
+static pthread_once_t build_once = PTHREAD_ONCE_INIT;
+
+// Hash a whole file, or give 0 if it can't be read
+static uint64_t hash_file(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if(!file) return 0;
+  uint64_t hash = 14695981039346656037u;
+  char buffer[65536];
+  size_t got;
+  while((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    for(size_t n = 0; n < got; n++) {
+      hash ^= (unsigned char)buffer[n];
+      hash *= 1099511628211u;
+    }
+  }
+  fclose(file);
+  return hash;
+}
+
+// Hash the build id of the executable or library holding this code
+// The linker's build id changes with anything linked into it. Without one,
+// the file it was loaded from is hashed instead.
+static int hash_build_id(struct dl_phdr_info *info, size_t size, void *data) {
+  (void)size;
+  uintptr_t code = (uintptr_t)&hash_build_id;
+  int found = 0;
+  for(int p = 0; p < info->dlpi_phnum && !found; p++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[p];
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+    found = phdr->p_type == PT_LOAD && code >= start && code - start < phdr->p_memsz;
+  }
+  if(!found) return 0;
+
+  uint64_t *hash = data;
+  for(int p = 0; p < info->dlpi_phnum; p++) {
+    const ElfW(Phdr) *phdr = &info->dlpi_phdr[p];
+    if(phdr->p_type != PT_NOTE) continue;
+    const char *note = (const char *)(info->dlpi_addr + phdr->p_vaddr);
+    const char *end = note + phdr->p_memsz;
+    while(note + sizeof(ElfW(Nhdr)) <= end) {
+      const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+      const char *name = note + sizeof(ElfW(Nhdr));
+      const char *desc = name + ((nhdr->n_namesz + 3) & ~3u);
+      if(nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+        *hash = cache_hash(desc, nhdr->n_descsz);
+        return 1;
+      }
+      note = desc + ((nhdr->n_descsz + 3) & ~3u);
+    }
+  }
+  *hash = hash_file(info->dlpi_name && info->dlpi_name[0] ? info->dlpi_name : "/proc/self/exe");
+  return 1;
+}
+
+static void cache_build_once(void) {
+  dl_iterate_phdr(hash_build_id, &build_hash);
+}
+
+// Describe the build of edxp, which cached files have to match to be used
+// That's the cache's format, the sizes of what images hold and the build of
+// edxp itself, so rebuilding it throws away everything cached before.
+static void cache_build(char build[IMAGE_BUILD_SIZE]) {
+  pthread_once(&build_once, cache_build_once);
+  memset(build, 0, IMAGE_BUILD_SIZE);
+  snprintf(build, IMAGE_BUILD_SIZE, "%d %zu %zu %016llx", CACHE_FORMAT, sizeof(ASTNode), sizeof(Parser), (unsigned long long)build_hash);
+}
+
+// Path of one of a program's cached files, creating the cache directory if
+// create is set
+static char *cache_path(const char *source_path, const char *suffix, int create) {
+  const char *slash = strrchr(source_path, '/');
+  size_t dir_length = slash ? slash - source_path + 1 : 0;
+  const char *name = source_path + dir_length;
+  size_t length = dir_length + strlen(CACHE_DIR) + 1 + strlen(name) + strlen(suffix);
+  char *path = malloc(length + 1);
+  if(!path) {
+    PERROR("malloc() failed.\n");
+    return NULL;
+  }
+
+  memcpy(path, source_path, dir_length);
+  strcpy(path + dir_length, CACHE_DIR);
+  if(create && mkdir(path, 0777) != 0 && errno != EEXIST) {
+    PERROR("Couldn't create %s: %s\n", path, strerror(errno));
+    free(path);
+    return NULL;
+  }
+  strcat(path, "/");
+  strcat(path, name);
+  strcat(path, suffix);
+  return path;
+}
+
+// Write a cached file out under a temporary name, and then move it into
+// place, so it's never seen half written
+static int cache_write(const char *path, const char *head, size_t head_length, const char *data, size_t length) {
+  size_t path_length = strlen(path);
+  char *temp = malloc(path_length + 8);
+  if(!temp) {
+    PERROR("malloc() failed.\n");
+    return 1;
+  }
+  memcpy(temp, path, path_length);
+  strcpy(temp + path_length, ".XXXXXX");
+
+  int fd = mkstemp(temp);
+  if(fd < 0) {
+    PERROR("Couldn't create %s: %s\n", temp, strerror(errno));
+    free(temp);
+    return 1;
+  }
+  // mkstemp() only lets the owner read it, but anyone who can read the
+  // program can read what it's cached as
+  int status = fchmod(fd, 0644) != 0;
+  const char *parts[2] = {head, data};
+  size_t lengths[2] = {head_length, length};
+  for(int p = 0; p < 2 && !status; p++) {
+    while(lengths[p] > 0) {
+      ssize_t written = write(fd, parts[p], lengths[p]);
+      if(written < 0 && errno == EINTR) continue;
+      if(written < 0) {
+        PERROR("Couldn't write %s: %s\n", temp, strerror(errno));
+        status = 1;
+        break;
+      }
+      parts[p] += written;
+      lengths[p] -= written;
+    }
+  }
+  if(close(fd) != 0) status = 1;
+  if(!status && rename(temp, path) != 0) {
+    PERROR("Couldn't replace %s: %s\n", path, strerror(errno));
+    status = 1;
+  }
+  if(status) unlink(temp);
+  free(temp);
+  return status;
+}
+
+// PROGRAM IMAGES
+// Where each thing copied into an image went, so something pointed to twice
+// is only copied once
+typedef struct {
+  const void *key;
+  size_t offset;
+} ImageSlot;
+
+// An image being written
+typedef struct {
+  char *data;
+  size_t size;
+  size_t capacity;
+  // Offsets of every pointer in the image
+  uint64_t *relocations;
+  size_t relocation_count;
+  size_t relocation_capacity;
+  // Copies, by what they were copied from, in an open addressed table
+  ImageSlot *slots;
+  size_t slot_count;
+  size_t slot_capacity;
+  // Nodes that have been copied, but not what they point to
+  size_t *pending;
+  size_t pending_count;
+  size_t pending_capacity;
+  // Set once anything fails, after which nothing more is copied
+  int failed;
+} ImageWriter;
+
+// Grow an array to hold at least one more element
+static int image_grow(void **array, size_t *capacity, size_t count, size_t size) {
+  if(count < *capacity) return 0;
+  size_t grown = *capacity ? *capacity * 2 : 256;
+  void *new = realloc(*array, size * grown);
+  if(!new) {
+    PERROR("realloc() failed.\n");
+    return 1;
+  }
+  *array = new;
+  *capacity = grown;
+  return 0;
+}
+
+static size_t hash_pointer(const void *key) {
+  uint64_t x = (uintptr_t)key;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdu;
+  x ^= x >> 33;
+  return x;
+}
+
+// Find where something was copied to, or 0 if it hasn't been
+static size_t image_find(ImageWriter *w, const void *key) {
+  if(!w->slot_capacity) return 0;
+  for(size_t s = hash_pointer(key) & (w->slot_capacity - 1);; s = (s + 1) & (w->slot_capacity - 1)) {
+    if(!w->slots[s].key) return 0;
+    if(w->slots[s].key == key) return w->slots[s].offset;
+  }
+}
+
+// Remember where something was copied to
+// The table is kept at most half full, and doubled rather than filled.
+static void image_remember(ImageWriter *w, const void *key, size_t offset) {
+  if(w->failed) return;
+  if((w->slot_count + 1) * 2 > w->slot_capacity) {
+    size_t capacity = w->slot_capacity ? w->slot_capacity * 2 : 1024;
+    ImageSlot *slots = calloc(capacity, sizeof(ImageSlot));
+    if(!slots) {
+      PERROR("calloc() failed.\n");
+      w->failed = 1;
+      return;
+    }
+    for(size_t s = 0; s < w->slot_capacity; s++) {
+      if(!w->slots[s].key) continue;
+      size_t t = hash_pointer(w->slots[s].key) & (capacity - 1);
+      while(slots[t].key) t = (t + 1) & (capacity - 1);
+      slots[t] = w->slots[s];
+    }
+    free(w->slots);
+    w->slots = slots;
+    w->slot_capacity = capacity;
+  }
+
+  size_t s = hash_pointer(key) & (w->slot_capacity - 1);
+  while(w->slots[s].key) s = (s + 1) & (w->slot_capacity - 1);
+  w->slots[s] = (ImageSlot){key, offset};
+  w->slot_count++;
+}
+
+// Add zeroed space to the end of the image
+// Returns its offset, or 0 if the image couldn't grow. Nothing but the
+// header is at 0, so that's never a real offset.
+static size_t image_reserve(ImageWriter *w, size_t size, size_t align) {
+  if(w->failed) return 0;
+  size_t offset = (w->size + align - 1) & ~(align - 1);
+  if(offset + size > w->capacity) {
+    size_t capacity = w->capacity ? w->capacity : 65536;
+    while(capacity < offset + size) capacity *= 2;
+    char *data = realloc(w->data, capacity);
+    if(!data) {
+      PERROR("realloc() failed.\n");
+      w->failed = 1;
+      return 0;
+    }
+    w->data = data;
+    w->capacity = capacity;
+  }
+  memset(w->data + w->size, 0, offset + size - w->size);
+  w->size = offset + size;
+  return offset;
+}
+
+// Point the pointer at slot to target, both offsets into the image
+static void image_point(ImageWriter *w, size_t slot, size_t target) {
+  if(w->failed) return;
+  if(image_grow((void **)&w->relocations, &w->relocation_capacity, w->relocation_count, sizeof(uint64_t)) != 0) {
+    w->failed = 1;
+    return;
+  }
+  uintptr_t address = IMAGE_BASE + target;
+  memcpy(w->data + slot, &address, sizeof(address));
+  w->relocations[w->relocation_count++] = slot;
+}
+
+// Point the pointer at slot to target, or leave it NULL if target is 0
+static void image_set(ImageWriter *w, size_t slot, size_t target) {
+  if(target) image_point(w, slot, target);
+}
+
+// Copy some bytes into the image
+static size_t image_copy_bytes(ImageWriter *w, const void *data, size_t length) {
+  if(!data) return 0;
+  size_t offset = image_find(w, data);
+  if(offset) return offset;
+  offset = image_reserve(w, length, 1);
+  if(!offset) return 0;
+  memcpy(w->data + offset, data, length);
+  image_remember(w, data, offset);
+  return offset;
+}
+
+static size_t image_copy_string(ImageWriter *w, const char *string) {
+  return string ? image_copy_bytes(w, string, strlen(string) + 1) : 0;
+}
+
+// Copy a node into the image, leaving what it points to for
+// image_fix_node()
+static size_t image_copy_node(ImageWriter *w, ASTNode *node) {
+  if(!node) return 0;
+  size_t offset = image_find(w, node);
+  if(offset) return offset;
+  offset = image_reserve(w, sizeof(ASTNode), _Alignof(ASTNode));
+  if(!offset) return 0;
+  memcpy(w->data + offset, node, sizeof(ASTNode));
+  image_remember(w, node, offset);
+  if(image_grow((void **)&w->pending, &w->pending_capacity, w->pending_count, sizeof(size_t)) != 0) {
+    w->failed = 1;
+    return 0;
+  }
+  w->pending[w->pending_count++] = offset;
+  return offset;
+}
+
+// Copy a list of nodes, and the nodes themselves
+static size_t image_copy_nodes(ImageWriter *w, ASTNode **nodes, size_t count) {
+  if(!nodes) return 0;
+  size_t offset = image_find(w, nodes);
+  if(offset) return offset;
+  offset = image_reserve(w, sizeof(ASTNode *) * (count ? count : 1), _Alignof(ASTNode *));
+  if(!offset) return 0;
+  image_remember(w, nodes, offset);
+  for(size_t n = 0; n < count; n++) image_set(w, offset + sizeof(ASTNode *) * n, image_copy_node(w, nodes[n]));
+  return offset;
+}
+
+// Copy a list of strings, and the strings themselves
+static size_t image_copy_strings(ImageWriter *w, char **strings, size_t count) {
+  if(!strings) return 0;
+  size_t offset = image_reserve(w, sizeof(char *) * (count ? count : 1), _Alignof(char *));
+  if(!offset) return 0;
+  for(size_t n = 0; n < count; n++) image_set(w, offset + sizeof(char *) * n, image_copy_string(w, strings[n]));
+  return offset;
+}
+
+// Copy everything a node in the image points to, and point it at the copies
+static void image_fix_node(ImageWriter *w, size_t offset) {
+  ASTNode n;
+  memcpy(&n, w->data + offset, sizeof(ASTNode));
+#define SLOT(field) (offset + offsetof(ASTNode, field))
+  switch(n.type) {
+  case NodeProgram:
+    image_set(w, SLOT(program.block), image_copy_node(w, n.program.block));
+    break;
+  case NodeBlock:
+    image_set(w, SLOT(block.statements), image_copy_nodes(w, n.block.statements, n.block.count));
+    break;
+  case NodeVarDecl:
+    image_set(w, SLOT(var_decl.id), image_copy_string(w, n.var_decl.id));
+    image_set(w, SLOT(var_decl.length), image_copy_node(w, n.var_decl.length));
+    image_set(w, SLOT(var_decl.columns), image_copy_node(w, n.var_decl.columns));
+    break;
+  case NodeVarAssign:
+    image_set(w, SLOT(var_assign.id), image_copy_string(w, n.var_assign.id));
+    image_set(w, SLOT(var_assign.index), image_copy_node(w, n.var_assign.index));
+    image_set(w, SLOT(var_assign.column), image_copy_node(w, n.var_assign.column));
+    image_set(w, SLOT(var_assign.expr), image_copy_node(w, n.var_assign.expr));
+    break;
+  case NodeExpr:
+    switch(n.expr.type) {
+    case ExprString:
+      image_set(w, SLOT(expr.string.data), image_copy_bytes(w, n.expr.string.data, n.expr.string.length + 1));
+      break;
+    case ExprVar:
+      image_set(w, SLOT(expr.var_name), image_copy_string(w, n.expr.var_name));
+      break;
+    case ExprOp:
+      image_set(w, SLOT(expr.op.left), image_copy_node(w, n.expr.op.left));
+      image_set(w, SLOT(expr.op.right), image_copy_node(w, n.expr.op.right));
+      break;
+    case ExprArray:
+      image_set(w, SLOT(expr.array.items), image_copy_nodes(w, n.expr.array.items, n.expr.array.count));
+      break;
+    case ExprIndex:
+      image_set(w, SLOT(expr.index.array), image_copy_node(w, n.expr.index.array));
+      image_set(w, SLOT(expr.index.index), image_copy_node(w, n.expr.index.index));
+      image_set(w, SLOT(expr.index.column), image_copy_node(w, n.expr.index.column));
+      break;
+    case ExprCall:
+      image_set(w, SLOT(expr.call.name), image_copy_string(w, n.expr.call.name));
+      image_set(w, SLOT(expr.call.args), image_copy_nodes(w, n.expr.call.args, n.expr.call.argc));
+      break;
+    default:
+      // Literals point to nothing
+      break;
+    }
+    break;
+  case NodeIf:
+    image_set(w, SLOT(if_stmt.condition), image_copy_node(w, n.if_stmt.condition));
+    image_set(w, SLOT(if_stmt.if_block), image_copy_node(w, n.if_stmt.if_block));
+    image_set(w, SLOT(if_stmt.else_block), image_copy_node(w, n.if_stmt.else_block));
+    break;
+  case NodeWhile:
+    image_set(w, SLOT(while_stmt.condition), image_copy_node(w, n.while_stmt.condition));
+    image_set(w, SLOT(while_stmt.while_block), image_copy_node(w, n.while_stmt.while_block));
+    break;
+  case NodeFor:
+    image_set(w, SLOT(for_stmt.id), image_copy_string(w, n.for_stmt.id));
+    image_set(w, SLOT(for_stmt.from), image_copy_node(w, n.for_stmt.from));
+    image_set(w, SLOT(for_stmt.to), image_copy_node(w, n.for_stmt.to));
+    image_set(w, SLOT(for_stmt.step), image_copy_node(w, n.for_stmt.step));
+    image_set(w, SLOT(for_stmt.for_block), image_copy_node(w, n.for_stmt.for_block));
+    break;
+  case NodeForEach:
+    image_set(w, SLOT(for_each.id), image_copy_string(w, n.for_each.id));
+    image_set(w, SLOT(for_each.array), image_copy_node(w, n.for_each.array));
+    image_set(w, SLOT(for_each.for_block), image_copy_node(w, n.for_each.for_block));
+    break;
+  case NodeSend:
+    image_set(w, SLOT(send_stmt.expr), image_copy_node(w, n.send_stmt.expr));
+    image_set(w, SLOT(send_stmt.device_name), image_copy_string(w, n.send_stmt.device_name));
+    break;
+  case NodeReceive:
+    image_set(w, SLOT(receive_stmt.id), image_copy_string(w, n.receive_stmt.id));
+    image_set(w, SLOT(receive_stmt.device_name), image_copy_string(w, n.receive_stmt.device_name));
+    break;
+  case NodeRead:
+    image_set(w, SLOT(read_stmt.path), image_copy_string(w, n.read_stmt.path));
+    image_set(w, SLOT(read_stmt.ids), image_copy_strings(w, n.read_stmt.ids, n.read_stmt.count));
+    break;
+  case NodeWrite:
+    image_set(w, SLOT(write_stmt.path), image_copy_string(w, n.write_stmt.path));
+    image_set(w, SLOT(write_stmt.items), image_copy_nodes(w, n.write_stmt.items, n.write_stmt.count));
+    break;
+  }
+#undef SLOT
+}
+
+// Lay a parser and its whole program out as an image
+// Returns the parser's offset in the image.
+static size_t image_build(ImageWriter *w, Parser *parser) {
+  image_reserve(w, sizeof(ImageHeader), _Alignof(ImageHeader));
+  size_t p = image_reserve(w, sizeof(Parser), _Alignof(Parser));
+  if(!p) return 0;
+  memcpy(w->data + p, parser, sizeof(Parser));
+  image_point(w, p + offsetof(Parser, mapping), 0);
+
+  image_set(w, p + offsetof(Parser, root), image_copy_node(w, parser->root));
+  image_set(w, p + offsetof(Parser, constants), image_copy_nodes(w, parser->constants, parser->constant_count));
+
+  size_t devices = image_reserve(w, sizeof(DeviceUse) * parser->device_count, _Alignof(DeviceUse));
+  if(!devices) return 0;
+  memcpy(w->data + devices, parser->devices, sizeof(DeviceUse) * parser->device_count);
+  image_set(w, p + offsetof(Parser, devices), devices);
+  for(size_t d = 0; d < parser->device_count; d++) {
+    image_set(w, devices + sizeof(DeviceUse) * d + offsetof(DeviceUse, name), image_copy_string(w, parser->devices[d].name));
+  }
+
+  if(parser->file_count) {
+    size_t files = image_reserve(w, sizeof(FileUse) * parser->file_count, _Alignof(FileUse));
+    if(!files) return 0;
+    memcpy(w->data + files, parser->files, sizeof(FileUse) * parser->file_count);
+    image_set(w, p + offsetof(Parser, files), files);
+    for(size_t f = 0; f < parser->file_count; f++) {
+      image_set(w, files + sizeof(FileUse) * f + offsetof(FileUse, path), image_copy_string(w, parser->files[f].path));
+    }
+  }
+
+  while(w->pending_count > 0 && !w->failed) image_fix_node(w, w->pending[--w->pending_count]);
+  return p;
+}
+
+// Save a parsed program to the cache, to be mapped by later runs
+int cache_store_program(const char *source_path, Parser *parser, uint64_t hash, size_t length) {
+  ImageWriter w = {0};
+  size_t p = image_build(&w, parser);
+
+  // The relocation table goes last, and the image knows its own size
+  size_t relocations = image_reserve(&w, sizeof(uint64_t) * w.relocation_count, _Alignof(uint64_t));
+  int status = w.failed;
+  if(!status) {
+    memcpy(w.data + relocations, w.relocations, sizeof(uint64_t) * w.relocation_count);
+    ImageHeader header = {.source_hash = hash,
+                          .source_length = length,
+                          .base = IMAGE_BASE,
+                          .size = w.size,
+                          .parser = p,
+                          .relocations = relocations,
+                          .relocation_count = w.relocation_count};
+    memcpy(header.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+    cache_build(header.build);
+    size_t mapping_size = w.size;
+    memcpy(w.data + p + offsetof(Parser, mapping_size), &mapping_size, sizeof(mapping_size));
+    memcpy(w.data, &header, sizeof(header));
+
+    char *path = cache_path(source_path, ".img", 1);
+    status = !path || cache_write(path, NULL, 0, w.data, w.size) != 0;
+    free(path);
+  }
+
+  free(w.data);
+  free(w.relocations);
+  free(w.slots);
+  free(w.pending);
+  return status;
+}
+
+// Check that a mapped image's pointers all point inside it
+static int image_check(const char *image, ImageHeader *header) {
+  const uint64_t *relocations = (const uint64_t *)(image + header->relocations);
+  for(uint64_t r = 0; r < header->relocation_count; r++) {
+    uint64_t slot = relocations[r];
+    uintptr_t address;
+    if(slot < sizeof(*header) || slot > header->size - sizeof(address)) return 1;
+    memcpy(&address, image + slot, sizeof(address));
+    if(address < header->base || address >= header->base + header->size) return 1;
+  }
+  return 0;
+}
+
+// Move a checked image's pointers to where it was mapped
+static void image_relocate(char *image, ImageHeader *header) {
+  uintptr_t delta = (uintptr_t)image - header->base;
+  const uint64_t *relocations = (const uint64_t *)(image + header->relocations);
+  for(uint64_t r = 0; r < header->relocation_count; r++) {
+    uintptr_t address;
+    memcpy(&address, image + relocations[r], sizeof(address));
+    address += delta;
+    memcpy(image + relocations[r], &address, sizeof(address));
+  }
+}
+
+// Map a program from the cache, if it holds one for this source
+// The program is used where it's mapped, read only and shared with every
+// other run mapping it, rather than being read back in. Images are only ever
+// moved into place whole and are checked against their size, so one mapped
+// where it was laid out is used untouched. Anywhere else its pointers are
+// checked and relocated first. Returns NULL if there's nothing cached for it,
+// or it's damaged.
+Parser *cache_load_program(const char *source_path, uint64_t hash, size_t length) {
+  char *path = cache_path(source_path, ".img", 0);
+  if(!path) return NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if(fd < 0) return NULL;
+
+  ImageHeader header;
+  char build[IMAGE_BUILD_SIZE];
+  cache_build(build);
+  struct stat st;
+  if(fstat(fd, &st) != 0 || read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) != 0 ||
+     memcmp(header.build, build, IMAGE_BUILD_SIZE) != 0 || header.source_hash != hash || header.source_length != length ||
+     header.size != (uint64_t)st.st_size || header.size < sizeof(header) || header.parser < sizeof(header) ||
+     header.parser > header.size - sizeof(Parser) || header.parser % _Alignof(Parser) != 0 ||
+     header.relocations > header.size || header.relocations % _Alignof(uint64_t) != 0 ||
+     header.relocation_count > (header.size - header.relocations) / sizeof(uint64_t)) {
+    close(fd);
+    return NULL;
+  }
+
+  char *image = mmap((void *)(uintptr_t)header.base, header.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(image != MAP_FAILED && (uintptr_t)image != header.base) {
+    munmap(image, header.size);
+    image = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(image == MAP_FAILED) return NULL;
+  if((uintptr_t)image != header.base) {
+    if(image_check(image, &header) != 0) {
+      PERROR("The cached program for %s is damaged.\n", source_path);
+      munmap(image, header.size);
+      return NULL;
+    }
+    image_relocate(image, &header);
+    if(mprotect(image, header.size, PROT_READ) != 0) {
+      munmap(image, header.size);
+      return NULL;
+    }
+  }
+  return (Parser *)(image + header.parser);
+}
+
+// PYTHON
+// The line cached --compile output starts with, naming the build and source
+// it was compiled from
+static int python_head(char *head, size_t size, uint64_t hash, size_t length) {
+  char build[IMAGE_BUILD_SIZE];
+  cache_build(build);
+  return snprintf(head, size, "# edxp %.*s %016llx %zu\n", IMAGE_BUILD_SIZE, build, (unsigned long long)hash, length);
+}
+
+// Copy cached --compile output to out_path, if the cache holds it for this
+// source
+// Returns 0 if it did, or 1 if it has to be compiled.
+int cache_load_python(const char *source_path, uint64_t hash, size_t length, const char *out_path) {
+  char *path = cache_path(source_path, ".py", 0);
+  if(!path) return 1;
+  FILE *in = fopen(path, "rb");
+  free(path);
+  if(!in) return 1;
+
+  char expected[128];
+  char head[128];
+  python_head(expected, sizeof(expected), hash, length);
+  if(!fgets(head, sizeof(head), in) || strcmp(head, expected) != 0) {
+    fclose(in);
+    return 1;
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if(!out) {
+    PERROR("Couldn't open output file for writing.\n");
+    fclose(in);
+    return 1;
+  }
+  char buffer[65536];
+  size_t got;
+  int status = 0;
+  while((got = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    if(fwrite(buffer, 1, got, out) != got) status = 1;
+  }
+  if(ferror(in)) status = 1;
+  fclose(in);
+  if(fclose(out) != 0) status = 1;
+  return status;
+}
+
+// Save --compile output to the cache, from the file it was compiled to
+int cache_store_python(const char *source_path, uint64_t hash, size_t length, const char *compiled_path) {
+  char *compiled = read_file_str((char *)compiled_path);
+  if(!compiled) return 1;
+  char head[128];
+  int head_length = python_head(head, sizeof(head), hash, length);
+  char *path = cache_path(source_path, ".py", 1);
+  int status = !path || cache_write(path, head, head_length, compiled, strlen(compiled)) != 0;
+  free(path);
+  free(compiled);
+  return status;
+}
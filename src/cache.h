@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+// Includes
+#include "parser.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+// Cached files go in this directory next to the program, as <name>.img for
+// its parsed program and <name>.py for its --compile output
+#define CACHE_DIR "__edxpcache__"
+// Program images start with this, and hold a header, the parser, everything
+// it points to and then the relocation table. Every pointer in the image is
+// stored as if it were mapped at base, and the relocation table lists where
+// they all are, so it can be mapped anywhere else too.
+#define IMAGE_MAGIC "EDXPIMG1"
+#define IMAGE_MAGIC_SIZE 8
+// Where images are laid out to be mapped, well away from where the heap,
+// libraries and stacks go, so they usually don't need relocating
+#define IMAGE_BASE 0x200000000000u
+#define IMAGE_BUILD_SIZE 32
+// Version of the cache's file formats, which goes up whenever images or cached
+// --compile output are laid out differently
+#define CACHE_FORMAT 2
+
+// Structs
+// The start of a program image
+// Cached files are only used by the same build of edxp that wrote them, and
+// for the same source.
+typedef struct {
+  char magic[IMAGE_MAGIC_SIZE];
+  char build[IMAGE_BUILD_SIZE];
+  uint64_t source_hash;
+  uint64_t source_length;
+  // Where the image was laid out to be mapped, and how big it is
+  uint64_t base;
+  uint64_t size;
+  // Offsets of the parser and the relocation table, and its length
+  uint64_t parser;
+  uint64_t relocations;
+  uint64_t relocation_count;
+} ImageHeader;
+
+// Function prototypes
+uint64_t cache_hash(const char *source, size_t length);
+Parser *cache_load_program(const char *source_path, uint64_t hash, size_t length);
+int cache_store_program(const char *source_path, Parser *parser, uint64_t hash, size_t length);
+int cache_load_python(const char *source_path, uint64_t hash, size_t length, const char *out_path);
+int cache_store_python(const char *source_path, uint64_t hash, size_t length, const char *compiled_path);
+
+#endif // cache.h
@@ -1,5 +1,7 @@
 #include "compiler.h"
 #include "def.h"
+#include "real.h"
+#include "variable.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -10,7 +12,209 @@ static void indent(Compiler *c) {
     fprintf(c->out_file, "  ");
 }
 
+// Helpers for the parts of the language Python doesn't have built in
+static const char *PRELUDE =
+    "import sys\n"
+    "\n"
+    "def _append(a, b):\n"
+    "  if not isinstance(a, list) and not isinstance(b, list):\n"
+    "    return a + b\n"
+    "  if a and isinstance(a[0], list) and not (b and isinstance(b[0], list)):\n"
+    "    b = [b]\n"
+    "  return (a if isinstance(a, list) else [a]) + (b if isinstance(b, list) else [b])\n"
+    "\n"
+    "# Arrays are values, so one that's assigned or walked is copied, rows and all\n"
+    "def _copy(v):\n"
+    "  return [r[:] if isinstance(r, list) else r for r in v] if isinstance(v, list) else v\n"
+    "\n"
+    "# Values are displayed the way the interpreter shows them\n"
+    "def _show(v):\n"
+    "  if isinstance(v, bool):\n"
+    "    return 'TRUE' if v else 'FALSE'\n"
+    "  if isinstance(v, list):\n"
+    "    return '[' + ', '.join(_show(e) for e in v) + ']'\n"
+    "  return str(v)\n"
+    "\n"
+    "def _for_range(start, stop, step=1):\n"
+    "  while (start <= stop) if step > 0 else (start >= stop):\n"
+    "    yield start\n"
+    "    start += step\n"
+    "\n"
+    "_paths = dict(b.split('=', 1) for a, b in zip(sys.argv[1:], sys.argv[2:]) if a in ('-d', '--device'))\n"
+    "if 'DISPLAY' in _paths:\n"
+    "  sys.stdout = open(_paths['DISPLAY'], 'w')\n"
+    "if 'KEYBOARD' in _paths:\n"
+    "  sys.stdin = open(_paths['KEYBOARD'])\n"
+    "_streams = {}\n"
+    "_lines = {}\n"
+    "\n"
+    "def _device(name, mode):\n"
+    "  if name == 'DISPLAY' and mode == 'w':\n"
+    "    return sys.stdout\n"
+    "  if name == 'KEYBOARD' and mode == 'r':\n"
+    "    return sys.stdin\n"
+    "  if (name, mode) not in _streams:\n"
+    "    if name not in _paths:\n"
+    "      sys.exit('Device %s isn\\'t bound to anything, use --device %s=<path>' % (name, name))\n"
+    "    _streams[name, mode] = open(_paths[name], mode)\n"
+    "  return _streams[name, mode]\n"
+    "\n"
+    "def _receive(kind, name):\n"
+    "  stream = _device(name, 'r')\n"
+    "  rest = _lines.pop(name, None)\n"
+    "  if kind == 'STRING':\n"
+    "    if rest:\n"
+    "      return rest\n"
+    "    line = stream.readline()\n"
+    "    if not line:\n"
+    "      raise EOFError('expected a STRING, reached the end of input')\n"
+    "    return line[:-1] if line.endswith('\\n') else line\n"
+    "  while not rest:\n"
+    "    rest = stream.readline()\n"
+    "    if not rest:\n"
+    "      raise EOFError('expected %s, reached the end of input' % kind)\n"
+    "    rest = rest.rstrip('\\n').lstrip(' \\t\\r')\n"
+    "  end = 1 if kind == 'CHARACTER' else len(rest.split(None, 1)[0])\n"
+    "  token, _lines[name] = rest[:end], rest[end:].lstrip(' \\t\\r')\n"
+    "  if kind == 'INTEGER':\n"
+    "    return int(token)\n"
+    "  if kind == 'REAL':\n"
+    "    return float(token)\n"
+    "  if kind == 'BOOLEAN' and token in ('TRUE', 'FALSE'):\n"
+    "    return token == 'TRUE'\n"
+    "  if kind == 'CHARACTER':\n"
+    "    return token\n"
+    "  raise ValueError('expected %s, got %r' % (kind, token))\n"
+    "\n"
+    "# Files of records: a record per line, with fields separated by commas\n"
+    "_readers = {}\n"
+    "_writers = {}\n"
+    "\n"
+    "def _reader(path):\n"
+    "  if path not in _readers:\n"
+    "    f = open(path, newline='')\n"
+    "    _readers[path] = [f, f.readline()]\n"
+    "  return _readers[path]\n"
+    "\n"
+    "def _eof(path):\n"
+    "  return not _reader(path)[1]\n"
+    "\n"
+    "def _field(field, kind):\n"
+    "  if kind is bool:\n"
+    "    if field not in ('TRUE', 'FALSE'):\n"
+    "      raise ValueError('expected TRUE or FALSE, got %r' % field)\n"
+    "    return field == 'TRUE'\n"
+    "  if kind is str or kind is None:\n"
+    "    return field\n"
+    "  return kind(field)\n"
+    "\n"
+    "def _read(path, names):\n"
+    "  r = _reader(path)\n"
+    "  if not r[1]:\n"
+    "    raise EOFError('%s has no more records to READ' % path)\n"
+    "  fields = r[1].rstrip('\\r\\n').split(',')\n"
+    "  r[1] = r[0].readline()\n"
+    "  kinds = globals().get('__annotations__', {})\n"
+    "  current = globals().get(names[0])\n"
+    "  if len(names) == 1 and isinstance(current, list):\n"
+    "    kind = type(current[0]) if current else str\n"
+    "    return ([_field(f, kind) for f in fields],)\n"
+    "  if len(fields) != len(names):\n"
+    "    raise ValueError('%s: expected %d fields, got %d' % (path, len(names), len(fields)))\n"
+    "  return tuple(_field(f, kinds.get(n)) for f, n in zip(fields, names))\n"
+    "\n"
+    "def _write(path, values):\n"
+    "  if path not in _writers:\n"
+    "    _writers[path] = open(path, 'w')\n"
+    "  fields = []\n"
+    "  for v in values:\n"
+    "    fields.extend(v if isinstance(v, list) else [v])\n"
+    "  text = [('TRUE' if f else 'FALSE') if isinstance(f, bool) else str(f) for f in fields]\n"
+    "  if any(',' in t or '\\n' in t or '\\r' in t for t in text):\n"
+    "    raise ValueError('can\\'t WRITE a field containing \\',\\' or a line break')\n"
+    "  _writers[path].write(','.join(text) + '\\n')\n"
+    "\n";
+
+int compile_expr(ASTNode *node, Compiler *c);
+
+// Write text as a Python string literal
+static void compile_string(const char *data, size_t length, Compiler *c) {
+  fputc('"', c->out_file);
+  for(size_t i = 0; i < length; i++) {
+    char ch = data[i];
+    if(ch == '"' || ch == '\\') fprintf(c->out_file, "\\%c", ch);
+    else if(ch >= ' ' && ch <= '~') fputc(ch, c->out_file);
+    else fprintf(c->out_file, "\\x%02x", (unsigned char)ch);
+  }
+  fputc('"', c->out_file);
+}
+
+// Whether an array literal is a list of rows
+static int is_matrix_lit(ASTNode *node) {
+  return node->expr.array.count > 0 && node->expr.array.items[0]->expr.type == ExprArray;
+}
+
+// Whether an array literal, or one of its rows, has a REAL literal in it
+// The interpreter makes every element of such an array REAL.
+static int has_real_item(ASTNode *node) {
+  for(size_t i = 0; i < node->expr.array.count; i++) {
+    ASTNode *item = node->expr.array.items[i];
+    if(item->expr.type == ExprReal) return 1;
+    if(item->expr.type == ExprArray) {
+      for(size_t j = 0; j < item->expr.array.count; j++) {
+        if(item->expr.array.items[j]->expr.type == ExprReal) return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Compile the items of an array literal between open and close
+// Rows are compiled the same way, and INTEGER literals are written as floats
+// if real is set.
+static int compile_array_items(ASTNode *node, int real, const char *open, const char *close, Compiler *c) {
+  fprintf(c->out_file, "%s", open);
+  for(size_t i = 0; i < node->expr.array.count; i++) {
+    ASTNode *item = node->expr.array.items[i];
+    if(i) fprintf(c->out_file, ", ");
+    int status = 0;
+    if(item->expr.type == ExprArray) status = compile_array_items(item, real, open, close, c);
+    else if(real && item->expr.type == ExprInt) fprintf(c->out_file, "(%d.0)", item->expr.int_val);
+    else status = compile_expr(item, c);
+    if(status) return status;
+  }
+  // A tuple of one needs a trailing comma
+  if(node->expr.array.count == 1 && open[0] == '(') fprintf(c->out_file, ",");
+  fprintf(c->out_file, "%s", close);
+  return 0;
+}
+
+// Compile a constant array literal as a tuple, with its rows as tuples too
+static int compile_tuple(ASTNode *node, Compiler *c) {
+  return compile_array_items(node, has_real_item(node), "(", ")", c);
+}
+
+// Hoist the constant array literals to module level tuples, built once
+// Strings need no hoisting, Python already keeps literals as constants.
+static int compile_constants(Compiler *c) {
+  for(size_t i = 0; i < c->parser->constant_count; i++) {
+    ASTNode *node = c->parser->constants[i];
+    if(node->expr.type != ExprArray) continue;
+    fprintf(c->out_file, "_K%zu = ", node->expr.array.id);
+    int status = compile_tuple(node, c);
+    if(status) return status;
+    fprintf(c->out_file, "\n");
+  }
+  fprintf(c->out_file, "\n");
+  return 0;
+}
+
 int compile_program(ASTNode *node, Compiler *c) {
+  fputs(PRELUDE, c->out_file);
+  if(c->parser && compile_constants(c) != 0) {
+    PERROR("Failed to compile constants.\n");
+    return 1;
+  }
   fprintf(c->out_file, "if __name__ == \"__main__\"");
   int block_status = compile_node(node->program.block, c);
   if(block_status) {
@@ -51,9 +255,13 @@ static char *var_type_to_py(VarType t) {
   case VarBoolean:
     return "bool";
   case VarCharacter:
-    return "char";
+    return "str";
   case VarReal:
     return "float";
+  case VarArray:
+    return "list";
+  case VarString:
+    return "str";
   default:
     return NULL;
   }
@@ -71,18 +279,90 @@ int compile_var_decl(ASTNode *node, Compiler *c) {
     return 1;
   }
 
-  fprintf(c->out_file, "%s: %s = None\n", node->var_decl.id, vtype);
+  if(node->var_decl.type != VarArray) {
+    fprintf(c->out_file, "%s: %s = None\n", node->var_decl.id, vtype);
+    return 0;
+  }
+
+  // Arrays start out filled with the element type's zero value
+  const char *zero = "0";
+  if(node->var_decl.elem_type == VarReal) zero = "0.0";
+  else if(node->var_decl.elem_type == VarBoolean) zero = "False";
+  else if(node->var_decl.elem_type == VarCharacter) zero = "'\\0'";
+  else if(node->var_decl.elem_type == VarString) zero = "\"\"";
+
+  // Two-dimensional arrays are lists of rows
+  ASTNode *row_length = node->var_decl.columns ? node->var_decl.columns : node->var_decl.length;
+  fprintf(c->out_file, "%s: %s = %s[%s] * ", node->var_decl.id, vtype, node->var_decl.columns ? "[" : "", zero);
+  if(!row_length) {
+    fprintf(c->out_file, "0\n");
+    return 0;
+  }
+  int length_status = compile_node(row_length, c);
+  if(!length_status && node->var_decl.columns) {
+    fprintf(c->out_file, " for _ in range(");
+    length_status = compile_node(node->var_decl.length, c);
+    fprintf(c->out_file, ")]");
+  }
+  if(length_status) {
+    PERROR("Failed to compile array length.\n");
+    return length_status;
+  }
+  fprintf(c->out_file, "\n");
   return 0;
 }
 
+// Compile [index] or [row][column]
+static int compile_subscript(ASTNode *index, ASTNode *column, Compiler *c) {
+  fprintf(c->out_file, "[");
+  int status = compile_node(index, c);
+  if(status) return status;
+  fprintf(c->out_file, "]");
+  if(!column) return 0;
+
+  fprintf(c->out_file, "[");
+  status = compile_node(column, c);
+  if(status) return status;
+  fprintf(c->out_file, "]");
+  return 0;
+}
+
+// Whether an expression can give an array that's also held somewhere else
+// Python lists are references, so these are copied to keep the interpreter's
+// value semantics. & builds a new list, but it can share the rows of a
+// two-dimensional array with its operands.
+static int may_share_array(ASTNode *node) {
+  if(node->type != NodeExpr) return 0;
+  if(node->expr.type == ExprVar || node->expr.type == ExprIndex) return 1;
+  return node->expr.type == ExprOp && node->expr.op.op == OpAppend;
+}
+
+// Compile an expression, copied if it could be an array held elsewhere
+static int compile_value(ASTNode *node, Compiler *c) {
+  if(!may_share_array(node)) return compile_node(node, c);
+  fprintf(c->out_file, "_copy(");
+  int status = compile_node(node, c);
+  fprintf(c->out_file, ")");
+  return status;
+}
+
 int compile_var_assign(ASTNode *node, Compiler *c) {
   if(!node->var_assign.id) {
     PERROR("Variable assignment node is missing an identifier.\n");
     return 1;
   }
 
-  fprintf(c->out_file, "%s = ", node->var_assign.id);
-  int expr_status = compile_node(node->var_assign.expr, c);
+  fprintf(c->out_file, "%s", node->var_assign.id);
+  if(node->var_assign.index) {
+    int index_status = compile_subscript(node->var_assign.index, node->var_assign.column, c);
+    if(index_status) {
+      PERROR("Failed to compile variable assignment index.\n");
+      return index_status;
+    }
+  }
+
+  fprintf(c->out_file, " = ");
+  int expr_status = compile_value(node->var_assign.expr, c);
   if(expr_status) {
     PERROR("Failed to compile variable assignment expression.\n");
     return expr_status;
@@ -93,17 +373,102 @@ int compile_var_assign(ASTNode *node, Compiler *c) {
   return 0;
 }
 
+// Compile a comma separated list of expressions
+static int compile_expr_list(ASTNode **items, size_t count, Compiler *c) {
+  for(size_t i = 0; i < count; i++) {
+    if(i) fprintf(c->out_file, ", ");
+    int status = compile_node(items[i], c);
+    if(status) return status;
+  }
+  return 0;
+}
+
 int compile_expr(ASTNode *node, Compiler *c) {
   switch(node->expr.type) {
   case ExprInt:
     fprintf(c->out_file, "(%d)", node->expr.int_val);
     return 0;
 
+  case ExprReal: {
+    // Written the way the interpreter displays it, which reads back as the
+    // same value and always as a float
+    char buf[REAL_FORMAT_MAX];
+    real_format(node->expr.real_val, buf);
+    if(strchr(buf, 'n')) fprintf(c->out_file, "float(\"%s\")", buf);
+    else fprintf(c->out_file, "(%s)", buf);
+    return 0;
+  }
+
+  case ExprBool:
+    fprintf(c->out_file, "(%s)", node->expr.bool_val ? "True" : "False");
+    return 0;
+
+  case ExprString:
+    fputc('(', c->out_file);
+    compile_string(node->expr.string.data, node->expr.string.length, c);
+    fputc(')', c->out_file);
+    return 0;
+
+  case ExprChar: {
+    char ch = node->expr.char_val;
+    if(ch == '\'' || ch == '\\') fprintf(c->out_file, "('\\%c')", ch);
+    else if(ch >= ' ' && ch <= '~') fprintf(c->out_file, "('%c')", ch);
+    else fprintf(c->out_file, "('\\x%02x')", (unsigned char)ch);
+    return 0;
+  }
+
+  case ExprArray: {
+    // Constants are copied, since the list may be changed
+    if(node->expr.array.constant) {
+      if(is_matrix_lit(node)) fprintf(c->out_file, "[[*_r] for _r in _K%zu]", node->expr.array.id);
+      else fprintf(c->out_file, "[*_K%zu]", node->expr.array.id);
+      return 0;
+    }
+    return compile_array_items(node, has_real_item(node), "[", "]", c);
+  }
+
+  case ExprIndex: {
+    int status = compile_node(node->expr.index.array, c);
+    if(status) return status;
+    return compile_subscript(node->expr.index.index, node->expr.index.column, c);
+  }
+
+  case ExprCall: {
+    if(strcmp(node->expr.call.name, "EOF") == 0) {
+      const char *path = c->parser->files[node->expr.call.file].path;
+      fprintf(c->out_file, "_eof(");
+      compile_string(path, strlen(path), c);
+      fprintf(c->out_file, ")");
+      return 0;
+    }
+    if(strcmp(node->expr.call.name, "LENGTH") != 0) {
+      PERROR("Unknown function \"%s\"\n", node->expr.call.name);
+      return 1;
+    }
+    fprintf(c->out_file, "len(");
+    int status = compile_expr_list(node->expr.call.args, node->expr.call.argc, c);
+    if(status) return status;
+    fprintf(c->out_file, ")");
+    return 0;
+  }
+
   case ExprVar:
     fprintf(c->out_file, "(%s)", node->expr.var_name);
     return 0;
 
   case ExprOp: {
+    // Python has no operator that appends both arrays and single values
+    if(node->expr.op.op == OpAppend) {
+      fprintf(c->out_file, "_append(");
+      int ls = compile_expr(node->expr.op.left, c);
+      if(ls) return ls;
+      fprintf(c->out_file, ", ");
+      int rs = compile_expr(node->expr.op.right, c);
+      if(rs) return rs;
+      fprintf(c->out_file, ")");
+      return 0;
+    }
+
     fprintf(c->out_file, "(");
     int ls = compile_expr(node->expr.op.left, c);
     if(ls) return ls;
@@ -126,10 +491,10 @@ int compile_expr(ASTNode *node, Compiler *c) {
       op = "%";
       break;
     case OpIntDiv:
-      op = "/";
+      op = "//";
       break;
     case OpExponent:
-      op = "^";
+      op = "**";
       break;
     case OpEqual:
       op = "==";
@@ -149,6 +514,12 @@ int compile_expr(ASTNode *node, Compiler *c) {
     case OpLessThanEq:
       op = "<=";
       break;
+    case OpAnd:
+      op = "and";
+      break;
+    case OpOr:
+      op = "or";
+      break;
     default:
       PERROR("Unknown operation %d\n", node->expr.op.op);
       return 1;
@@ -181,6 +552,7 @@ int compile_if(ASTNode *node, Compiler *c) {
   }
 
   if(node->if_stmt.else_block) {
+    indent(c);
     fprintf(c->out_file, "else");
     int else_status = compile_node(node->if_stmt.else_block, c);
     if(else_status) {
@@ -209,22 +581,96 @@ int compile_while(ASTNode *node, Compiler *c) {
   return 0;
 }
 
-int compile_send(ASTNode *node, Compiler *c) {
-  if(strcmp(node->send_stmt.device_name, "DISPLAY") != 0) {
-    PERROR("Only the DISPLAY device is supported for now.\n");
+int compile_for(ASTNode *node, Compiler *c) {
+  fprintf(c->out_file, "for %s in _for_range(", node->for_stmt.id);
+  int status = compile_node(node->for_stmt.from, c);
+  if(!status) {
+    fprintf(c->out_file, ", ");
+    status = compile_node(node->for_stmt.to, c);
+  }
+  if(!status && node->for_stmt.step) {
+    fprintf(c->out_file, ", ");
+    status = compile_node(node->for_stmt.step, c);
+  }
+  if(status) {
+    PERROR("Failed to compile for statement range.\n");
+    return 1;
+  }
+  fprintf(c->out_file, ")");
+
+  int block_status = compile_node(node->for_stmt.for_block, c);
+  if(block_status) {
+    PERROR("Failed to compile for statement block.\n");
     return 1;
   }
 
-  fprintf(c->out_file, "print(");
+  return 0;
+}
+
+int compile_for_each(ASTNode *node, Compiler *c) {
+  fprintf(c->out_file, "for %s in ", node->for_each.id);
+  // Looping over a constant never changes it, so no copy is needed unless its
+  // rows are handed out. Anything else that could be changed by the body is
+  // walked as it was when the loop started, like the interpreter does.
+  ASTNode *array = node->for_each.array;
+  int expr_status = 0;
+  if(array->type == NodeExpr && array->expr.type == ExprArray && array->expr.array.constant && !is_matrix_lit(array)) fprintf(c->out_file, "_K%zu", array->expr.array.id);
+  else expr_status = compile_value(array, c);
+  if(expr_status) {
+    PERROR("Failed to compile for each statement array.\n");
+    return 1;
+  }
+
+  int block_status = compile_node(node->for_each.for_block, c);
+  if(block_status) {
+    PERROR("Failed to compile for each statement block.\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+int compile_send(ASTNode *node, Compiler *c) {
+  fprintf(c->out_file, "print(_show(");
   int expr_status = compile_node(node->send_stmt.expr, c);
   if(expr_status) {
     PERROR("Failed to compile SEND expression.\n");
     return 1;
   }
+  fprintf(c->out_file, ")");
+  if(node->send_stmt.device != DEVICE_DISPLAY) fprintf(c->out_file, ", file=_device('%s', 'w')", node->send_stmt.device_name);
   fprintf(c->out_file, ")\n");
   return 0;
 }
 
+int compile_receive(ASTNode *node, Compiler *c) {
+  fprintf(c->out_file, "%s = _receive('%s', '%s')\n", node->receive_stmt.id, var_type_name(node->receive_stmt.type), node->receive_stmt.device_name);
+  return 0;
+}
+
+int compile_read(ASTNode *node, Compiler *c) {
+  for(size_t i = 0; i < node->read_stmt.count; i++) fprintf(c->out_file, "%s, ", node->read_stmt.ids[i]);
+  fprintf(c->out_file, "= _read(");
+  compile_string(node->read_stmt.path, strlen(node->read_stmt.path), c);
+  fprintf(c->out_file, ", (");
+  for(size_t i = 0; i < node->read_stmt.count; i++) fprintf(c->out_file, "'%s', ", node->read_stmt.ids[i]);
+  fprintf(c->out_file, "))\n");
+  return 0;
+}
+
+int compile_write(ASTNode *node, Compiler *c) {
+  fprintf(c->out_file, "_write(");
+  compile_string(node->write_stmt.path, strlen(node->write_stmt.path), c);
+  fprintf(c->out_file, ", [");
+  int status = compile_expr_list(node->write_stmt.items, node->write_stmt.count, c);
+  if(status) {
+    PERROR("Failed to compile WRITE fields.\n");
+    return 1;
+  }
+  fprintf(c->out_file, "])\n");
+  return 0;
+}
+
 int compile_node(ASTNode *node, Compiler *c) {
   if(!node) {
     PERROR("NULL node passed.\n");
@@ -254,9 +700,24 @@ int compile_node(ASTNode *node, Compiler *c) {
   case NodeWhile:
     status = compile_while(node, c);
     break;
+  case NodeFor:
+    status = compile_for(node, c);
+    break;
+  case NodeForEach:
+    status = compile_for_each(node, c);
+    break;
   case NodeSend:
     status = compile_send(node, c);
     break;
+  case NodeReceive:
+    status = compile_receive(node, c);
+    break;
+  case NodeRead:
+    status = compile_read(node, c);
+    break;
+  case NodeWrite:
+    status = compile_write(node, c);
+    break;
   default:
     PERROR("Unimplemented node type: %d\n", node->type);
     status = 1;
@@ -278,7 +739,8 @@ int compile(Parser *parser, FILE *out_file) {
 
   Compiler c = {
       .out_file = out_file,
-      .indent = 0};
+      .indent = 0,
+      .parser = parser};
 
   int status = compile_node(parser->root, &c);
   if(status) {
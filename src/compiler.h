@@ -9,6 +9,7 @@
 typedef struct {
   FILE *out_file;
   size_t indent;
+  Parser *parser;
 } Compiler;
 
 // Function prototypes
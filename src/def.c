@@ -0,0 +1,3 @@
+#include "def.h"
+
+_Thread_local FILE *diag_out = NULL;
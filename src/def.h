@@ -1,4 +1,9 @@
 #ifndef DEF_H
 #define DEF_H
-#define PERROR(fmt, ...) fprintf(stderr, "(%s): " fmt, __func__, ##__VA_ARGS__)
+#include <stdio.h>
+// Where PERROR and the interpreter's reports go on this thread, stderr unless
+// it's set
+extern _Thread_local FILE *diag_out;
+#define DIAG_OUT (diag_out ? diag_out : stderr)
+#define PERROR(fmt, ...) fprintf(DIAG_OUT, "(%s): " fmt, __func__, ##__VA_ARGS__)
 #endif
@@ -0,0 +1,93 @@
+#include "device.h"
+#include "def.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Parse a NAME=path argument
+// The argument is split in place.
+int device_binding_parse(char *arg, DeviceBinding *out) {
+  char *equals = strchr(arg, '=');
+  if(!equals || equals == arg || !equals[1]) {
+    PERROR("Expected NAME=path, got \"%s\"\n", arg);
+    return 1;
+  }
+
+  *equals = '\0';
+  out->name = arg;
+  out->path = equals + 1;
+  return 0;
+}
+
+// Find the path a device is bound to, or NULL if it isn't
+// A device bound more than once uses its last binding.
+const char *device_binding_find(const DeviceBinding *bindings, size_t count, const char *name) {
+  for(size_t b = count; b > 0; b--) {
+    if(strcmp(bindings[b - 1].name, name) == 0) return bindings[b - 1].path;
+  }
+  return NULL;
+}
+
+// Open a device for reading
+int device_open_reader(Device *device, Output *tie) {
+  int fd = open(device->path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    PERROR("Couldn't open %s for device %s: %s\n", device->path, device->name, strerror(errno));
+    return 1;
+  }
+
+  device->reader = input_create(fd, tie);
+  if(!device->reader) {
+    PERROR("input_create() failed.\n");
+    close(fd);
+    return 1;
+  }
+  device->owns_reader = 1;
+  return 0;
+}
+
+// Open a device for writing
+// Regular files are truncated and fully buffered. Pipes, FIFOs and terminals
+// are written out after every line, since something may be waiting on them.
+int device_open_writer(Device *device, int unbuffered) {
+  int fd = open(device->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(fd < 0) {
+    PERROR("Couldn't open %s for device %s: %s\n", device->path, device->name, strerror(errno));
+    return 1;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) == 0 && !S_ISREG(st.st_mode)) unbuffered = 1;
+  device->writer = output_create(fd, unbuffered);
+  if(!device->writer) {
+    PERROR("output_create() failed.\n");
+    close(fd);
+    return 1;
+  }
+  return 0;
+}
+
+// Write out anything buffered for a device
+int device_flush(Device *device) {
+  if(!device->writer || output_flush(device->writer) == 0) return 0;
+  PERROR("Failed to write to %s.\n", device->name);
+  return 1;
+}
+
+// Close a device's reader and writer, if it owns them
+void device_close(Device *device) {
+  if(device->writer && device->path) {
+    int fd = device->writer->fd;
+    output_destroy(&device->writer);
+    close(fd);
+  }
+  // Replayed readers don't have a file descriptor
+  if(device->reader && device->owns_reader) {
+    int fd = device->reader->fd;
+    input_destroy(&device->reader);
+    if(fd >= 0) close(fd);
+  }
+}
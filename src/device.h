@@ -0,0 +1,38 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+// Includes
+#include "input.h"
+#include "output.h"
+#include <stddef.h>
+
+// Structs
+// A device bound to a file, pipe or FIFO, from --device NAME=path
+typedef struct {
+  const char *name;
+  const char *path;
+} DeviceBinding;
+
+// A device a program uses
+// Its reader and writer are opened the first time the program RECEIVEs from
+// or SENDs to it, so FIFOs are opened in the order the program uses them. A
+// device with no path uses the interpreter's KEYBOARD and DISPLAY, which it
+// doesn't own.
+typedef struct {
+  const char *name;
+  const char *path;
+  Input *reader;
+  Output *writer;
+  // Set when reader was made for the device, rather than being KEYBOARD's
+  int owns_reader;
+} Device;
+
+// Function prototypes
+int device_binding_parse(char *arg, DeviceBinding *out);
+const char *device_binding_find(const DeviceBinding *bindings, size_t count, const char *name);
+int device_open_reader(Device *device, Output *tie);
+int device_open_writer(Device *device, int unbuffered);
+int device_flush(Device *device);
+void device_close(Device *device);
+
+#endif // device.h
@@ -0,0 +1,130 @@
+#include "edxp.h"
+#include "def.h"
+#include "interpreter.h"
+#include "source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How much KEYBOARD input is asked for at a time
+#define EDXP_READ_SIZE 65536
+
+struct EdxpProgram {
+  Parser *parser;
+};
+
+// Diagnostics being collected on this thread, to hand to the caller
+typedef struct {
+  FILE *previous;
+  FILE *stream;
+  char *text;
+  size_t size;
+} Capture;
+
+// Start collecting diagnostics rather than printing them
+static void capture_begin(Capture *capture) {
+  capture->previous = diag_out;
+  capture->text = NULL;
+  capture->size = 0;
+  capture->stream = open_memstream(&capture->text, &capture->size);
+  if(capture->stream) diag_out = capture->stream;
+}
+
+// Stop collecting diagnostics, and give any there were to io
+static void capture_end(Capture *capture, const EdxpIO *io) {
+  diag_out = capture->previous;
+  if(!capture->stream) return;
+  fclose(capture->stream);
+  if(capture->size && io && io->diagnostics) io->diagnostics(io->context, capture->text, capture->size);
+  free(capture->text);
+}
+
+// Where DISPLAY goes when the caller doesn't want it
+static int discard(void *context, const char *data, size_t length) {
+  (void)context;
+  (void)data;
+  (void)length;
+  return 0;
+}
+
+// Compile a program
+// Returns NULL if it doesn't parse, with why given to io's diagnostics.
+EdxpProgram *edxp_compile(const char *source, const EdxpIO *io) {
+  Capture capture;
+  capture_begin(&capture);
+
+  EdxpProgram *program = NULL;
+  size_t length = strlen(source);
+  char *copy = malloc(length + 1);
+  if(!copy) PERROR("malloc() failed.\n");
+  else {
+    memcpy(copy, source, length + 1);
+    Parser *parser = source_parse(copy);
+    free(copy);
+    if(parser) {
+      program = malloc(sizeof(EdxpProgram));
+      if(!program) {
+        PERROR("malloc() failed.\n");
+        parser_destroy(&parser);
+      } else {
+        program->parser = parser;
+      }
+    }
+  }
+
+  capture_end(&capture, io);
+  return program;
+}
+
+// Run a compiled program
+EdxpResult edxp_run(const EdxpProgram *program, const EdxpIO *io, const EdxpLimits *limits) {
+  EdxpResult result = {ERR_CREATE_FAIL, 1, 0};
+  Capture capture;
+  capture_begin(&capture);
+
+  InterpreterConfig config = {0};
+  config.no_files = !io || !io->files;
+  if(limits) {
+    config.max_steps = limits->max_steps;
+    config.max_heap = limits->max_heap;
+    config.max_output = limits->max_output;
+  }
+
+  char *buffer = malloc(EDXP_READ_SIZE);
+  Interpreter *interpreter = buffer ? interpreter_start(program->parser, &config, -1, &result.status) : NULL;
+  if(!buffer) PERROR("malloc() failed.\n");
+  if(interpreter) {
+    interpreter->display->sink = io && io->write ? io->write : discard;
+    interpreter->display->sink_context = io ? io->context : NULL;
+
+    int run;
+    while((run = interpreter_run(interpreter, SIZE_MAX)) == RUN_WAITING) {
+      long got = 0;
+      if(interpreter->waiting == DEVICE_KEYBOARD && io && io->read) got = io->read(io->context, buffer, EDXP_READ_SIZE);
+      if(got < 0) {
+        PERROR("Reading KEYBOARD's input failed.\n");
+        got = 0;
+      }
+      if(interpreter_feed(interpreter, interpreter->devices[interpreter->waiting].name, buffer, got) != ERR_OKAY) break;
+    }
+
+    result.status = ERR_DEVICE;
+    if(run == RUN_DONE) result.status = ERR_OKAY;
+    if(run == RUN_FAILED) result.status = interpreter->status;
+    result.steps = interpreter->steps;
+    interpreter_destroy(&interpreter);
+  }
+  free(buffer);
+
+  result.exit_status = interpreter_exit_status(result.status);
+  capture_end(&capture, io);
+  return result;
+}
+
+// Destroy a compiled program, once nothing is running it
+void edxp_program_destroy(EdxpProgram **program) {
+  if(!program || !*program) return;
+  parser_destroy(&(*program)->parser);
+  free(*program);
+  *program = NULL;
+}
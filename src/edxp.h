@@ -0,0 +1,66 @@
+#ifndef EDXP_H
+#define EDXP_H
+
+// libedxp, for running programs inside another process
+// A program is compiled once with edxp_compile() and can then be run any
+// number of times with edxp_run(), from any number of threads at once. Each
+// run has its own heap, and only reads the compiled program.
+
+// Includes
+#include <stddef.h>
+
+// Defines
+// The functions a shared build of the library exports
+#define EDXP_API __attribute__((visibility("default")))
+
+// Structs
+// A compiled program
+typedef struct EdxpProgram EdxpProgram;
+
+// Where a run's KEYBOARD input comes from, and where its DISPLAY output and
+// diagnostics go
+// Any of the callbacks can be NULL, in which case KEYBOARD has no input, or
+// the output or diagnostics are dropped. Devices the program RECEIVEs from
+// other than KEYBOARD have no input, and it can't SEND to devices other than
+// DISPLAY. Programs that READ or WRITE files on the host aren't run unless
+// files is set.
+typedef struct {
+  // Read up to size bytes into buffer, returning how many were read, 0 at
+  // the end of the input or -1 if reading failed
+  long (*read)(void *context, char *buffer, size_t size);
+  // Write some output, returning 0, or non-zero if it couldn't be written
+  int (*write)(void *context, const char *data, size_t length);
+  // Take the diagnostics from compiling or running a program, if there were
+  // any, all at once when it's done
+  void (*diagnostics)(void *context, const char *text, size_t length);
+  void *context;
+  // Let the program READ and WRITE files, with the process's permissions
+  int files;
+} EdxpIO;
+
+// Limits on a run, like --max_steps, --max_heap and --max_output, or 0 for
+// none
+typedef struct {
+  size_t max_steps;
+  size_t max_heap;
+  size_t max_output;
+} EdxpLimits;
+
+// How a run ended
+typedef struct {
+  // 0 if the program finished, or the error it stopped with or couldn't be
+  // started with, as listed in interpreter.h
+  int status;
+  // What edxp would have exited with, where 3, 4 and 5 are the step, heap
+  // and output limits
+  int exit_status;
+  // Steps the program ran
+  size_t steps;
+} EdxpResult;
+
+// Function prototypes
+EDXP_API EdxpProgram *edxp_compile(const char *source, const EdxpIO *io);
+EDXP_API EdxpResult edxp_run(const EdxpProgram *program, const EdxpIO *io, const EdxpLimits *limits);
+EDXP_API void edxp_program_destroy(EdxpProgram **program);
+
+#endif // edxp.h
@@ -0,0 +1,124 @@
+#include "forkserver.h"
+#include "def.h"
+#include "iolog.h"
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Point a standard descriptor at a file
+static int redirect(const char *path, int flags, int target) {
+  int fd = open(path, flags, 0666);
+  if(fd < 0) {
+    PERROR("Couldn't open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if(fd != target) {
+    if(dup2(fd, target) < 0) {
+      PERROR("dup2() failed: %s\n", strerror(errno));
+      close(fd);
+      return 1;
+    }
+    close(fd);
+  }
+  return 0;
+}
+
+// Run one request in a forked child, and exit with its status
+// ready is the preloaded program's interpreter, already set up, unless the
+// request names a program of its own.
+static void fork_server_child(Interpreter *ready, char *input, char *output, char *path, InterpreterConfig *config) {
+  if(redirect(input, O_RDONLY, STDIN_FILENO) != 0 || redirect(output, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO) != 0) _exit(1);
+
+  Interpreter *interpreter = ready;
+  if(path) {
+    Parser *parser = source_parse_file(path);
+    if(!parser) _exit(1);
+    interpreter = interpreter_prepare(parser, config);
+    if(!interpreter) _exit(1);
+  }
+
+  int status = interpreter_execute(interpreter);
+  if(status) PERROR("Failed to interpret: status %d\n", status);
+  // The process is about to go, so there's only something to do at the
+  // interpreter's end if it reports on it
+  if(config->memory_debug || config->stats) interpreter_destroy(&interpreter);
+  _exit(interpreter_exit_status(status));
+}
+
+// Split a request into its fields
+// Returns the number of fields, or 0 if there are too many.
+static size_t split_request(char *line, char **fields, size_t max) {
+  size_t count = 0;
+  line[strcspn(line, "\r\n")] = '\0';
+  while(1) {
+    if(count == max) return 0;
+    fields[count++] = line;
+    char *tab = strchr(line, '\t');
+    if(!tab) return count;
+    *tab = '\0';
+    line = tab + 1;
+  }
+}
+
+// Run a program once per request, each time in a child forked from a process
+// that has already done everything up to running it
+// If program is set, it's parsed and its interpreter set up, with its
+// constants loaded and its devices and files waiting to be opened, so a child
+// only has to point its standard input and output at the request's files and
+// run it. Either way the child starts with this process's heap and libraries
+// already warmed up. Runs until standard input ends.
+int fork_server(Parser *program, InterpreterConfig *config) {
+  Interpreter *ready = NULL;
+  if(program) {
+    ready = interpreter_prepare(program, config);
+    if(!ready) {
+      PERROR("Failed to set up the program.\n");
+      return 1;
+    }
+  }
+
+  char line[FORK_SERVER_MAX_LINE];
+  int status = 0;
+  while(fgets(line, sizeof(line), stdin)) {
+    uint64_t started = iolog_now();
+    char *fields[3];
+    size_t count = split_request(line, fields, 3);
+    if(count < 2 || (count == 2 && !ready)) {
+      PERROR("Expected input, output%s separated by tabs.\n", ready ? " and maybe a program" : " and program");
+      printf("1 0\n");
+      fflush(stdout);
+      continue;
+    }
+
+    // Anything buffered has to go out before the child gets a copy of it
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid < 0) {
+      PERROR("fork() failed: %s\n", strerror(errno));
+      status = 1;
+      break;
+    }
+    if(pid == 0) fork_server_child(ready, fields[0], fields[1], count == 3 ? fields[2] : NULL, config);
+
+    int wait_status;
+    while(waitpid(pid, &wait_status, 0) < 0) {
+      if(errno != EINTR) {
+        PERROR("waitpid() failed: %s\n", strerror(errno));
+        wait_status = 1 << 8;
+        break;
+      }
+    }
+    int exited = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+    printf("%d %llu\n", exited, (unsigned long long)((iolog_now() - started) / 1000));
+    fflush(stdout);
+  }
+
+  interpreter_destroy(&ready);
+  return status;
+}
@@ -0,0 +1,22 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+// Includes
+#include "interpreter.h"
+#include "parser.h"
+
+// Defines
+// Requests are read from standard input, one per line, with tab separated
+// fields:
+//   input     file the run's KEYBOARD reads
+//   output    file its DISPLAY is written to, truncated first
+//   program   optional, the program to run instead of the preloaded one
+// Each gets a line on standard output once the run has finished:
+//   status    what the run exited with, or 128 + the signal that killed it
+//   time      microseconds from the request being read to the run ending
+#define FORK_SERVER_MAX_LINE 4096
+
+// Function prototypes
+int fork_server(Parser *program, InterpreterConfig *config);
+
+#endif // forkserver.h
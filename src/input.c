@@ -0,0 +1,399 @@
+#include "input.h"
+#include "def.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Create an input for a file descriptor
+// The buffer isn't allocated until the first read.
+Input *input_create(int fd, Output *tie) {
+  Input *in = calloc(1, sizeof(Input));
+  if(!in) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+  in->fd = fd;
+  in->tie = tie;
+  in->line = 1;
+  return in;
+}
+
+// Create an input that reads from memory
+// It takes ownership of data, which must have come from malloc().
+Input *input_create_buffer(char *data, size_t size) {
+  Input *in = input_create(-1, NULL);
+  if(!in) {
+    PERROR("input_create() failed.\n");
+    return NULL;
+  }
+  in->data = data;
+  in->end = size;
+  in->capacity = size;
+  in->eof = 1;
+  return in;
+}
+
+// Destroy an input
+void input_destroy(Input **in) {
+  if(!in) return;
+  Input *i = *in;
+  if(!i) return;
+  free(i->data);
+  free(i);
+  *in = NULL;
+}
+
+// Move whatever is unread to the start of the buffer
+static void input_compact(Input *in) {
+  if(in->start > 0) {
+    memmove(in->data, in->data + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+  }
+}
+
+// Give an input with no file descriptor more data
+// Feeding it 0 bytes is the end of its input.
+int input_feed(Input *in, const char *data, size_t length) {
+  if(in->fd >= 0 || in->eof) {
+    PERROR("Input can't be fed.\n");
+    return 1;
+  }
+  if(in->log && iolog_read(in->log, in->log_slot, data, length, iolog_now()) != 0) return 1;
+  if(length == 0) {
+    in->eof = 1;
+    return 0;
+  }
+
+  input_compact(in);
+  if(in->capacity - in->end < length) {
+    size_t capacity = in->capacity ? in->capacity : 4096;
+    while(capacity - in->end < length) capacity *= 2;
+    char *grown = realloc(in->data, capacity);
+    if(!grown) {
+      PERROR("realloc() failed.\n");
+      return 1;
+    }
+    in->data = grown;
+    in->capacity = capacity;
+  }
+  memcpy(in->data + in->end, data, length);
+  in->end += length;
+  return 0;
+}
+
+// Read more data, keeping whatever is unread
+// The buffer grows when a single token fills all of it. Returns INPUT_OKAY if
+// data was added, INPUT_EOF at the end of input, or INPUT_WAIT if the input is
+// fed and has run out.
+static int input_fill(Input *in) {
+  if(in->eof) return INPUT_EOF;
+  if(in->fd < 0) {
+    if(in->tie) output_flush(in->tie);
+    return INPUT_WAIT;
+  }
+
+  input_compact(in);
+  if(in->end == in->capacity) {
+    size_t capacity = in->capacity ? in->capacity * 2 : INPUT_BUFFER_SIZE;
+    char *data = realloc(in->data, capacity);
+    if(!data) {
+      PERROR("realloc() failed.\n");
+      return INPUT_FAIL;
+    }
+    in->data = data;
+    in->capacity = capacity;
+  }
+
+  if(in->tie) output_flush(in->tie);
+  uint64_t started = in->log ? iolog_now() : 0;
+  while(1) {
+    ssize_t got = read(in->fd, in->data + in->end, in->capacity - in->end);
+    if(got < 0 && errno == EINTR) continue;
+    if(got < 0) {
+      PERROR("read() failed: %s\n", strerror(errno));
+      return INPUT_FAIL;
+    }
+    if(in->log && iolog_read(in->log, in->log_slot, in->data + in->end, got, started) != 0) return INPUT_FAIL;
+    if(got == 0) {
+      in->eof = 1;
+      return INPUT_EOF;
+    }
+    in->end += got;
+    return INPUT_OKAY;
+  }
+}
+
+static inline int is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Skip whitespace, then find the end of the next token
+// On success the token is data[start, *end).
+static int next_token(Input *in, size_t *end) {
+  in->in_token_line = 0;
+  while(1) {
+    while(in->start < in->end && is_space(in->data[in->start])) {
+      if(in->data[in->start] == '\n') in->line++;
+      in->start++;
+    }
+    if(in->start < in->end) break;
+    int status = input_fill(in);
+    if(status) return status;
+  }
+
+  size_t i = in->start;
+  while(1) {
+    while(i < in->end && !is_space(in->data[i])) i++;
+    if(i < in->end) break;
+    size_t offset = i - in->start;
+    int status = input_fill(in);
+    i = in->start + offset;
+    if(status == INPUT_EOF) break;
+    if(status) return status;
+  }
+  *end = i;
+  return INPUT_OKAY;
+}
+
+static inline int is_blank(char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Move past a token, and past the rest of its line if that's only whitespace
+// Only what's already buffered is looked at, reading more could block on a
+// line that is still being typed. If the buffer runs out first, the next
+// STRING finishes the job.
+static void finish_token(Input *in, size_t end) {
+  in->start = end;
+  while(in->start < in->end && is_blank(in->data[in->start])) in->start++;
+  in->in_token_line = in->start == in->end;
+  if(in->start < in->end && in->data[in->start] == '\n') {
+    in->start++;
+    in->line++;
+  }
+}
+
+// Report a token that isn't a valid value of a type
+static int malformed(Input *in, size_t end, const char *type) {
+  int length = (int)(end - in->start > 40 ? 40 : end - in->start);
+  PERROR("Line %zu: expected %s, got \"%.*s%s\"\n", in->line, type, length, in->data + in->start, end - in->start > 40 ? "..." : "");
+  finish_token(in, end);
+  return INPUT_MALFORMED;
+}
+
+// Report running out of input
+static int end_of_input(Input *in, int status, const char *type) {
+  if(status == INPUT_EOF) PERROR("Line %zu: expected %s, reached the end of input\n", in->line, type);
+  return status;
+}
+
+// Parse an optional sign and digits into an unsigned magnitude
+// Returns the number of digits, or 0 if there aren't any or they overflow.
+static size_t parse_digits(const char *p, const char *end, uint64_t *value) {
+  uint64_t v = 0;
+  const char *start = p;
+  while(p < end && *p >= '0' && *p <= '9') {
+    unsigned digit = *p - '0';
+    if(v > (UINT64_MAX - digit) / 10) return 0;
+    v = v * 10 + digit;
+    p++;
+  }
+  *value = v;
+  return p - start;
+}
+
+// Parse an INTEGER from some text
+// Returns INPUT_RANGE if it's a whole number too big for an INTEGER.
+int input_parse_int(const char *data, size_t length, int *out) {
+  const char *p = data;
+  const char *e = data + length;
+  int negative = p < e && *p == '-';
+  if(p < e && (*p == '-' || *p == '+')) p++;
+  uint64_t magnitude;
+  size_t digits = parse_digits(p, e, &magnitude);
+  if(!digits || p + digits != e) return INPUT_MALFORMED;
+  if(magnitude > (uint64_t)INT_MAX + negative) return INPUT_RANGE;
+
+  *out = negative ? (int)-(int64_t)magnitude : (int)magnitude;
+  return INPUT_OKAY;
+}
+
+// Powers of ten that are exact doubles
+static const double EXACT_POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parse a REAL from some text
+// Short numbers are converted exactly with one multiply or divide, everything
+// else goes through strtod.
+int input_parse_real(const char *data, size_t length, double *out) {
+  const char *p = data;
+  const char *e = data + length;
+  int negative = p < e && *p == '-';
+  if(p < e && (*p == '-' || *p == '+')) p++;
+
+  uint64_t mantissa = 0;
+  size_t digits = 0;
+  int exponent = 0;
+  int fast = 1;
+  while(p < e && *p >= '0' && *p <= '9') {
+    if(digits < 19) mantissa = mantissa * 10 + (*p - '0');
+    else fast = 0;
+    digits++;
+    p++;
+  }
+  if(p < e && *p == '.') {
+    p++;
+    while(p < e && *p >= '0' && *p <= '9') {
+      if(digits < 19) mantissa = mantissa * 10 + (*p - '0');
+      else fast = 0;
+      digits++;
+      exponent--;
+      p++;
+    }
+  }
+  if(digits == 0) return INPUT_MALFORMED;
+  if(p < e && (*p == 'e' || *p == 'E')) {
+    p++;
+    int exp_negative = p < e && *p == '-';
+    if(p < e && (*p == '-' || *p == '+')) p++;
+    uint64_t exp_value;
+    size_t exp_digits = parse_digits(p, e, &exp_value);
+    if(!exp_digits) return INPUT_MALFORMED;
+    p += exp_digits;
+    if(exp_value > 400) fast = 0;
+    else exponent += exp_negative ? -(int)exp_value : (int)exp_value;
+  }
+  if(p != e) return INPUT_MALFORMED;
+
+  if(fast && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+    double value = (double)mantissa;
+    value = exponent < 0 ? value / EXACT_POW10[-exponent] : value * EXACT_POW10[exponent];
+    *out = negative ? -value : value;
+    return INPUT_OKAY;
+  }
+
+  // The text isn't '\0' terminated
+  char small[64];
+  char *copy = length < sizeof(small) ? small : malloc(length + 1);
+  if(!copy) {
+    PERROR("malloc() failed.\n");
+    return INPUT_FAIL;
+  }
+  memcpy(copy, data, length);
+  copy[length] = '\0';
+  *out = strtod(copy, NULL);
+  if(copy != small) free(copy);
+  return INPUT_OKAY;
+}
+
+// Parse a BOOLEAN, written TRUE or FALSE
+int input_parse_bool(const char *data, size_t length, int *out) {
+  if(length == 4 && memcmp(data, "TRUE", 4) == 0) *out = 1;
+  else if(length == 5 && memcmp(data, "FALSE", 5) == 0) *out = 0;
+  else return INPUT_MALFORMED;
+  return INPUT_OKAY;
+}
+
+// Read an INTEGER
+int input_int(Input *in, int *out) {
+  size_t end;
+  int status = next_token(in, &end);
+  if(status) return end_of_input(in, status, "an INTEGER");
+
+  status = input_parse_int(in->data + in->start, end - in->start, out);
+  if(status == INPUT_RANGE) {
+    PERROR("Line %zu: %.*s doesn't fit in an INTEGER\n", in->line, (int)(end - in->start), in->data + in->start);
+    finish_token(in, end);
+    return INPUT_MALFORMED;
+  }
+  if(status) return malformed(in, end, "an INTEGER");
+
+  finish_token(in, end);
+  return INPUT_OKAY;
+}
+
+// Read a REAL
+int input_real(Input *in, double *out) {
+  size_t end;
+  int status = next_token(in, &end);
+  if(status) return end_of_input(in, status, "a REAL");
+
+  status = input_parse_real(in->data + in->start, end - in->start, out);
+  if(status == INPUT_FAIL) return status;
+  if(status) return malformed(in, end, "a REAL");
+
+  finish_token(in, end);
+  return INPUT_OKAY;
+}
+
+// Read a BOOLEAN
+int input_bool(Input *in, int *out) {
+  size_t end;
+  int status = next_token(in, &end);
+  if(status) return end_of_input(in, status, "a BOOLEAN");
+
+  if(input_parse_bool(in->data + in->start, end - in->start, out) != 0) return malformed(in, end, "TRUE or FALSE");
+
+  finish_token(in, end);
+  return INPUT_OKAY;
+}
+
+// Read a CHARACTER, the next character that isn't whitespace
+int input_char(Input *in, char *out) {
+  size_t end;
+  int status = next_token(in, &end);
+  if(status) return end_of_input(in, status, "a CHARACTER");
+
+  *out = in->data[in->start];
+  finish_token(in, in->start + 1);
+  return INPUT_OKAY;
+}
+
+// Read a STRING, the rest of the current line
+// The line break isn't included, whether it's "\n" or "\r\n".
+int input_line(Input *in, String *out) {
+  // Skip what's left of the line of the last token, if it's only whitespace
+  if(in->in_token_line) {
+    while(1) {
+      while(in->start < in->end && is_blank(in->data[in->start])) in->start++;
+      if(in->start < in->end) break;
+      int status = input_fill(in);
+      if(status == INPUT_EOF) break;
+      if(status) return status;
+    }
+    if(in->start < in->end && in->data[in->start] == '\n') {
+      in->start++;
+      in->line++;
+    }
+    in->in_token_line = 0;
+  }
+
+  size_t i = in->start;
+  while(1) {
+    while(i < in->end && in->data[i] != '\n') i++;
+    if(i < in->end) break;
+    size_t offset = i - in->start;
+    int status = input_fill(in);
+    i = in->start + offset;
+    if(status == INPUT_EOF) break;
+    if(status) return status;
+  }
+  if(i == in->start && in->eof && i == in->end) return end_of_input(in, INPUT_EOF, "a STRING");
+
+  size_t length = i - in->start;
+  if(length > 0 && in->data[in->start + length - 1] == '\r') length--;
+  if(string_set(out, in->data + in->start, length) != 0) return INPUT_FAIL;
+
+  in->start = i;
+  if(i < in->end) {
+    in->start++;
+    in->line++;
+  }
+  return INPUT_OKAY;
+}
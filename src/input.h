@@ -0,0 +1,64 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+// Includes
+#include "iolog.h"
+#include "output.h"
+#include "str.h"
+#include <stddef.h>
+
+// Defines
+#define INPUT_BUFFER_SIZE (1 << 20)
+
+// Structs
+// Buffered reader for a file descriptor
+// Values are read a token at a time: leading whitespace is skipped, and a
+// token ends at the next whitespace. After a token the rest of its line is
+// skipped too if it's only whitespace, so a STRING read afterwards gets the
+// next line rather than an empty one. tie, if set, is flushed before every
+// read that could block, so prompts appear before the program waits.
+// An input with no file descriptor is fed its data with input_feed(), and
+// reading past what it's been fed gives INPUT_WAIT, leaving the token unread
+// so it can be tried again once there's more.
+typedef struct {
+  int fd;
+  Output *tie;
+  char *data;
+  size_t start;
+  size_t end;
+  size_t capacity;
+  int eof;
+  // Set when a token's line might go on past what has been read so far
+  int in_token_line;
+  // Line of the next unread character, for error messages
+  size_t line;
+  // Where every read is recorded, if anywhere
+  IoLog *log;
+  size_t log_slot;
+} Input;
+
+// Errors
+enum {
+  INPUT_OKAY,
+  INPUT_EOF,
+  INPUT_MALFORMED,
+  INPUT_RANGE,
+  INPUT_WAIT,
+  INPUT_FAIL
+};
+
+// Function prototypes
+Input *input_create(int fd, Output *tie);
+Input *input_create_buffer(char *data, size_t size);
+void input_destroy(Input **in);
+int input_feed(Input *in, const char *data, size_t length);
+int input_int(Input *in, int *out);
+int input_real(Input *in, double *out);
+int input_bool(Input *in, int *out);
+int input_char(Input *in, char *out);
+int input_line(Input *in, String *out);
+int input_parse_int(const char *data, size_t length, int *out);
+int input_parse_real(const char *data, size_t length, double *out);
+int input_parse_bool(const char *data, size_t length, int *out);
+
+#endif // input.h
@@ -1,16 +1,18 @@
 #include "interpreter.h"
 #include "def.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // FRAME NODE IMPLEMENTATION
 // Create a frame node
 static FrameNode *frame_node_create(char *id) {
-  FrameNode *f = malloc(sizeof(FrameNode));
+  FrameNode *f = pool_alloc(sizeof(FrameNode));
   if(!f) {
-    PERROR("malloc() failed.\n");
+    PERROR("pool_alloc() failed.\n");
     return NULL;
   }
 
@@ -18,10 +20,10 @@ static FrameNode *frame_node_create(char *id) {
       .type = -1,
       .int_val = 0};
 
-  f->id = strdup(id);
+  f->id = pool_strdup(id);
   if(!f->id) {
-    PERROR("strdup() failed.\n");
-    free(f);
+    PERROR("pool_strdup() failed.\n");
+    pool_free(f);
     return NULL;
   }
   f->next = NULL;
@@ -36,10 +38,11 @@ static void frame_node_destroy(FrameNode **node) {
   FrameNode *f = n;
   while(f) {
     FrameNode *next = f->next;
-    if(f->id) free(f->id);
+    variable_destroy(&f->var);
+    pool_free(f->id);
     f->id = NULL;
     f->next = NULL;
-    free(f);
+    pool_free(f);
     f = next;
   }
   *node = NULL;
@@ -48,9 +51,9 @@ static void frame_node_destroy(FrameNode **node) {
 // FRAME IMPLEMENTATION
 // Create a frame
 static Frame *frame_create(void) {
-  Frame *f = malloc(sizeof(Frame));
+  Frame *f = pool_alloc(sizeof(Frame));
   if(!f) {
-    PERROR("malloc() failed.\n");
+    PERROR("pool_alloc() failed.\n");
     return NULL;
   }
   for(size_t i = 0; i < NUM_BUCKETS; i++) {
@@ -68,7 +71,7 @@ static void frame_destroy(Frame **frame) {
   for(size_t i = 0; i < NUM_BUCKETS; i++) {
     frame_node_destroy(&f->buckets[i]);
   }
-  free(f);
+  pool_free(f);
   *frame = NULL;
 }
 
@@ -115,45 +118,35 @@ static int frame_insert(Frame *frame, FrameNode *node) {
   }
 }
 
-// Lookup a variable in a frame
-static FrameNode *frame_lookup(Frame *frame, char *id) {
+// Lookup a variable in a frame, given the hash of its id
+// Returns NULL without complaining if it isn't there, since the caller will
+// usually go on to look in an enclosing scope.
+static FrameNode *frame_lookup(Frame *frame, char *id, uint32_t hash) {
   if(!frame || !id) {
     PERROR("Invalid frame or id string passed.\n");
     return NULL;
   }
 
-  uint32_t idx = hash_str(id) % NUM_BUCKETS;
-
-  FrameNode *n = frame->buckets[idx];
-  if(!n) {
-    PERROR("Variable \"%s\" not found: bucket was empty.\n", id);
-    return NULL;
-  }
-
+  FrameNode *n = frame->buckets[hash % NUM_BUCKETS];
   while(n) {
     if(strcmp(n->id, id) == 0) return n;
     n = n->next;
   }
 
-  PERROR("Variable \"%s\" not found: bucket did not contain id.\n", id);
   return NULL;
 }
 
 // SCOPE IMPLEMENTATION
 // Create a scope
 static Scope *scope_create(void) {
-  Scope *s = malloc(sizeof(Scope));
+  Scope *s = pool_alloc(sizeof(Scope));
   if(!s) {
-    PERROR("malloc() failed.\n");
+    PERROR("pool_alloc() failed.\n");
     return NULL;
   }
 
-  s->frame = frame_create();
-  if(!s->frame) {
-    PERROR("frame_create() failed.\n");
-    free(s);
-    return NULL;
-  }
+  // The frame is created by the first declaration
+  s->frame = NULL;
   s->next = NULL;
   s->prev = NULL;
   return s;
@@ -167,49 +160,55 @@ static void scope_destroy(Scope **scope) {
   Scope *c = s;
   while(c) {
     Scope *next = c->next;
-    if(c->prev) {
-      c->prev->next = NULL;
-    }
     frame_destroy(&c->frame);
-    free(c);
+    pool_free(c);
     c = next;
   }
   *scope = NULL;
 }
 
 // Append a new scope to a scope
+// A scope left behind by an earlier block is reused, so entering a block in a
+// loop doesn't allocate.
 static int scope_push_scope(Scope *scope) {
   if(!scope) {
     PERROR("NULL Scope passed!\n");
     return ERR_NULL_ARGS;
   }
 
+  if(scope->next) return ERR_OKAY;
+
   Scope *new = scope_create();
   if(!new) {
     PERROR("Failed to create a new scope.\n");
     return ERR_CREATE_FAIL;
   }
 
-  if(scope->next) scope_destroy(&scope->next);
+  new->prev = scope;
   scope->next = new;
   return ERR_OKAY;
 }
 
-// Declare a variable within a scope
-static int scope_declare(Scope *scope, char *id, VarType type) {
-  Frame *frame = scope->frame;
-  if(!frame) {
-    PERROR("Failed to declare variable \"%s\"\n: Scope is missing a frame!\n", id);
-    return ERR_INTERP_MISSING_COMPONENT;
+// Declare a variable within a scope, taking ownership of its value
+static int scope_declare(Scope *scope, char *id, Variable var) {
+  if(!scope->frame) {
+    scope->frame = frame_create();
+    if(!scope->frame) {
+      PERROR("Failed to declare variable \"%s\"\n: Couldn't create a frame!\n", id);
+      variable_destroy(&var);
+      return ERR_CREATE_FAIL;
+    }
   }
+  Frame *frame = scope->frame;
 
   FrameNode *fn = frame_node_create(id);
   if(!fn) {
     PERROR("frame_node_create() failed.\n");
+    variable_destroy(&var);
     return ERR_CREATE_FAIL;
   }
 
-  fn->var = var_new(type);
+  fn->var = var;
   if(fn->var.type == -1) {
     PERROR("Failed to initialise variable \"%s\".\n", id);
   }
@@ -242,11 +241,21 @@ static State *state_create(void) {
 
   state->scope_cur = state->scope_top;
 
+  state->exec = NULL;
+  state->exec_count = 0;
+  state->exec_alloced = 0;
+
   state->next = NULL;
   state->prev = NULL;
   return state;
 }
 
+// Release anything an execution frame owns
+static void exec_frame_release(ExecFrame *frame) {
+  variable_destroy(&frame->items);
+  variable_destroy(&frame->step);
+}
+
 // Destroy a state
 static void state_destroy(State **state) {
   if(!state) return;
@@ -255,6 +264,8 @@ static void state_destroy(State **state) {
   State *t = s;
   while(t) {
     State *next = t->next;
+    for(size_t i = 0; i < t->exec_count; i++) exec_frame_release(&t->exec[i]);
+    pool_free(t->exec);
     scope_destroy(&t->scope_top);
     if(t->prev) t->prev->next = NULL;
     free(t);
@@ -281,33 +292,133 @@ static int state_push_scope(State *state) {
   return ERR_OKAY;
 }
 
-// Declare a variable in a state
-static int state_declare(State *state, char *id, VarType type) {
-  if(!state->scope_cur) {
-    PERROR("State is missing a scope!\n");
+// Leave the current scope of a state, releasing its variables
+// The scope itself is kept around to be reused by the next push.
+static int state_pop_scope(State *state) {
+  if(!state->scope_cur || !state->scope_cur->prev) {
+    PERROR("State has no scope to pop!\n");
     return ERR_INTERP_MISSING_COMPONENT;
   }
 
-  int status = scope_declare(state->scope_cur, id, type);
-  if(status) {
-    PERROR("Failed to declare variable \"%s\".\n", id);
-    return status;
-  }
+  frame_destroy(&state->scope_cur->frame);
+  state->scope_cur = state->scope_cur->prev;
   return ERR_OKAY;
 }
 
+// Look up a variable in a state, from the innermost scope outwards
+// Returns NULL without complaining if it isn't declared.
+static Variable *state_lookup(State *state, char *id) {
+  uint32_t hash = hash_str(id);
+  for(Scope *s = state->scope_cur; s; s = s->prev) {
+    if(!s->frame) continue;
+    FrameNode *n = frame_lookup(s->frame, id, hash);
+    if(n) return &n->var;
+  }
+  return NULL;
+}
+
+// Push a statement onto a state's execution stack
+static ExecFrame *state_push_exec(State *state, ASTNode *node) {
+  if(state->exec_count >= state->exec_alloced) {
+    size_t alloced = state->exec_alloced ? state->exec_alloced * 2 : 64;
+    ExecFrame *new = pool_realloc(state->exec, sizeof(ExecFrame) * alloced);
+    if(!new) {
+      PERROR("pool_realloc() failed.\n");
+      return NULL;
+    }
+    state->exec = new;
+    state->exec_alloced = alloced;
+  }
+
+  ExecFrame *frame = &state->exec[state->exec_count++];
+  *frame = (ExecFrame){
+      .node = node,
+      .items = {.type = -1},
+      .step = {.type = -1}};
+  return frame;
+}
+
+// Pop the top statement from a state's execution stack
+static void state_pop_exec(State *state) {
+  exec_frame_release(&state->exec[--state->exec_count]);
+}
+
 // INTERPRETER IMPLEMENTATION
 // Create an interpreter
-static Interpreter *interpreter_create(void) {
+// DISPLAY writes to display_fd. KEYBOARD reads standard input, or is fed its
+// input with interpreter_feed() if fed is set.
+static Interpreter *interpreter_create(InterpreterConfig *config, int display_fd, int fed) {
   Interpreter *i = malloc(sizeof(Interpreter));
   if(!i) {
     PERROR("malloc() failed.\n");
     return NULL;
   }
 
+  i->config = config ? *config : (InterpreterConfig){0};
+  i->live_arrays = array_live_count();
+  i->live_strings = string_live_count();
+
+  i->pool = pool_create();
+  if(!i->pool) {
+    PERROR("pool_create() failed.\n");
+    free(i);
+    return NULL;
+  }
+
+  i->strings = NULL;
+  i->constants = NULL;
+  i->constant_count = 0;
+  i->devices = NULL;
+  i->device_count = 0;
+  i->files = NULL;
+  i->file_count = 0;
+  i->fed = fed;
+  i->waiting = 0;
+  i->status = ERR_OKAY;
+  i->steps = 0;
+  i->pool->limit = i->config.max_heap;
+
+  i->display = output_create(display_fd, i->config.unbuffered);
+  if(!i->display) {
+    PERROR("output_create() failed.\n");
+    pool_destroy(&i->pool);
+    free(i);
+    return NULL;
+  }
+  i->output_budget = (OutputBudget){i->config.max_output, 0, 0};
+  i->display->budget = &i->output_budget;
+
+  // Prompts are displayed before waiting on the keyboard
+  i->keyboard = input_create(fed ? -1 : STDIN_FILENO, i->display);
+  if(!i->keyboard) {
+    PERROR("input_create() failed.\n");
+    output_destroy(&i->display);
+    pool_destroy(&i->pool);
+    free(i);
+    return NULL;
+  }
+
+  i->log = NULL;
+  if(i->config.replay_path) i->log = iolog_replay(i->config.replay_path);
+  else if(i->config.record_path) i->log = iolog_record(i->config.record_path);
+  if((i->config.replay_path || i->config.record_path) && !i->log) {
+    PERROR("Failed to open the device log.\n");
+    input_destroy(&i->keyboard);
+    output_destroy(&i->display);
+    pool_destroy(&i->pool);
+    free(i);
+    return NULL;
+  }
+
+  Pool *prev = pool_set_current(i->pool);
   i->state_glob = state_create();
+  pool_set_current(prev);
   if(!i->state_glob) {
     PERROR("state_create() failed.\n");
+    iolog_close(&i->log);
+    input_destroy(&i->keyboard);
+    output_destroy(&i->display);
+    pool_destroy(&i->pool);
     free(i);
     return NULL;
   }
@@ -321,7 +432,35 @@ void interpreter_destroy(Interpreter **interpreter) {
   if(!interpreter) return;
   Interpreter *i = *interpreter;
   if(!i) return;
+  // Printed before anything is released, so the live blocks are the ones the
+  // program finished with
+  if(i->config.stats) pool_print_stats(i->pool, DIAG_OUT);
   state_destroy(&i->state_glob);
+  for(size_t d = 0; d < i->device_count; d++) device_close(&i->devices[d]);
+  pool_free(i->devices);
+  i->devices = NULL;
+  for(size_t f = 0; f < i->file_count; f++) record_file_close(&i->files[f]);
+  pool_free(i->files);
+  i->files = NULL;
+  input_destroy(&i->keyboard);
+  output_destroy(&i->display);
+  if(i->log && i->config.stats) iolog_print_stats(i->log, DIAG_OUT);
+  iolog_close(&i->log);
+  for(size_t c = 0; c < i->constant_count; c++) variable_destroy(&i->constants[c]);
+  pool_free(i->constants);
+  i->constants = NULL;
+  string_table_destroy(&i->strings);
+
+  // Every value should have been released along with the scopes holding it
+  if(i->config.memory_debug) {
+    size_t arrays = array_live_count() - i->live_arrays;
+    size_t strings = string_live_count() - i->live_strings;
+    if(arrays || strings) fprintf(DIAG_OUT, "Memory debug: %zu arrays and %zu strings were leaked\n", arrays, strings);
+    else fprintf(DIAG_OUT, "Memory debug: no leaks\n");
+  }
+
+  // Anything still in the pool's slabs goes with it
+  pool_destroy(&i->pool);
   free(i);
   *interpreter = NULL;
 }
@@ -343,25 +482,31 @@ int interpreter_push_scope(Interpreter *interpreter) {
   return ERR_OKAY;
 }
 
-// Declare a variable at the current scope
-int interpreter_declare(Interpreter *interpreter, char *id, VarType type) {
+// Declare a variable at the current scope, taking ownership of its value
+// If global is set, it is declared in the outermost scope instead. That's
+// where variables first seen in a SET or FOR go, so that like in Python they
+// are still visible after the block that set them.
+int interpreter_declare(Interpreter *interpreter, char *id, Variable var, int global) {
   if(!interpreter) {
     PERROR("NULL interpreter passed.\n");
+    variable_destroy(&var);
     return ERR_NULL_ARGS;
   }
 
   if(!id) {
     PERROR("NULL id passed.\n");
+    variable_destroy(&var);
     return ERR_NULL_ARGS;
   }
 
   State *state = interpreter->state_cur;
-  if(!state) {
+  if(!state || !state->scope_cur) {
     PERROR("Interpreter is missing a state!\n");
+    variable_destroy(&var);
     return ERR_INTERP_MISSING_COMPONENT;
   }
 
-  int status = state_declare(state, id, type);
+  int status = scope_declare(global ? state->scope_top : state->scope_cur, id, var);
   if(status) {
     PERROR("Failed to declare variable \"%s\".\n", id);
     return status;
@@ -370,103 +515,1640 @@ int interpreter_declare(Interpreter *interpreter, char *id, VarType type) {
   return ERR_OKAY;
 }
 
-int interpret_node(Interpreter *interpreter, ASTNode *node);
+// Look up a variable, complaining if it isn't declared
+static Variable *interpreter_lookup(Interpreter *interpreter, char *id) {
+  Variable *var = state_lookup(interpreter->state_cur, id);
+  if(!var) PERROR("Variable \"%s\" has not been declared.\n", id);
+  return var;
+}
 
-// Interpret a block node
-int interpret_block(Interpreter *interpreter, ASTNode *node) {
-  if(!node->block.statements) {
-    PERROR("Block node is missing statements!\n");
-    return ERR_NODE_MISSING_COMPONENT;
+// EXPRESSION EVALUATION
+static int eval_expr(Interpreter *interpreter, ASTNode *node, Variable *out);
+
+// Evaluate an expression without copying it if it is just a variable
+// *ref points either at the variable itself, which must not be modified, or
+// at tmp, which the caller must destroy.
+static int eval_ref(Interpreter *interpreter, ASTNode *node, Variable *tmp, Variable **ref) {
+  if(node->type == NodeExpr && node->expr.type == ExprVar) {
+    *ref = interpreter_lookup(interpreter, node->expr.var_name);
+    return *ref ? ERR_OKAY : ERR_UNDECLARED;
   }
 
-  // Push a new scope for the block
-  int push_status = interpreter_push_scope(interpreter);
-  if(push_status) {
-    PERROR("Failed to push a new scope for the block.\n");
-    return push_status;
+  int status = eval_expr(interpreter, node, tmp);
+  if(status) return status;
+  *ref = tmp;
+  return ERR_OKAY;
+}
+
+// Evaluate an expression that must be an INTEGER
+static int eval_int(Interpreter *interpreter, ASTNode *node, int *out) {
+  Variable v = {.type = -1};
+  int status = eval_expr(interpreter, node, &v);
+  if(status) return status;
+  if(v.type != VarInteger) {
+    PERROR("Expected INTEGER, got %s\n", var_type_name(v.type));
+    variable_destroy(&v);
+    return ERR_TYPE_MISMATCH;
   }
+  *out = v.int_val;
+  return ERR_OKAY;
+}
 
-  for(size_t i = 0; i < node->block.count; i++) {
-    int status = interpret_node(interpreter, node->block.statements[i]);
-    if(status != 0) {
-      PERROR("Failed to interpret statement index %zu.\n", i);
-      return status;
-    }
+// Evaluate an expression that must be a BOOLEAN
+static int eval_bool(Interpreter *interpreter, ASTNode *node, int *out) {
+  Variable v = {.type = -1};
+  int status = eval_expr(interpreter, node, &v);
+  if(status) return status;
+  if(v.type != VarBoolean) {
+    PERROR("Expected BOOLEAN, got %s\n", var_type_name(v.type));
+    variable_destroy(&v);
+    return ERR_TYPE_MISMATCH;
   }
+  *out = v.boolean_val;
+  return ERR_OKAY;
+}
 
+// Check a row index against the number of rows of an array
+static int check_row(Array *array, int row) {
+  if(row < 0 || (size_t)row >= array_rows(array)) {
+    PERROR("Index %d is out of bounds for ARRAY of length %zu\n", row, array_rows(array));
+    return ERR_OUT_OF_BOUNDS;
+  }
   return ERR_OKAY;
 }
 
-// Interpret a program node
-int interpret_program(Interpreter *interpreter, ASTNode *node) {
-  int block_status = interpret_node(interpreter, node->program.block);
-  if(block_status) {
-    PERROR("Failed to interpret program's block.\n");
-    return block_status;
+// Find the position of an element in an array's buffer, checking bounds
+// A two-dimensional array needs both an index and a column, a one-dimensional
+// array only the index.
+static int element_offset(Array *array, int index, int column, int has_column, size_t *offset) {
+  if(has_column != (array->stride != 0)) {
+    PERROR("ARRAY is %s-dimensional, expected %s\n", array->stride ? "two" : "one", array->stride ? "[row, column]" : "[index]");
+    return ERR_TYPE_MISMATCH;
   }
 
+  int status = check_row(array, index);
+  if(status) return status;
+  if(!has_column) {
+    *offset = (size_t)index;
+    return ERR_OKAY;
+  }
+
+  if(column < 0 || (size_t)column >= array->stride) {
+    PERROR("Column %d is out of bounds for ARRAY with %zu columns\n", column, array->stride);
+    return ERR_OUT_OF_BOUNDS;
+  }
+  *offset = (size_t)index * array->stride + (size_t)column;
   return ERR_OKAY;
 }
 
-int interpret_var_decl(Interpreter *interpreter, ASTNode *node) {
+// Evaluate the index and optional column of a subscript
+static int eval_subscript(Interpreter *interpreter, ASTNode *index, ASTNode *column, int *row_out, int *column_out) {
+  int status = eval_int(interpreter, index, row_out);
+  if(status || !column) return status;
+  return eval_int(interpreter, column, column_out);
+}
+
+// Evaluate an array literal
+static int eval_array_lit(Interpreter *interpreter, ASTNode *node, Variable *out) {
+  size_t count = node->expr.array.count;
+
+  // The element type is REAL if any element is, STRING if any element is,
+  // otherwise it's the type of the first element. Evaluate everything first so it's known.
+  Variable *items = calloc(count ? count : 1, sizeof(Variable));
+  if(!items) {
+    PERROR("calloc() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+
+  int status = ERR_OKAY;
+  size_t done = 0;
+  VarType type = -1;
+  for(; done < count; done++) {
+    status = eval_expr(interpreter, node->expr.array.items[done], &items[done]);
+    if(status) goto out;
+    VarType item_type = items[done].type;
+    if(item_type == VarArray) item_type = items[done].array_val->type;
+    if(type == -1 || (type == VarInteger && item_type == VarReal) || (type == VarCharacter && item_type == VarString)) type = item_type;
+  }
+
+  // A list of one-dimensional arrays of the same length is a two-dimensional
+  // array, [[1, 2], [3, 4]]
+  size_t columns = 0;
+  if(count > 0 && items[0].type == VarArray && !items[0].array_val->stride) columns = items[0].array_val->length;
+  for(size_t i = 0; columns > 0 && i < count; i++) {
+    if(items[i].type != VarArray || items[i].array_val->stride || items[i].array_val->length != columns) {
+      PERROR("Rows of a two-dimensional ARRAY must all have %zu elements\n", columns);
+      status = ERR_TYPE_MISMATCH;
+      goto out;
+    }
+  }
+
+  *out = columns ? var_new_array_2d(type, 0, columns) : var_new_array(type, 0);
+  if(out->type == -1) {
+    status = ERR_CREATE_FAIL;
+    goto out;
+  }
+  if(count > 0 && array_reserve(out->array_val, count * (columns ? columns : 1)) != 0) {
+    status = ERR_CREATE_FAIL;
+    goto out;
+  }
+  for(size_t i = 0; i < count; i++) {
+    int failed = 0;
+    if(columns) {
+      for(size_t j = 0; j < columns && !failed; j++) {
+        Variable elem = var_array_get(items[i].array_val, j);
+        failed = var_array_push(out->array_val, &elem);
+        variable_destroy(&elem);
+      }
+    } else {
+      failed = var_array_push(out->array_val, &items[i]);
+    }
+    if(failed) {
+      PERROR("Failed to build array literal.\n");
+      status = ERR_TYPE_MISMATCH;
+      goto out;
+    }
+  }
+
+out:
+  if(status) variable_destroy(out);
+  for(size_t i = 0; i < done; i++) variable_destroy(&items[i]);
+  free(items);
+  return status;
+}
+
+// Evaluate an array element
+static int eval_index(Interpreter *interpreter, ASTNode *node, Variable *out) {
+  Variable tmp = {.type = -1};
+  Variable *array = NULL;
+  int status = eval_ref(interpreter, node->expr.index.array, &tmp, &array);
+  if(status) return status;
+
+  // A character of a string
+  if(array->type == VarString && !node->expr.index.column) {
+    int index = 0;
+    status = eval_int(interpreter, node->expr.index.index, &index);
+    if(status) goto out;
+    if(index < 0 || (size_t)index >= array->string_val.length) {
+      PERROR("Index %d is out of bounds for STRING of length %zu\n", index, array->string_val.length);
+      status = ERR_OUT_OF_BOUNDS;
+      goto out;
+    }
+    *out = (Variable){.type = VarCharacter, .character_val = string_data(&array->string_val)[index]};
+    goto out;
+  }
+
+  if(array->type != VarArray) {
+    PERROR("Can't index into %s\n", var_type_name(array->type));
+    status = ERR_TYPE_MISMATCH;
+    goto out;
+  }
+
+  int index = 0;
+  int column = 0;
+  ASTNode *column_node = node->expr.index.column;
+  status = eval_subscript(interpreter, node->expr.index.index, column_node, &index, &column);
+  if(status) goto out;
+
+  // A single index into a two-dimensional array reads a whole row
+  if(array->array_val->stride && !column_node) {
+    status = check_row(array->array_val, index);
+    if(status) goto out;
+    Array *row = array_row(array->array_val, index);
+    if(!row) {
+      status = ERR_CREATE_FAIL;
+      goto out;
+    }
+    *out = (Variable){.type = VarArray, .array_val = row};
+    goto out;
+  }
+
+  size_t offset = 0;
+  status = element_offset(array->array_val, index, column, column_node != NULL, &offset);
+  if(status) goto out;
+
+  *out = var_array_get(array->array_val, offset);
+
+out:
+  if(array == &tmp) variable_destroy(&tmp);
+  return status;
+}
+
+// Evaluate a built in function call
+static int eval_call(Interpreter *interpreter, ASTNode *node, Variable *out) {
+  char *name = node->expr.call.name;
+  if(strcmp(name, "LENGTH") == 0) {
+    if(node->expr.call.argc != 1) {
+      PERROR("LENGTH() takes 1 argument, got %zu\n", node->expr.call.argc);
+      return ERR_INVALID_ARGS;
+    }
+
+    Variable tmp = {.type = -1};
+    Variable *arg = NULL;
+    int status = eval_ref(interpreter, node->expr.call.args[0], &tmp, &arg);
+    if(status) return status;
+    if(arg->type == VarString) {
+      *out = (Variable){.type = VarInteger, .int_val = (int)arg->string_val.length};
+    } else if(arg->type != VarArray) {
+      PERROR("LENGTH() expects an ARRAY or STRING, got %s\n", var_type_name(arg->type));
+      status = ERR_TYPE_MISMATCH;
+    } else {
+      *out = (Variable){.type = VarInteger, .int_val = (int)array_rows(arg->array_val)};
+    }
+    if(arg == &tmp) variable_destroy(&tmp);
+    return status;
+  }
+
+  // Whether a file has no records left to READ
+  if(strcmp(name, "EOF") == 0) {
+    RecordFile *file = &interpreter->files[node->expr.call.file];
+    if(!file->reader && record_file_open_reader(file) != 0) return ERR_IO;
+    *out = (Variable){.type = VarBoolean, .boolean_val = record_at_end(file->reader)};
+    return ERR_OKAY;
+  }
+
+  PERROR("Unknown function %s()\n", name);
+  return ERR_UNDECLARED;
+}
+
+// Append b to a, leaving the result in a
+// a and b are both temporaries owned by the caller. A two-dimensional array
+// can only be appended a row, or another array with the same number of
+// columns.
+static int eval_append(Variable *a, Variable *b) {
+  if(a->type == VarArray && array_make_unique(&a->array_val) != 0) return ERR_CREATE_FAIL;
+
+  // Joining strings and characters makes a STRING, appending to a in place
+  if((a->type == VarString || a->type == VarCharacter) && (b->type == VarString || b->type == VarCharacter)) {
+    if(var_coerce(a, VarString) != 0) return ERR_TYPE_MISMATCH;
+    int failed = b->type == VarString ? string_append(&a->string_val, string_data(&b->string_val), b->string_val.length) : string_append(&a->string_val, &b->character_val, 1);
+    return failed ? ERR_CREATE_FAIL : ERR_OKAY;
+  }
+
+  if(a->type == VarArray && a->array_val->stride) {
+    Array *x = a->array_val;
+    Array *y = b->type == VarArray ? b->array_val : NULL;
+    size_t y_columns = y ? (y->stride ? y->stride : y->length) : 0;
+    if(!y || y_columns != x->stride || var_array_extend(x, y) != 0) {
+      PERROR("Can only append rows of %zu elements to a two-dimensional ARRAY\n", x->stride);
+      return ERR_TYPE_MISMATCH;
+    }
+    return ERR_OKAY;
+  }
+
+  if(b->type == VarArray && b->array_val->stride) {
+    PERROR("Can't append a two-dimensional ARRAY to %s\n", var_type_name(a->type));
+    return ERR_TYPE_MISMATCH;
+  }
+
+  if(a->type == VarArray) {
+    int failed = b->type == VarArray ? var_array_extend(a->array_val, b->array_val) : var_array_push(a->array_val, b);
+    if(failed) {
+      PERROR("Failed to append %s to ARRAY\n", var_type_name(b->type));
+      return ERR_TYPE_MISMATCH;
+    }
+    return ERR_OKAY;
+  }
+
+  if(b->type == VarArray) {
+    Variable out = var_new_array(b->array_val->type, 0);
+    if(out.type == -1) return ERR_CREATE_FAIL;
+    if(var_array_push(out.array_val, a) != 0 || var_array_extend(out.array_val, b->array_val) != 0) {
+      PERROR("Failed to append ARRAY to %s\n", var_type_name(a->type));
+      variable_destroy(&out);
+      return ERR_TYPE_MISMATCH;
+    }
+    variable_destroy(a);
+    *a = out;
+    return ERR_OKAY;
+  }
+
+  PERROR("& needs an ARRAY, got %s and %s\n", var_type_name(a->type), var_type_name(b->type));
+  return ERR_TYPE_MISMATCH;
+}
+
+// Compare two values, setting *cmp to <0, 0 or >0
+// Only = and <> make sense for some types, ordered is cleared for those.
+// With equality set only whether cmp is 0 matters, which is cheaper to tell
+// for strings.
+static int compare_values(Variable *a, Variable *b, int equality, int *cmp, int *ordered) {
+  *ordered = 1;
+  if((a->type == VarInteger || a->type == VarReal) && (b->type == VarInteger || b->type == VarReal)) {
+    if(a->type == VarInteger && b->type == VarInteger) {
+      *cmp = (a->int_val > b->int_val) - (a->int_val < b->int_val);
+    } else {
+      double x = a->type == VarReal ? a->real_val : a->int_val;
+      double y = b->type == VarReal ? b->real_val : b->int_val;
+      *cmp = (x > y) - (x < y);
+    }
+    return ERR_OKAY;
+  }
+
+  // A CHARACTER is compared with a STRING as the one character STRING it
+  // would be coerced to
+  if((a->type == VarCharacter && b->type == VarString) || (a->type == VarString && b->type == VarCharacter)) {
+    Variable *ch = a->type == VarCharacter ? a : b;
+    Variable *str = a->type == VarCharacter ? b : a;
+    String s;
+    string_init(&s);
+    if(string_append(&s, &ch->character_val, 1) != 0) return ERR_CREATE_FAIL;
+    *cmp = string_compare(&s, &str->string_val);
+    if(ch == b) *cmp = -*cmp;
+    string_destroy(&s);
+    return ERR_OKAY;
+  }
+
+  if(a->type != b->type) {
+    PERROR("Can't compare %s with %s\n", var_type_name(a->type), var_type_name(b->type));
+    return ERR_TYPE_MISMATCH;
+  }
+
+  switch(a->type) {
+  case VarCharacter:
+    *cmp = (a->character_val > b->character_val) - (a->character_val < b->character_val);
+    return ERR_OKAY;
+  case VarBoolean:
+    *ordered = 0;
+    *cmp = (a->boolean_val != 0) != (b->boolean_val != 0);
+    return ERR_OKAY;
+  case VarArray: {
+    *ordered = 0;
+    *cmp = !array_equal(a->array_val, b->array_val);
+    return ERR_OKAY;
+  }
+  case VarString:
+    if(equality) *cmp = !string_equal(&a->string_val, &b->string_val);
+    else *cmp = string_compare(&a->string_val, &b->string_val);
+    return ERR_OKAY;
+  default:
+    PERROR("Can't compare %s values\n", var_type_name(a->type));
+    return ERR_TYPE_MISMATCH;
+  }
+}
+
+// Floor division and modulo, like Python's // and %
+// Dividing by -1 is done without / and %, which trap on the smallest INTEGER
+// divided by -1. Its quotient wraps around like the other arithmetic does.
+static int int_div(int a, int b) {
+  if(b == -1) return (int)(0u - (unsigned int)a);
+  int q = a / b;
+  if((a % b != 0) && ((a < 0) != (b < 0))) q--;
+  return q;
+}
+
+static int int_mod(int a, int b) {
+  if(b == -1) return 0;
+  int m = a % b;
+  if(m != 0 && ((m < 0) != (b < 0))) m += b;
+  return m;
+}
+
+// Raise an integer to a non negative integer power
+static int int_pow(int base, int exp) {
+  unsigned int result = 1;
+  unsigned int b = (unsigned int)base;
+  while(exp > 0) {
+    if(exp & 1) result *= b;
+    b *= b;
+    exp >>= 1;
+  }
+  return (int)result;
+}
+
+// Apply an arithmetic or relational operator to two values
+static int apply_op(Op op, Variable *a, Variable *b, Variable *out) {
+  switch(op) {
+  case OpEqual:
+  case OpNEqual:
+  case OpGreaterThan:
+  case OpGreaterThanEq:
+  case OpLessThan:
+  case OpLessThanEq: {
+    int cmp = 0;
+    int ordered = 0;
+    int status = compare_values(a, b, op == OpEqual || op == OpNEqual, &cmp, &ordered);
+    if(status) return status;
+    if(!ordered && op != OpEqual && op != OpNEqual) {
+      PERROR("%s values can only be compared with = and <>\n", var_type_name(a->type));
+      return ERR_TYPE_MISMATCH;
+    }
+
+    int result = 0;
+    switch(op) {
+    case OpEqual:
+      result = cmp == 0;
+      break;
+    case OpNEqual:
+      result = cmp != 0;
+      break;
+    case OpGreaterThan:
+      result = cmp > 0;
+      break;
+    case OpGreaterThanEq:
+      result = cmp >= 0;
+      break;
+    case OpLessThan:
+      result = cmp < 0;
+      break;
+    default:
+      result = cmp <= 0;
+      break;
+    }
+    *out = (Variable){.type = VarBoolean, .boolean_val = result};
+    return ERR_OKAY;
+  }
+  default:
+    break;
+  }
+
+  if((a->type != VarInteger && a->type != VarReal) || (b->type != VarInteger && b->type != VarReal)) {
+    PERROR("Arithmetic needs INTEGER or REAL values, got %s and %s\n", var_type_name(a->type), var_type_name(b->type));
+    return ERR_TYPE_MISMATCH;
+  }
+
+  // Mixed mode arithmetic is coerced to REAL, and / always gives a REAL
+  if(a->type == VarInteger && b->type == VarInteger && op != OpDivide &&
+     !(op == OpExponent && b->int_val < 0)) {
+    int x = a->int_val;
+    int y = b->int_val;
+    if((op == OpModulo || op == OpIntDiv) && y == 0) {
+      PERROR("Division by zero\n");
+      return ERR_DIV_ZERO;
+    }
+
+    int result = 0;
+    switch(op) {
+    case OpAdd:
+      result = (int)((unsigned int)x + (unsigned int)y);
+      break;
+    case OpSubtract:
+      result = (int)((unsigned int)x - (unsigned int)y);
+      break;
+    case OpMultiply:
+      result = (int)((unsigned int)x * (unsigned int)y);
+      break;
+    case OpModulo:
+      result = int_mod(x, y);
+      break;
+    case OpIntDiv:
+      result = int_div(x, y);
+      break;
+    case OpExponent:
+      result = int_pow(x, y);
+      break;
+    default:
+      PERROR("Unknown operation %d\n", op);
+      return ERR_INVALID_ARGS;
+    }
+    *out = (Variable){.type = VarInteger, .int_val = result};
+    return ERR_OKAY;
+  }
+
+  double x = a->type == VarReal ? a->real_val : a->int_val;
+  double y = b->type == VarReal ? b->real_val : b->int_val;
+  double result = 0.0;
+  switch(op) {
+  case OpAdd:
+    result = x + y;
+    break;
+  case OpSubtract:
+    result = x - y;
+    break;
+  case OpMultiply:
+    result = x * y;
+    break;
+  case OpDivide:
+    result = x / y;
+    break;
+  case OpModulo:
+    result = x - y * floor(x / y);
+    break;
+  case OpIntDiv:
+    result = floor(x / y);
+    break;
+  case OpExponent:
+    result = pow(x, y);
+    break;
+  default:
+    PERROR("Unknown operation %d\n", op);
+    return ERR_INVALID_ARGS;
+  }
+  *out = (Variable){.type = VarReal, .real_val = result};
+  return ERR_OKAY;
+}
+
+// Evaluate an operator expression
+static int eval_op(Interpreter *interpreter, ASTNode *node, Variable *out) {
+  Op op = node->expr.op.op;
+
+  // AND and OR short circuit
+  if(op == OpAnd || op == OpOr) {
+    int left = 0;
+    int status = eval_bool(interpreter, node->expr.op.left, &left);
+    if(status) return status;
+    if(left == (op == OpOr)) {
+      *out = (Variable){.type = VarBoolean, .boolean_val = left};
+      return ERR_OKAY;
+    }
+    int right = 0;
+    status = eval_bool(interpreter, node->expr.op.right, &right);
+    if(status) return status;
+    *out = (Variable){.type = VarBoolean, .boolean_val = right};
+    return ERR_OKAY;
+  }
+
+  Variable a = {.type = -1};
+  Variable b = {.type = -1};
+  int status = eval_expr(interpreter, node->expr.op.left, &a);
+  if(status) return status;
+  status = eval_expr(interpreter, node->expr.op.right, &b);
+  if(status) {
+    variable_destroy(&a);
+    return status;
+  }
+
+  if(op == OpAppend) {
+    status = eval_append(&a, &b);
+    variable_destroy(&b);
+    if(status) {
+      variable_destroy(&a);
+      return status;
+    }
+    *out = a;
+    return ERR_OKAY;
+  }
+
+  status = apply_op(op, &a, &b, out);
+  variable_destroy(&a);
+  variable_destroy(&b);
+  return status;
+}
+
+// Evaluate an expression into a new value, owned by the caller
+static int eval_expr(Interpreter *interpreter, ASTNode *node, Variable *out) {
+  if(!node || node->type != NodeExpr) {
+    PERROR("Expected an expression node.\n");
+    return ERR_MISMATCHED_NODE;
+  }
+
+  switch(node->expr.type) {
+  case ExprInt:
+    *out = (Variable){.type = VarInteger, .int_val = node->expr.int_val};
+    return ERR_OKAY;
+  case ExprReal:
+    *out = (Variable){.type = VarReal, .real_val = node->expr.real_val};
+    return ERR_OKAY;
+  case ExprBool:
+    *out = (Variable){.type = VarBoolean, .boolean_val = node->expr.bool_val};
+    return ERR_OKAY;
+  case ExprChar:
+    *out = (Variable){.type = VarCharacter, .character_val = node->expr.char_val};
+    return ERR_OKAY;
+  case ExprString:
+    *out = variable_copy(interpreter->constants[node->expr.string.id]);
+    return ERR_OKAY;
+  case ExprVar: {
+    Variable *var = interpreter_lookup(interpreter, node->expr.var_name);
+    if(!var) return ERR_UNDECLARED;
+    *out = variable_copy(*var);
+    if(out->type == -1) {
+      PERROR("Failed to copy variable \"%s\".\n", node->expr.var_name);
+      return ERR_CREATE_FAIL;
+    }
+    return ERR_OKAY;
+  }
+  case ExprOp:
+    return eval_op(interpreter, node, out);
+  case ExprArray:
+    if(node->expr.array.constant) {
+      Variable *constant = &interpreter->constants[node->expr.array.id];
+      if(constant->type == -1) {
+        int status = eval_array_lit(interpreter, node, constant);
+        if(status) return status;
+      }
+      *out = variable_copy(*constant);
+      return ERR_OKAY;
+    }
+    return eval_array_lit(interpreter, node, out);
+  case ExprIndex:
+    return eval_index(interpreter, node, out);
+  case ExprCall:
+    return eval_call(interpreter, node, out);
+  default:
+    PERROR("Unknown expression type %d\n", node->expr.type);
+    return ERR_UNKNOWN_NODE;
+  }
+}
+
+// STATEMENT EXECUTION
+// Interpret a variable declaration
+static int interpret_var_decl(Interpreter *interpreter, ASTNode *node) {
   if(!node->var_decl.id) {
     PERROR("Variable declaration node is missing an identifier!\n");
     return ERR_NODE_MISSING_COMPONENT;
   }
 
-  int decl_status = interpreter_declare(interpreter, node->var_decl.id, node->var_decl.type);
+  Variable var = {.type = -1};
+  if(node->var_decl.type == VarArray) {
+    int length = 0;
+    int columns = 0;
+    if(node->var_decl.length) {
+      int status = eval_subscript(interpreter, node->var_decl.length, node->var_decl.columns, &length, &columns);
+      if(status) return status;
+      if(length < 0 || columns < 0 || (node->var_decl.columns && columns == 0)) {
+        PERROR("Invalid array size for \"%s\"\n", node->var_decl.id);
+        return ERR_OUT_OF_BOUNDS;
+      }
+    }
+    if(node->var_decl.columns) var = var_new_array_2d(node->var_decl.elem_type, length, columns);
+    else var = var_new_array(node->var_decl.elem_type, length);
+  } else {
+    var = var_new(node->var_decl.type);
+  }
+  if(var.type == -1) {
+    PERROR("Failed to initialise variable \"%s\".\n", node->var_decl.id);
+    return ERR_CREATE_FAIL;
+  }
+
+  int decl_status = interpreter_declare(interpreter, node->var_decl.id, var, 0);
   if(decl_status) {
     PERROR("Failed to declare variable \"%s\".\n", node->var_decl.id);
+    return decl_status;
   }
 
   return ERR_OKAY;
 }
 
-// Interpret a node of the AST
-int interpret_node(Interpreter *interpreter, ASTNode *node) {
-  if(!interpreter) {
-    PERROR("NULL interpreter passed.\n");
-    return ERR_NULL_ARGS;
+// Check if an expression reads a variable
+static int expr_uses_var(ASTNode *node, char *id) {
+  if(!node) return 0;
+  switch(node->expr.type) {
+  case ExprVar:
+    return strcmp(node->expr.var_name, id) == 0;
+  case ExprOp:
+    return expr_uses_var(node->expr.op.left, id) || expr_uses_var(node->expr.op.right, id);
+  case ExprIndex:
+    return expr_uses_var(node->expr.index.array, id) || expr_uses_var(node->expr.index.index, id) ||
+           expr_uses_var(node->expr.index.column, id);
+  case ExprArray:
+    for(size_t i = 0; i < node->expr.array.count; i++)
+      if(expr_uses_var(node->expr.array.items[i], id)) return 1;
+    return 0;
+  case ExprCall:
+    for(size_t i = 0; i < node->expr.call.argc; i++)
+      if(expr_uses_var(node->expr.call.args[i], id)) return 1;
+    return 0;
+  default:
+    return 0;
   }
+}
 
-  if(!node) {
-    PERROR("NULL node passed.\n");
-    return ERR_NULL_ARGS;
+// Check if SET <id> TO <id> & ... can append to the variable in place
+// The chain of & must start with the variable itself, and nothing appended
+// can read it, or it would see the half appended value.
+static int is_self_append(ASTNode *expr, char *id) {
+  while(expr->expr.type == ExprOp && expr->expr.op.op == OpAppend) {
+    if(expr_uses_var(expr->expr.op.right, id)) return 0;
+    expr = expr->expr.op.left;
   }
+  return expr != NULL && expr->expr.type == ExprVar && strcmp(expr->expr.var_name, id) == 0;
+}
 
-  int status = 0;
-  switch(node->type) {
-  case NodeProgram:
-    status = interpret_program(interpreter, node);
+// Append the right hand sides of a chain of & to an array, left to right
+static int append_in_place(Interpreter *interpreter, Variable *target, ASTNode *expr) {
+  if(expr->expr.type != ExprOp || expr->expr.op.op != OpAppend) return ERR_OKAY;
+
+  int status = append_in_place(interpreter, target, expr->expr.op.left);
+  if(status) return status;
+
+  Variable value = {.type = -1};
+  status = eval_expr(interpreter, expr->expr.op.right, &value);
+  if(status) return status;
+  status = eval_append(target, &value);
+  variable_destroy(&value);
+  return status;
+}
+
+// Overwrite a row of a two-dimensional array: SET Array[row] TO <array>
+static int set_row(Array *array, int row, Variable *value) {
+  int status = check_row(array, row);
+  if(status) return status;
+
+  Array *src = value->type == VarArray ? value->array_val : NULL;
+  if(!src || src->stride || src->length != array->stride) {
+    PERROR("A row of this ARRAY must be an ARRAY of %zu elements\n", array->stride);
+    return ERR_TYPE_MISMATCH;
+  }
+
+  size_t start = (size_t)row * array->stride;
+  for(size_t i = 0; i < array->stride; i++) {
+    Variable elem = var_array_get(src, i);
+    int failed = var_array_set(array, start + i, &elem);
+    variable_destroy(&elem);
+    if(failed) return ERR_TYPE_MISMATCH;
+  }
+  return ERR_OKAY;
+}
+
+// Interpret a variable assignment
+static int interpret_var_assign(Interpreter *interpreter, ASTNode *node) {
+  char *id = node->var_assign.id;
+  if(!id || !node->var_assign.expr) {
+    PERROR("Variable assignment node is missing a component!\n");
+    return ERR_NODE_MISSING_COMPONENT;
+  }
+
+  // SET Array[index] TO <expression> or SET Array[row, column] TO <expression>
+  if(node->var_assign.index) {
+    Variable *target = interpreter_lookup(interpreter, id);
+    if(!target) return ERR_UNDECLARED;
+    if(target->type != VarArray) {
+      PERROR("Can't index into %s \"%s\"\n", var_type_name(target->type), id);
+      return ERR_TYPE_MISMATCH;
+    }
+
+    int index = 0;
+    int column = 0;
+    ASTNode *column_node = node->var_assign.column;
+    int status = eval_subscript(interpreter, node->var_assign.index, column_node, &index, &column);
+    if(status) return status;
+
+    Variable value = {.type = -1};
+    status = eval_expr(interpreter, node->var_assign.expr, &value);
+    if(status) return status;
+
+    // The value's expression may have changed the array, so check bounds last
+    if(array_make_unique(&target->array_val) != 0) {
+      variable_destroy(&value);
+      return ERR_CREATE_FAIL;
+    }
+    Array *array = target->array_val;
+    if(array->stride && !column_node) {
+      status = set_row(array, index, &value);
+    } else {
+      size_t offset = 0;
+      status = element_offset(array, index, column, column_node != NULL, &offset);
+      if(!status && var_array_set(array, offset, &value) != 0) status = ERR_TYPE_MISMATCH;
+    }
+    variable_destroy(&value);
+    return status;
+  }
+
+  Variable *target = state_lookup(interpreter->state_cur, id);
+
+  // SET Array TO Array & ... and SET String TO String & ... grow the value in
+  // place
+  if(target && (target->type == VarArray || target->type == VarString) && is_self_append(node->var_assign.expr, id)) {
+    return append_in_place(interpreter, target, node->var_assign.expr);
+  }
+
+  Variable value = {.type = -1};
+  int status = eval_expr(interpreter, node->var_assign.expr, &value);
+  if(status) return status;
+
+  // Assigning to an undeclared variable declares it
+  if(!target) return interpreter_declare(interpreter, id, value, 1);
+
+  // The value is a temporary, so it's moved rather than copied
+  status = var_move(target, &value) ? ERR_TYPE_MISMATCH : ERR_OKAY;
+  if(status) PERROR("Failed to assign to \"%s\".\n", id);
+  return status;
+}
+
+// Interpret a SEND statement
+static int interpret_send(Interpreter *interpreter, ASTNode *node) {
+  Device *device = &interpreter->devices[node->send_stmt.device];
+  if(!device->writer) {
+    if(device_open_writer(device, interpreter->config.unbuffered) != 0) return ERR_DEVICE;
+    device->writer->budget = &interpreter->output_budget;
+  }
+
+  Variable value = {.type = -1};
+  int status = eval_expr(interpreter, node->send_stmt.expr, &value);
+  if(status) return status;
+  var_print(device->writer, &value);
+  variable_destroy(&value);
+  // A write that failed while the line was buffered is caught here too
+  if(output_end_line(device->writer) != 0 || device->writer->failed) {
+    PERROR("Failed to write to %s.\n", device->name);
+    return ERR_IO;
+  }
+  return ERR_OKAY;
+}
+
+// Look up a variable, declaring it if needed, and move a value into it
+// Used for loop variables and RECEIVE.
+static int set_loop_var(Interpreter *interpreter, char *id, Variable *value, Variable **out) {
+  Variable *var = state_lookup(interpreter->state_cur, id);
+  if(!var) {
+    int status = interpreter_declare(interpreter, id, *value, 1);
+    value->type = -1;
+    if(status) return status;
+    var = state_lookup(interpreter->state_cur, id);
+  } else if(var_move(var, value) != 0) {
+    PERROR("Failed to set loop variable \"%s\".\n", id);
+    return ERR_TYPE_MISMATCH;
+  }
+  *out = var;
+  return ERR_OKAY;
+}
+
+// Log everything a device reads in the device log being recorded
+static int record_reads(Interpreter *interpreter, Device *device) {
+  if(iolog_add_device(interpreter->log, device->name, &device->reader->log_slot) != 0) return ERR_IO;
+  device->reader->log = interpreter->log;
+  return ERR_OKAY;
+}
+
+// Open a device for reading
+// With --replay everything the device reads comes from the device log rather
+// than its file, so it doesn't have to be bound.
+static int open_reader(Interpreter *interpreter, Device *device) {
+  IoLog *log = interpreter->log;
+  if(!log || !log->replaying) {
+    if(device_open_reader(device, interpreter->display) != 0) return ERR_DEVICE;
+    return log ? record_reads(interpreter, device) : ERR_OKAY;
+  }
+
+  char *data;
+  size_t size;
+  if(iolog_device_data(log, device->name, &data, &size) != 0) return ERR_DEVICE;
+  device->reader = input_create_buffer(data, size);
+  if(!device->reader) {
+    PERROR("input_create_buffer() failed.\n");
+    free(data);
+    return ERR_CREATE_FAIL;
+  }
+  device->owns_reader = 1;
+  return ERR_OKAY;
+}
+
+// Interpret a receive statement
+// The variable is declared if needed, like SET does.
+static int interpret_receive(Interpreter *interpreter, ASTNode *node) {
+  Device *device = &interpreter->devices[node->receive_stmt.device];
+  if(!device->reader) {
+    int status = open_reader(interpreter, device);
+    if(status) return status;
+  }
+
+  Input *in = device->reader;
+  Variable value = var_new(node->receive_stmt.type);
+  int status = INPUT_OKAY;
+  switch(node->receive_stmt.type) {
+  case VarInteger:
+    status = input_int(in, &value.int_val);
     break;
-  case NodeBlock:
-    status = interpret_block(interpreter, node);
+  case VarReal:
+    status = input_real(in, &value.real_val);
     break;
-  case NodeVarDecl:
-    status = interpret_var_decl(interpreter, node);
+  case VarBoolean:
+    status = input_bool(in, &value.boolean_val);
+    break;
+  case VarCharacter:
+    status = input_char(in, &value.character_val);
+    break;
+  case VarString:
+    status = input_line(in, &value.string_val);
+    break;
+  default:
+    PERROR("Can't receive %s values\n", var_type_name(node->receive_stmt.type));
+    status = INPUT_FAIL;
+    break;
+  }
+  if(status == INPUT_WAIT) {
+    variable_destroy(&value);
+    interpreter->waiting = node->receive_stmt.device;
+    return ERR_WAIT;
+  }
+  if(status) {
+    variable_destroy(&value);
+    PERROR("Failed to receive \"%s\" from %s.\n", node->receive_stmt.id, device->name);
+    return status == INPUT_FAIL ? ERR_IO : ERR_INPUT;
+  }
+
+  Variable *var = NULL;
+  status = set_loop_var(interpreter, node->receive_stmt.id, &value, &var);
+  variable_destroy(&value);
+  return status;
+}
+
+// Convert a field of a record to a value of a type
+// Returns one of the INPUT_* codes.
+static int field_value(RecordField *field, VarType type, Variable *out) {
+  *out = var_new(type);
+  int status = INPUT_OKAY;
+  switch(type) {
+  case VarInteger:
+    status = input_parse_int(field->data, field->length, &out->int_val);
+    break;
+  case VarReal:
+    status = input_parse_real(field->data, field->length, &out->real_val);
+    break;
+  case VarBoolean:
+    status = input_parse_bool(field->data, field->length, &out->boolean_val);
+    break;
+  case VarCharacter:
+    if(field->length == 1) out->character_val = field->data[0];
+    else status = INPUT_MALFORMED;
+    break;
+  case VarString:
+    if(string_set(&out->string_val, field->data, field->length) != 0) status = INPUT_FAIL;
     break;
+  default:
+    status = INPUT_MALFORMED;
+    break;
+  }
+  if(status) variable_destroy(out);
+  return status;
+}
+
+// Report a field that can't be converted to a type
+static int bad_field(RecordFile *file, size_t index, VarType type, int status) {
+  if(status == INPUT_FAIL) return ERR_IO;
+  RecordField *field = &file->reader->fields[index];
+  int length = (int)(field->length > 40 ? 40 : field->length);
+  PERROR("%s line %zu: field %zu isn't %s %s: \"%.*s%s\"\n", file->path, file->reader->line, index + 1, type == VarInteger ? "an" : "a", var_type_name(type), length, field->data, field->length > 40 ? "..." : "");
+  return ERR_INPUT;
+}
+
+// Read every field of a record into an ARRAY variable
+// The elements are converted to the array's element type. The record replaces
+// the array's contents, so it can have any number of fields.
+static int read_array(RecordFile *file, Variable *target) {
+  if(target->array_val->stride) {
+    PERROR("Can't READ a record into a two-dimensional ARRAY\n");
+    return ERR_TYPE_MISMATCH;
+  }
+
+  RecordReader *reader = file->reader;
+  VarType type = target->array_val->type == -1 ? VarString : target->array_val->type;
+  Variable array = var_new_array(type, reader->field_count);
+  if(array.type == -1) return ERR_CREATE_FAIL;
+  for(size_t f = 0; f < reader->field_count; f++) {
+    Variable value;
+    int status = field_value(&reader->fields[f], type, &value);
+    if(status) {
+      variable_destroy(&array);
+      return bad_field(file, f, type, status);
+    }
+    status = var_array_set(array.array_val, f, &value);
+    variable_destroy(&value);
+    if(status) {
+      variable_destroy(&array);
+      return ERR_TYPE_MISMATCH;
+    }
+  }
+  return var_move(target, &array) ? ERR_TYPE_MISMATCH : ERR_OKAY;
+}
+
+// Interpret a READ statement
+// Each field of the next record goes into a variable, converted to the
+// variable's type. Variables that don't exist yet are declared as STRINGs,
+// like SET would. A single ARRAY variable gets all of the record's fields.
+static int interpret_read(Interpreter *interpreter, ASTNode *node) {
+  RecordFile *file = &interpreter->files[node->read_stmt.file];
+  if(!file->reader && record_file_open_reader(file) != 0) return ERR_IO;
+
+  int status = record_next(file->reader);
+  if(status == RECORD_EOF) {
+    PERROR("%s has no more records to READ.\n", file->path);
+    return ERR_INPUT;
+  }
+  if(status) return ERR_IO;
+
+  char **ids = node->read_stmt.ids;
+  size_t count = node->read_stmt.count;
+  if(count == 1) {
+    Variable *target = state_lookup(interpreter->state_cur, ids[0]);
+    if(target && target->type == VarArray) return read_array(file, target);
+  }
+  if(file->reader->field_count != count) {
+    PERROR("%s line %zu: expected %zu fields, got %zu\n", file->path, file->reader->line, count, file->reader->field_count);
+    return ERR_INPUT;
+  }
+
+  for(size_t f = 0; f < count; f++) {
+    Variable *target = state_lookup(interpreter->state_cur, ids[f]);
+    VarType type = target ? target->type : VarString;
+    Variable value;
+    status = field_value(&file->reader->fields[f], type, &value);
+    if(status) return bad_field(file, f, type, status);
+
+    if(target) status = var_move(target, &value) ? ERR_TYPE_MISMATCH : ERR_OKAY;
+    else status = set_loop_var(interpreter, ids[f], &value, &target);
+    variable_destroy(&value);
+    if(status) return status;
+  }
+  return ERR_OKAY;
+}
+
+// Write a value as a field of a record
+// Text can't contain the delimiter or a line break, since it would be read
+// back as more than one field or record.
+static int write_field(Output *out, Variable *value, size_t *fields) {
+  const char *text = NULL;
+  size_t length = 0;
+  if(value->type == VarString) {
+    text = string_data(&value->string_val);
+    length = value->string_val.length;
+  } else if(value->type == VarCharacter) {
+    text = &value->character_val;
+    length = 1;
+  }
+  for(size_t c = 0; c < length; c++) {
+    if(text[c] == RECORD_DELIMITER || text[c] == '\n' || text[c] == '\r') {
+      PERROR("Can't WRITE a field containing '%c' or a line break\n", RECORD_DELIMITER);
+      return ERR_INVALID_ARGS;
+    }
+  }
+
+  if((*fields)++ > 0) output_putc(out, RECORD_DELIMITER);
+  var_print(out, value);
+  return ERR_OKAY;
+}
+
+// Interpret a WRITE statement
+// Each expression is a field of the record, and an ARRAY is written as a
+// field per element.
+static int interpret_write(Interpreter *interpreter, ASTNode *node) {
+  RecordFile *file = &interpreter->files[node->write_stmt.file];
+  if(!file->writer && record_file_open_writer(file) != 0) return ERR_IO;
+
+  size_t fields = 0;
+  for(size_t i = 0; i < node->write_stmt.count; i++) {
+    Variable value = {.type = -1};
+    int status = eval_expr(interpreter, node->write_stmt.items[i], &value);
+    if(status) return status;
+
+    if(value.type != VarArray) status = write_field(file->writer, &value, &fields);
+    else if(value.array_val->stride) {
+      PERROR("Can't WRITE a two-dimensional ARRAY\n");
+      status = ERR_TYPE_MISMATCH;
+    } else {
+      for(size_t e = 0; !status && e < value.array_val->length; e++) {
+        Variable elem = var_array_get(value.array_val, e);
+        status = write_field(file->writer, &elem, &fields);
+        variable_destroy(&elem);
+      }
+    }
+    variable_destroy(&value);
+    if(status) return status;
+  }
+
+  if(output_end_line(file->writer) != 0) {
+    PERROR("Failed to write to %s.\n", file->path);
+    return ERR_IO;
+  }
+  return ERR_OKAY;
+}
+
+// Start executing a block: push a scope and a frame for its statements
+static int exec_push_block(Interpreter *interpreter, ASTNode *block) {
+  if(!block || block->type != NodeBlock || !block->block.statements) {
+    PERROR("Block node is missing statements!\n");
+    return ERR_NODE_MISSING_COMPONENT;
+  }
+
+  // Push a new scope for the block
+  int push_status = interpreter_push_scope(interpreter);
+  if(push_status) {
+    PERROR("Failed to push a new scope for the block.\n");
+    return push_status;
+  }
+
+  if(!state_push_exec(interpreter->state_cur, block)) return ERR_CREATE_FAIL;
+  return ERR_OKAY;
+}
+
+// Run FOR i FROM a TO b DO SET Array[i] TO <literal> END FOR as a single fill
+// of the array, which packed BOOLEAN arrays do a word at a time. Returns 1 if
+// the loop was run, 0 if it isn't of that form and must be run normally.
+static int fill_loop(Interpreter *interpreter, ASTNode *node, Variable *from, Variable *to, Variable *step) {
+  ASTNode *block = node->for_stmt.for_block;
+  // --profile counts and times the body's line, which a fill would skip
+  if(interpreter->config.profile) return 0;
+  if(from->type != VarInteger || step->int_val != 1 || from->int_val > to->int_val) return 0;
+  if(!block || block->block.count != 1) return 0;
+
+  ASTNode *stmt = block->block.statements[0];
+  if(stmt->type != NodeVarAssign || !stmt->var_assign.index || stmt->var_assign.column) return 0;
+  ASTNode *index = stmt->var_assign.index;
+  ASTNode *expr = stmt->var_assign.expr;
+  if(index->expr.type != ExprVar || strcmp(index->expr.var_name, node->for_stmt.id) != 0) return 0;
+  if(expr->expr.type != ExprInt && expr->expr.type != ExprReal && expr->expr.type != ExprBool && expr->expr.type != ExprChar) return 0;
+  if(strcmp(stmt->var_assign.id, node->for_stmt.id) == 0) return 0;
+
+  // Anything that would fail part way through is left to the normal loop to
+  // report
+  Variable *target = state_lookup(interpreter->state_cur, stmt->var_assign.id);
+  if(!target || target->type != VarArray || target->array_val->stride) return 0;
+  if(from->int_val < 0 || (size_t)to->int_val >= target->array_val->length) return 0;
+
+  // The types are checked without var_coerce() reporting a mismatch
+  Variable value = {.type = -1};
+  if(eval_expr(interpreter, expr, &value) != 0) return 0;
+  if(!var_can_coerce(value.type, target->array_val->type) || var_coerce(&value, target->array_val->type) != 0) {
+    variable_destroy(&value);
+    return 0;
+  }
+
+  size_t count = (size_t)to->int_val - (size_t)from->int_val + 1;
+  int filled = array_make_unique(&target->array_val) == 0 &&
+               var_array_fill(target->array_val, (size_t)from->int_val, count, &value) == 0;
+  variable_destroy(&value);
+  return filled;
+}
+
+// Start a FOR loop
+static int exec_push_for(Interpreter *interpreter, ASTNode *node) {
+  Variable from = {.type = -1};
+  Variable to = {.type = -1};
+  Variable step = {.type = VarInteger, .int_val = 1};
+  int status = eval_expr(interpreter, node->for_stmt.from, &from);
+  if(!status) status = eval_expr(interpreter, node->for_stmt.to, &to);
+  if(!status && node->for_stmt.step) status = eval_expr(interpreter, node->for_stmt.step, &step);
+  if(status) goto out;
+
+  // Loop in REAL if any of the bounds are REAL
+  VarType type = VarInteger;
+  if(from.type == VarReal || to.type == VarReal || step.type == VarReal) type = VarReal;
+  if(var_coerce(&from, type) || var_coerce(&to, type) || var_coerce(&step, type)) {
+    PERROR("FOR loop bounds must be INTEGER or REAL\n");
+    status = ERR_TYPE_MISMATCH;
+    goto out;
+  }
+  if(type == VarInteger ? step.int_val == 0 : step.real_val == 0.f) {
+    PERROR("FOR loop step can't be 0\n");
+    status = ERR_INVALID_ARGS;
+    goto out;
+  }
+
+  Variable *counter = NULL;
+  if(fill_loop(interpreter, node, &from, &to, &step)) {
+    // Leave the loop variable where the loop would have
+    Variable end = {.type = VarInteger, .int_val = to.int_val + 1};
+    status = set_loop_var(interpreter, node->for_stmt.id, &end, &counter);
+    goto out;
+  }
+
+  status = set_loop_var(interpreter, node->for_stmt.id, &from, &counter);
+  if(status) goto out;
+
+  ExecFrame *frame = state_push_exec(interpreter->state_cur, node);
+  if(!frame) {
+    status = ERR_CREATE_FAIL;
+    goto out;
+  }
+  frame->counter = counter;
+  frame->items = to;
+  frame->step = step;
+  return ERR_OKAY;
+
+out:
+  variable_destroy(&from);
+  variable_destroy(&to);
+  variable_destroy(&step);
+  return status;
+}
+
+// Start a FOR EACH loop
+// The loop walks the array as it was when the loop started, so it runs once
+// per element however the body changes the variable. That costs a reference
+// rather than a copy: the array is shared, and changing the variable inside
+// the loop copies it instead. A loop over a row, FOR EACH x FROM Array[row],
+// walks just that part of the two-dimensional array.
+static int exec_push_for_each(Interpreter *interpreter, ASTNode *node) {
+  ASTNode *expr = node->for_each.array;
+  ASTNode *row_node = NULL;
+  if(expr->type == NodeExpr && expr->expr.type == ExprIndex && !expr->expr.index.column) {
+    row_node = expr->expr.index.index;
+    expr = expr->expr.index.array;
+  }
+
+  Variable tmp = {.type = -1};
+  Variable *array = NULL;
+  int status = eval_ref(interpreter, expr, &tmp, &array);
+  if(status) return status;
+  if(array->type != VarArray || (row_node && !array->array_val->stride)) {
+    PERROR("FOR EACH needs an ARRAY, got %s\n", row_node && array->type == VarArray ? "an element of one" : var_type_name(array->type));
+    variable_destroy(&tmp);
+    return ERR_TYPE_MISMATCH;
+  }
+
+  int row = 0;
+  if(row_node) {
+    status = eval_int(interpreter, row_node, &row);
+    if(!status) status = check_row(array->array_val, row);
+    if(status) {
+      variable_destroy(&tmp);
+      return status;
+    }
+  }
+
+  ExecFrame *frame = state_push_exec(interpreter->state_cur, node);
+  if(!frame) {
+    variable_destroy(&tmp);
+    return ERR_CREATE_FAIL;
+  }
+  frame->items = array == &tmp ? tmp : (Variable){.type = VarArray, .array_val = array_share(array->array_val)};
+  if(row_node) {
+    frame->index = (size_t)row * array->array_val->stride;
+    frame->end = frame->index + array->array_val->stride;
+  }
+  return ERR_OKAY;
+}
+
+// Start executing a statement
+// Simple statements run straight away, statements with blocks push a frame.
+static int exec_statement(Interpreter *interpreter, ASTNode *node) {
+  switch(node->type) {
+  case NodeVarDecl:
+    return interpret_var_decl(interpreter, node);
+  case NodeVarAssign:
+    return interpret_var_assign(interpreter, node);
+  case NodeSend:
+    return interpret_send(interpreter, node);
+  case NodeReceive:
+    return interpret_receive(interpreter, node);
+  case NodeRead:
+    return interpret_read(interpreter, node);
+  case NodeWrite:
+    return interpret_write(interpreter, node);
+  case NodeIf: {
+    int cond = 0;
+    int status = eval_bool(interpreter, node->if_stmt.condition, &cond);
+    if(status) {
+      PERROR("Failed to evaluate IF condition.\n");
+      return status;
+    }
+    ASTNode *block = cond ? node->if_stmt.if_block : node->if_stmt.else_block;
+    return block ? exec_push_block(interpreter, block) : ERR_OKAY;
+  }
+  case NodeWhile:
+    return state_push_exec(interpreter->state_cur, node) ? ERR_OKAY : ERR_CREATE_FAIL;
+  case NodeFor:
+    return exec_push_for(interpreter, node);
+  case NodeForEach:
+    return exec_push_for_each(interpreter, node);
   default:
     PERROR("Unknown node type %d\n", node->type);
     return ERR_UNKNOWN_NODE;
   }
+}
+
+// Run one step of the statement on top of the execution stack
+static int exec_step(Interpreter *interpreter) {
+  State *state = interpreter->state_cur;
+  ExecFrame *frame = &state->exec[state->exec_count - 1];
+  ASTNode *node = frame->node;
+
+  switch(node->type) {
+  case NodeBlock: {
+    if(frame->index >= node->block.count) {
+      state_pop_exec(state);
+      return state_pop_scope(state);
+    }
+    ASTNode *statement = node->block.statements[frame->index++];
+    int status = exec_statement(interpreter, statement);
+    // A RECEIVE that has to wait for input starts again once it's been fed
+    if(status == ERR_WAIT) frame->index--;
+    else if(status) PERROR("Failed to interpret statement index %zu.\n", frame->index - 1);
+    return status;
+  }
+
+  case NodeWhile: {
+    int cond = 0;
+    int status = eval_bool(interpreter, node->while_stmt.condition, &cond);
+    if(status) {
+      PERROR("Failed to evaluate WHILE condition.\n");
+      return status;
+    }
+    if(!cond) {
+      state_pop_exec(state);
+      return ERR_OKAY;
+    }
+    return exec_push_block(interpreter, node->while_stmt.while_block);
+  }
+
+  case NodeFor: {
+    Variable *counter = frame->counter;
+    if(counter->type != frame->step.type) {
+      PERROR("FOR loop variable \"%s\" changed type\n", node->for_stmt.id);
+      return ERR_TYPE_MISMATCH;
+    }
+
+    int done = 0;
+    if(counter->type == VarInteger) {
+      if(frame->index) counter->int_val += frame->step.int_val;
+      done = frame->step.int_val > 0 ? counter->int_val > frame->items.int_val : counter->int_val < frame->items.int_val;
+    } else {
+      if(frame->index) counter->real_val += frame->step.real_val;
+      done = frame->step.real_val > 0 ? counter->real_val > frame->items.real_val : counter->real_val < frame->items.real_val;
+    }
+    frame->index = 1;
+
+    if(done) {
+      state_pop_exec(state);
+      return ERR_OKAY;
+    }
+    return exec_push_block(interpreter, node->for_stmt.for_block);
+  }
+
+  case NodeForEach: {
+    Array *array = frame->items.array_val;
+    size_t end = frame->end ? frame->end : array_rows(array);
+    if(frame->index >= end) {
+      state_pop_exec(state);
+      return ERR_OKAY;
+    }
+
+    // Walking a whole two-dimensional array gives a copy of each row
+    Variable elem = {.type = -1};
+    if(array->stride && !frame->end) {
+      elem.array_val = array_row(array, frame->index++);
+      if(!elem.array_val) return ERR_CREATE_FAIL;
+      elem.type = VarArray;
+    } else {
+      elem = var_array_get(array, frame->index++);
+    }
+
+    Variable *counter = NULL;
+    int status = set_loop_var(interpreter, node->for_each.id, &elem, &counter);
+    variable_destroy(&elem);
+    if(status) return status;
+    return exec_push_block(interpreter, node->for_each.for_block);
+  }
+
+  default:
+    PERROR("Unknown node type %d on the execution stack\n", node->type);
+    return ERR_UNKNOWN_NODE;
+  }
+}
+
+// Run one step of the statement on top of the execution stack, profiling it
+// A statement that starts in a block is counted, and timed until the next
+// step starts, as is each test of a WHILE loop. Ending a block and stepping
+// a FOR or FOR EACH loop take next to no time, so the clock isn't read for
+// them and they're timed with the step before. A frame the step pushes
+// belongs to the statement that pushed it.
+static int exec_step_profiled(Interpreter *interpreter) {
+  Profile *profile = interpreter->config.profile;
+  State *state = interpreter->state_cur;
+  ExecFrame *frame = &state->exec[state->exec_count - 1];
+  ASTNode *node = frame->node;
+  size_t path = frame->profile;
+  ASTNode *statement = NULL;
+  if(node->type == NodeBlock && frame->index < node->block.count) {
+    statement = node->block.statements[frame->index];
+    path = profile_enter(profile, path, statement->line_no);
+    profile_switch(profile, path);
+  } else if(node->type != NodeBlock) {
+    profile->paths[path].count++;
+    if(node->type == NodeWhile) profile_switch(profile, path);
+  }
 
+  size_t depth = state->exec_count;
+  int status = exec_step(interpreter);
+  if(state->exec_count > depth) state->exec[state->exec_count - 1].profile = path;
+  // A loop is counted each time it's tested rather than when it starts,
+  // unless it finished without being pushed
+  if(statement && state->exec_count > depth && (statement->type == NodeWhile || statement->type == NodeFor || statement->type == NodeForEach)) profile->paths[path].count--;
+  // A RECEIVE that waits runs again, so it doesn't count yet
+  if(statement && status == ERR_WAIT) profile->paths[path].count--;
   return status;
 }
 
-// Interpret a program
-Interpreter *interpret(Parser *parser) {
+// Run up to steps steps of the program, or until it finishes or fails
+// Steps are counted against max_steps, and running out of them or going over
+// max_heap or max_output stops the program with a limit error.
+static int exec_run(Interpreter *interpreter, size_t steps) {
+  size_t max = interpreter->config.max_steps;
+  size_t left = max ? max - interpreter->steps : SIZE_MAX;
+  size_t budget = steps < left ? steps : left;
+  size_t taken = 0;
+  int status = ERR_OKAY;
+  Profile *profile = interpreter->config.profile;
+  while(!status && taken < budget && interpreter->state_cur->exec_count > 0) {
+    status = profile ? exec_step_profiled(interpreter) : exec_step(interpreter);
+    taken++;
+  }
+  if(profile) profile_stop(profile);
+  // A RECEIVE that waits runs again, so it doesn't count yet
+  if(status == ERR_WAIT) taken--;
+  interpreter->steps += taken;
+
+  if(!status && taken == left && interpreter->state_cur->exec_count > 0) status = ERR_STEP_LIMIT;
+  if(status && interpreter->pool->over_limit) status = ERR_HEAP_LIMIT;
+  if(status && interpreter->output_budget.over_limit) status = ERR_OUTPUT_LIMIT;
+  return status;
+}
+
+// Report a program that was stopped by one of its limits
+static void interpreter_print_limit(Interpreter *interpreter, int status) {
+  InterpreterConfig *config = &interpreter->config;
+  FILE *out = DIAG_OUT;
+  const char *limit = status == ERR_STEP_LIMIT ? "step" : status == ERR_HEAP_LIMIT ? "heap" : "output";
+  fprintf(out, "Stopped by the %s limit:\n", limit);
+  fprintf(out, "  steps: %zu", interpreter->steps);
+  if(config->max_steps) fprintf(out, " of %zu", config->max_steps);
+  fprintf(out, "\n  heap: %zu bytes peak", interpreter->pool->peak_block_bytes);
+  if(config->max_heap) fprintf(out, " of %zu", config->max_heap);
+  fprintf(out, "\n  output: %zu bytes", interpreter->output_budget.written);
+  if(config->max_output) fprintf(out, " of %zu", config->max_output);
+  fprintf(out, "\n");
+}
+
+// Set up the constant pool of a program
+// Strings are interned up front. Arrays are built the first time they're
+// evaluated, so a bad literal that never runs isn't reported. Evaluating a
+// constant after that only shares it, and comparing against a string constant
+// is a pointer compare when the other side is interned too.
+static int interpreter_load_constants(Interpreter *interpreter, Parser *parser) {
+  interpreter->strings = string_table_create();
+  if(!interpreter->strings) {
+    PERROR("string_table_create() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+  size_t count = parser->constant_count;
+  if(count == 0) return ERR_OKAY;
+
+  interpreter->constants = pool_alloc(sizeof(Variable) * count);
+  if(!interpreter->constants) {
+    PERROR("pool_alloc() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+  for(size_t i = 0; i < count; i++) interpreter->constants[i] = (Variable){.type = -1};
+  interpreter->constant_count = count;
+
+  for(size_t i = 0; i < count; i++) {
+    ASTNode *node = parser->constants[i];
+    if(node->expr.type != ExprString) continue;
+
+    Variable *constant = &interpreter->constants[i];
+    *constant = var_new(VarString);
+    if(string_set(&constant->string_val, node->expr.string.data, node->expr.string.length) != 0 || string_intern(interpreter->strings, &constant->string_val) != 0) {
+      PERROR("Failed to intern a string literal.\n");
+      return ERR_CREATE_FAIL;
+    }
+  }
+  return ERR_OKAY;
+}
+
+// Set up the program's devices from its device table
+// DISPLAY and KEYBOARD default to standard output and input, and every other
+// device the program uses has to be bound to a path before it starts, unless
+// it's only read from and its reads are being replayed from a device log or
+// fed to it.
+static int interpreter_bind_devices(Interpreter *interpreter, Parser *parser) {
+  size_t count = parser->device_count;
+  interpreter->devices = pool_calloc(sizeof(Device) * count);
+  if(!interpreter->devices) {
+    PERROR("pool_calloc() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+  interpreter->device_count = count;
+
+  InterpreterConfig *config = &interpreter->config;
+  int replaying = interpreter->log && interpreter->log->replaying;
+  int status = ERR_OKAY;
+  for(size_t d = 0; d < count; d++) {
+    Device *device = &interpreter->devices[d];
+    DeviceUse *use = &parser->devices[d];
+    device->name = use->name;
+    device->path = device_binding_find(config->bindings, config->binding_count, use->name);
+    if(device->path) continue;
+
+    if(d == DEVICE_DISPLAY) device->writer = interpreter->display;
+    if(d == DEVICE_KEYBOARD && !replaying) device->reader = interpreter->keyboard;
+    if(use->reads && !device->reader && !replaying && interpreter->fed) {
+      device->reader = input_create(-1, interpreter->display);
+      if(!device->reader) {
+        PERROR("input_create() failed.\n");
+        return ERR_CREATE_FAIL;
+      }
+      device->owns_reader = 1;
+    }
+    if((use->reads && !device->reader && !replaying) || (use->writes && !device->writer)) {
+      PERROR("Device %s isn't bound to anything, use --device %s=<path>\n", use->name, use->name);
+      status = ERR_DEVICE;
+    }
+  }
+
+  // Standard input is logged like any other device
+  Device *keyboard = &interpreter->devices[DEVICE_KEYBOARD];
+  if(!status && interpreter->log && !replaying && !keyboard->path && parser->devices[DEVICE_KEYBOARD].reads) {
+    status = record_reads(interpreter, keyboard);
+  }
+  return status;
+}
+
+// Set up the files the program READs and WRITEs
+static int interpreter_bind_files(Interpreter *interpreter, Parser *parser) {
+  size_t count = parser->file_count;
+  if(count == 0) return ERR_OKAY;
+  if(interpreter->config.no_files) {
+    PERROR("The program READs or WRITEs %s, but isn't allowed to use files.\n", parser->files[0].path);
+    return ERR_IO;
+  }
+
+  interpreter->files = pool_calloc(sizeof(RecordFile) * count);
+  if(!interpreter->files) {
+    PERROR("pool_calloc() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+  interpreter->file_count = count;
+  for(size_t f = 0; f < count; f++) interpreter->files[f].path = parser->files[f].path;
+  return ERR_OKAY;
+}
+
+// Create an interpreter and get a program ready to run
+// If status_out isn't NULL it gets ERR_OKAY, or the error setting up failed
+// with.
+static Interpreter *interpreter_setup(Parser *parser, InterpreterConfig *config, int display_fd, int fed, int *status_out) {
+  if(status_out) *status_out = ERR_NULL_ARGS;
   if(!parser) {
     PERROR("NULL parser passed.\n");
     return NULL;
   }
 
-  Interpreter *interpreter = interpreter_create();
+  if(status_out) *status_out = ERR_CREATE_FAIL;
+  Interpreter *interpreter = interpreter_create(config, display_fd, fed);
   if(!interpreter) {
     PERROR("interpreter_create() failed.\n");
     return NULL;
   }
 
-  int status = interpret_node(interpreter, parser->root);
+  ASTNode *root = parser->root;
+  if(!root || root->type != NodeProgram) {
+    PERROR("Expected a program node.\n");
+    if(status_out) *status_out = ERR_MISMATCHED_NODE;
+    interpreter_destroy(&interpreter);
+    return NULL;
+  }
+
+  Pool *prev = pool_set_current(interpreter->pool);
+  int status = interpreter_load_constants(interpreter, parser);
+  if(!status) status = interpreter_bind_devices(interpreter, parser);
+  if(!status) status = interpreter_bind_files(interpreter, parser);
+  if(!status) status = exec_push_block(interpreter, root->program.block);
+  pool_set_current(prev);
+  if(status_out) *status_out = status;
+  if(status) {
+    PERROR("Failed to set up the program: status %d\n", status);
+    interpreter_destroy(&interpreter);
+    return NULL;
+  }
+  return interpreter;
+}
+
+// Write out everything a program has left buffered once it's stopped
+// Returns status, or ERR_IO if that was ERR_OKAY and something couldn't be
+// written.
+static int interpreter_finish(Interpreter *interpreter, int status) {
+  if(output_flush(interpreter->display) != 0 && !status) status = ERR_IO;
+  for(size_t d = 0; d < interpreter->device_count; d++) {
+    if(interpreter->devices[d].path && device_flush(&interpreter->devices[d]) != 0 && !status) status = ERR_IO;
+  }
+  if(status == ERR_IO && interpreter->output_budget.over_limit) status = ERR_OUTPUT_LIMIT;
+  for(size_t f = 0; f < interpreter->file_count; f++) {
+    if(record_file_flush(&interpreter->files[f]) != 0 && !status) status = ERR_IO;
+  }
+  if(interpreter->log && interpreter->log->out && output_flush(interpreter->log->out) != 0 && !status) {
+    PERROR("Failed to write the device log.\n");
+    status = ERR_IO;
+  }
+  if(status >= ERR_STEP_LIMIT && status <= ERR_OUTPUT_LIMIT) interpreter_print_limit(interpreter, status);
+  return status;
+}
+
+// Get a program ready to run with interpreter_execute()
+// DISPLAY and KEYBOARD are whatever standard output and input are when it
+// runs, so they can be pointed somewhere else in between.
+Interpreter *interpreter_prepare(Parser *parser, InterpreterConfig *config) {
+  return interpreter_setup(parser, config, STDOUT_FILENO, 0, NULL);
+}
+
+// Run a prepared program to the end
+// Returns ERR_OKAY, or the error the program stopped with.
+int interpreter_execute(Interpreter *interpreter) {
+  Pool *prev = pool_set_current(interpreter->pool);
+  int status = exec_run(interpreter, SIZE_MAX);
+  pool_set_current(prev);
+
+  // The program has finished, so anything it displayed, sent or wrote is due
+  return interpreter_finish(interpreter, status);
+}
+
+// Interpret a program
+// If status_out isn't NULL it gets ERR_OKAY, or the error the program stopped
+// with.
+Interpreter *interpret(Parser *parser, InterpreterConfig *config, int *status_out) {
+  Interpreter *interpreter = interpreter_setup(parser, config, STDOUT_FILENO, 0, status_out);
+  if(!interpreter) return NULL;
+
+  int status = interpreter_execute(interpreter);
+  if(status_out) *status_out = status;
   if(status != 0) {
     PERROR("Failed to interpret: status %d\n", status);
     interpreter_destroy(&interpreter);
@@ -475,3 +2157,62 @@ Interpreter *interpret(Parser *parser) {
 
   return interpreter;
 }
+
+// Get a program ready to be run a few steps at a time with interpreter_run()
+// Rather than blocking, RECEIVE suspends the program when a device it reads
+// from runs out of input. KEYBOARD and any other unbound device it reads from
+// are fed their input with interpreter_feed(). DISPLAY writes to display_fd.
+// The program's nodes are used as it runs, so parser has to outlive it.
+Interpreter *interpreter_start(Parser *parser, InterpreterConfig *config, int display_fd, int *status_out) {
+  return interpreter_setup(parser, config, display_fd, 1, status_out);
+}
+
+// Give a device of a started program more input
+// Feeding it 0 bytes ends its input, so RECEIVEs after everything it was fed
+// fail rather than waiting.
+int interpreter_feed(Interpreter *interpreter, const char *device, const char *data, size_t length) {
+  for(size_t d = 0; d < interpreter->device_count; d++) {
+    Device *dev = &interpreter->devices[d];
+    if(strcmp(dev->name, device) != 0) continue;
+    if(!dev->reader || dev->reader->fd >= 0 || dev->reader->eof) {
+      PERROR("Device %s can't be fed input.\n", device);
+      return ERR_DEVICE;
+    }
+    return input_feed(dev->reader, data, length) ? ERR_IO : ERR_OKAY;
+  }
+  PERROR("The program doesn't use a device called %s.\n", device);
+  return ERR_DEVICE;
+}
+
+// Run a started program for up to steps steps
+// Returns RUN_DONE once the program has finished, RUN_FAILED if it stopped
+// with an error, which is kept in interpreter->status, RUN_WAITING if it's
+// waiting for input on interpreter->waiting, and RUN_READY if it ran out of
+// steps first. A program that has stopped stays stopped.
+int interpreter_run(Interpreter *interpreter, size_t steps) {
+  if(interpreter->status) return RUN_FAILED;
+  if(interpreter->state_cur->exec_count == 0) return RUN_DONE;
+
+  Pool *prev = pool_set_current(interpreter->pool);
+  int status = exec_run(interpreter, steps);
+  pool_set_current(prev);
+
+  if(status == ERR_WAIT) return RUN_WAITING;
+  if(!status && interpreter->state_cur->exec_count > 0) return RUN_READY;
+
+  interpreter->status = interpreter_finish(interpreter, status);
+  if(interpreter->status) {
+    PERROR("Failed to interpret: status %d\n", interpreter->status);
+    return RUN_FAILED;
+  }
+  return RUN_DONE;
+}
+
+// The exit status for a process whose program stopped with status
+int interpreter_exit_status(int status) {
+  if(status == ERR_OKAY) return 0;
+  if(status == ERR_STEP_LIMIT) return EXIT_STEP_LIMIT;
+  if(status == ERR_HEAP_LIMIT) return EXIT_HEAP_LIMIT;
+  if(status == ERR_OUTPUT_LIMIT) return EXIT_OUTPUT_LIMIT;
+  return 1;
+}
@@ -2,7 +2,14 @@
 #define INTERPRETER_H
 
 // Includes
+#include "device.h"
+#include "input.h"
+#include "iolog.h"
+#include "output.h"
 #include "parser.h"
+#include "pool.h"
+#include "profile.h"
+#include "record.h"
 #include "variable.h"
 
 typedef struct FrameNode {
@@ -17,27 +24,125 @@ typedef struct {
   FrameNode *buckets[NUM_BUCKETS];
 } Frame;
 
+// frame is only allocated once something is declared in the scope
 typedef struct Scope {
   Frame *frame;
   struct Scope *next;
   struct Scope *prev;
 } Scope;
 
+// A statement that is still being executed
+// Blocks and loops are kept on an explicit stack rather than the C stack, so
+// nesting depth is only limited by memory.
+typedef struct {
+  ASTNode *node;
+  // Next statement of a block, next element of a FOR EACH loop, or whether a
+  // FOR loop has started
+  size_t index;
+  // Loop variable of a FOR or FOR EACH loop
+  Variable *counter;
+  // FOR EACH over a row of a two-dimensional array: the element after the
+  // row, 0 when walking a whole array
+  size_t end;
+  // FOR: the end value, FOR EACH: a reference to the array being walked
+  Variable items;
+  // FOR: the step value
+  Variable step;
+  // --profile: the path of the statement the frame belongs to
+  size_t profile;
+} ExecFrame;
+
 typedef struct State {
   Scope *scope_top;
   Scope *scope_cur;
+  ExecFrame *exec;
+  size_t exec_count;
+  size_t exec_alloced;
   struct State *next;
   struct State *prev;
 } State;
 
+// Settings for running a program
+typedef struct {
+  // Report arrays and strings that were never released at interpreter_destroy
+  int memory_debug;
+  // Print the allocator's stats at interpreter_destroy
+  int stats;
+  // Write DISPLAY output out after every SEND, rather than when the buffer
+  // fills up
+  int unbuffered;
+  // Paths devices are bound to, from --device
+  DeviceBinding *bindings;
+  size_t binding_count;
+  // Log every device read to record_path, or serve them all from the log at
+  // replay_path, from --record and --replay
+  const char *record_path;
+  const char *replay_path;
+  // Stop the program once it has run max_steps steps, has more than max_heap
+  // bytes allocated or has sent max_output bytes to DISPLAY and its other
+  // devices between them, for any that are set
+  size_t max_steps;
+  size_t max_heap;
+  size_t max_output;
+  // Count and time every statement into profile, from --profile, if it's set
+  Profile *profile;
+  // Refuse to run programs that READ or WRITE files, for libedxp callers
+  // that haven't allowed them
+  int no_files;
+} InterpreterConfig;
+
 typedef struct {
   State *state_glob;
   State *state_cur;
+  InterpreterConfig config;
+  // Every runtime heap object is allocated from here
+  Pool *pool;
+  // Standard output and input, which DISPLAY and KEYBOARD use unless they're
+  // bound to something else
+  Output *display;
+  Input *keyboard;
+  // What DISPLAY and every other device has written, counted against
+  // max_output
+  OutputBudget output_budget;
+  // The program's devices, indexed like the parser's device table
+  Device *devices;
+  size_t device_count;
+  // Device log being recorded or replayed, if any
+  IoLog *log;
+  // Set for interpreters from interpreter_start(), whose unbound devices are
+  // fed their input
+  int fed;
+  // interpreter_run(): the device a RECEIVE is waiting on, and the error the
+  // program stopped with
+  size_t waiting;
+  int status;
+  // Steps run so far, counted against max_steps
+  size_t steps;
+  // The files the program READs and WRITEs, indexed like the parser's file
+  // table
+  RecordFile *files;
+  size_t file_count;
+  // The program's constant pool, indexed by the constants' ids
+  // Strings are interned, and values are shared copy-on-write with whatever
+  // they're assigned to.
+  StringTable *strings;
+  Variable *constants;
+  size_t constant_count;
+  // Live arrays and string buffers when the interpreter was created, anything
+  // above these when it's destroyed was leaked
+  size_t live_arrays;
+  size_t live_strings;
 } Interpreter;
 
 // Function prototypes
-Interpreter *interpret(Parser *parser);
+Interpreter *interpret(Parser *parser, InterpreterConfig *config, int *status);
+Interpreter *interpreter_prepare(Parser *parser, InterpreterConfig *config);
+int interpreter_execute(Interpreter *interpreter);
+Interpreter *interpreter_start(Parser *parser, InterpreterConfig *config, int display_fd, int *status_out);
+int interpreter_feed(Interpreter *interpreter, const char *device, const char *data, size_t length);
+int interpreter_run(Interpreter *interpreter, size_t steps);
 void interpreter_destroy(Interpreter **interpreter);
+int interpreter_exit_status(int status);
 
 // ERRORS
 enum {
@@ -49,7 +154,34 @@ enum {
   ERR_CREATE_FAIL,
   ERR_INTERP_MISSING_COMPONENT,
   ERR_NODE_MISSING_COMPONENT,
+  ERR_UNDECLARED,
+  ERR_TYPE_MISMATCH,
+  ERR_OUT_OF_BOUNDS,
+  ERR_DIV_ZERO,
+  ERR_IO,
+  ERR_INPUT,
+  ERR_DEVICE,
+  ERR_WAIT,
+  ERR_STEP_LIMIT,
+  ERR_HEAP_LIMIT,
+  ERR_OUTPUT_LIMIT,
   ERR_TODO
 };
 
+// Exit statuses for a program stopped by one of its limits, so whatever is
+// running it can tell them apart from other failures
+enum {
+  EXIT_STEP_LIMIT = 3,
+  EXIT_HEAP_LIMIT,
+  EXIT_OUTPUT_LIMIT
+};
+
+// What interpreter_run() left a program doing
+enum {
+  RUN_DONE,
+  RUN_READY,
+  RUN_WAITING,
+  RUN_FAILED
+};
+
 #endif // interpreter.h
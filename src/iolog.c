@@ -0,0 +1,284 @@
+#include "iolog.h"
+#include "def.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Nanoseconds on a clock that only goes forward
+uint64_t iolog_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void write_varint(Output *out, uint64_t value) {
+  char bytes[10];
+  size_t length = 0;
+  do {
+    bytes[length] = value & 0x7f;
+    value >>= 7;
+    if(value) bytes[length] |= 0x80;
+    length++;
+  } while(value);
+  output_write(out, bytes, length);
+}
+
+// Read a varint at *pos, failing if it runs past the end of the log
+static int read_varint(IoLog *log, size_t *pos, uint64_t *value) {
+  uint64_t v = 0;
+  for(unsigned shift = 0; shift < 64; shift += 7) {
+    if(*pos >= log->size) return 1;
+    unsigned char byte = log->data[(*pos)++];
+    v |= (uint64_t)(byte & 0x7f) << shift;
+    if(!(byte & 0x80)) {
+      *value = v;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Add a name to the log's list of device names
+static int push_name(IoLog *log, const char *name, size_t length) {
+  char **names = realloc(log->names, sizeof(char *) * (log->name_count + 1));
+  if(!names) {
+    PERROR("realloc() failed.\n");
+    return 1;
+  }
+  log->names = names;
+  names[log->name_count] = malloc(length + 1);
+  if(!names[log->name_count]) {
+    PERROR("malloc() failed.\n");
+    return 1;
+  }
+  memcpy(names[log->name_count], name, length);
+  names[log->name_count][length] = '\0';
+  log->name_count++;
+  return 0;
+}
+
+// Start recording device reads to a file
+IoLog *iolog_record(const char *path) {
+  IoLog *log = calloc(1, sizeof(IoLog));
+  if(!log) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(fd < 0) {
+    PERROR("Couldn't open %s: %s\n", path, strerror(errno));
+    free(log);
+    return NULL;
+  }
+  log->out = output_create(fd, 0);
+  if(!log->out) {
+    PERROR("output_create() failed.\n");
+    close(fd);
+    free(log);
+    return NULL;
+  }
+
+  output_write(log->out, IOLOG_MAGIC, IOLOG_MAGIC_SIZE);
+  log->last_start = iolog_now();
+  return log;
+}
+
+// Check that a log is well formed, and add up its totals
+static int iolog_scan(IoLog *log) {
+  if(log->size < IOLOG_MAGIC_SIZE || memcmp(log->data, IOLOG_MAGIC, IOLOG_MAGIC_SIZE) != 0) return 1;
+
+  size_t pos = IOLOG_MAGIC_SIZE;
+  while(pos < log->size) {
+    unsigned char tag = log->data[pos++];
+    uint64_t slot, delta, wait, length;
+    if(tag == IOLOG_DEVICE) {
+      if(read_varint(log, &pos, &length) || length > log->size - pos) return 1;
+      if(push_name(log, log->data + pos, length) != 0) return 1;
+      pos += length;
+    } else if(tag == IOLOG_READ) {
+      if(read_varint(log, &pos, &slot) || slot >= log->name_count) return 1;
+      if(read_varint(log, &pos, &delta) || read_varint(log, &pos, &wait)) return 1;
+      if(read_varint(log, &pos, &length) || length > log->size - pos) return 1;
+      pos += length;
+      log->reads++;
+      log->bytes += length;
+      log->wait += wait;
+    } else {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Load a log of device reads to replay
+IoLog *iolog_replay(const char *path) {
+  IoLog *log = calloc(1, sizeof(IoLog));
+  if(!log) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+  log->replaying = 1;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    PERROR("Couldn't open %s: %s\n", path, strerror(errno));
+    free(log);
+    return NULL;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    PERROR("%s isn't a regular file.\n", path);
+    close(fd);
+    free(log);
+    return NULL;
+  }
+
+  log->data = malloc(st.st_size ? st.st_size : 1);
+  if(!log->data) {
+    PERROR("malloc() failed.\n");
+    close(fd);
+    free(log);
+    return NULL;
+  }
+  while(log->size < (size_t)st.st_size) {
+    ssize_t got = read(fd, log->data + log->size, st.st_size - log->size);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) break;
+    log->size += got;
+  }
+  close(fd);
+
+  if(log->size != (size_t)st.st_size || iolog_scan(log) != 0) {
+    PERROR("%s isn't a valid device log.\n", path);
+    iolog_close(&log);
+    return NULL;
+  }
+  return log;
+}
+
+// Finish with a log
+// A log being recorded is written out, and its status is returned.
+int iolog_close(IoLog **log) {
+  if(!log) return 0;
+  IoLog *l = *log;
+  if(!l) return 0;
+
+  int status = 0;
+  if(l->out) {
+    int fd = l->out->fd;
+    status = output_flush(l->out);
+    output_destroy(&l->out);
+    if(close(fd) != 0) status = 1;
+    if(status) PERROR("Failed to write the device log.\n");
+  }
+  for(size_t n = 0; n < l->name_count; n++) free(l->names[n]);
+  free(l->names);
+  free(l->data);
+  free(l);
+  *log = NULL;
+  return status;
+}
+
+// Give a device a slot in a log being recorded
+int iolog_add_device(IoLog *log, const char *name, size_t *slot) {
+  size_t length = strlen(name);
+  if(push_name(log, name, length) != 0) return 1;
+  output_putc(log->out, IOLOG_DEVICE);
+  write_varint(log->out, length);
+  output_write(log->out, name, length);
+  *slot = log->name_count - 1;
+  return 0;
+}
+
+// Record a read from a device
+// started is when the read was asked for, so how long it blocked is logged
+// along with what it got.
+int iolog_read(IoLog *log, size_t slot, const char *data, size_t length, uint64_t started) {
+  uint64_t now = iolog_now();
+  output_putc(log->out, IOLOG_READ);
+  write_varint(log->out, slot);
+  write_varint(log->out, started - log->last_start);
+  write_varint(log->out, now - started);
+  write_varint(log->out, length);
+  output_write(log->out, data, length);
+  log->last_start = started;
+  log->reads++;
+  log->bytes += length;
+  log->wait += now - started;
+  if(log->out->failed) {
+    PERROR("Failed to write the device log.\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Gather everything a device read in a log being replayed
+// *data is allocated, even if nothing was read.
+int iolog_device_data(IoLog *log, const char *name, char **data, size_t *size) {
+  int found = 0;
+  size_t total = 0;
+  char *joined = NULL;
+  for(int pass = 0; pass < 2; pass++) {
+    size_t pos = IOLOG_MAGIC_SIZE;
+    while(pos < log->size) {
+      unsigned char tag = log->data[pos++];
+      uint64_t slot, delta, wait, length;
+      // The log was checked when it was loaded, but it's read as carefully
+      // here as it was then
+      int bad;
+      if(tag == IOLOG_DEVICE) {
+        bad = read_varint(log, &pos, &length);
+      } else {
+        bad = read_varint(log, &pos, &slot) || slot >= log->name_count;
+        bad = bad || read_varint(log, &pos, &delta) || read_varint(log, &pos, &wait);
+        bad = bad || read_varint(log, &pos, &length);
+      }
+      if(bad || length > log->size - pos) {
+        PERROR("The device log is damaged.\n");
+        free(joined);
+        return 1;
+      }
+      if(tag == IOLOG_DEVICE) {
+        pos += length;
+        continue;
+      }
+      if(strcmp(log->names[slot], name) == 0) {
+        found = 1;
+        if(pass == 0) total += length;
+        else {
+          memcpy(joined + *size, log->data + pos, length);
+          *size += length;
+        }
+      }
+      pos += length;
+    }
+
+    if(pass == 0) {
+      if(!found) {
+        PERROR("%s wasn't read from in the recording.\n", name);
+        return 1;
+      }
+      joined = malloc(total ? total : 1);
+      if(!joined) {
+        PERROR("malloc() failed.\n");
+        return 1;
+      }
+      *size = 0;
+    }
+  }
+  *data = joined;
+  return 0;
+}
+
+// Print how much a log holds
+void iolog_print_stats(IoLog *log, FILE *out) {
+  fprintf(out, "Device log stats (%s):\n", log->replaying ? "replayed" : "recorded");
+  fprintf(out, "  devices: %zu\n", log->name_count);
+  fprintf(out, "  reads: %zu, %zu bytes\n", log->reads, log->bytes);
+  fprintf(out, "  time spent waiting on reads: %.3f ms\n", log->wait / 1e6);
+}
@@ -0,0 +1,52 @@
+#ifndef IOLOG_H
+#define IOLOG_H
+
+// Includes
+#include "output.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Defines
+// Logs start with this, and then hold a list of entries:
+//   IOLOG_DEVICE  name length, name           names the next device slot
+//   IOLOG_READ    slot, time since the last read started, time spent waiting,
+//                 length, data
+// Every number is an unsigned LEB128 varint, and times are in nanoseconds.
+// A read of length 0 is where the device reached the end of its input.
+#define IOLOG_MAGIC "EDXPLOG1"
+#define IOLOG_MAGIC_SIZE 8
+#define IOLOG_DEVICE 1
+#define IOLOG_READ 2
+
+// Structs
+// A log of device reads, being recorded with --record or replayed with
+// --replay
+typedef struct IoLog {
+  int replaying;
+  // Recording: where entries are written, and when the last read started
+  Output *out;
+  uint64_t last_start;
+  // Replaying: the whole log
+  char *data;
+  size_t size;
+  // Device names, indexed by slot
+  char **names;
+  size_t name_count;
+  // Totals, for --stats
+  size_t reads;
+  size_t bytes;
+  uint64_t wait;
+} IoLog;
+
+// Function prototypes
+IoLog *iolog_record(const char *path);
+IoLog *iolog_replay(const char *path);
+int iolog_close(IoLog **log);
+uint64_t iolog_now(void);
+int iolog_add_device(IoLog *log, const char *name, size_t *slot);
+int iolog_read(IoLog *log, size_t slot, const char *data, size_t length, uint64_t started);
+int iolog_device_data(IoLog *log, const char *name, char **data, size_t *size);
+void iolog_print_stats(IoLog *log, FILE *out);
+
+#endif // iolog.h
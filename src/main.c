@@ -1,63 +1,34 @@
+#include "batch.h"
+#include "cache.h"
 #include "compiler.h"
 #include "def.h"
+#include "forkserver.h"
 #include "interpreter.h"
 #include "parser.h"
+#include "profile.h"
+#include "serve.h"
+#include "source.h"
 #include "tokeniser.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-// Read a file into a string
-char *read_file_str(char *file_dir) {
-  if(!file_dir) {
-    PERROR("NULL file_dir passed.\n");
-    return NULL;
-  }
-
-  FILE *file = fopen(file_dir, "rb");
-  if(!file) {
-    PERROR("Could not open file %s.\n", file_dir);
-    return NULL;
-  }
-
-  fseek(file, 0, SEEK_END);
-  size_t file_len = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  char *out = malloc(sizeof(char) * (file_len + 1));
-  if(!out) {
-    PERROR("malloc() failed.\n");
-    fclose(file);
-    return NULL;
-  }
-
-  if(fread(out, sizeof(char), file_len, file) != file_len) {
-    PERROR("fread() failed.\n");
-    free(out);
-    fclose(file);
-    return NULL;
-  }
-
-  out[file_len] = '\0';
-  fclose(file);
-  return out;
-}
-
-// Strip comments from a string (# until \n)
-void strip_comments(char *src) {
-  if(!src) return;
-  char *read = src;
-  char *write = src;
-
-  int in_comment = 0;
-
-  while(*read != '\0') {
-    if(*read == '#') in_comment = 1;
-    if(*read == '\n') in_comment = 0;
-    if(!in_comment) *(write++) = (*read);
-    read++;
-  }
-  *write = '\0';
+// Parse a count or size for a limit
+// A K, M or G suffix multiplies it by 1024, 1024^2 or 1024^3.
+int parse_limit(const char *arg, size_t *out) {
+  char *end;
+  if(*arg < '0' || *arg > '9') return 1;
+  unsigned long long value = strtoull(arg, &end, 10);
+  unsigned shift = 0;
+  if(*end == 'K') shift = 10;
+  if(*end == 'M') shift = 20;
+  if(*end == 'G') shift = 30;
+  if(shift) end++;
+  if(*end || value == 0 || value > (SIZE_MAX >> shift)) return 1;
+  *out = (size_t)value << shift;
+  return 0;
 }
 
 void print_help(char *bin_path) {
@@ -69,6 +40,30 @@ void print_help(char *bin_path) {
   printf("-p, --parser_debug      Print a debug view of the parser after parsing\n");
   printf("-P, --parse_only        Tokenise and parse only; do not compile or execute\n");
   printf("-c, --compile           Compile to Python instead of executing\n");
+  printf("-m, --memory_debug      Report values that were never freed after executing\n");
+  printf("-s, --stats             Report allocator statistics after executing\n");
+  printf("-u, --unbuffered        Write DISPLAY output after every SEND\n");
+  printf("-d, --device NAME=path  Bind a device to a file, pipe or FIFO\n");
+  printf("-r, --record FILE       Log every device read, and how long it waited, to FILE\n");
+  printf("-R, --replay FILE       Read devices from a log made with --record instead\n");
+  printf("--max_steps N           Stop after N steps, with exit status %d\n", EXIT_STEP_LIMIT);
+  printf("--max_heap BYTES        Stop if more than BYTES are allocated, with exit status %d\n", EXIT_HEAP_LIMIT);
+  printf("--max_output BYTES      Stop after SENDing BYTES to devices, with exit status %d\n", EXIT_OUTPUT_LIMIT);
+  printf("-b, --batch             Run every program listed in file, one per line, or\n");
+  printf("                        every .edx file in it if it's a directory\n");
+  printf("-i, --inputs DIR        Run file once on every input in DIR, which go to\n");
+  printf("                        KEYBOARD, writing each one's output to <input>.out\n");
+  printf("-j, --jobs N            Run a batch or inputs on N threads, one per CPU by default\n");
+  printf("--serve SOCKET          Run programs sent with --client, given SOCKET in place\n");
+  printf("                        of the file, keeping them parsed, until interrupted\n");
+  printf("--client SOCKET         Run file on the daemon serving SOCKET\n");
+  printf("--fork_server           Run file once per request line read from standard input,\n");
+  printf("                        each time in a fork of a process with it ready to run\n");
+  printf("--cache                 Keep file parsed, or compiled with -c, in %s next to it,\n", CACHE_DIR);
+  printf("                        and use that until file changes\n");
+  printf("--profile               Count and time every line as it runs, into %s\n", PROFILE_LISTING_PATH);
+  printf("                        and collapsed stacks for flame graphs in %s\n", PROFILE_STACKS_PATH);
+  printf("Note: Limits can end in K, M or G, like --max_heap 64M.\n");
   printf("Note: Combining multiple short flags like -Tt is not supported.\n");
 }
 
@@ -87,6 +82,17 @@ int main(int argc, char **argv) {
   int parse_debug = 0;
   int parse_only = 0;
   int compile_py = 0;
+  int batch = 0;
+  char *inputs = NULL;
+  int serving = 0;
+  int forking = 0;
+  int cache = 0;
+  int profiling = 0;
+  char *client = NULL;
+  size_t jobs = 0;
+  InterpreterConfig config = {0};
+  DeviceBinding bindings[argc];
+  config.bindings = bindings;
   for(int i = 1; i < argc - 1; i++) {
     if(strcmp(argv[i], "--help") == 0) help = 1;
     if(strcmp(argv[i], "--tokeniser_debug") == 0) tok_debug = 1;
@@ -99,6 +105,103 @@ int main(int argc, char **argv) {
     if(strcmp(argv[i], "-P") == 0) parse_only = 1;
     if(strcmp(argv[i], "--compile") == 0) compile_py = 1;
     if(strcmp(argv[i], "-c") == 0) compile_py = 1;
+    if(strcmp(argv[i], "--memory_debug") == 0) config.memory_debug = 1;
+    if(strcmp(argv[i], "-m") == 0) config.memory_debug = 1;
+    if(strcmp(argv[i], "--stats") == 0) config.stats = 1;
+    if(strcmp(argv[i], "-s") == 0) config.stats = 1;
+    if(strcmp(argv[i], "--unbuffered") == 0) config.unbuffered = 1;
+    if(strcmp(argv[i], "-u") == 0) config.unbuffered = 1;
+    if(strcmp(argv[i], "--device") == 0 || strcmp(argv[i], "-d") == 0) {
+      if(i + 1 >= argc - 1 || device_binding_parse(argv[++i], &bindings[config.binding_count]) != 0) {
+        PERROR("--device expects NAME=path before the file.\n");
+        return 1;
+      }
+      config.binding_count++;
+    }
+    if(strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "-r") == 0) {
+      if(i + 1 >= argc - 1) {
+        PERROR("--record expects a log file before the program.\n");
+        return 1;
+      }
+      config.record_path = argv[++i];
+    }
+    if(strcmp(argv[i], "--replay") == 0 || strcmp(argv[i], "-R") == 0) {
+      if(i + 1 >= argc - 1) {
+        PERROR("--replay expects a log file before the program.\n");
+        return 1;
+      }
+      config.replay_path = argv[++i];
+    }
+    size_t *limit = NULL;
+    if(strcmp(argv[i], "--max_steps") == 0) limit = &config.max_steps;
+    if(strcmp(argv[i], "--max_heap") == 0) limit = &config.max_heap;
+    if(strcmp(argv[i], "--max_output") == 0) limit = &config.max_output;
+    if(limit) {
+      if(i + 1 >= argc - 1 || parse_limit(argv[i + 1], limit) != 0) {
+        PERROR("%s expects a number before the program.\n", argv[i]);
+        return 1;
+      }
+      i++;
+    }
+    if(strcmp(argv[i], "--batch") == 0 || strcmp(argv[i], "-b") == 0) batch = 1;
+    if(strcmp(argv[i], "--inputs") == 0 || strcmp(argv[i], "-i") == 0) {
+      if(i + 1 >= argc - 1) {
+        PERROR("--inputs expects a directory before the program.\n");
+        return 1;
+      }
+      inputs = argv[++i];
+    }
+    if(strcmp(argv[i], "--serve") == 0) serving = 1;
+    if(strcmp(argv[i], "--fork_server") == 0) forking = 1;
+    if(strcmp(argv[i], "--cache") == 0) cache = 1;
+    if(strcmp(argv[i], "--profile") == 0) profiling = 1;
+    if(strcmp(argv[i], "--client") == 0) {
+      if(i + 1 >= argc - 1) {
+        PERROR("--client expects a socket before the program.\n");
+        return 1;
+      }
+      client = argv[++i];
+    }
+    if(strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) {
+      if(i + 1 >= argc - 1 || parse_limit(argv[i + 1], &jobs) != 0) {
+        PERROR("%s expects a number before the program.\n", argv[i]);
+        return 1;
+      }
+      i++;
+    }
+  }
+
+  if(config.record_path && config.replay_path) {
+    PERROR("--record and --replay can't be used together.\n");
+    return 1;
+  }
+  if(batch && (config.record_path || config.replay_path || compile_py || tok_only || parse_only || tok_debug || parse_debug)) {
+    PERROR("--batch only runs programs, and can't record or replay them.\n");
+    return 1;
+  }
+  if(inputs && (batch || config.record_path || config.replay_path || compile_py)) {
+    PERROR("--inputs only runs a program, and can't record or replay it.\n");
+    return 1;
+  }
+  if((serving || client) && (batch || inputs || config.record_path || config.replay_path || compile_py || tok_only || parse_only || tok_debug || parse_debug)) {
+    PERROR("--serve and --client only run programs, and can't record or replay them.\n");
+    return 1;
+  }
+  if(forking && (batch || inputs || serving || client || config.record_path || config.replay_path || compile_py || tok_only || parse_only)) {
+    PERROR("--fork_server only runs programs, and can't record or replay them.\n");
+    return 1;
+  }
+  if(serving && client) {
+    PERROR("--serve and --client can't be used together.\n");
+    return 1;
+  }
+  if(profiling && (batch || inputs || serving || client || forking || compile_py)) {
+    PERROR("--profile only profiles a single run of a program.\n");
+    return 1;
+  }
+  if(jobs == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    jobs = cpus > 0 ? (size_t)cpus : 1;
   }
 
   if(help) {
@@ -110,36 +213,62 @@ int main(int argc, char **argv) {
   // File path should always be the last argument
   file_path = argv[argc - 1];
 
+  if(batch) return batch_run(file_path, jobs, &config);
+  if(serving) return serve(file_path, &config);
+  if(client) return interpreter_exit_status(serve_request(client, file_path));
+  // Without a program, each request names the one it runs
+  if(forking && strcmp(file_path, "-") == 0) return fork_server(NULL, &config);
+
   // Read input file into a string
   char *file_contents = read_file_str(file_path);
   if(!file_contents) {
     PERROR("Failed to read input file.\n");
     return 1;
   }
-  // Remove comments
-  strip_comments(file_contents);
-
-  // Tokenise the input
-  Tokeniser *tokeniser = tokenise(file_contents);
-  free(file_contents);
-  if(!tokeniser) {
-    PERROR("Failed to tokenise file.\n");
-    return 1;
+  // The cache is keyed on the source as it was read
+  size_t source_length = strlen(file_contents);
+  uint64_t source_hash = cache_hash(file_contents, source_length);
+  cache = cache && !tok_debug && !tok_only;
+  if(cache && compile_py && cache_load_python(file_path, source_hash, source_length, "./out.py") == 0) {
+    free(file_contents);
+    return 0;
   }
 
-  if(tok_debug) tokeniser_dump(tokeniser);
-  if(tok_only) {
-    // Exit early
+  Parser *parser = NULL;
+  if(cache && !compile_py) parser = cache_load_program(file_path, source_hash, source_length);
+  if(parser) {
+    free(file_contents);
+  } else {
+    // Remove comments
+    strip_comments(file_contents);
+
+    // Tokenise the input
+    Tokeniser *tokeniser = tokenise(file_contents);
+    free(file_contents);
+    if(!tokeniser) {
+      PERROR("Failed to tokenise file.\n");
+      return 1;
+    }
+
+    if(tok_debug) tokeniser_dump(tokeniser);
+    if(tok_only) {
+      // Exit early
+      tokeniser_destroy(&tokeniser);
+      return 0;
+    }
+
+    // Parse the tokens
+    parser = parse(tokeniser);
     tokeniser_destroy(&tokeniser);
-    return 0;
-  }
+    if(!parser) {
+      PERROR("Failed to parse tokens.\n");
+      return 1;
+    }
 
-  // Parse the tokens
-  Parser *parser = parse(tokeniser);
-  tokeniser_destroy(&tokeniser);
-  if(!parser) {
-    PERROR("Failed to parse tokens.\n");
-    return 1;
+    // Not being able to cache the program doesn't stop it running
+    if(cache && !compile_py && cache_store_program(file_path, parser, source_hash, source_length) != 0) {
+      PERROR("Couldn't cache the parsed program.\n");
+    }
   }
 
   if(parse_debug) parser_dump(parser);
@@ -149,6 +278,20 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  if(forking) {
+    // Run the program once per request
+    int status = fork_server(parser, &config);
+    parser_destroy(&parser);
+    return status;
+  }
+
+  if(inputs) {
+    // Run the program on every input
+    int status = batch_sweep(parser, inputs, jobs, &config);
+    parser_destroy(&parser);
+    return status;
+  }
+
   if(compile_py) {
     // Compile AST
     FILE *out_file = fopen("./out.py", "w");
@@ -165,13 +308,31 @@ int main(int argc, char **argv) {
       PERROR("Compilation failed.\n");
       return 1;
     }
+    if(cache && cache_store_python(file_path, source_hash, source_length, "./out.py") != 0) {
+      PERROR("Couldn't cache the compiled program.\n");
+    }
   } else {
     // Interpret AST
-    Interpreter *interpreter = interpret(parser);
+    if(profiling) {
+      config.profile = profile_create();
+      if(!config.profile) {
+        PERROR("Failed to set up the profile.\n");
+        parser_destroy(&parser);
+        return 1;
+      }
+    }
+
+    int status;
+    Interpreter *interpreter = interpret(parser, &config, &status);
     parser_destroy(&parser);
+    // A program that stopped part way through is profiled up to there
+    if(profiling) {
+      if(profile_write(config.profile, file_path) != 0) PERROR("Failed to write the profile.\n");
+      profile_destroy(&config.profile);
+    }
     if(!interpreter) {
       PERROR("Failed to interpret.\n");
-      return 1;
+      return interpreter_exit_status(status);
     }
 
     interpreter_destroy(&interpreter);
@@ -0,0 +1,147 @@
+#include "output.h"
+#include "def.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Create an output for a file descriptor
+// A terminal is flushed after every line, like stdout is, and so is anything
+// if unbuffered is set. Anything already written to stdout is flushed first so
+// it comes out in order.
+Output *output_create(int fd, int unbuffered) {
+  Output *out = malloc(sizeof(Output));
+  if(!out) {
+    PERROR("malloc() failed.\n");
+    return NULL;
+  }
+
+  fflush(stdout);
+  out->fd = fd;
+  out->sink = NULL;
+  out->sink_context = NULL;
+  out->line_buffered = unbuffered || isatty(fd);
+  out->failed = 0;
+  out->budget = NULL;
+  out->length = 0;
+  return out;
+}
+
+// Flush and destroy an output
+void output_destroy(Output **out) {
+  if(!out) return;
+  Output *o = *out;
+  if(!o) return;
+  output_flush(o);
+  free(o);
+  *out = NULL;
+}
+
+// Write all of some data to a file descriptor
+static int write_all(int fd, const char *data, size_t length) {
+  while(length > 0) {
+    ssize_t written = write(fd, data, length);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      PERROR("write() failed: %s\n", strerror(errno));
+      return 1;
+    }
+    data += written;
+    length -= written;
+  }
+  return 0;
+}
+
+// Write some data out, up to what's left of the output's budget
+static int output_emit(Output *out, const char *data, size_t length) {
+  OutputBudget *budget = out->budget;
+  int over = budget && budget->limit && length > budget->limit - budget->written;
+  if(over) length = budget->limit - budget->written;
+  if(out->sink ? out->sink(out->sink_context, data, length) != 0 : write_all(out->fd, data, length) != 0) return 1;
+  if(budget) {
+    budget->written += length;
+    if(over) budget->over_limit = 1;
+  }
+  return over;
+}
+
+// Write out everything that's buffered
+int output_flush(Output *out) {
+  size_t length = out->length;
+  out->length = 0;
+  if(out->failed) return 1;
+  if(length > 0 && output_emit(out, out->data, length) != 0) {
+    out->failed = 1;
+    return 1;
+  }
+  return 0;
+}
+
+// Write some text
+// Text too long to be worth buffering is written straight through.
+int output_write(Output *out, const char *data, size_t length) {
+  if(length <= OUTPUT_BUFFER_SIZE - out->length) {
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+    return 0;
+  }
+
+  if(output_flush(out) != 0) return 1;
+  if(length < OUTPUT_BUFFER_SIZE) {
+    memcpy(out->data, data, length);
+    out->length = length;
+    return 0;
+  }
+  if(output_emit(out, data, length) != 0) {
+    out->failed = 1;
+    return 1;
+  }
+  return 0;
+}
+
+// Pairs of decimal digits, so an integer can be formatted two digits at a time
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// Write an integer in decimal
+int output_int(Output *out, int64_t value) {
+  char buf[20];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+
+  // Work with the magnitude unsigned, so INT64_MIN doesn't overflow
+  uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  while(magnitude >= 100) {
+    unsigned pair = (unsigned)(magnitude % 100) * 2;
+    magnitude /= 100;
+    *--p = DIGIT_PAIRS[pair + 1];
+    *--p = DIGIT_PAIRS[pair];
+  }
+  if(magnitude >= 10) {
+    unsigned pair = (unsigned)magnitude * 2;
+    *--p = DIGIT_PAIRS[pair + 1];
+    *--p = DIGIT_PAIRS[pair];
+  } else {
+    *--p = (char)('0' + magnitude);
+  }
+  if(value < 0) *--p = '-';
+
+  return output_write(out, p, end - p);
+}
+
+// End a line, flushing if the output is line buffered
+int output_end_line(Output *out) {
+  if(output_putc(out, '\n') != 0) return 1;
+  if(out->line_buffered) return output_flush(out);
+  return 0;
+}
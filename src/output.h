@@ -0,0 +1,57 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+#define OUTPUT_BUFFER_SIZE 65536
+
+// Structs
+// Where an output's text goes instead of its file descriptor, if it's set
+// Returns 0, or non-zero if the text couldn't be written.
+typedef int (*OutputSink)(void *context, const char *data, size_t length);
+
+// Bytes written out by the outputs sharing it
+// If limit is set, only that many bytes are ever written out between them,
+// and going past it sets over_limit.
+typedef struct {
+  size_t limit;
+  size_t written;
+  int over_limit;
+} OutputBudget;
+
+// Buffered writer for a file descriptor
+// Text is collected in data and written out when it fills up, when the
+// output is flushed or destroyed, and after every line if line_buffered is
+// set. Once a write fails everything after it is dropped. What's written out
+// is counted against budget, if it's set, and going over it counts as a
+// failed write.
+typedef struct {
+  int fd;
+  OutputSink sink;
+  void *sink_context;
+  int line_buffered;
+  int failed;
+  OutputBudget *budget;
+  size_t length;
+  char data[OUTPUT_BUFFER_SIZE];
+} Output;
+
+// Function prototypes
+Output *output_create(int fd, int unbuffered);
+void output_destroy(Output **out);
+int output_flush(Output *out);
+int output_write(Output *out, const char *data, size_t length);
+int output_int(Output *out, int64_t value);
+int output_end_line(Output *out);
+
+// Write a single character
+static inline int output_putc(Output *out, char c) {
+  if(out->length == OUTPUT_BUFFER_SIZE && output_flush(out) != 0) return 1;
+  out->data[out->length++] = c;
+  return 0;
+}
+
+#endif // output.h
@@ -1,10 +1,10 @@
 #include "parser.h"
 #include "def.h"
 #include "tokeniser.h"
-#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #define PERROR_LOC                                                                 \
   {                                                                                \
@@ -27,6 +27,10 @@ static VarType token_type_to_var_type(TokenType token_type) {
     return VarBoolean;
   case TokenCharacter:
     return VarCharacter;
+  case TokenArray:
+    return VarArray;
+  case TokenString:
+    return VarString;
   default:
     return -1;
   }
@@ -49,70 +53,172 @@ static ASTNode *node_create(NodeType type) {
   return node;
 }
 
-// Destroy an AST node
+// A stack of AST nodes, used to walk trees without recursing once per level
+typedef struct {
+  ASTNode **nodes;
+  size_t count;
+  size_t alloced;
+} NodeStack;
+
+static int node_stack_push(NodeStack *stack, ASTNode *node) {
+  if(!node) return 0;
+  if(stack->count >= stack->alloced) {
+    size_t alloced = stack->alloced ? stack->alloced * 2 : 64;
+    ASTNode **new = realloc(stack->nodes, sizeof(ASTNode *) * alloced);
+    if(!new) {
+      PERROR("realloc() failed.\n");
+      return 1;
+    }
+    stack->nodes = new;
+    stack->alloced = alloced;
+  }
+  stack->nodes[stack->count++] = node;
+  return 0;
+}
+
+// Destroy an AST node and all of its children
+// Children are pushed to an explicit stack, so deeply nested programs can't
+// overflow the call stack.
 static void node_destroy(ASTNode **node) {
   if(!node) return;
-  ASTNode *n = *node;
-  if(!n) return;
-  switch(n->type) {
-  case NodeProgram:
-    node_destroy(&n->program.block);
-    break;
-  case NodeVarDecl:
-    if(n->var_decl.id) free(n->var_decl.id);
-    break;
-  case NodeVarAssign:
-    if(n->var_assign.id) free(n->var_assign.id);
-    node_destroy(&n->var_assign.expr);
-    break;
-  case NodeExpr:
-    switch(n->expr.type) {
-    case ExprOp:
-      node_destroy(&n->expr.op.left);
-      node_destroy(&n->expr.op.right);
+  if(!*node) return;
+  NodeStack stack = {0};
+  if(node_stack_push(&stack, *node) != 0) {
+    PERROR("Failed to destroy node.\n");
+    return;
+  }
+  *node = NULL;
+
+  while(stack.count > 0) {
+    ASTNode *n = stack.nodes[--stack.count];
+    int push_status = 0;
+    switch(n->type) {
+    case NodeProgram:
+      push_status |= node_stack_push(&stack, n->program.block);
       break;
-    case ExprVar:
-      if(n->expr.var_name) free(n->expr.var_name);
-      n->expr.var_name = NULL;
+    case NodeVarDecl:
+      if(n->var_decl.id) free(n->var_decl.id);
+      push_status |= node_stack_push(&stack, n->var_decl.length);
+      push_status |= node_stack_push(&stack, n->var_decl.columns);
       break;
-    case ExprInt:
-      // Nothing to free
+    case NodeVarAssign:
+      if(n->var_assign.id) free(n->var_assign.id);
+      push_status |= node_stack_push(&stack, n->var_assign.index);
+      push_status |= node_stack_push(&stack, n->var_assign.column);
+      push_status |= node_stack_push(&stack, n->var_assign.expr);
       break;
-    default:
-      PERROR("UNIMPLEMENTED EXPRESSION DESTRUCTION!!!!!\n");
+    case NodeExpr:
+      switch(n->expr.type) {
+      case ExprOp:
+        push_status |= node_stack_push(&stack, n->expr.op.left);
+        push_status |= node_stack_push(&stack, n->expr.op.right);
+        break;
+      case ExprVar:
+        if(n->expr.var_name) free(n->expr.var_name);
+        n->expr.var_name = NULL;
+        break;
+      case ExprArray:
+        for(size_t i = 0; i < n->expr.array.count; i++) {
+          push_status |= node_stack_push(&stack, n->expr.array.items[i]);
+        }
+        free(n->expr.array.items);
+        n->expr.array.items = NULL;
+        break;
+      case ExprIndex:
+        push_status |= node_stack_push(&stack, n->expr.index.array);
+        push_status |= node_stack_push(&stack, n->expr.index.index);
+        push_status |= node_stack_push(&stack, n->expr.index.column);
+        break;
+      case ExprCall:
+        if(n->expr.call.name) free(n->expr.call.name);
+        for(size_t i = 0; i < n->expr.call.argc; i++) {
+          push_status |= node_stack_push(&stack, n->expr.call.args[i]);
+        }
+        free(n->expr.call.args);
+        n->expr.call.args = NULL;
+        break;
+      case ExprString:
+        if(n->expr.string.data) free(n->expr.string.data);
+        n->expr.string.data = NULL;
+        break;
+      case ExprInt:
+      case ExprReal:
+      case ExprBool:
+      case ExprChar:
+        // Nothing to free
+        break;
+      default:
+        PERROR("UNIMPLEMENTED EXPRESSION DESTRUCTION!!!!!\n");
+        break;
+      }
       break;
-    }
-    break;
-  case NodeIf:
-    node_destroy(&n->if_stmt.condition);
-    node_destroy(&n->if_stmt.if_block);
-    node_destroy(&n->if_stmt.else_block);
-    break;
-  case NodeWhile:
-    node_destroy(&n->while_stmt.condition);
-    node_destroy(&n->while_stmt.while_block);
-    break;
-  case NodeBlock:
-    if(n->block.statements) {
-      for(size_t i = 0; i < n->block.count; i++) {
-        node_destroy(&n->block.statements[i]);
+    case NodeIf:
+      push_status |= node_stack_push(&stack, n->if_stmt.condition);
+      push_status |= node_stack_push(&stack, n->if_stmt.if_block);
+      push_status |= node_stack_push(&stack, n->if_stmt.else_block);
+      break;
+    case NodeWhile:
+      push_status |= node_stack_push(&stack, n->while_stmt.condition);
+      push_status |= node_stack_push(&stack, n->while_stmt.while_block);
+      break;
+    case NodeFor:
+      if(n->for_stmt.id) free(n->for_stmt.id);
+      push_status |= node_stack_push(&stack, n->for_stmt.from);
+      push_status |= node_stack_push(&stack, n->for_stmt.to);
+      push_status |= node_stack_push(&stack, n->for_stmt.step);
+      push_status |= node_stack_push(&stack, n->for_stmt.for_block);
+      break;
+    case NodeForEach:
+      if(n->for_each.id) free(n->for_each.id);
+      push_status |= node_stack_push(&stack, n->for_each.array);
+      push_status |= node_stack_push(&stack, n->for_each.for_block);
+      break;
+    case NodeBlock:
+      if(n->block.statements) {
+        for(size_t i = 0; i < n->block.count; i++) {
+          push_status |= node_stack_push(&stack, n->block.statements[i]);
+        }
+        free(n->block.statements);
+        n->block.statements = NULL;
+        n->block.count = 0;
+      }
+      break;
+    case NodeSend:
+      push_status |= node_stack_push(&stack, n->send_stmt.expr);
+      if(n->send_stmt.device_name) free(n->send_stmt.device_name);
+      n->send_stmt.device_name = NULL;
+      break;
+    case NodeReceive:
+      free(n->receive_stmt.id);
+      free(n->receive_stmt.device_name);
+      n->receive_stmt.id = NULL;
+      n->receive_stmt.device_name = NULL;
+      break;
+    case NodeRead:
+      free(n->read_stmt.path);
+      for(size_t i = 0; i < n->read_stmt.count; i++) free(n->read_stmt.ids[i]);
+      free(n->read_stmt.ids);
+      n->read_stmt.path = NULL;
+      n->read_stmt.ids = NULL;
+      break;
+    case NodeWrite:
+      free(n->write_stmt.path);
+      for(size_t i = 0; i < n->write_stmt.count; i++) {
+        push_status |= node_stack_push(&stack, n->write_stmt.items[i]);
       }
-      free(n->block.statements);
-      n->block.statements = NULL;
-      n->block.count = 0;
+      free(n->write_stmt.items);
+      n->write_stmt.path = NULL;
+      n->write_stmt.items = NULL;
+      break;
+    default:
+      PERROR("UNIMPLEMENTED NODE_DESTROY()!!!\n");
+      break;
     }
-    break;
-  case NodeSend:
-    node_destroy(&n->send_stmt.expr);
-    if(n->send_stmt.device_name) free(n->send_stmt.device_name);
-    n->send_stmt.device_name = NULL;
-    break;
-  default:
-    PERROR("UNIMPLEMENTED NODE_DESTROY()!!!\n");
-    break;
+    if(push_status) PERROR("Failed to push child nodes, some memory was leaked.\n");
+    free(n);
   }
-  free(n);
-  *node = NULL;
+
+  free(stack.nodes);
 }
 
 // Create a parser
@@ -124,6 +230,14 @@ static Parser *parser_create(void) {
   }
 
   parser->root = NULL;
+  parser->constants = NULL;
+  parser->constant_count = 0;
+  parser->devices = NULL;
+  parser->device_count = 0;
+  parser->files = NULL;
+  parser->file_count = 0;
+  parser->mapping = NULL;
+  parser->mapping_size = 0;
 
   return parser;
 }
@@ -133,9 +247,16 @@ void parser_destroy(Parser **parser) {
   if(!parser) return;
   Parser *p = *parser;
   if(!p) return;
+  *parser = NULL;
+  if(p->mapping) {
+    munmap(p->mapping, p->mapping_size);
+    return;
+  }
   node_destroy(&p->root);
+  free(p->constants);
+  free(p->devices);
+  free(p->files);
   free(p);
-  *parser = NULL;
 }
 
 static NodeType detect_type(Tokeniser *tokeniser) {
@@ -147,16 +268,63 @@ static NodeType detect_type(Tokeniser *tokeniser) {
   if(token->type == TokenSet) return NodeVarAssign;
   if(token->type == TokenIf) return NodeIf;
   if(token->type == TokenWhile) return NodeWhile;
+  if(token->type == TokenFor) return NodeFor;
   if(token->type == TokenSend) return NodeSend;
+  if(token->type == TokenReceive) return NodeReceive;
+  if(token->type == TokenRead) return NodeRead;
+  if(token->type == TokenWrite) return NodeWrite;
 
   // Couldn't detect type
   return -1;
 }
 
+static ASTNode *parse_expr(Tokeniser *tokeniser);
+
+// Parse a subscript: [<expression>] or [<expression>, <expression>]
+// column is left NULL for a single expression. On failure, neither is set.
+static int parse_subscript(Tokeniser *tokeniser, ASTNode **index, ASTNode **column) {
+  if(!tokeniser_expect(tokeniser, 1, TokenLBracket)) {
+    PERROR("Expected [\n");
+    PERROR_LOC
+    return 1;
+  }
+
+  ASTNode *first = parse_expr(tokeniser);
+  if(!first) {
+    PERROR("Failed to parse index.\n");
+    return 1;
+  }
+
+  ASTNode *second = NULL;
+  if(tokeniser_expect(tokeniser, 1, TokenComma)) {
+    second = parse_expr(tokeniser);
+    if(!second) {
+      PERROR("Failed to parse column index.\n");
+      node_destroy(&first);
+      return 1;
+    }
+  }
+
+  if(!tokeniser_expect(tokeniser, 1, TokenRBracket)) {
+    PERROR("Expected ]\n");
+    PERROR_LOC
+    node_destroy(&first);
+    node_destroy(&second);
+    return 1;
+  }
+
+  *index = first;
+  *column = second;
+  return 0;
+}
+
 // Parse a variable declaration
+// Arrays are declared with ARRAY OF <type> <id>, optionally followed by an
+// initial length in square brackets, or by rows and columns for a
+// two-dimensional array.
 static ASTNode *parse_var_decl(Tokeniser *tokeniser) {
   if(!tokeniser) return NULL;
-  Token *type_tok = tokeniser_expect(tokeniser, 4, TokenInteger, TokenReal, TokenBoolean, TokenCharacter);
+  Token *type_tok = tokeniser_expect(tokeniser, 6, TokenInteger, TokenReal, TokenBoolean, TokenCharacter, TokenString, TokenArray);
   if(!type_tok) {
     PERROR("Expected variable type\n");
     PERROR_LOC
@@ -164,6 +332,22 @@ static ASTNode *parse_var_decl(Tokeniser *tokeniser) {
   }
 
   VarType type = token_type_to_var_type(type_tok->type);
+  VarType elem_type = -1;
+  if(type == VarArray) {
+    if(!tokeniser_expect(tokeniser, 1, TokenOf)) {
+      PERROR("Expected OF\n");
+      PERROR_LOC
+      return NULL;
+    }
+    Token *elem_tok = tokeniser_expect(tokeniser, 5, TokenInteger, TokenReal, TokenBoolean, TokenCharacter, TokenString);
+    if(!elem_tok) {
+      PERROR("Expected array element type\n");
+      PERROR_LOC
+      return NULL;
+    }
+    elem_type = token_type_to_var_type(elem_tok->type);
+  }
+
   Token *ident_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
   if(!ident_tok) {
     PERROR("Expected identifier.\n");
@@ -185,24 +369,28 @@ static ASTNode *parse_var_decl(Tokeniser *tokeniser) {
   }
 
   node->var_decl.type = type;
+  node->var_decl.elem_type = elem_type;
   node->var_decl.id = id;
+
+  Token *next_tok = tokeniser_top(tokeniser);
+  if(type == VarArray && next_tok && next_tok->type == TokenLBracket) {
+    if(parse_subscript(tokeniser, &node->var_decl.length, &node->var_decl.columns) != 0) {
+      PERROR("Failed to parse array length.\n");
+      node_destroy(&node);
+      return NULL;
+    }
+  }
+
   return node;
 }
 
 // OKay
 // What are all tokens that can be in an expression
 
-#define VALUE_TYPES TokenIdentifier, TokenIntLit
-#define OPERATOR_TOKS TokenAdd, TokenSubtract, TokenDivide, TokenMultiply, TokenExponent, TokenModulo, TokenIntDiv, TokenEqualTo, TokenNEqualTo, TokenGreaterThan, TokenGreaterThanEq, TokenLessThan, TokenLessThanEq
-#define OPERATOR_PRECEDENCES 1, 1, 2, 2, 3, 2, 2, 0, 0, 0, 0, 0, 0
-#define OPERATOR_OPS OpAdd, OpSubtract, OpDivide, OpMultiply, OpExponent, OpModulo, OpIntDiv, OpEqual, OpNEqual, OpGreaterThan, OpGreaterThanEq, OpLessThan, OpLessThanEq
-
-static Token *consume_expr_tok(Tokeniser *tokeniser) {
-  // Stupid hack
-  TokenType toks[] = {VALUE_TYPES, OPERATOR_TOKS};
-  size_t num = sizeof(toks) / sizeof(toks[0]);
-  return tokeniser_expect(tokeniser, num, VALUE_TYPES, OPERATOR_TOKS);
-}
+#define VALUE_TYPES TokenIdentifier, TokenIntLit, TokenRealLit, TokenBooleanLit, TokenCharacterLit, TokenStringLit
+#define OPERATOR_TOKS TokenAdd, TokenSubtract, TokenDivide, TokenMultiply, TokenExponent, TokenModulo, TokenIntDiv, TokenEqualTo, TokenNEqualTo, TokenGreaterThan, TokenGreaterThanEq, TokenLessThan, TokenLessThanEq, TokenAnd, TokenOr, TokenAppend
+#define OPERATOR_PRECEDENCES 4, 4, 5, 5, 6, 5, 5, 2, 2, 2, 2, 2, 2, 1, 0, 3
+#define OPERATOR_OPS OpAdd, OpSubtract, OpDivide, OpMultiply, OpExponent, OpModulo, OpIntDiv, OpEqual, OpNEqual, OpGreaterThan, OpGreaterThanEq, OpLessThan, OpLessThanEq, OpAnd, OpOr, OpAppend
 
 static int is_op_tok(Token *tok) {
   TokenType op_toks[] = {OPERATOR_TOKS};
@@ -328,14 +516,6 @@ static Token *token_queue_pop(TokenQueue *queue) {
   return (queue->toks[--queue->count]);
 }
 
-static Token *token_queue_pop_front(TokenQueue *queue) {
-  if(!queue || !queue->count) return NULL;
-  Token *tok = queue->toks[0];
-  memmove(queue->toks, queue->toks + 1, sizeof(Token *) * (queue->count - 1));
-  queue->count--;
-  return tok;
-}
-
 static ASTNode *make_int_lit(char *val) {
   if(!val) return NULL;
   int int_val = atoi(val);
@@ -350,6 +530,93 @@ static ASTNode *make_int_lit(char *val) {
   return node;
 }
 
+static ASTNode *make_real_lit(char *val) {
+  if(!val) return NULL;
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    return NULL;
+  }
+
+  node->expr.type = ExprReal;
+  node->expr.real_val = strtod(val, NULL);
+  return node;
+}
+
+static ASTNode *make_bool_lit(char *val) {
+  if(!val) return NULL;
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    return NULL;
+  }
+
+  node->expr.type = ExprBool;
+  node->expr.bool_val = strcmp(val, "TRUE") == 0;
+  return node;
+}
+
+// Make a character literal from its token, which still has its quotes
+// Read the character after a backslash in a literal
+static char unescape(char c) {
+  switch(c) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case '0':
+    return '\0';
+  default:
+    return c;
+  }
+}
+
+static ASTNode *make_char_lit(char *val) {
+  if(!val) return NULL;
+  char c = val[1];
+  if(c == '\\') c = unescape(val[2]);
+
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    return NULL;
+  }
+
+  node->expr.type = ExprChar;
+  node->expr.char_val = c;
+  return node;
+}
+
+static ASTNode *make_str_lit(char *val) {
+  if(!val) return NULL;
+
+  // Drop the quotes and resolve escapes, which only ever shortens the text
+  size_t val_len = strlen(val);
+  char *data = malloc(val_len);
+  if(!data) {
+    PERROR("malloc() failed.\n");
+    return NULL;
+  }
+  size_t length = 0;
+  for(size_t i = 1; i + 1 < val_len; i++) {
+    if(val[i] == '\\' && i + 2 < val_len) data[length++] = unescape(val[++i]);
+    else data[length++] = val[i];
+  }
+  data[length] = '\0';
+
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    free(data);
+    return NULL;
+  }
+
+  node->expr.type = ExprString;
+  node->expr.string.data = data;
+  node->expr.string.length = length;
+  return node;
+}
+
 static ASTNode *make_var(char *val) {
   if(!val) return NULL;
   ASTNode *node = node_create(NodeExpr);
@@ -360,6 +627,11 @@ static ASTNode *make_var(char *val) {
 
   node->expr.type = ExprVar;
   node->expr.var_name = strdup(val);
+  if(!node->expr.var_name) {
+    PERROR("strdup() failed.\n");
+    node_destroy(&node);
+    return NULL;
+  }
   return node;
 }
 
@@ -369,6 +641,14 @@ ASTNode *create_value_node(Token *tok) {
   switch(tok->type) {
   case TokenIntLit:
     return make_int_lit(tok->value);
+  case TokenRealLit:
+    return make_real_lit(tok->value);
+  case TokenBooleanLit:
+    return make_bool_lit(tok->value);
+  case TokenCharacterLit:
+    return make_char_lit(tok->value);
+  case TokenStringLit:
+    return make_str_lit(tok->value);
   case TokenIdentifier:
     return make_var(tok->value);
   default:
@@ -399,291 +679,377 @@ ASTNode *create_expr_node(ASTNode *a, ASTNode *b, Token *op_tok) {
   return node;
 }
 
-// Parse an expression
-// TODO: Make this function memory safe.
-// RIght now, it doesnt free all memory on failure (value queue)
-static ASTNode *parse_expr(Tokeniser *tokeniser) {
-  if(!tokeniser) return NULL;
-  Token *tok = NULL;
-
-  TokenQueue *output_queue = token_queue_create();
-  if(!output_queue) {
-    PERROR("Failed to allocate output queue.\n");
-    return NULL;
-  }
-
-  TokenQueue *op_queue = token_queue_create();
-  if(!op_queue) {
-    PERROR("Failed to allocate operator queue.\n");
-    token_queue_destroy(&output_queue);
-    return NULL;
-  }
+// Parse a comma separated list of expressions up to a closing token
+// The opening token must already have been consumed.
+static int parse_expr_list(Tokeniser *tokeniser, TokenType close, ASTNode ***out, size_t *out_count) {
+  NodeStack items = {0};
 
-  while((tok = consume_expr_tok(tokeniser))) {
-    if(is_value_tok(tok)) {
-      // put into output queue
-      if(token_queue_push(output_queue, tok) != 0) {
-        PERROR("Failed to append value to output queue.\n");
-        goto err;
-      }
-    } else if(is_op_tok(tok)) {
-      // while top of op stack has greater precedence: pop from op stack to
-      //  output
-      Token *popped = token_queue_pop(op_queue);
-      while(popped && token_precedence(popped) >= token_precedence(tok)) {
-        if(token_queue_push(output_queue, popped) != 0) {
-          PERROR("Failed to push operator to output queue.\n");
-          goto err;
-        }
-        popped = token_queue_pop(op_queue);
-      }
-      if(popped) {
-        if(token_queue_push(op_queue, popped) != 0) {
-          PERROR("Failed to return operator to operator queue.\n");
-          goto err;
-        }
-      }
-      // push into op stack
-      if(token_queue_push(op_queue, tok) != 0) {
-        PERROR("Failed to push operator to operator queue.\n");
+  if(!tokeniser_expect(tokeniser, 1, close)) {
+    while(1) {
+      ASTNode *item = parse_expr(tokeniser);
+      if(!item) {
+        PERROR("Failed to parse list item.\n");
         goto err;
       }
-    }
-    // TODO: parenthesis
-    else {
-      PERROR("huh\n");
-      PERROR_LOC
-      continue;
-    }
-  }
-
-  // while there are tokens on the operator stack:
-  //   pop the operator from the operator stack onto the output queue
-  Token *op_tok = token_queue_pop(op_queue);
-  while(op_tok) {
-    if(token_queue_push(output_queue, op_tok) != 0) {
-      PERROR("Failed to push remaining operator to output queue.\n");
-      goto err;
-    }
-    op_tok = token_queue_pop(op_queue);
-  }
-
-  token_queue_destroy(&op_queue);
-
-  // OKay
-  // now the algorithm is something like:
-  // while there are values in the otuput queue:
-  //   if the value is a value:
-  //     create an expression node with that value
-  //     push to value stack
-  //   if the value is an operator:
-  //     pop value_b from value stack
-  //     pop value_a from value stack
-  //     create an expression node of (value_a op value_b)
-  //     push to value stack
-  // final expression node = pop from value stack
-
-  // IDC fixed size queue
-  ASTNode *value_queue[256] = {0};
-  size_t count = 0;
-
-  Token *popped = token_queue_pop_front(output_queue);
-  // while there are values in the otuput queue:
-  while(popped) {
-    // if the value is a value:
-    if(is_value_tok(popped)) {
-      // create an expression node with that value
-      ASTNode *value_node = create_value_node(popped);
-      // push to value stack
-      if(count < 256)
-        value_queue[count++] = value_node;
-      else {
-        PERROR("Stack overflow!!\n");
-        node_destroy(&value_node);
+      if(node_stack_push(&items, item) != 0) {
+        node_destroy(&item);
         goto err;
       }
-    } else if(is_op_tok(popped)) {
-      // pop value_b from value stack
-      ASTNode *value_b = count > 0 ? value_queue[--count] : NULL;
-      // pop value_a from value stack
-      ASTNode *value_a = count > 0 ? value_queue[--count] : NULL;
-      if(!value_b || !value_a) {
-        if(value_b) node_destroy(&value_b);
-        if(value_a) node_destroy(&value_a);
-        PERROR("Failed to get value from value queue.\n");
+      if(tokeniser_expect(tokeniser, 1, close)) break;
+      if(!tokeniser_expect(tokeniser, 1, TokenComma)) {
+        PERROR("Expected , or closing bracket\n");
         PERROR_LOC
         goto err;
       }
-      // create an expression node of (value_a op value_b)
-      ASTNode *expr_node = create_expr_node(value_a, value_b, popped);
-      // push to value stack
-      if(count < 256)
-        value_queue[count++] = expr_node;
-      else {
-        node_destroy(&expr_node);
-        PERROR("Stack overflow!!\n");
-        goto err;
-      }
-    } else {
-      PERROR("huh!!\n");
-      goto err;
-    }
-    popped = token_queue_pop_front(output_queue);
-  }
-
-  token_queue_destroy(&output_queue);
-
-  // final expression node = pop from value stack
-
-  if(count != 1) {
-    PERROR("Too many values left in value queue.\n");
-    PERROR_LOC
-    for(size_t i = 0; i < count; i++) {
-      node_destroy(&value_queue[i]);
     }
-    goto err;
   }
 
-  return value_queue[0];
+  *out = items.nodes;
+  *out_count = items.count;
+  return 0;
 
 err:
-  token_queue_destroy(&output_queue);
-  token_queue_destroy(&op_queue);
-  return NULL;
+  for(size_t i = 0; i < items.count; i++)
+    node_destroy(&items.nodes[i]);
+  free(items.nodes);
+  return 1;
 }
 
-// Parse a variable assignment
-static ASTNode *parse_var_assign(Tokeniser *tokeniser) {
-  if(!tokeniser) return NULL;
-  Token *set_tok = tokeniser_expect(tokeniser, 1, TokenSet);
-  if(!set_tok) {
-    PERROR("Expected SET\n");
+// Parse an array literal: [<expression>, ...]
+static ASTNode *parse_array_lit(Tokeniser *tokeniser) {
+  if(!tokeniser_expect(tokeniser, 1, TokenLBracket)) {
+    PERROR("Expected [\n");
+    PERROR_LOC
     return NULL;
   }
 
-  Token *id_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
-  if(!id_tok) {
-    PERROR("Expected identifier\n");
-    return NULL;
-  }
-  char *id = strdup(id_tok->value);
-  if(!id) {
-    PERROR("strdup() failed.\n");
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
     return NULL;
   }
+  node->expr.type = ExprArray;
 
-  Token *to_tok = tokeniser_expect(tokeniser, 1, TokenTo);
-  if(!to_tok) {
-    PERROR("Expected TO\n");
-    free(id);
+  if(parse_expr_list(tokeniser, TokenRBracket, &node->expr.array.items, &node->expr.array.count) != 0) {
+    PERROR("Failed to parse array literal.\n");
+    node_destroy(&node);
     return NULL;
   }
+  return node;
+}
 
-  // Expression
-  ASTNode *expr_node = parse_expr(tokeniser);
-  if(!expr_node) {
-    PERROR("Failed to parse expression.\n");
-    free(id);
+// Parse a built in function call, after its name: (<expression>, ...)
+static ASTNode *parse_call(Tokeniser *tokeniser, Token *name_tok) {
+  if(!tokeniser_expect(tokeniser, 1, TokenLParen)) {
+    PERROR("Expected (\n");
+    PERROR_LOC
     return NULL;
   }
 
-  ASTNode *node = node_create(NodeVarAssign);
+  ASTNode *node = node_create(NodeExpr);
   if(!node) {
     PERROR("Failed to create node.\n");
-    node_destroy(&expr_node);
-    free(id);
     return NULL;
   }
+  node->expr.type = ExprCall;
 
-  node->var_assign.id = id;
-  node->var_assign.expr = expr_node;
+  node->expr.call.name = strdup(name_tok->value);
+  if(!node->expr.call.name) {
+    PERROR("strdup() failed.\n");
+    node_destroy(&node);
+    return NULL;
+  }
 
+  if(parse_expr_list(tokeniser, TokenRParen, &node->expr.call.args, &node->expr.call.argc) != 0) {
+    PERROR("Failed to parse arguments of %s.\n", name_tok->value);
+    node_destroy(&node);
+    return NULL;
+  }
   return node;
 }
 
-static ASTNode *parse_statement(Tokeniser *tokeniser);
+// Parse an index into an array value: [<expression>] or
+// [<expression>, <expression>]
+// Takes ownership of array.
+static ASTNode *parse_index(Tokeniser *tokeniser, ASTNode *array) {
+  ASTNode *index = NULL;
+  ASTNode *column = NULL;
+  if(parse_subscript(tokeniser, &index, &column) != 0) goto err;
 
-ASTNode *parse_until(Tokeniser *tokeniser, size_t n, ...) {
-  if(!tokeniser) return NULL;
+  ASTNode *node = node_create(NodeExpr);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    goto err;
+  }
 
-  size_t allocated = 16;
-  size_t count = 0;
-  ASTNode **out = malloc(sizeof(ASTNode *) * allocated);
-  if(!out) return NULL;
+  node->expr.type = ExprIndex;
+  node->expr.index.array = array;
+  node->expr.index.index = index;
+  node->expr.index.column = column;
+  return node;
 
-  while(1) {
-    if(tokeniser_done(tokeniser)) {
-      if(n == 0)
-        break;
-      else {
-        PERROR("Unexpected end of tokens.\n");
+err:
+  node_destroy(&array);
+  node_destroy(&index);
+  node_destroy(&column);
+  return NULL;
+}
+
+// Parse any indexes following a value
+static ASTNode *parse_indexes(Tokeniser *tokeniser, ASTNode *node) {
+  while(node) {
+    Token *next = tokeniser_top(tokeniser);
+    if(!next || next->type != TokenLBracket) break;
+    node = parse_index(tokeniser, node);
+  }
+  return node;
+}
+
+// Parse a single value of an expression
+// A literal, variable, function call or array literal, followed by any number
+// of indexes. Parentheses are left to parse_expr().
+static ASTNode *parse_value(Tokeniser *tokeniser) {
+  Token *tok = tokeniser_top(tokeniser);
+  if(!tok) {
+    PERROR("Expected a value, reached end of tokens.\n");
+    return NULL;
+  }
+
+  ASTNode *node = NULL;
+  if(tok->type == TokenLBracket) {
+    node = parse_array_lit(tokeniser);
+  } else if(is_value_tok(tok)) {
+    tokeniser_expect(tokeniser, 1, tok->type);
+    Token *next = tokeniser_top(tokeniser);
+    if(tok->type == TokenIdentifier && next && next->type == TokenLParen)
+      node = parse_call(tokeniser, tok);
+    else
+      node = create_value_node(tok);
+  } else {
+    PERROR("Expected a value.\n");
+    PERROR_LOC
+    return NULL;
+  }
+
+  return parse_indexes(tokeniser, node);
+}
+
+// Pop two values and an operator, and push the expression combining them
+static int reduce_expr(NodeStack *values, Token *op_tok) {
+  // pop value_b from value stack
+  ASTNode *value_b = values->count > 0 ? values->nodes[--values->count] : NULL;
+  // pop value_a from value stack
+  ASTNode *value_a = values->count > 0 ? values->nodes[--values->count] : NULL;
+  if(!value_b || !value_a) {
+    if(value_b) node_destroy(&value_b);
+    if(value_a) node_destroy(&value_a);
+    PERROR("Failed to get value from value stack.\n");
+    return 1;
+  }
+  // create an expression node of (value_a op value_b)
+  ASTNode *expr_node = create_expr_node(value_a, value_b, op_tok);
+  if(!expr_node) {
+    node_destroy(&value_a);
+    node_destroy(&value_b);
+    return 1;
+  }
+  // push to value stack
+  if(node_stack_push(values, expr_node) != 0) {
+    node_destroy(&expr_node);
+    return 1;
+  }
+  return 0;
+}
+
+// Parse an expression
+// Values and operators alternate until a token that can't continue the
+// expression. Instead of building an output queue, operators popped by the
+// shunting yard algorithm are combined with the top two values straight away.
+// Parentheses go on the operator stack too, so however deeply they're nested
+// they don't recurse.
+static ASTNode *parse_expr(Tokeniser *tokeniser) {
+  if(!tokeniser) return NULL;
+
+  NodeStack values = {0};
+  size_t open = 0;
+  TokenQueue *op_queue = token_queue_create();
+  if(!op_queue) {
+    PERROR("Failed to allocate operator queue.\n");
+    return NULL;
+  }
+
+  while(1) {
+    // Any number of parentheses can open before a value
+    Token *tok = tokeniser_top(tokeniser);
+    while(tok && tok->type == TokenLParen) {
+      tokeniser_expect(tokeniser, 1, TokenLParen);
+      if(token_queue_push(op_queue, tok) != 0) {
+        PERROR("Failed to push ( to operator queue.\n");
         goto err;
       }
+      open++;
+      tok = tokeniser_top(tokeniser);
     }
 
-    Token *tok = tokeniser_top(tokeniser);
+    ASTNode *value = parse_value(tokeniser);
+    if(!value) {
+      PERROR("Failed to parse value.\n");
+      goto err;
+    }
+    if(node_stack_push(&values, value) != 0) {
+      node_destroy(&value);
+      goto err;
+    }
 
-    va_list args;
-    va_start(args, n);
-    int should_stop = 0;
-    for(size_t i = 0; i < n; i++) {
-      TokenType expected_type = va_arg(args, TokenType);
-      if(tok->type == expected_type) {
-        should_stop = 1;
-        break;
+    // and any number can close after one, each followed by any indexes of
+    // what it closes
+    tok = tokeniser_top(tokeniser);
+    while(open > 0 && tok && tok->type == TokenRParen) {
+      tokeniser_expect(tokeniser, 1, TokenRParen);
+      Token *popped = token_queue_pop(op_queue);
+      while(popped->type != TokenLParen) {
+        if(reduce_expr(&values, popped) != 0) {
+          PERROR("Failed to build expression.\n");
+          PERROR_LOC
+          goto err;
+        }
+        popped = token_queue_pop(op_queue);
       }
+      open--;
+      ASTNode *closed = values.nodes[--values.count];
+      closed = parse_indexes(tokeniser, closed);
+      if(!closed) goto err;
+      values.nodes[values.count++] = closed;
+      tok = tokeniser_top(tokeniser);
     }
-    va_end(args);
 
-    if(should_stop)
-      break;
+    if(!tok || !is_op_tok(tok)) break;
+    tokeniser_expect(tokeniser, 1, tok->type);
 
-    ASTNode *statement = parse_statement(tokeniser);
-    if(!statement) {
-      if(n == 0 && tokeniser_done(tokeniser)) break;
-      PERROR("Failed to parse a statement.\n");
-      PERROR_LOC
-      goto err;
+    // while top of op stack has greater precedence: pop from op stack to
+    //  output
+    // ( has no precedence, so nothing is popped past it.
+    Token *popped = token_queue_pop(op_queue);
+    while(popped && token_precedence(popped) >= token_precedence(tok)) {
+      if(reduce_expr(&values, popped) != 0) {
+        PERROR("Failed to build expression.\n");
+        PERROR_LOC
+        goto err;
+      }
+      popped = token_queue_pop(op_queue);
     }
-
-    if(count >= allocated) {
-      allocated *= 2;
-      ASTNode **new = realloc(out, sizeof(ASTNode *) * allocated);
-      if(!new) {
-        PERROR("realloc() failed.\n");
-        node_destroy(&statement);
+    if(popped) {
+      if(token_queue_push(op_queue, popped) != 0) {
+        PERROR("Failed to return operator to operator queue.\n");
         goto err;
       }
-      out = new;
     }
+    // push into op stack
+    if(token_queue_push(op_queue, tok) != 0) {
+      PERROR("Failed to push operator to operator queue.\n");
+      goto err;
+    }
+  }
+
+  if(open > 0) {
+    PERROR("Expected )\n");
+    PERROR_LOC
+    goto err;
+  }
 
-    out[count++] = statement;
+  // while there are tokens on the operator stack:
+  //   pop the operator from the operator stack onto the output
+  Token *op_tok = token_queue_pop(op_queue);
+  while(op_tok) {
+    if(reduce_expr(&values, op_tok) != 0) {
+      PERROR("Failed to build expression.\n");
+      PERROR_LOC
+      goto err;
+    }
+    op_tok = token_queue_pop(op_queue);
   }
 
-  if(count == 0) {
-    PERROR("Empty block\n");
+  token_queue_destroy(&op_queue);
+
+  // final expression node = pop from value stack
+  if(values.count != 1) {
+    PERROR("Too many values left in value stack.\n");
+    PERROR_LOC
     goto err;
   }
 
-  ASTNode *node = node_create(NodeBlock);
+  ASTNode *node = values.nodes[0];
+  free(values.nodes);
+  return node;
+
+err:
+  for(size_t i = 0; i < values.count; i++)
+    node_destroy(&values.nodes[i]);
+  free(values.nodes);
+  token_queue_destroy(&op_queue);
+  return NULL;
+}
+
+// Parse a variable assignment
+static ASTNode *parse_var_assign(Tokeniser *tokeniser) {
+  if(!tokeniser) return NULL;
+  Token *set_tok = tokeniser_expect(tokeniser, 1, TokenSet);
+  if(!set_tok) {
+    PERROR("Expected SET\n");
+    return NULL;
+  }
+
+  Token *id_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
+  if(!id_tok) {
+    PERROR("Expected identifier\n");
+    return NULL;
+  }
+
+  ASTNode *node = node_create(NodeVarAssign);
   if(!node) {
-    PERROR("node_create() failed.\n");
+    PERROR("Failed to create node.\n");
+    return NULL;
+  }
+
+  node->var_assign.id = strdup(id_tok->value);
+  if(!node->var_assign.id) {
+    PERROR("strdup() failed.\n");
+    goto err;
+  }
+
+  // Array element
+  Token *next_tok = tokeniser_top(tokeniser);
+  if(next_tok && next_tok->type == TokenLBracket) {
+    if(parse_subscript(tokeniser, &node->var_assign.index, &node->var_assign.column) != 0) {
+      PERROR("Failed to parse index.\n");
+      goto err;
+    }
+  }
+
+  Token *to_tok = tokeniser_expect(tokeniser, 1, TokenTo);
+  if(!to_tok) {
+    PERROR("Expected TO\n");
     goto err;
   }
 
-  node->block.count = count;
-  node->block.statements = out;
+  // Expression
+  node->var_assign.expr = parse_expr(tokeniser);
+  if(!node->var_assign.expr) {
+    PERROR("Failed to parse expression.\n");
+    goto err;
+  }
 
   return node;
 
 err:
-  for(size_t i = 0; i < count; i++)
-    node_destroy(&out[i]);
-  free(out);
+  node_destroy(&node);
   return NULL;
 }
 
-static ASTNode *parse_if(Tokeniser *tokeniser) {
+// Parse the head of an IF statement: IF <expression> THEN
+// Returns an IF node with only its condition filled in; the blocks are filled
+// in by parse_program() once they have been parsed.
+static ASTNode *parse_if_head(Tokeniser *tokeniser) {
   if(!tokeniser) return NULL;
 
   Token *if_tok = tokeniser_expect(tokeniser, 1, TokenIf);
@@ -693,11 +1059,7 @@ static ASTNode *parse_if(Tokeniser *tokeniser) {
     return NULL;
   }
 
-  ASTNode *cond = NULL;
-  ASTNode *if_block = NULL;
-  ASTNode *else_block = NULL;
-
-  cond = parse_expr(tokeniser);
+  ASTNode *cond = parse_expr(tokeniser);
   if(!cond) {
     PERROR("Failed to parse condition.\n");
     return NULL;
@@ -706,54 +1068,23 @@ static ASTNode *parse_if(Tokeniser *tokeniser) {
   if(!tokeniser_expect(tokeniser, 1, TokenThen)) {
     PERROR("Expected THEN\n");
     PERROR_LOC
-    goto err;
-  }
-
-  if_block = parse_until(tokeniser, 2, TokenEnd, TokenElse);
-  if(!if_block) {
-    PERROR("Failed to parse IF statements.\n");
-    goto err;
-  }
-
-  Token *top = tokeniser_top(tokeniser);
-  if(top->type == TokenElse) {
-    tokeniser_expect(tokeniser, 1, TokenElse);
-    else_block = parse_until(tokeniser, 1, TokenEnd);
-    if(!else_block) {
-      PERROR("Failed to parse ELSE statements.\n");
-      goto err;
-    }
-  }
-
-  if(!tokeniser_expect(tokeniser, 1, TokenEnd) ||
-     !tokeniser_expect(tokeniser, 1, TokenIf)) {
-    PERROR("Expected END IF\n");
-    PERROR_LOC
-    goto err;
+    node_destroy(&cond);
+    return NULL;
   }
 
   ASTNode *node = node_create(NodeIf);
   if(!node) {
     PERROR("Failed to create node.\n");
-    goto err;
+    node_destroy(&cond);
+    return NULL;
   }
 
   node->if_stmt.condition = cond;
-  node->if_stmt.if_block = if_block;
-  node->if_stmt.else_block = else_block;
-
   return node;
-
-err:
-  node_destroy(&cond);
-  node_destroy(&if_block);
-  node_destroy(&else_block);
-
-  return NULL;
 }
 
-// Parse a while loop
-static ASTNode *parse_while(Tokeniser *tokeniser) {
+// Parse the head of a while loop: WHILE <expression> DO
+static ASTNode *parse_while_head(Tokeniser *tokeniser) {
   if(!tokeniser) return NULL;
 
   Token *while_tok = tokeniser_expect(tokeniser, 1, TokenWhile);
@@ -763,10 +1094,7 @@ static ASTNode *parse_while(Tokeniser *tokeniser) {
     return NULL;
   }
 
-  ASTNode *cond = NULL;
-  ASTNode *while_block = NULL;
-
-  cond = parse_expr(tokeniser);
+  ASTNode *cond = parse_expr(tokeniser);
   if(!cond) {
     PERROR("Failed to parse condition.\n");
     return NULL;
@@ -775,37 +1103,109 @@ static ASTNode *parse_while(Tokeniser *tokeniser) {
   if(!tokeniser_expect(tokeniser, 1, TokenDo)) {
     PERROR("Expected DO\n");
     PERROR_LOC
-    goto err;
+    node_destroy(&cond);
+    return NULL;
   }
 
-  while_block = parse_until(tokeniser, 1, TokenEnd);
-  if(!while_block) {
-    PERROR("Failed to parse WHILE statements.\n");
-    goto err;
+  ASTNode *node = node_create(NodeWhile);
+  if(!node) {
+    PERROR("Failed to create node.\n");
+    node_destroy(&cond);
+    return NULL;
   }
 
-  if(!tokeniser_expect(tokeniser, 1, TokenEnd) ||
-     !tokeniser_expect(tokeniser, 1, TokenWhile)) {
-    PERROR("Expected END WHILE\n");
+  node->while_stmt.condition = cond;
+  return node;
+}
+
+// Parse the head of a for loop
+// Either FOR <id> FROM <expression> TO <expression> [STEP <expression>] DO
+// or FOR EACH <id> FROM <expression> DO
+static ASTNode *parse_for_head(Tokeniser *tokeniser) {
+  if(!tokeniser) return NULL;
+
+  Token *for_tok = tokeniser_expect(tokeniser, 1, TokenFor);
+  if(!for_tok) {
+    PERROR("Expected FOR\n");
     PERROR_LOC
-    goto err;
+    return NULL;
   }
 
-  ASTNode *node = node_create(NodeWhile);
+  int each = tokeniser_expect(tokeniser, 1, TokenEach) != NULL;
+
+  Token *id_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
+  if(!id_tok) {
+    PERROR("Expected identifier\n");
+    PERROR_LOC
+    return NULL;
+  }
+
+  ASTNode *node = node_create(each ? NodeForEach : NodeFor);
   if(!node) {
     PERROR("Failed to create node.\n");
+    return NULL;
+  }
+
+  char *id = strdup(id_tok->value);
+  if(!id) {
+    PERROR("strdup() failed.\n");
     goto err;
   }
+  if(each)
+    node->for_each.id = id;
+  else
+    node->for_stmt.id = id;
 
-  node->while_stmt.condition = cond;
-  node->while_stmt.while_block = while_block;
+  if(!tokeniser_expect(tokeniser, 1, TokenFrom)) {
+    PERROR("Expected FROM\n");
+    PERROR_LOC
+    goto err;
+  }
+
+  if(each) {
+    node->for_each.array = parse_expr(tokeniser);
+    if(!node->for_each.array) {
+      PERROR("Failed to parse FOR EACH array.\n");
+      goto err;
+    }
+  } else {
+    node->for_stmt.from = parse_expr(tokeniser);
+    if(!node->for_stmt.from) {
+      PERROR("Failed to parse FOR start.\n");
+      goto err;
+    }
+
+    if(!tokeniser_expect(tokeniser, 1, TokenTo)) {
+      PERROR("Expected TO\n");
+      PERROR_LOC
+      goto err;
+    }
+
+    node->for_stmt.to = parse_expr(tokeniser);
+    if(!node->for_stmt.to) {
+      PERROR("Failed to parse FOR end.\n");
+      goto err;
+    }
+
+    if(tokeniser_expect(tokeniser, 1, TokenStep)) {
+      node->for_stmt.step = parse_expr(tokeniser);
+      if(!node->for_stmt.step) {
+        PERROR("Failed to parse FOR step.\n");
+        goto err;
+      }
+    }
+  }
+
+  if(!tokeniser_expect(tokeniser, 1, TokenDo)) {
+    PERROR("Expected DO\n");
+    PERROR_LOC
+    goto err;
+  }
 
   return node;
 
 err:
-  node_destroy(&cond);
-  node_destroy(&while_block);
-
+  node_destroy(&node);
   return NULL;
 }
 
@@ -860,78 +1260,767 @@ static ASTNode *parse_send(Tokeniser *tokeniser) {
   return node;
 }
 
-// Parse a statement
-static ASTNode *parse_statement(Tokeniser *tokeniser) {
-  // Detect the node type
-  NodeType type = detect_type(tokeniser);
-  if(type == -1) {
-    PERROR("Failed to detect statement type.\n");
+// Parse RECEIVE <identifier> FROM (<type>) <device>
+static ASTNode *parse_receive(Tokeniser *tokeniser) {
+  if(!tokeniser_expect(tokeniser, 1, TokenReceive)) {
+    PERROR("Expected RECEIVE\n");
     PERROR_LOC
     return NULL;
   }
 
-  switch(type) {
-  case NodeVarDecl:
-    return parse_var_decl(tokeniser);
-  case NodeVarAssign:
-    return parse_var_assign(tokeniser);
-  case NodeIf:
-    return parse_if(tokeniser);
-  case NodeWhile:
-    return parse_while(tokeniser);
-  case NodeSend:
-    return parse_send(tokeniser);
-  default:
-    PERROR("Unimplemented node type %d\n", type);
+  Token *id_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
+  if(!id_tok) {
+    PERROR("Expected identifier.\n");
+    PERROR_LOC
     return NULL;
   }
-}
 
-static ASTNode *parse_program(Tokeniser *tokeniser) {
-  if(!tokeniser) return NULL;
-  ASTNode *block = parse_until(tokeniser, 0);
-  if(!block) {
-    PERROR("Failed to parse program.\n");
+  if(!tokeniser_expect(tokeniser, 1, TokenFrom) || !tokeniser_expect(tokeniser, 1, TokenLParen)) {
+    PERROR("Expected FROM (<type>)\n");
+    PERROR_LOC
     return NULL;
   }
 
-  ASTNode *node = node_create(NodeProgram);
-  if(!node) {
-    PERROR("node_create() failed.\n");
-    node_destroy(&block);
+  // Arrays can't be typed in
+  Token *type_tok = tokeniser_top(tokeniser);
+  VarType type = type_tok ? token_type_to_var_type(type_tok->type) : -1;
+  if(type == -1 || type == VarArray) {
+    PERROR("Expected INTEGER, REAL, BOOLEAN, CHARACTER or STRING.\n");
+    PERROR_LOC
     return NULL;
   }
+  tokeniser_expect(tokeniser, 1, type_tok->type);
 
-  node->program.block = block;
-  return node;
-}
+  if(!tokeniser_expect(tokeniser, 1, TokenRParen)) {
+    PERROR("Expected )\n");
+    PERROR_LOC
+    return NULL;
+  }
 
-// Construct an AST from a tokeniser's output
-Parser *parse(Tokeniser *tokeniser) {
-  if(!tokeniser || tokeniser->status != 0) {
-    PERROR("Invalid tokeniser passed.\n");
+  Token *device_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
+  if(!device_tok) {
+    PERROR("Expected device identifier.\n");
+    PERROR_LOC
     return NULL;
   }
 
-  // Create the parser
-  Parser *parser = parser_create();
-  if(!parser) {
-    PERROR("Failed to create parser.\n");
+  ASTNode *node = node_create(NodeReceive);
+  if(!node) {
+    PERROR("node_create() failed.\n");
     return NULL;
   }
 
-  parser->root = parse_program(tokeniser);
+  node->receive_stmt.type = type;
+  node->receive_stmt.id = strdup(id_tok->value);
+  node->receive_stmt.device_name = strdup(device_tok->value);
+  if(!node->receive_stmt.id || !node->receive_stmt.device_name) {
+    PERROR("strdup() failed.\n");
+    node_destroy(&node);
+    return NULL;
+  }
+  return node;
+}
+
+// Parse the file of a READ or WRITE: a string literal, or an identifier that
+// is used as the file's name
+static char *parse_file_name(Tokeniser *tokeniser) {
+  Token *tok = tokeniser_top(tokeniser);
+  if(!tok || (tok->type != TokenStringLit && tok->type != TokenIdentifier)) {
+    PERROR("Expected a file name.\n");
+    PERROR_LOC
+    return NULL;
+  }
+  tokeniser_expect(tokeniser, 1, tok->type);
+
+  if(tok->type == TokenIdentifier) {
+    char *path = strdup(tok->value);
+    if(!path) PERROR("strdup() failed.\n");
+    return path;
+  }
+
+  ASTNode *lit = make_str_lit(tok->value);
+  if(!lit) return NULL;
+  char *path = lit->expr.string.data;
+  lit->expr.string.data = NULL;
+  node_destroy(&lit);
+  if(strlen(path) == 0) {
+    PERROR("File name can't be empty.\n");
+    PERROR_LOC
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+// Parse READ <file> <identifier>, ...
+static ASTNode *parse_read(Tokeniser *tokeniser) {
+  if(!tokeniser_expect(tokeniser, 1, TokenRead)) {
+    PERROR("Expected READ\n");
+    PERROR_LOC
+    return NULL;
+  }
+
+  ASTNode *node = node_create(NodeRead);
+  if(!node) {
+    PERROR("node_create() failed.\n");
+    return NULL;
+  }
+  node->read_stmt.path = parse_file_name(tokeniser);
+  if(!node->read_stmt.path) {
+    node_destroy(&node);
+    return NULL;
+  }
+
+  do {
+    Token *id_tok = tokeniser_expect(tokeniser, 1, TokenIdentifier);
+    if(!id_tok) {
+      PERROR("Expected identifier.\n");
+      PERROR_LOC
+      node_destroy(&node);
+      return NULL;
+    }
+    char **ids = realloc(node->read_stmt.ids, sizeof(char *) * (node->read_stmt.count + 1));
+    if(!ids) {
+      PERROR("realloc() failed.\n");
+      node_destroy(&node);
+      return NULL;
+    }
+    node->read_stmt.ids = ids;
+    ids[node->read_stmt.count] = strdup(id_tok->value);
+    if(!ids[node->read_stmt.count]) {
+      PERROR("strdup() failed.\n");
+      node_destroy(&node);
+      return NULL;
+    }
+    node->read_stmt.count++;
+  } while(tokeniser_expect(tokeniser, 1, TokenComma));
+
+  return node;
+}
+
+// Parse WRITE <file> <expression>, ...
+static ASTNode *parse_write(Tokeniser *tokeniser) {
+  if(!tokeniser_expect(tokeniser, 1, TokenWrite)) {
+    PERROR("Expected WRITE\n");
+    PERROR_LOC
+    return NULL;
+  }
+
+  ASTNode *node = node_create(NodeWrite);
+  if(!node) {
+    PERROR("node_create() failed.\n");
+    return NULL;
+  }
+  node->write_stmt.path = parse_file_name(tokeniser);
+  if(!node->write_stmt.path) {
+    node_destroy(&node);
+    return NULL;
+  }
+
+  NodeStack items = {0};
+  do {
+    ASTNode *item = parse_expr(tokeniser);
+    if(!item) {
+      PERROR("Failed to parse WRITE field.\n");
+      break;
+    }
+    if(node_stack_push(&items, item) != 0) {
+      node_destroy(&item);
+      break;
+    }
+  } while(tokeniser_expect(tokeniser, 1, TokenComma));
+
+  // Anything parsed so far is destroyed with the node on failure
+  node->write_stmt.items = items.nodes;
+  node->write_stmt.count = items.count;
+  Token *next = tokeniser_top(tokeniser);
+  if(items.count == 0 || (next && next->type == TokenComma)) {
+    node_destroy(&node);
+    return NULL;
+  }
+  return node;
+}
+
+// Parse a statement that doesn't contain a block
+static ASTNode *parse_statement(Tokeniser *tokeniser) {
+  // Detect the node type
+  NodeType type = detect_type(tokeniser);
+  if(type == -1) {
+    PERROR("Failed to detect statement type.\n");
+    PERROR_LOC
+    return NULL;
+  }
+
+  switch(type) {
+  case NodeVarDecl:
+    return parse_var_decl(tokeniser);
+  case NodeVarAssign:
+    return parse_var_assign(tokeniser);
+  case NodeSend:
+    return parse_send(tokeniser);
+  case NodeReceive:
+    return parse_receive(tokeniser);
+  case NodeRead:
+    return parse_read(tokeniser);
+  case NodeWrite:
+    return parse_write(tokeniser);
+  default:
+    PERROR("Unimplemented node type %d\n", type);
+    return NULL;
+  }
+}
+
+// A block that is still being parsed, along with the node that owns it
+// owner is NULL for the program's top level block, otherwise it is the
+// partially built IF, WHILE or FOR node the block belongs to.
+typedef struct {
+  ASTNode *owner;
+  int in_else;
+  ASTNode **statements;
+  size_t count;
+  size_t alloced;
+} ParseFrame;
+
+typedef struct {
+  ParseFrame *frames;
+  size_t count;
+  size_t alloced;
+} ParseStack;
+
+static ParseFrame *parse_stack_push(ParseStack *stack, ASTNode *owner) {
+  if(stack->count >= stack->alloced) {
+    size_t alloced = stack->alloced ? stack->alloced * 2 : 16;
+    ParseFrame *new = realloc(stack->frames, sizeof(ParseFrame) * alloced);
+    if(!new) {
+      PERROR("realloc() failed.\n");
+      return NULL;
+    }
+    stack->frames = new;
+    stack->alloced = alloced;
+  }
+  ParseFrame *frame = &stack->frames[stack->count++];
+  *frame = (ParseFrame){.owner = owner};
+  return frame;
+}
+
+// Append a statement to a frame's block
+static int parse_frame_append(ParseFrame *frame, ASTNode *statement) {
+  if(frame->count >= frame->alloced) {
+    size_t alloced = frame->alloced ? frame->alloced * 2 : 16;
+    ASTNode **new = realloc(frame->statements, sizeof(ASTNode *) * alloced);
+    if(!new) {
+      PERROR("realloc() failed.\n");
+      return 1;
+    }
+    frame->statements = new;
+    frame->alloced = alloced;
+  }
+  frame->statements[frame->count++] = statement;
+  return 0;
+}
+
+// Turn a frame's statements into a block node, taking ownership of them
+static ASTNode *parse_frame_take_block(ParseFrame *frame) {
+  if(frame->count == 0) {
+    PERROR("Empty block\n");
+    return NULL;
+  }
+
+  ASTNode *node = node_create(NodeBlock);
+  if(!node) {
+    PERROR("node_create() failed.\n");
+    return NULL;
+  }
+
+  node->block.count = frame->count;
+  node->block.statements = frame->statements;
+  frame->statements = NULL;
+  frame->count = 0;
+  frame->alloced = 0;
+  return node;
+}
+
+// Free a frame's statements and its partially built owner
+static void parse_frame_destroy(ParseFrame *frame) {
+  for(size_t i = 0; i < frame->count; i++)
+    node_destroy(&frame->statements[i]);
+  free(frame->statements);
+  frame->statements = NULL;
+  frame->count = 0;
+  node_destroy(&frame->owner);
+}
+
+// Check if a token ends the block of a frame
+static int parse_frame_ends_at(ParseFrame *frame, Token *tok) {
+  if(!frame->owner) return 0;
+  if(tok->type == TokenEnd) return 1;
+  return frame->owner->type == NodeIf && !frame->in_else && tok->type == TokenElse;
+}
+
+// Name of the statement that owns a frame's block, for error messages
+static const char *parse_frame_name(ParseFrame *frame) {
+  switch(frame->owner->type) {
+  case NodeWhile:
+    return "WHILE";
+  case NodeFor:
+    return "FOR";
+  case NodeForEach:
+    return "FOREACH";
+  default:
+    return frame->in_else ? "ELSE" : "IF";
+  }
+}
+
+// Close the block of a frame whose terminating token is at the top
+// Returns 1 if the owner node is complete, 0 if the frame continues with an
+// ELSE block, or -1 on failure.
+static int parse_frame_close(Tokeniser *tokeniser, ParseFrame *frame) {
+  ASTNode *block = parse_frame_take_block(frame);
+  if(!block) {
+    PERROR("Failed to parse %s statements.\n", parse_frame_name(frame));
+    return -1;
+  }
+
+  ASTNode *owner = frame->owner;
+  if(owner->type != NodeIf) {
+    TokenType end_type = TokenWhile;
+    if(owner->type == NodeWhile) {
+      owner->while_stmt.while_block = block;
+    } else if(owner->type == NodeFor) {
+      owner->for_stmt.for_block = block;
+      end_type = TokenFor;
+    } else {
+      owner->for_each.for_block = block;
+      end_type = TokenForEach;
+    }
+    if(!tokeniser_expect(tokeniser, 1, TokenEnd) ||
+       !tokeniser_expect(tokeniser, 1, end_type)) {
+      PERROR("Expected END %s\n", parse_frame_name(frame));
+      PERROR_LOC
+      return -1;
+    }
+    return 1;
+  }
+
+  if(frame->in_else)
+    owner->if_stmt.else_block = block;
+  else
+    owner->if_stmt.if_block = block;
+
+  if(tokeniser_expect(tokeniser, 1, TokenElse)) {
+    frame->in_else = 1;
+    return 0;
+  }
+
+  if(!tokeniser_expect(tokeniser, 1, TokenEnd) ||
+     !tokeniser_expect(tokeniser, 1, TokenIf)) {
+    PERROR("Expected END IF\n");
+    PERROR_LOC
+    return -1;
+  }
+  return 1;
+}
+
+// Parse a whole program
+// IF, WHILE and FOR blocks are parsed with an explicit stack of open blocks rather
+// than by recursion, so nesting depth is only limited by memory.
+static ASTNode *parse_program(Tokeniser *tokeniser) {
+  if(!tokeniser) return NULL;
+
+  ParseStack stack = {0};
+  if(!parse_stack_push(&stack, NULL)) {
+    PERROR("Failed to allocate parse stack.\n");
+    return NULL;
+  }
+
+  while(1) {
+    ParseFrame *frame = &stack.frames[stack.count - 1];
+
+    if(tokeniser_done(tokeniser)) {
+      if(!frame->owner) break;
+      PERROR("Unexpected end of tokens.\n");
+      goto err;
+    }
+
+    Token *tok = tokeniser_top(tokeniser);
+    size_t line_no = tok->line_no;
+
+    // End of the current block
+    if(parse_frame_ends_at(frame, tok)) {
+      int close_status = parse_frame_close(tokeniser, frame);
+      if(close_status < 0) goto err;
+      if(close_status == 0) continue;
+
+      ASTNode *owner = frame->owner;
+      frame->owner = NULL;
+      parse_frame_destroy(frame);
+      stack.count--;
+      if(parse_frame_append(&stack.frames[stack.count - 1], owner) != 0) {
+        node_destroy(&owner);
+        goto err;
+      }
+      continue;
+    }
+
+    // Start of a new block
+    if(tok->type == TokenIf || tok->type == TokenWhile || tok->type == TokenFor) {
+      ASTNode *owner = NULL;
+      if(tok->type == TokenIf)
+        owner = parse_if_head(tokeniser);
+      else if(tok->type == TokenWhile)
+        owner = parse_while_head(tokeniser);
+      else
+        owner = parse_for_head(tokeniser);
+      if(!owner) {
+        PERROR("Failed to parse a statement.\n");
+        PERROR_LOC
+        goto err;
+      }
+      owner->line_no = line_no;
+      if(!parse_stack_push(&stack, owner)) {
+        node_destroy(&owner);
+        goto err;
+      }
+      continue;
+    }
+
+    ASTNode *statement = parse_statement(tokeniser);
+    if(!statement) {
+      if(!frame->owner && tokeniser_done(tokeniser)) break;
+      PERROR("Failed to parse a statement.\n");
+      PERROR_LOC
+      goto err;
+    }
+    statement->line_no = line_no;
+
+    if(parse_frame_append(frame, statement) != 0) {
+      node_destroy(&statement);
+      goto err;
+    }
+  }
+
+  ASTNode *block = parse_frame_take_block(&stack.frames[0]);
+  parse_frame_destroy(&stack.frames[0]);
+  free(stack.frames);
+  if(!block) {
+    PERROR("Failed to parse program.\n");
+    return NULL;
+  }
+
+  ASTNode *node = node_create(NodeProgram);
+  if(!node) {
+    PERROR("node_create() failed.\n");
+    node_destroy(&block);
+    return NULL;
+  }
+
+  node->program.block = block;
+  return node;
+
+err:
+  while(stack.count > 0)
+    parse_frame_destroy(&stack.frames[--stack.count]);
+  free(stack.frames);
+  PERROR("Failed to parse program.\n");
+  return NULL;
+}
+
+// Push the children of a node that can contain expressions
+static int node_stack_push_children(NodeStack *stack, ASTNode *n) {
+  int push_status = 0;
+  switch(n->type) {
+  case NodeProgram:
+    push_status |= node_stack_push(stack, n->program.block);
+    break;
+  case NodeVarDecl:
+    push_status |= node_stack_push(stack, n->var_decl.length);
+    push_status |= node_stack_push(stack, n->var_decl.columns);
+    break;
+  case NodeVarAssign:
+    push_status |= node_stack_push(stack, n->var_assign.index);
+    push_status |= node_stack_push(stack, n->var_assign.column);
+    push_status |= node_stack_push(stack, n->var_assign.expr);
+    break;
+  case NodeExpr:
+    switch(n->expr.type) {
+    case ExprOp:
+      push_status |= node_stack_push(stack, n->expr.op.left);
+      push_status |= node_stack_push(stack, n->expr.op.right);
+      break;
+    case ExprArray:
+      for(size_t i = 0; i < n->expr.array.count; i++) push_status |= node_stack_push(stack, n->expr.array.items[i]);
+      break;
+    case ExprIndex:
+      push_status |= node_stack_push(stack, n->expr.index.array);
+      push_status |= node_stack_push(stack, n->expr.index.index);
+      push_status |= node_stack_push(stack, n->expr.index.column);
+      break;
+    case ExprCall:
+      for(size_t i = 0; i < n->expr.call.argc; i++) push_status |= node_stack_push(stack, n->expr.call.args[i]);
+      break;
+    default:
+      break;
+    }
+    break;
+  case NodeIf:
+    push_status |= node_stack_push(stack, n->if_stmt.condition);
+    push_status |= node_stack_push(stack, n->if_stmt.if_block);
+    push_status |= node_stack_push(stack, n->if_stmt.else_block);
+    break;
+  case NodeWhile:
+    push_status |= node_stack_push(stack, n->while_stmt.condition);
+    push_status |= node_stack_push(stack, n->while_stmt.while_block);
+    break;
+  case NodeFor:
+    push_status |= node_stack_push(stack, n->for_stmt.from);
+    push_status |= node_stack_push(stack, n->for_stmt.to);
+    push_status |= node_stack_push(stack, n->for_stmt.step);
+    push_status |= node_stack_push(stack, n->for_stmt.for_block);
+    break;
+  case NodeForEach:
+    push_status |= node_stack_push(stack, n->for_each.array);
+    push_status |= node_stack_push(stack, n->for_each.for_block);
+    break;
+  case NodeBlock:
+    for(size_t i = 0; i < n->block.count; i++) push_status |= node_stack_push(stack, n->block.statements[i]);
+    break;
+  case NodeSend:
+    push_status |= node_stack_push(stack, n->send_stmt.expr);
+    break;
+  case NodeWrite:
+    for(size_t i = 0; i < n->write_stmt.count; i++) push_status |= node_stack_push(stack, n->write_stmt.items[i]);
+    break;
+  default:
+    break;
+  }
+  return push_status;
+}
+
+// Check whether an array literal holds nothing but literals
+static int is_constant_array(ASTNode *node, int *constant) {
+  NodeStack stack = {0};
+  int status = node_stack_push(&stack, node);
+  *constant = 1;
+  while(!status && *constant && stack.count > 0) {
+    ASTNode *n = stack.nodes[--stack.count];
+    switch(n->expr.type) {
+    case ExprInt:
+    case ExprReal:
+    case ExprBool:
+    case ExprChar:
+    case ExprString:
+      break;
+    case ExprArray:
+      for(size_t i = 0; i < n->expr.array.count; i++) status |= node_stack_push(&stack, n->expr.array.items[i]);
+      break;
+    default:
+      *constant = 0;
+      break;
+    }
+  }
+  free(stack.nodes);
+  return status;
+}
+
+// Add a string literal to the constant pool
+static int add_string_constant(NodeStack *constants, ASTNode *node) {
+  node->expr.string.id = constants->count;
+  return node_stack_push(constants, node);
+}
+
+// Add a constant array literal to the constant pool, along with the strings in
+// it
+// Arrays nested in it are built along with it, rather than pooled on their
+// own.
+static int add_array_constant(NodeStack *constants, ASTNode *node) {
+  node->expr.array.constant = 1;
+  node->expr.array.id = constants->count;
+  NodeStack stack = {0};
+  int status = node_stack_push(constants, node);
+  for(size_t i = 0; !status && i < node->expr.array.count; i++) status = node_stack_push(&stack, node->expr.array.items[i]);
+  while(!status && stack.count > 0) {
+    ASTNode *n = stack.nodes[--stack.count];
+    if(n->expr.type == ExprString) status = add_string_constant(constants, n);
+    else if(n->expr.type == ExprArray) {
+      for(size_t i = 0; !status && i < n->expr.array.count; i++) status = node_stack_push(&stack, n->expr.array.items[i]);
+    }
+  }
+  free(stack.nodes);
+  return status;
+}
+
+// Build the constant pool
+// String literals and constant array literals are given ids and listed in the
+// parser, so the interpreter can build each of them once up front and share
+// it wherever it's evaluated.
+static int collect_constants(Parser *parser) {
+  NodeStack stack = {0};
+  NodeStack constants = {0};
+  int status = node_stack_push(&stack, parser->root);
+  while(!status && stack.count > 0) {
+    ASTNode *n = stack.nodes[--stack.count];
+    if(n->type == NodeExpr && n->expr.type == ExprString) {
+      status = add_string_constant(&constants, n);
+      continue;
+    }
+    if(n->type == NodeExpr && n->expr.type == ExprArray) {
+      int constant = 0;
+      status = is_constant_array(n, &constant);
+      if(!status && constant) {
+        status = add_array_constant(&constants, n);
+        continue;
+      }
+    }
+    if(!status) status = node_stack_push_children(&stack, n);
+  }
+  free(stack.nodes);
+  if(status) {
+    free(constants.nodes);
+    return status;
+  }
+
+  parser->constants = constants.nodes;
+  parser->constant_count = constants.count;
+  return 0;
+}
+
+// Find a device in the device table, adding it if it's new
+static int use_device(Parser *parser, const char *name, size_t *index) {
+  for(size_t d = 0; d < parser->device_count; d++) {
+    if(strcmp(parser->devices[d].name, name) == 0) {
+      *index = d;
+      return 0;
+    }
+  }
+
+  DeviceUse *devices = realloc(parser->devices, sizeof(DeviceUse) * (parser->device_count + 1));
+  if(!devices) {
+    PERROR("realloc() failed.\n");
+    return 1;
+  }
+  parser->devices = devices;
+  parser->devices[parser->device_count] = (DeviceUse){.name = name};
+  *index = parser->device_count++;
+  return 0;
+}
+
+// Find a file in the file table, adding it if it's new
+static int use_file(Parser *parser, const char *path, size_t *index) {
+  for(size_t f = 0; f < parser->file_count; f++) {
+    if(strcmp(parser->files[f].path, path) == 0) {
+      *index = f;
+      return 0;
+    }
+  }
+
+  FileUse *files = realloc(parser->files, sizeof(FileUse) * (parser->file_count + 1));
+  if(!files) {
+    PERROR("realloc() failed.\n");
+    return 1;
+  }
+  parser->files = files;
+  parser->files[parser->file_count] = (FileUse){.path = path};
+  *index = parser->file_count++;
+  return 0;
+}
+
+// Resolve the file of an EOF(<file>) call
+// The file is written like in READ, as a string literal or an identifier.
+static int resolve_eof(Parser *parser, ASTNode *call) {
+  ASTNode *arg = call->expr.call.argc == 1 ? call->expr.call.args[0] : NULL;
+  if(!arg || (arg->expr.type != ExprString && arg->expr.type != ExprVar)) {
+    PERROR("EOF() takes a file name.\n");
+    return 1;
+  }
+  const char *path = arg->expr.type == ExprString ? arg->expr.string.data : arg->expr.var_name;
+  return use_file(parser, path, &call->expr.call.file);
+}
+
+// Build the device and file tables
+// Every SEND, RECEIVE, READ and WRITE gets the index of its device or file, so
+// running them never has to look one up by name.
+static int resolve_io(Parser *parser) {
+  size_t index;
+  if(use_device(parser, "DISPLAY", &index) != 0 || use_device(parser, "KEYBOARD", &index) != 0) return 1;
+
+  NodeStack stack = {0};
+  int status = node_stack_push(&stack, parser->root);
+  while(!status && stack.count > 0) {
+    ASTNode *n = stack.nodes[--stack.count];
+    if(n->type == NodeSend) {
+      status = use_device(parser, n->send_stmt.device_name, &n->send_stmt.device);
+      if(!status) parser->devices[n->send_stmt.device].writes = 1;
+    } else if(n->type == NodeReceive) {
+      status = use_device(parser, n->receive_stmt.device_name, &n->receive_stmt.device);
+      if(!status) parser->devices[n->receive_stmt.device].reads = 1;
+    } else if(n->type == NodeRead) {
+      status = use_file(parser, n->read_stmt.path, &n->read_stmt.file);
+      if(!status) parser->files[n->read_stmt.file].reads = 1;
+    } else if(n->type == NodeWrite) {
+      status = use_file(parser, n->write_stmt.path, &n->write_stmt.file);
+      if(!status) parser->files[n->write_stmt.file].writes = 1;
+    } else if(n->type == NodeExpr && n->expr.type == ExprCall && strcmp(n->expr.call.name, "EOF") == 0) {
+      status = resolve_eof(parser, n);
+      if(!status) parser->files[n->expr.call.file].reads = 1;
+    }
+    if(!status) status = node_stack_push_children(&stack, n);
+  }
+  free(stack.nodes);
+  if(status) return status;
+
+  // A file is truncated when it's opened for writing, so it can't be read too
+  for(size_t f = 0; f < parser->file_count; f++) {
+    if(parser->files[f].reads && parser->files[f].writes) {
+      PERROR("%s is both READ and WRITTEN, which isn't supported.\n", parser->files[f].path);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Construct an AST from a tokeniser's output
+Parser *parse(Tokeniser *tokeniser) {
+  if(!tokeniser || tokeniser->status != 0) {
+    PERROR("Invalid tokeniser passed.\n");
+    return NULL;
+  }
+
+  // Create the parser
+  Parser *parser = parser_create();
+  if(!parser) {
+    PERROR("Failed to create parser.\n");
+    return NULL;
+  }
+
+  parser->root = parse_program(tokeniser);
   if(!parser->root) {
     PERROR("Failed to parse program\n");
     parser_destroy(&parser);
     return NULL;
   }
 
+  if(collect_constants(parser) != 0) {
+    PERROR("Failed to build the constant pool\n");
+    parser_destroy(&parser);
+    return NULL;
+  }
+
+  if(resolve_io(parser) != 0) {
+    PERROR("Failed to build the device and file tables\n");
+    parser_destroy(&parser);
+    return NULL;
+  }
+
   return parser;
 }
 
+// Indentation is clamped so dumping a deeply nested tree stays linear in its
+// size
+#define MAX_PRINT_INDENT 128
+
 static inline void print_indent(size_t indent) {
-  for(size_t i = 0; i < indent; i++) putchar(' ');
+  if(indent > MAX_PRINT_INDENT) indent = MAX_PRINT_INDENT;
+  printf("%*s", (int)indent, "");
 }
 
 static const char *var_type_to_str(VarType type) {
@@ -944,6 +2033,10 @@ static const char *var_type_to_str(VarType type) {
     return "VarBoolean";
   case VarCharacter:
     return "VarCharacter";
+  case VarArray:
+    return "VarArray";
+  case VarString:
+    return "VarString";
   default:
     return "?";
   }
@@ -965,106 +2058,280 @@ static const char *expr_op_to_str(Op op) {
     return "OpModulo";
   case OpIntDiv:
     return "OpIntDiv";
+  case OpEqual:
+    return "OpEqual";
+  case OpNEqual:
+    return "OpNEqual";
+  case OpGreaterThan:
+    return "OpGreaterThan";
+  case OpGreaterThanEq:
+    return "OpGreaterThanEq";
+  case OpLessThan:
+    return "OpLessThan";
+  case OpLessThanEq:
+    return "OpLessThanEq";
+  case OpAnd:
+    return "OpAnd";
+  case OpOr:
+    return "OpOr";
+  case OpAppend:
+    return "OpAppend";
   default:
     return "?";
   }
 }
 
+// A pending piece of output while printing a tree
+// Either a whole node, or a line of text belonging to a node that has already
+// been started.
+typedef struct {
+  ASTNode *node;
+  const char *fmt;
+  const char *arg;
+  size_t indent;
+  int indent_head;
+} PrintTask;
+
+typedef struct {
+  PrintTask *tasks;
+  size_t count;
+  size_t alloced;
+} PrintStack;
+
+static int print_stack_push(PrintStack *stack, PrintTask task) {
+  if(stack->count >= stack->alloced) {
+    size_t alloced = stack->alloced ? stack->alloced * 2 : 64;
+    PrintTask *new = realloc(stack->tasks, sizeof(PrintTask) * alloced);
+    if(!new) {
+      PERROR("realloc() failed.\n");
+      return 1;
+    }
+    stack->tasks = new;
+    stack->alloced = alloced;
+  }
+  stack->tasks[stack->count++] = task;
+  return 0;
+}
+
+// Queue a line of text at an indent
+#define PRINT_TEXT(fmt_, arg_, indent_) \
+  push_status |= print_stack_push(&stack, (PrintTask){.fmt = (fmt_), .arg = (arg_), .indent = (indent_)})
+
+// Queue a child node
+#define PRINT_NODE(node_, indent_) \
+  push_status |= print_stack_push(&stack, (PrintTask){.node = (node_), .indent = (indent_)})
+
+// Queue a list of child nodes, closed by a brace
+#define PRINT_LIST(nodes_, count_)                                                                                       \
+  PRINT_TEXT("  }\n", NULL, indent);                                                                                     \
+  for(size_t i = (count_); i > 0; i--) {                                                                                 \
+    push_status |= print_stack_push(&stack, (PrintTask){.node = (nodes_)[i - 1], .indent = indent + 4, .indent_head = 1}); \
+  }
+
+// Queue a field name followed by the child node it holds
+// Tasks are popped in reverse, so the node is pushed before its label.
+#define PRINT_FIELD(label, node_)  \
+  PRINT_NODE(node_, indent + 2); \
+  PRINT_TEXT(label, NULL, indent)
+
 #define NODE_PRINTF(fmt, ...) \
   print_indent(indent);       \
   printf(fmt, ##__VA_ARGS__);
 
-static void node_print(ASTNode *node, size_t indent, int indent_head) {
-  if(indent_head) {
-    print_indent(indent);
-  }
-  if(!node) {
-    printf("(null)\n");
+// Print a node and all of its children
+// Children and the text that follows them are queued on an explicit stack in
+// reverse order, so deeply nested programs can't overflow the call stack.
+static void node_print(ASTNode *root, size_t root_indent, int root_indent_head) {
+  PrintStack stack = {0};
+  if(print_stack_push(&stack, (PrintTask){.node = root, .indent = root_indent, .indent_head = root_indent_head}) != 0) {
+    PERROR("Failed to print node.\n");
     return;
   }
-  printf("(ASTNode) {\n");
-  switch(node->type) {
-  case NodeProgram:
-    NODE_PRINTF("  NodeType type = NodeProgram\n");
-    NODE_PRINTF("  program.block = ");
-    node_print(node->program.block, indent + 2, 0);
-    break;
-  case NodeVarDecl:
-    NODE_PRINTF("  NodeType type = NodeVarDecl\n");
-    NODE_PRINTF("  var_decl.type = %s\n", var_type_to_str(node->var_decl.type));
-    NODE_PRINTF("  var_decl.id = \"%s\"\n", node->var_decl.id);
-    break;
-  case NodeVarAssign:
-    NODE_PRINTF("  NodeType type = NodeVarAssign\n");
-    NODE_PRINTF("  var_assign.id = \"%s\"\n", node->var_assign.id);
-    NODE_PRINTF("  var_assign.expr = ");
-    node_print(node->var_assign.expr, indent + 2, 0);
-    break;
-  case NodeExpr:
-    NODE_PRINTF("  NodeType type = NodeExpr\n");
-    switch(node->expr.type) {
-    case ExprOp:
-      NODE_PRINTF("  expr.type = ExprOp\n");
-      NODE_PRINTF("  expr.op.op = %s\n", expr_op_to_str(node->expr.op.op));
-      NODE_PRINTF("  expr.op.left = ");
-      node_print(node->expr.op.left, indent + 2, 0);
-      NODE_PRINTF("  expr.op.right = ");
-      node_print(node->expr.op.right, indent + 2, 0);
+
+  while(stack.count > 0) {
+    PrintTask task = stack.tasks[--stack.count];
+    size_t indent = task.indent;
+
+    if(task.fmt) {
+      NODE_PRINTF(task.fmt, task.arg);
+      continue;
+    }
+
+    ASTNode *node = task.node;
+    if(task.indent_head) {
+      print_indent(indent);
+    }
+    if(!node) {
+      printf("(null)\n");
+      continue;
+    }
+    printf("(ASTNode) {\n");
+
+    int push_status = 0;
+    PRINT_TEXT("}\n", NULL, indent);
+    switch(node->type) {
+    case NodeProgram:
+      NODE_PRINTF("  NodeType type = NodeProgram\n");
+      PRINT_FIELD("  program.block = ", node->program.block);
       break;
-    case ExprInt:
-      NODE_PRINTF("  expr.type = ExprInt\n");
-      NODE_PRINTF("  expr.int_val = %d\n", node->expr.int_val);
+    case NodeVarDecl:
+      NODE_PRINTF("  NodeType type = NodeVarDecl\n");
+      NODE_PRINTF("  var_decl.type = %s\n", var_type_to_str(node->var_decl.type));
+      NODE_PRINTF("  var_decl.id = \"%s\"\n", node->var_decl.id);
+      if(node->var_decl.type == VarArray) {
+        NODE_PRINTF("  var_decl.elem_type = %s\n", var_type_to_str(node->var_decl.elem_type));
+        if(node->var_decl.columns) {
+          PRINT_FIELD("  var_decl.columns = ", node->var_decl.columns);
+        }
+        PRINT_FIELD("  var_decl.length = ", node->var_decl.length);
+      }
+      break;
+    case NodeVarAssign:
+      NODE_PRINTF("  NodeType type = NodeVarAssign\n");
+      NODE_PRINTF("  var_assign.id = \"%s\"\n", node->var_assign.id);
+      PRINT_FIELD("  var_assign.expr = ", node->var_assign.expr);
+      if(node->var_assign.column) {
+        PRINT_FIELD("  var_assign.column = ", node->var_assign.column);
+      }
+      if(node->var_assign.index) {
+        PRINT_FIELD("  var_assign.index = ", node->var_assign.index);
+      }
+      break;
+    case NodeExpr:
+      NODE_PRINTF("  NodeType type = NodeExpr\n");
+      switch(node->expr.type) {
+      case ExprOp:
+        NODE_PRINTF("  expr.type = ExprOp\n");
+        NODE_PRINTF("  expr.op.op = %s\n", expr_op_to_str(node->expr.op.op));
+        PRINT_FIELD("  expr.op.right = ", node->expr.op.right);
+        PRINT_FIELD("  expr.op.left = ", node->expr.op.left);
+        break;
+      case ExprInt:
+        NODE_PRINTF("  expr.type = ExprInt\n");
+        NODE_PRINTF("  expr.int_val = %d\n", node->expr.int_val);
+        break;
+      case ExprReal:
+        NODE_PRINTF("  expr.type = ExprReal\n");
+        NODE_PRINTF("  expr.real_val = %g\n", node->expr.real_val);
+        break;
+      case ExprBool:
+        NODE_PRINTF("  expr.type = ExprBool\n");
+        NODE_PRINTF("  expr.bool_val = %d\n", node->expr.bool_val);
+        break;
+      case ExprChar:
+        NODE_PRINTF("  expr.type = ExprChar\n");
+        NODE_PRINTF("  expr.char_val = %d\n", node->expr.char_val);
+        break;
+      case ExprString:
+        NODE_PRINTF("  expr.type = ExprString\n");
+        NODE_PRINTF("  expr.string.length = %zu\n", node->expr.string.length);
+        NODE_PRINTF("  expr.string.data = \"%s\"\n", node->expr.string.data);
+        break;
+      case ExprVar:
+        NODE_PRINTF("  expr.type = ExprVar\n");
+        NODE_PRINTF("  expr.var_name = %s\n", node->expr.var_name);
+        break;
+      case ExprArray:
+        NODE_PRINTF("  expr.type = ExprArray\n");
+        NODE_PRINTF("  expr.array.count = %zu\n", node->expr.array.count);
+        NODE_PRINTF("  expr.array.items = {\n");
+        PRINT_LIST(node->expr.array.items, node->expr.array.count);
+        break;
+      case ExprIndex:
+        NODE_PRINTF("  expr.type = ExprIndex\n");
+        if(node->expr.index.column) {
+          PRINT_FIELD("  expr.index.column = ", node->expr.index.column);
+        }
+        PRINT_FIELD("  expr.index.index = ", node->expr.index.index);
+        PRINT_FIELD("  expr.index.array = ", node->expr.index.array);
+        break;
+      case ExprCall:
+        NODE_PRINTF("  expr.type = ExprCall\n");
+        NODE_PRINTF("  expr.call.name = %s\n", node->expr.call.name);
+        NODE_PRINTF("  expr.call.argc = %zu\n", node->expr.call.argc);
+        NODE_PRINTF("  expr.call.args = {\n");
+        PRINT_LIST(node->expr.call.args, node->expr.call.argc);
+        break;
+      default:
+        NODE_PRINTF("?\n");
+        break;
+      }
+      break;
+    case NodeIf:
+      NODE_PRINTF("  NodeType type = NodeIf\n");
+      PRINT_FIELD("  if_stmt.else_block = ", node->if_stmt.else_block);
+      PRINT_FIELD("  if_stmt.if_block = ", node->if_stmt.if_block);
+      PRINT_FIELD("  if_stmt.condition = ", node->if_stmt.condition);
+      break;
+    case NodeWhile:
+      NODE_PRINTF("  NodeType type = NodeWhile\n");
+      PRINT_FIELD("  while_stmt.while_block = ", node->while_stmt.while_block);
+      PRINT_FIELD("  while_stmt.condition = ", node->while_stmt.condition);
       break;
-    case ExprVar:
-      NODE_PRINTF("  expr.type = ExprVar\n");
-      NODE_PRINTF("  expr.var_name = %s\n", node->expr.var_name);
+    case NodeFor:
+      NODE_PRINTF("  NodeType type = NodeFor\n");
+      NODE_PRINTF("  for_stmt.id = \"%s\"\n", node->for_stmt.id);
+      PRINT_FIELD("  for_stmt.for_block = ", node->for_stmt.for_block);
+      PRINT_FIELD("  for_stmt.step = ", node->for_stmt.step);
+      PRINT_FIELD("  for_stmt.to = ", node->for_stmt.to);
+      PRINT_FIELD("  for_stmt.from = ", node->for_stmt.from);
+      break;
+    case NodeForEach:
+      NODE_PRINTF("  NodeType type = NodeForEach\n");
+      NODE_PRINTF("  for_each.id = \"%s\"\n", node->for_each.id);
+      PRINT_FIELD("  for_each.for_block = ", node->for_each.for_block);
+      PRINT_FIELD("  for_each.array = ", node->for_each.array);
+      break;
+    case NodeBlock:
+      NODE_PRINTF("  NodeType type = NodeBlock\n");
+      NODE_PRINTF("  block.count = %zu\n", node->block.count);
+      if(node->block.statements) {
+        NODE_PRINTF("  block.statements = {\n");
+        PRINT_LIST(node->block.statements, node->block.count);
+      } else {
+        NODE_PRINTF("  block.statements = (null)\n");
+      }
+      break;
+    case NodeSend:
+      NODE_PRINTF("  NodeType type = NodeSend\n");
+      PRINT_TEXT("  send_stmt.device_name = \"%s\"\n", node->send_stmt.device_name, indent);
+      NODE_PRINTF("  send_stmt.device = %zu\n", node->send_stmt.device);
+      PRINT_FIELD("  send_stmt.expr = ", node->send_stmt.expr);
+      break;
+    case NodeReceive:
+      NODE_PRINTF("  NodeType type = NodeReceive\n");
+      NODE_PRINTF("  receive_stmt.id = \"%s\"\n", node->receive_stmt.id);
+      NODE_PRINTF("  receive_stmt.type = %d\n", node->receive_stmt.type);
+      NODE_PRINTF("  receive_stmt.device_name = \"%s\"\n", node->receive_stmt.device_name);
+      NODE_PRINTF("  receive_stmt.device = %zu\n", node->receive_stmt.device);
+      break;
+    case NodeRead:
+      NODE_PRINTF("  NodeType type = NodeRead\n");
+      NODE_PRINTF("  read_stmt.path = \"%s\"\n", node->read_stmt.path);
+      NODE_PRINTF("  read_stmt.file = %zu\n", node->read_stmt.file);
+      for(size_t i = 0; i < node->read_stmt.count; i++) {
+        NODE_PRINTF("  read_stmt.ids[%zu] = \"%s\"\n", i, node->read_stmt.ids[i]);
+      }
+      break;
+    case NodeWrite:
+      NODE_PRINTF("  NodeType type = NodeWrite\n");
+      NODE_PRINTF("  write_stmt.path = \"%s\"\n", node->write_stmt.path);
+      NODE_PRINTF("  write_stmt.file = %zu\n", node->write_stmt.file);
+      NODE_PRINTF("  write_stmt.items = {\n");
+      PRINT_LIST(node->write_stmt.items, node->write_stmt.count);
       break;
     default:
       NODE_PRINTF("?\n");
       break;
     }
-    break;
-  case NodeIf:
-    NODE_PRINTF("  NodeType type = NodeIf\n");
-    NODE_PRINTF("  if_stmt.condition = ");
-    node_print(node->if_stmt.condition, indent + 2, 0);
-    NODE_PRINTF("  if_stmt.if_block = ");
-    node_print(node->if_stmt.if_block, indent + 2, 0);
-    NODE_PRINTF("  if_stmt.else_block = ");
-    node_print(node->if_stmt.else_block, indent + 2, 0);
-    break;
-  case NodeWhile:
-    NODE_PRINTF("  NodeType type = NodeWhile\n");
-    NODE_PRINTF("  while_stmt.condition = ");
-    node_print(node->while_stmt.condition, indent + 2, 0);
-    NODE_PRINTF("  while_stmt.while_block = ");
-    node_print(node->while_stmt.while_block, indent + 2, 0);
-    break;
-  case NodeBlock:
-    NODE_PRINTF("  NodeType type = NodeBlock\n");
-    NODE_PRINTF("  block.count = %zu\n", node->block.count);
-    if(node->block.statements) {
-      NODE_PRINTF("  block.statements = {\n");
-      for(size_t i = 0; i < node->block.count; i++) {
-        node_print(node->block.statements[i], indent + 4, 1);
-      }
-      NODE_PRINTF("  }\n");
-    } else {
-      NODE_PRINTF("  block.statements = (null)\n");
+
+    if(push_status) {
+      PERROR("Failed to queue child nodes for printing.\n");
+      break;
     }
-    break;
-  case NodeSend:
-    NODE_PRINTF("  NodeType type = NodeSend\n");
-    NODE_PRINTF("  send_stmt.expr = ");
-    node_print(node->send_stmt.expr, indent + 2, 0);
-    NODE_PRINTF("  send_stmt.device_name = \"%s\"\n", node->send_stmt.device_name);
-    break;
-  default:
-    NODE_PRINTF("?\n");
-    break;
   }
-  print_indent(indent);
-  printf("}\n");
+
+  free(stack.tasks);
 }
 
 void parser_dump(Parser *parser) {
@@ -4,6 +4,10 @@
 
 #include "tokeniser.h"
 
+// Indices of the devices every program has in its device table
+#define DEVICE_DISPLAY 0
+#define DEVICE_KEYBOARD 1
+
 typedef enum { NodeProgram,
                NodeVarDecl,
                NodeVarAssign,
@@ -11,16 +15,30 @@ typedef enum { NodeProgram,
                NodeBlock,
                NodeIf,
                NodeWhile,
-               NodeSend } NodeType;
+               NodeFor,
+               NodeForEach,
+               NodeSend,
+               NodeReceive,
+               NodeRead,
+               NodeWrite } NodeType;
 
 typedef enum { VarInteger,
                VarReal,
                VarBoolean,
-               VarCharacter } VarType;
+               VarCharacter,
+               VarArray,
+               VarString } VarType;
 
 typedef enum { ExprInt,
+               ExprReal,
+               ExprBool,
+               ExprChar,
+               ExprString,
                ExprVar,
-               ExprOp } ExprType;
+               ExprOp,
+               ExprArray,
+               ExprIndex,
+               ExprCall } ExprType;
 
 typedef enum { OpAdd,
                OpSubtract,
@@ -35,10 +53,15 @@ typedef enum { OpAdd,
                OpGreaterThanEq,
                OpLessThan,
                OpLessThanEq,
+               OpAnd,
+               OpOr,
+               OpAppend,
 } Op;
 
 typedef struct ASTNode {
   NodeType type;
+  // Line the node starts on, set for statements, 0 for everything else
+  size_t line_no;
   union {
     // A program
     struct {
@@ -53,14 +76,23 @@ typedef struct ASTNode {
     } block;
 
     // Variable declarations
+    // elem_type and length are only used by ARRAY OF <type> <id>[<length>],
+    // and columns by two-dimensional ARRAY OF <type> <id>[<rows>, <columns>]
     struct {
       VarType type;
+      VarType elem_type;
       char *id;
+      struct ASTNode *length;
+      struct ASTNode *columns;
     } var_decl;
 
     // Variable assignments
+    // index is NULL unless assigning to an element of an array, and column is
+    // NULL unless the array is two-dimensional
     struct {
       char *id;
+      struct ASTNode *index;
+      struct ASTNode *column;
       struct ASTNode *expr;
     } var_assign;
 
@@ -70,12 +102,46 @@ typedef struct ASTNode {
 
       union {
         int int_val;
+        double real_val;
+        int bool_val;
+        char char_val;
+        // String literal, which may contain '\0'
+        // id is its position in the parser's constant pool
+        struct {
+          char *data;
+          size_t length;
+          size_t id;
+        } string;
         char *var_name;
         struct {
           Op op;
           struct ASTNode *left;
           struct ASTNode *right;
         } op;
+        // Array literal: [<expression>, ...]
+        // An array of nothing but literals is constant, and id is then its
+        // position in the parser's constant pool
+        struct {
+          size_t count;
+          struct ASTNode **items;
+          int constant;
+          size_t id;
+        } array;
+        // Array element: <expression>[<expression>], or
+        // <expression>[<expression>, <expression>] in a two-dimensional array
+        struct {
+          struct ASTNode *array;
+          struct ASTNode *index;
+          struct ASTNode *column;
+        } index;
+        // Built in function call: <id>(<expression>, ...)
+        // For EOF(<file>), file is the file's index in the parser's file table
+        struct {
+          char *name;
+          size_t argc;
+          struct ASTNode **args;
+          size_t file;
+        } call;
       };
     } expr;
 
@@ -92,16 +158,91 @@ typedef struct ASTNode {
       struct ASTNode *while_block;
     } while_stmt;
 
+    // For loop, step is NULL if not given
+    struct {
+      char *id;
+      struct ASTNode *from;
+      struct ASTNode *to;
+      struct ASTNode *step;
+      struct ASTNode *for_block;
+    } for_stmt;
+
+    // For each loop
+    struct {
+      char *id;
+      struct ASTNode *array;
+      struct ASTNode *for_block;
+    } for_each;
+
     // Send statement
+    // device is the device's index in the parser's device table
     struct {
       struct ASTNode *expr;
       char *device_name;
+      size_t device;
     } send_stmt;
+
+    // Receive statement: RECEIVE <id> FROM (<type>) <device>
+    struct {
+      char *id;
+      VarType type;
+      char *device_name;
+      size_t device;
+    } receive_stmt;
+
+    // Read statement: READ <file> <id>, ...
+    // file is the file's index in the parser's file table
+    struct {
+      char *path;
+      size_t file;
+      size_t count;
+      char **ids;
+    } read_stmt;
+
+    // Write statement: WRITE <file> <expression>, ...
+    struct {
+      char *path;
+      size_t file;
+      size_t count;
+      struct ASTNode **items;
+    } write_stmt;
   };
 } ASTNode;
 
+// A device named by the program
+typedef struct {
+  const char *name;
+  // Whether the program RECEIVEs from it and SENDs to it
+  int reads;
+  int writes;
+} DeviceUse;
+
+// A file named by the program
+typedef struct {
+  const char *path;
+  // Whether the program READs from it and WRITEs to it
+  int reads;
+  int writes;
+} FileUse;
+
 typedef struct {
   ASTNode *root;
+  // Constant pool: every string literal and constant array literal in the
+  // program, in the order of their ids
+  ASTNode **constants;
+  size_t constant_count;
+  // Device table: every device SENT to or RECEIVEd from, in the order of their
+  // indices, starting with DISPLAY and KEYBOARD
+  DeviceUse *devices;
+  size_t device_count;
+  // File table: every file READ from or WRITTEN to, in the order of their
+  // indices
+  FileUse *files;
+  size_t file_count;
+  // Set when the parser is a program image mapped from the cache, which is
+  // unmapped all at once rather than freed
+  void *mapping;
+  size_t mapping_size;
 } Parser;
 
 Parser *parse(Tokeniser *tokeniser);
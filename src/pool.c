@@ -0,0 +1,270 @@
+#include "pool.h"
+#include "def.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Usable size of each size class
+static const size_t CLASS_SIZES[POOL_NUM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192};
+
+// Size class of blocks that were allocated with malloc
+#define CLASS_LARGE UINT32_MAX
+
+// Header in front of every block, so it can be freed without knowing its size
+// or the pool it came from. It keeps the block aligned like malloc's.
+typedef union {
+  struct {
+    Pool *pool;
+    uint32_t size_class;
+    // Requested size, for the fragmentation stats
+    size_t size;
+  };
+  max_align_t align;
+} BlockHeader;
+
+// Pool that allocations on this thread come from
+static _Thread_local Pool *current_pool = NULL;
+
+// Create an empty pool
+Pool *pool_create(void) {
+  Pool *pool = calloc(1, sizeof(Pool));
+  if(!pool) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+  return pool;
+}
+
+// Destroy a pool, releasing all of its slabs and large blocks at once
+void pool_destroy(Pool **pool) {
+  if(!pool) return;
+  Pool *p = *pool;
+  if(!p) return;
+  if(current_pool == p) current_pool = NULL;
+
+  PoolSlab *slab = p->slabs;
+  while(slab) {
+    PoolSlab *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  PoolLarge *large = p->large;
+  while(large) {
+    PoolLarge *next = large->next;
+    free(large);
+    large = next;
+  }
+  free(p);
+  *pool = NULL;
+}
+
+// Make a pool the one that allocations on this thread come from
+// Returns the previous one, so it can be restored. With no pool, allocations
+// go to malloc.
+Pool *pool_set_current(Pool *pool) {
+  Pool *prev = current_pool;
+  current_pool = pool;
+  return prev;
+}
+
+// Find the smallest size class that fits a request
+static uint32_t size_class_of(size_t size) {
+  for(uint32_t i = 0; i < POOL_NUM_CLASSES; i++) {
+    if(size <= CLASS_SIZES[i]) return i;
+  }
+  return CLASS_LARGE;
+}
+
+// Take a fresh block of a size class from a slab, adding a slab if needed
+static BlockHeader *slab_take(Pool *pool, uint32_t size_class) {
+  size_t block_size = sizeof(BlockHeader) + CLASS_SIZES[size_class];
+  if(pool->bump_end[size_class] - pool->bump[size_class] < (ptrdiff_t)block_size) {
+    size_t slab_size = POOL_SLAB_SIZE;
+    if(slab_size < sizeof(BlockHeader) + 8 * block_size) slab_size = sizeof(BlockHeader) + 8 * block_size;
+
+    PoolSlab *slab = malloc(slab_size);
+    if(!slab) {
+      PERROR("malloc() failed.\n");
+      return NULL;
+    }
+    slab->size = slab_size;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_bytes += slab_size;
+
+    // Blocks start after a header-sized gap, so they stay aligned
+    pool->bump[size_class] = (char *)slab + sizeof(BlockHeader);
+    pool->bump_end[size_class] = (char *)slab + slab_size;
+  }
+
+  BlockHeader *header = (BlockHeader *)pool->bump[size_class];
+  pool->bump[size_class] += block_size;
+  return header;
+}
+
+// Allocate memory from the current pool
+void *pool_alloc(size_t size) {
+  Pool *pool = current_pool;
+  uint32_t size_class = pool ? size_class_of(size) : CLASS_LARGE;
+  if(pool && pool->limit) {
+    size_t bytes = size_class == CLASS_LARGE ? size : CLASS_SIZES[size_class];
+    if(pool->live_block_bytes > pool->limit || bytes > pool->limit - pool->live_block_bytes) {
+      pool->over_limit = 1;
+      return NULL;
+    }
+  }
+
+  BlockHeader *header = NULL;
+  if(size_class == CLASS_LARGE) {
+    if(size > SIZE_MAX - sizeof(PoolLarge) - sizeof(BlockHeader)) {
+      PERROR("Allocation of %zu bytes is too large.\n", size);
+      return NULL;
+    }
+    PoolLarge *large = malloc(sizeof(PoolLarge) + sizeof(BlockHeader) + size);
+    if(!large) {
+      PERROR("malloc() failed.\n");
+      return NULL;
+    }
+    large->prev = NULL;
+    large->next = NULL;
+    if(pool) {
+      large->next = pool->large;
+      if(pool->large) pool->large->prev = large;
+      pool->large = large;
+      pool->large_allocs++;
+    }
+    header = (BlockHeader *)(large + 1);
+  } else if(pool->free_lists[size_class]) {
+    PoolFree *block = pool->free_lists[size_class];
+    pool->free_lists[size_class] = block->next;
+    header = (BlockHeader *)block - 1;
+  } else {
+    header = slab_take(pool, size_class);
+    if(!header) return NULL;
+  }
+
+  if(pool) {
+    pool->allocs++;
+    pool->live_blocks++;
+    pool->live_block_bytes += size_class == CLASS_LARGE ? size : CLASS_SIZES[size_class];
+    if(size_class == CLASS_LARGE) pool->live_large_bytes += size;
+    pool->live_requested_bytes += size;
+    if(pool->live_block_bytes > pool->peak_block_bytes) {
+      pool->peak_block_bytes = pool->live_block_bytes;
+      pool->peak_large_bytes = pool->live_large_bytes;
+      pool->peak_requested_bytes = pool->live_requested_bytes;
+      pool->peak_slab_bytes = pool->slab_bytes;
+    }
+  }
+  header->pool = pool;
+  header->size_class = size_class;
+  header->size = size;
+  return header + 1;
+}
+
+// Allocate zeroed memory from the current pool
+void *pool_calloc(size_t size) {
+  void *ptr = pool_alloc(size);
+  if(ptr) memset(ptr, 0, size);
+  return ptr;
+}
+
+// Return a block to the pool it came from
+void pool_free(void *ptr) {
+  if(!ptr) return;
+  BlockHeader *header = (BlockHeader *)ptr - 1;
+  Pool *pool = header->pool;
+  uint32_t size_class = header->size_class;
+
+  if(pool) {
+    pool->frees++;
+    pool->live_blocks--;
+    pool->live_block_bytes -= size_class == CLASS_LARGE ? header->size : CLASS_SIZES[size_class];
+    if(size_class == CLASS_LARGE) pool->live_large_bytes -= header->size;
+    pool->live_requested_bytes -= header->size;
+  }
+
+  if(size_class == CLASS_LARGE) {
+    PoolLarge *large = (PoolLarge *)header - 1;
+    if(pool) {
+      if(large->prev) large->prev->next = large->next;
+      else pool->large = large->next;
+      if(large->next) large->next->prev = large->prev;
+      pool->large_frees++;
+    }
+    free(large);
+    return;
+  }
+
+  PoolFree *block = ptr;
+  block->next = pool->free_lists[size_class];
+  pool->free_lists[size_class] = block;
+}
+
+// Resize a block
+// A block that still fits its size class is kept where it is.
+void *pool_realloc(void *ptr, size_t size) {
+  if(!ptr) return pool_alloc(size);
+  BlockHeader *header = (BlockHeader *)ptr - 1;
+  Pool *pool = header->pool;
+  uint32_t size_class = header->size_class;
+  size_t old_size = header->size;
+
+  if(size_class != CLASS_LARGE && size <= CLASS_SIZES[size_class]) {
+    if(pool) pool->live_requested_bytes = pool->live_requested_bytes - old_size + size;
+    header->size = size;
+    return ptr;
+  }
+
+  // Large blocks outside of a pool can grow in place
+  if(size_class == CLASS_LARGE && !pool && size <= SIZE_MAX - sizeof(PoolLarge) - sizeof(BlockHeader)) {
+    PoolLarge *large = realloc((PoolLarge *)header - 1, sizeof(PoolLarge) + sizeof(BlockHeader) + size);
+    if(!large) {
+      PERROR("realloc() failed.\n");
+      return NULL;
+    }
+    BlockHeader *new = (BlockHeader *)(large + 1);
+    new->size = size;
+    return new + 1;
+  }
+
+  // Otherwise move it, into the pool it came from
+  Pool *prev = pool_set_current(pool);
+  void *new = pool_alloc(size);
+  pool_set_current(prev);
+  if(!new) return NULL;
+  memcpy(new, ptr, old_size < size ? old_size : size);
+  pool_free(ptr);
+  return new;
+}
+
+// Copy a string into the current pool
+char *pool_strdup(const char *str) {
+  size_t length = strlen(str);
+  char *copy = pool_alloc(length + 1);
+  if(!copy) return NULL;
+  memcpy(copy, str, length + 1);
+  return copy;
+}
+
+// Print how much a pool has been used
+// Fragmentation is worked out at the peak, when it matters most: internal
+// fragmentation is the part of the live blocks lost to rounding up to a size
+// class, external fragmentation the part of the slabs not holding a live
+// block.
+void pool_print_stats(Pool *pool, FILE *out) {
+  // Large blocks live outside of the slabs
+  size_t peak_small_bytes = pool->peak_block_bytes - pool->peak_large_bytes;
+
+  double internal = pool->peak_block_bytes ? 100.0 * (pool->peak_block_bytes - pool->peak_requested_bytes) / pool->peak_block_bytes : 0.0;
+  double external = pool->peak_slab_bytes ? 100.0 * (pool->peak_slab_bytes - peak_small_bytes) / pool->peak_slab_bytes : 0.0;
+
+  fprintf(out, "Allocator stats:\n");
+  fprintf(out, "  allocations: %zu (%zu large)\n", pool->allocs, pool->large_allocs);
+  fprintf(out, "  frees: %zu (%zu large)\n", pool->frees, pool->large_frees);
+  fprintf(out, "  live blocks: %zu, %zu bytes requested, %zu bytes allocated\n", pool->live_blocks, pool->live_requested_bytes, pool->live_block_bytes);
+  fprintf(out, "  peak: %zu bytes requested, %zu bytes allocated, in %zu bytes of slabs\n", pool->peak_requested_bytes, pool->peak_block_bytes, pool->peak_slab_bytes);
+  fprintf(out, "  slabs: %zu bytes\n", pool->slab_bytes);
+  fprintf(out, "  internal fragmentation at peak: %.1f%%\n", internal);
+  fprintf(out, "  external fragmentation at peak: %.1f%%\n", external);
+}
@@ -0,0 +1,83 @@
+#ifndef POOL_H
+#define POOL_H
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Defines
+#define POOL_NUM_CLASSES 18
+// Size of the slabs small blocks are carved out of
+#define POOL_SLAB_SIZE 65536
+
+// Structs
+// A slab of memory that blocks of one size class are carved out of
+typedef struct PoolSlab {
+  struct PoolSlab *next;
+  size_t size;
+} PoolSlab;
+
+// Links in front of a block too big for a size class, so its pool can free
+// it if its owner doesn't
+typedef union PoolLarge {
+  struct {
+    union PoolLarge *prev;
+    union PoolLarge *next;
+  };
+  max_align_t align;
+} PoolLarge;
+
+// A freed block, waiting to be reused
+typedef struct PoolFree {
+  struct PoolFree *next;
+} PoolFree;
+
+// Allocator for the runtime's heap objects
+// Small requests are rounded up to one of POOL_NUM_CLASSES size classes and
+// served from slabs, with a free list per class so freed blocks are reused
+// without going back to malloc. Larger requests go straight to malloc, and
+// are kept on a list. Destroying the pool releases every slab and every large
+// block still on the list at once.
+typedef struct Pool {
+  PoolFree *free_lists[POOL_NUM_CLASSES];
+  // Unused end of the newest slab of each class
+  char *bump[POOL_NUM_CLASSES];
+  char *bump_end[POOL_NUM_CLASSES];
+  PoolSlab *slabs;
+  PoolLarge *large;
+
+  // Stats
+  size_t allocs;
+  size_t frees;
+  size_t large_allocs;
+  size_t large_frees;
+  size_t slab_bytes;
+  size_t live_blocks;
+  size_t live_block_bytes;
+  size_t live_large_bytes;
+  size_t live_requested_bytes;
+  // Live bytes when the most were allocated, and the slabs at the time
+  size_t peak_block_bytes;
+  size_t peak_large_bytes;
+  size_t peak_requested_bytes;
+  size_t peak_slab_bytes;
+
+  // Allocations that would take live blocks past limit bytes fail and set
+  // over_limit, if limit is set
+  size_t limit;
+  int over_limit;
+} Pool;
+
+// Function prototypes
+Pool *pool_create(void);
+void pool_destroy(Pool **pool);
+Pool *pool_set_current(Pool *pool);
+void *pool_alloc(size_t size);
+void *pool_calloc(size_t size);
+void *pool_realloc(void *ptr, size_t size);
+void pool_free(void *ptr);
+char *pool_strdup(const char *str);
+void pool_print_stats(Pool *pool, FILE *out);
+
+#endif // pool.h
@@ -0,0 +1,254 @@
+#include "profile.h"
+#include "def.h"
+#include "iolog.h"
+#include "source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest a statement's source gets in a collapsed stack frame
+#define PROFILE_FRAME_TEXT 60
+
+// Create a profile, with just the program's own path
+Profile *profile_create(void) {
+  Profile *profile = calloc(1, sizeof(Profile));
+  if(!profile) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+
+  profile->path_alloced = 64;
+  profile->paths = calloc(profile->path_alloced, sizeof(ProfilePath));
+  profile->table_size = 128;
+  profile->table = calloc(profile->table_size, sizeof(size_t));
+  if(!profile->paths || !profile->table) {
+    PERROR("calloc() failed.\n");
+    profile_destroy(&profile);
+    return NULL;
+  }
+  profile->path_count = 1;
+  return profile;
+}
+
+// Destroy a profile
+void profile_destroy(Profile **profile) {
+  if(!profile || !*profile) return;
+  free((*profile)->paths);
+  free((*profile)->table);
+  free(*profile);
+  *profile = NULL;
+}
+
+static inline size_t profile_slot(Profile *profile, size_t parent, size_t line_no) {
+  uint64_t x = ((uint64_t)parent << 32 ^ line_no) * 0x9e3779b97f4a7c15u;
+  return (x >> 32) & (profile->table_size - 1);
+}
+
+// Double the size of the path table
+// The table holds path numbers plus one, so 0 is an empty slot.
+static int profile_grow_table(Profile *profile) {
+  size_t old_size = profile->table_size;
+  size_t *old = profile->table;
+  profile->table_size *= 2;
+  profile->table = calloc(profile->table_size, sizeof(size_t));
+  if(!profile->table) {
+    PERROR("calloc() failed.\n");
+    profile->table = old;
+    profile->table_size = old_size;
+    return 1;
+  }
+
+  for(size_t s = 0; s < old_size; s++) {
+    if(!old[s]) continue;
+    ProfilePath *path = &profile->paths[old[s] - 1];
+    size_t t = profile_slot(profile, path->parent, path->line_no);
+    while(profile->table[t]) t = (t + 1) & (profile->table_size - 1);
+    profile->table[t] = old[s];
+  }
+  free(old);
+  return 0;
+}
+
+// Count a statement on line_no running inside parent, and get its path
+// If the path can't be added, the statement is put down to parent.
+size_t profile_enter(Profile *profile, size_t parent, size_t line_no) {
+  size_t s = profile_slot(profile, parent, line_no);
+  for(; profile->table[s]; s = (s + 1) & (profile->table_size - 1)) {
+    ProfilePath *path = &profile->paths[profile->table[s] - 1];
+    if(path->parent == parent && path->line_no == line_no) {
+      path->count++;
+      return profile->table[s] - 1;
+    }
+  }
+
+  // Keep the table at most half full
+  if(profile->path_count * 2 >= profile->table_size) {
+    if(profile_grow_table(profile) != 0) {
+      profile->failed = 1;
+      return parent;
+    }
+    return profile_enter(profile, parent, line_no);
+  }
+  if(profile->path_count >= profile->path_alloced) {
+    size_t alloced = profile->path_alloced * 2;
+    ProfilePath *new = realloc(profile->paths, sizeof(ProfilePath) * alloced);
+    if(!new) {
+      PERROR("realloc() failed.\n");
+      profile->failed = 1;
+      return parent;
+    }
+    profile->paths = new;
+    profile->path_alloced = alloced;
+  }
+
+  size_t id = profile->path_count++;
+  profile->paths[id] = (ProfilePath){.parent = parent, .line_no = line_no, .count = 1};
+  profile->table[s] = id + 1;
+  return id;
+}
+
+// Put the time since the last step down to the path that ran it, and start
+// timing path
+void profile_switch(Profile *profile, size_t path) {
+  uint64_t now = iolog_now();
+  if(profile->last) profile->paths[profile->current].self += now - profile->last;
+  profile->current = path;
+  profile->last = now;
+}
+
+// Stop timing, until the program runs again
+void profile_stop(Profile *profile) {
+  profile_switch(profile, profile->current);
+  profile->last = 0;
+}
+
+// Split a program's source into its lines, in place
+// Returns an array indexed by line number, starting at 1, with *count set to
+// the number of lines.
+static char **split_lines(char *source, size_t *count) {
+  size_t lines = 1;
+  for(char *c = source; *c; c++) lines += *c == '\n';
+  char **line = malloc(sizeof(char *) * (lines + 1));
+  if(!line) {
+    PERROR("malloc() failed.\n");
+    return NULL;
+  }
+
+  line[0] = NULL;
+  size_t n = 1;
+  line[n] = source;
+  for(char *c = source; *c; c++) {
+    if(*c != '\n') continue;
+    *c = '\0';
+    if(c > line[n] && c[-1] == '\r') c[-1] = '\0';
+    line[++n] = c + 1;
+  }
+  // A newline at the end doesn't start another line
+  *count = lines > 1 && !*line[lines] ? lines - 1 : lines;
+  return line;
+}
+
+// Write a path's frames, outermost first, as a collapsed stack
+// Each frame is the statement's line number and source, without the
+// semicolons that separate frames.
+static void write_stack(FILE *out, Profile *profile, size_t id, char **lines, size_t line_count) {
+  size_t depth = 0;
+  for(size_t p = id; p != PROFILE_ROOT; p = profile->paths[p].parent) depth++;
+  size_t stack[depth ? depth : 1];
+  size_t d = depth;
+  for(size_t p = id; p != PROFILE_ROOT; p = profile->paths[p].parent) stack[--d] = p;
+
+  for(d = 0; d < depth; d++) {
+    size_t line_no = profile->paths[stack[d]].line_no;
+    const char *text = line_no <= line_count ? lines[line_no] : "";
+    while(*text == ' ' || *text == '\t') text++;
+    fprintf(out, ";%zu: ", line_no);
+    for(size_t c = 0; text[c] && c < PROFILE_FRAME_TEXT; c++) fputc(text[c] == ';' ? ',' : text[c], out);
+  }
+}
+
+// Write the annotated listing and the collapsed stacks of a profiled program
+// Lines are listed with the number of times they ran and their inclusive
+// time, which for IF, WHILE and FOR includes everything inside them. The
+// collapsed stacks give each path's own time in nanoseconds, one path a line,
+// for flamegraph tools.
+int profile_write(Profile *profile, const char *source_path) {
+  char *source = read_file_str((char *)source_path);
+  if(!source) {
+    PERROR("Failed to read %s.\n", source_path);
+    return 1;
+  }
+  size_t line_count = 0;
+  char **lines = split_lines(source, &line_count);
+  if(!lines) {
+    free(source);
+    return 1;
+  }
+  size_t *counts = calloc(line_count + 1, sizeof(size_t));
+  uint64_t *times = calloc(line_count + 1, sizeof(uint64_t));
+  // The last path each line's time was added for, so a line that turns up
+  // twice on one path is only counted once
+  size_t *seen = calloc(line_count + 1, sizeof(size_t));
+  if(!counts || !times || !seen) {
+    PERROR("calloc() failed.\n");
+    free(source);
+    free(lines);
+    free(counts);
+    free(times);
+    free(seen);
+    return 1;
+  }
+
+  uint64_t total = 0;
+  for(size_t id = 0; id < profile->path_count; id++) {
+    ProfilePath *path = &profile->paths[id];
+    total += path->self;
+    if(path->line_no <= line_count) counts[path->line_no] += path->count;
+    for(size_t p = id; p != PROFILE_ROOT; p = profile->paths[p].parent) {
+      size_t line_no = profile->paths[p].line_no;
+      if(line_no > line_count || seen[line_no] == id + 1) continue;
+      seen[line_no] = id + 1;
+      times[line_no] += path->self;
+    }
+  }
+
+  int status = 0;
+  FILE *out = fopen(PROFILE_LISTING_PATH, "w");
+  if(!out) {
+    PERROR("Couldn't open %s for writing.\n", PROFILE_LISTING_PATH);
+    status = 1;
+  } else {
+    fprintf(out, "Profile of %s: %.3f ms\n", source_path, total / 1e6);
+    if(profile->failed) fprintf(out, "Some statements ran out of memory to profile, and are counted in the statements around them\n");
+    fprintf(out, "\n%6s %12s %12s %7s  %s\n", "Line", "Count", "Time (ms)", "Time", "Source");
+    for(size_t n = 1; n <= line_count; n++) {
+      if(counts[n] || times[n]) fprintf(out, "%6zu %12zu %12.3f %6.1f%%  %s\n", n, counts[n], times[n] / 1e6, total ? 100.0 * times[n] / total : 0.0, lines[n]);
+      else fprintf(out, "%6zu %12s %12s %7s  %s\n", n, "", "", "", lines[n]);
+    }
+    if(fclose(out) != 0) status = 1;
+  }
+
+  out = fopen(PROFILE_STACKS_PATH, "w");
+  if(!out) {
+    PERROR("Couldn't open %s for writing.\n", PROFILE_STACKS_PATH);
+    status = 1;
+  } else {
+    // Every stack starts with the program, named after its file
+    const char *name = strrchr(source_path, '/');
+    name = name ? name + 1 : source_path;
+    for(size_t id = 0; id < profile->path_count; id++) {
+      if(!profile->paths[id].self) continue;
+      for(const char *c = name; *c; c++) fputc(*c == ';' ? ',' : *c, out);
+      write_stack(out, profile, id, lines, line_count);
+      fprintf(out, " %llu\n", (unsigned long long)profile->paths[id].self);
+    }
+    if(fclose(out) != 0) status = 1;
+  }
+
+  free(source);
+  free(lines);
+  free(counts);
+  free(times);
+  free(seen);
+  return status;
+}
@@ -0,0 +1,53 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+// Where --profile writes its annotated listing and its collapsed stacks
+#define PROFILE_LISTING_PATH "./profile.txt"
+#define PROFILE_STACKS_PATH "./profile.folded"
+// The path of the program itself, which every other path starts from
+#define PROFILE_ROOT 0
+
+// Structs
+// A path through the program: a statement, inside the blocks of the
+// statements above it
+typedef struct {
+  size_t parent;
+  size_t line_no;
+  // Times the statement ran on this path, and the time spent in it, not
+  // counting the statements inside its blocks
+  size_t count;
+  uint64_t self;
+} ProfilePath;
+
+// Line-level counts and timings of a running program, from --profile
+// Time is measured between the steps of the program and put down to the
+// statement that was running, along the path of blocks it was reached
+// through. Paths are numbered as they're first reached, and looked up by
+// parent and line in an open addressed table.
+typedef struct {
+  ProfilePath *paths;
+  size_t path_count;
+  size_t path_alloced;
+  size_t *table;
+  size_t table_size;
+  // The path being timed, and when the last step started
+  size_t current;
+  uint64_t last;
+  // Set if a path couldn't be added, whose time went to its parent instead
+  int failed;
+} Profile;
+
+// Function prototypes
+Profile *profile_create(void);
+void profile_destroy(Profile **profile);
+size_t profile_enter(Profile *profile, size_t parent, size_t line_no);
+void profile_switch(Profile *profile, size_t path);
+void profile_stop(Profile *profile);
+int profile_write(Profile *profile, const char *source_path);
+
+#endif // profile.h
@@ -0,0 +1,252 @@
+#include "real.h"
+#include "real_tables.h"
+#include <stdint.h>
+#include <string.h>
+
+// Shortest round-trip formatting of REAL values, after Ulf Adams' Ryu
+// ("Ryu: fast float-to-string conversion", PLDI 2018).
+//
+// The digits are the fewest that read back as exactly the same double, and
+// of those the closest to the value. They're laid out like Python's repr(),
+// so the interpreter and the Python backend display the same text:
+//   - Plain notation when the decimal point falls between 4 places before
+//     the first digit and 16 places after it, with at least one digit after
+//     the point: 1.0, 0.0001, 123.25, 1000000000000000.0
+//   - Otherwise scientific notation, with a sign and at least two digits in
+//     the exponent: 1e-05, 1.5e+16, 2.5e-308
+//   - A leading '-' for negative values, including -0.0
+//   - inf, -inf and nan for the values that aren't finite
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+#define MANTISSA_BITS 52
+#define EXPONENT_BITS 11
+#define EXPONENT_BIAS 1023
+
+// floor(log2(5^e)) + 1, for 0 <= e <= 3528
+static inline int32_t pow5bits(int32_t e) {
+  return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)), for 0 <= e <= 1650
+static inline uint32_t log10_pow2(int32_t e) {
+  return ((uint32_t)e * 78913) >> 18;
+}
+
+// floor(log10(5^e)), for 0 <= e <= 2620
+static inline uint32_t log10_pow5(int32_t e) {
+  return ((uint32_t)e * 732923) >> 20;
+}
+
+// Number of times 5 divides a value
+static inline uint32_t pow5_factor(uint64_t value) {
+  uint32_t count = 0;
+  while(value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count;
+}
+
+static inline int multiple_of_pow5(uint64_t value, uint32_t p) {
+  return pow5_factor(value) >= p;
+}
+
+static inline int multiple_of_pow2(uint64_t value, uint32_t p) {
+  return (value & ((1ull << p) - 1)) == 0;
+}
+
+// (m * mul) >> j, where mul is a 128 bit table entry and j >= 64
+static inline uint64_t mul_shift(uint64_t m, const uint64_t *mul, int32_t j) {
+  uint128_t low = (uint128_t)m * mul[0];
+  uint128_t high = (uint128_t)m * mul[1];
+  return (uint64_t)(((low >> 64) + high) >> (j - 64));
+}
+
+// Find the shortest decimal in the rounding interval of a double
+// Sets *digits and *exponent so that the value is digits * 10^exponent.
+static void shortest_decimal(uint64_t ieee_mantissa, uint32_t ieee_exponent, uint64_t *digits, int32_t *exponent) {
+  int32_t e2;
+  uint64_t m2;
+  if(ieee_exponent == 0) {
+    e2 = 1 - EXPONENT_BIAS - MANTISSA_BITS - 2;
+    m2 = ieee_mantissa;
+  } else {
+    e2 = (int32_t)ieee_exponent - EXPONENT_BIAS - MANTISSA_BITS - 2;
+    m2 = (1ull << MANTISSA_BITS) | ieee_mantissa;
+  }
+  // Ties go to the even mantissa, so an even one owns the ends of its interval
+  int accept_bounds = (m2 & 1) == 0;
+
+  // The value and the halfway points to its neighbours, all times 4
+  uint64_t mv = 4 * m2;
+  uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+  // Scale them to decimal: vr is the value, vp and vm the upper and lower
+  // bounds of the interval
+  uint64_t vr, vp, vm;
+  int32_t e10;
+  int vm_trailing_zeros = 0;
+  int vr_trailing_zeros = 0;
+  if(e2 >= 0) {
+    uint32_t q = log10_pow2(e2) - (e2 > 3);
+    e10 = (int32_t)q;
+    int32_t k = REAL_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+    int32_t i = -e2 + (int32_t)q + k;
+    vr = mul_shift(4 * m2, REAL_POW5_INV[q], i);
+    vp = mul_shift(4 * m2 + 2, REAL_POW5_INV[q], i);
+    vm = mul_shift(4 * m2 - 1 - mm_shift, REAL_POW5_INV[q], i);
+    if(q <= 21) {
+      // Only one of mp, mv and mm can be a multiple of 5, if any
+      if(mv % 5 == 0) vr_trailing_zeros = multiple_of_pow5(mv, q);
+      else if(accept_bounds) vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+      else vp -= multiple_of_pow5(mv + 2, q);
+    }
+  } else {
+    uint32_t q = log10_pow5(-e2) - (-e2 > 1);
+    e10 = (int32_t)q + e2;
+    int32_t i = -e2 - (int32_t)q;
+    int32_t k = pow5bits(i) - REAL_POW5_BITCOUNT;
+    int32_t j = (int32_t)q - k;
+    vr = mul_shift(4 * m2, REAL_POW5[i], j);
+    vp = mul_shift(4 * m2 + 2, REAL_POW5[i], j);
+    vm = mul_shift(4 * m2 - 1 - mm_shift, REAL_POW5[i], j);
+    if(q <= 1) {
+      // mv has at least q trailing 0 bits, and so do mp and mm
+      vr_trailing_zeros = 1;
+      if(accept_bounds) vm_trailing_zeros = mm_shift == 1;
+      else vp--;
+    } else if(q < 63) {
+      vr_trailing_zeros = multiple_of_pow2(mv, q);
+    }
+  }
+
+  // Drop digits while the interval still holds a shorter number
+  int32_t removed = 0;
+  uint8_t last_removed = 0;
+  uint64_t output;
+  if(vm_trailing_zeros || vr_trailing_zeros) {
+    // The rare case, where exact ties and the bounds need care
+    while(vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed == 0;
+      last_removed = (uint8_t)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if(vm_trailing_zeros) {
+      while(vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed == 0;
+        last_removed = (uint8_t)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    // Round half to even when the value is exactly halfway
+    if(vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) last_removed = 4;
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+  } else {
+    int round_up = 0;
+    while(vp / 10 > vm / 10) {
+      round_up = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || round_up);
+  }
+
+  *digits = output;
+  *exponent = e10 + removed;
+}
+
+// Write an exponent with a sign and at least two digits
+static size_t format_exponent(char *buf, int32_t exponent) {
+  size_t length = 0;
+  buf[length++] = 'e';
+  buf[length++] = exponent < 0 ? '-' : '+';
+  if(exponent < 0) exponent = -exponent;
+  if(exponent >= 100) buf[length++] = (char)('0' + exponent / 100);
+  buf[length++] = (char)('0' + exponent / 10 % 10);
+  buf[length++] = (char)('0' + exponent % 10);
+  return length;
+}
+
+// Format a double, see the top of the file for the format
+// buf must hold REAL_FORMAT_MAX bytes. Returns the length of the text.
+size_t real_format(double value, char *buf) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int sign = (int)(bits >> (MANTISSA_BITS + EXPONENT_BITS));
+  uint64_t ieee_mantissa = bits & ((1ull << MANTISSA_BITS) - 1);
+  uint32_t ieee_exponent = (uint32_t)((bits >> MANTISSA_BITS) & ((1u << EXPONENT_BITS) - 1));
+
+  size_t length = 0;
+  if(ieee_exponent == (1u << EXPONENT_BITS) - 1 && ieee_mantissa) {
+    memcpy(buf, "nan", 4);
+    return 3;
+  }
+  if(sign) buf[length++] = '-';
+  if(ieee_exponent == (1u << EXPONENT_BITS) - 1) {
+    memcpy(buf + length, "inf", 4);
+    return length + 3;
+  }
+  if(ieee_exponent == 0 && ieee_mantissa == 0) {
+    memcpy(buf + length, "0.0", 4);
+    return length + 3;
+  }
+
+  uint64_t output;
+  int32_t exponent;
+  shortest_decimal(ieee_mantissa, ieee_exponent, &output, &exponent);
+
+  // At most 17 digits
+  char digits[20];
+  int32_t count = 0;
+  uint64_t rest = output;
+  do {
+    count++;
+    rest /= 10;
+  } while(rest);
+  for(int32_t i = count - 1; i >= 0; i--) {
+    digits[i] = (char)('0' + output % 10);
+    output /= 10;
+  }
+
+  // Where the decimal point goes, counted from the start of the digits
+  int32_t point = exponent + count;
+  if(point < -3 || point > 16) {
+    buf[length++] = digits[0];
+    if(count > 1) {
+      buf[length++] = '.';
+      memcpy(buf + length, digits + 1, count - 1);
+      length += count - 1;
+    }
+    length += format_exponent(buf + length, point - 1);
+  } else if(point <= 0) {
+    buf[length++] = '0';
+    buf[length++] = '.';
+    for(int32_t i = point; i < 0; i++) buf[length++] = '0';
+    memcpy(buf + length, digits, count);
+    length += count;
+  } else if(point >= count) {
+    memcpy(buf + length, digits, count);
+    length += count;
+    for(int32_t i = count; i < point; i++) buf[length++] = '0';
+    buf[length++] = '.';
+    buf[length++] = '0';
+  } else {
+    memcpy(buf + length, digits, point);
+    length += point;
+    buf[length++] = '.';
+    memcpy(buf + length, digits + point, count - point);
+    length += count - point;
+  }
+  buf[length] = '\0';
+  return length;
+}
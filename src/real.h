@@ -0,0 +1,14 @@
+#ifndef REAL_H
+#define REAL_H
+
+// Includes
+#include <stddef.h>
+
+// Defines
+// Longest text real_format() writes, including the '\0'
+#define REAL_FORMAT_MAX 32
+
+// Function prototypes
+size_t real_format(double value, char *buf);
+
+#endif // real.h
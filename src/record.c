@@ -0,0 +1,181 @@
+#include "record.h"
+#include "def.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read all of a file that can't be mapped, like a pipe or FIFO
+static int read_all(int fd, RecordReader *reader) {
+  char *data = NULL;
+  size_t size = 0;
+  size_t capacity = 0;
+  while(1) {
+    if(size == capacity) {
+      capacity = capacity ? capacity * 2 : 65536;
+      char *grown = realloc(data, capacity);
+      if(!grown) {
+        PERROR("realloc() failed.\n");
+        free(data);
+        return 1;
+      }
+      data = grown;
+    }
+    ssize_t got = read(fd, data + size, capacity - size);
+    if(got < 0 && errno == EINTR) continue;
+    if(got < 0) {
+      PERROR("read() failed: %s\n", strerror(errno));
+      free(data);
+      return 1;
+    }
+    if(got == 0) break;
+    size += got;
+  }
+
+  reader->data = data;
+  reader->size = size;
+  return 0;
+}
+
+// Open a file of records
+RecordReader *record_reader_open(const char *path) {
+  RecordReader *reader = calloc(1, sizeof(RecordReader));
+  if(!reader) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if(fd < 0) {
+    PERROR("Couldn't open %s: %s\n", path, strerror(errno));
+    free(reader);
+    return NULL;
+  }
+
+  struct stat st;
+  int status = 0;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    if(st.st_size > 0) {
+      void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(data == MAP_FAILED) {
+        PERROR("mmap() failed: %s\n", strerror(errno));
+        status = 1;
+      } else {
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        reader->data = data;
+        reader->size = st.st_size;
+        reader->mapped = 1;
+      }
+    }
+  } else {
+    status = read_all(fd, reader);
+  }
+  close(fd);
+  if(status) {
+    free(reader);
+    return NULL;
+  }
+  return reader;
+}
+
+// Close a file of records
+void record_reader_close(RecordReader **reader) {
+  if(!reader) return;
+  RecordReader *r = *reader;
+  if(!r) return;
+  if(r->mapped) munmap((void *)r->data, r->size);
+  else free((void *)r->data);
+  free(r->fields);
+  free(r);
+  *reader = NULL;
+}
+
+// Add a field to the reader's list for the current record
+static int push_field(RecordReader *reader, const char *data, size_t length) {
+  if(reader->field_count == reader->field_capacity) {
+    size_t capacity = reader->field_capacity ? reader->field_capacity * 2 : 16;
+    RecordField *fields = realloc(reader->fields, sizeof(RecordField) * capacity);
+    if(!fields) {
+      PERROR("realloc() failed.\n");
+      return 1;
+    }
+    reader->fields = fields;
+    reader->field_capacity = capacity;
+  }
+  reader->fields[reader->field_count++] = (RecordField){data, length};
+  return 0;
+}
+
+// Split the next record into fields
+// The line break isn't part of the last field, whether it's "\n" or "\r\n".
+int record_next(RecordReader *reader) {
+  if(record_at_end(reader)) return RECORD_EOF;
+
+  const char *start = reader->data + reader->pos;
+  const char *end = memchr(start, '\n', reader->size - reader->pos);
+  if(end) reader->pos = end - reader->data + 1;
+  else {
+    end = reader->data + reader->size;
+    reader->pos = reader->size;
+  }
+  if(end > start && end[-1] == '\r') end--;
+  reader->line++;
+
+  reader->field_count = 0;
+  while(1) {
+    const char *delimiter = memchr(start, RECORD_DELIMITER, end - start);
+    const char *field_end = delimiter ? delimiter : end;
+    if(push_field(reader, start, field_end - start) != 0) return RECORD_FAIL;
+    if(!delimiter) break;
+    start = delimiter + 1;
+  }
+  return RECORD_OKAY;
+}
+
+// Open a file for reading records
+int record_file_open_reader(RecordFile *file) {
+  file->reader = record_reader_open(file->path);
+  if(!file->reader) {
+    PERROR("Failed to open %s for reading.\n", file->path);
+    return 1;
+  }
+  return 0;
+}
+
+// Open a file for writing records
+int record_file_open_writer(RecordFile *file) {
+  int fd = open(file->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if(fd < 0) {
+    PERROR("Couldn't open %s for writing: %s\n", file->path, strerror(errno));
+    return 1;
+  }
+
+  file->writer = output_create(fd, 0);
+  if(!file->writer) {
+    PERROR("output_create() failed.\n");
+    close(fd);
+    return 1;
+  }
+  return 0;
+}
+
+// Write out any records still buffered for a file
+int record_file_flush(RecordFile *file) {
+  if(!file->writer || output_flush(file->writer) == 0) return 0;
+  PERROR("Failed to write to %s.\n", file->path);
+  return 1;
+}
+
+// Close a file's reader and writer
+void record_file_close(RecordFile *file) {
+  record_reader_close(&file->reader);
+  if(file->writer) {
+    int fd = file->writer->fd;
+    output_destroy(&file->writer);
+    close(fd);
+  }
+}
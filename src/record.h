@@ -0,0 +1,67 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+// Includes
+#include "output.h"
+#include <stddef.h>
+
+// Defines
+// Records are one per line, with their fields separated by RECORD_DELIMITER.
+// There's no quoting, so a field can't contain the delimiter or a line break.
+#define RECORD_DELIMITER ','
+
+// Structs
+// A field of a record, pointing into the reader's data
+typedef struct {
+  const char *data;
+  size_t length;
+} RecordField;
+
+// Reader for a file of records
+// The file is mapped into memory, or read into it if it can't be mapped, and
+// records are split up in place. fields holds the fields of the last record
+// read, and is only valid until the next one.
+typedef struct {
+  const char *data;
+  size_t size;
+  int mapped;
+  size_t pos;
+  // Line of the last record read, for error messages
+  size_t line;
+  RecordField *fields;
+  size_t field_count;
+  size_t field_capacity;
+} RecordReader;
+
+// A file a program uses
+// Its reader or writer is opened the first time the program READs from or
+// WRITEs to it. Writes are buffered and the file is truncated when it's
+// opened.
+typedef struct {
+  const char *path;
+  RecordReader *reader;
+  Output *writer;
+} RecordFile;
+
+// Errors
+enum {
+  RECORD_OKAY,
+  RECORD_EOF,
+  RECORD_FAIL
+};
+
+// Function prototypes
+RecordReader *record_reader_open(const char *path);
+void record_reader_close(RecordReader **reader);
+int record_next(RecordReader *reader);
+int record_file_open_reader(RecordFile *file);
+int record_file_open_writer(RecordFile *file);
+int record_file_flush(RecordFile *file);
+void record_file_close(RecordFile *file);
+
+// Whether a reader has no records left
+static inline int record_at_end(RecordReader *reader) {
+  return reader->pos >= reader->size;
+}
+
+#endif // record.h
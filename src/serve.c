@@ -0,0 +1,485 @@
+#include "serve.h"
+#include "cache.h"
+#include "def.h"
+#include "iolog.h"
+#include "source.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// How much of a client's standard input is read at a time
+#define SERVE_READ_SIZE 65536
+
+// Set by SIGINT and SIGTERM to stop the daemon
+static volatile sig_atomic_t serve_stopping = 0;
+
+static void serve_stop(int signal) {
+  (void)signal;
+  serve_stopping = 1;
+}
+
+// Read exactly length bytes, failing if the input ends first
+static int read_all(int fd, void *data, size_t length) {
+  char *p = data;
+  while(length) {
+    ssize_t got = read(fd, p, length);
+    if(got < 0 && errno == EINTR) continue;
+    if(got <= 0) return 1;
+    p += got;
+    length -= got;
+  }
+  return 0;
+}
+
+// Send all of data to a socket
+// A peer that has hung up is an error rather than a SIGPIPE.
+static int send_all(int fd, const void *data, size_t length) {
+  const char *p = data;
+  while(length) {
+    ssize_t sent = send(fd, p, length, MSG_NOSIGNAL);
+    if(sent < 0 && errno == EINTR) continue;
+    if(sent < 0) return 1;
+    p += sent;
+    length -= sent;
+  }
+  return 0;
+}
+
+// Fill in the address of a socket at path
+static int serve_address(const char *path, struct sockaddr_un *address) {
+  if(strlen(path) >= sizeof(address->sun_path)) {
+    PERROR("The socket path %s is too long.\n", path);
+    return 1;
+  }
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, path);
+  return 0;
+}
+
+// CACHE
+// Find a program in the cache, with the lock held
+static ServeEntry *serve_cache_find(ServeCache *cache, uint64_t hash, const char *source, size_t length) {
+  for(ServeEntry *entry = cache->entries; entry; entry = entry->next) {
+    if(entry->hash == hash && entry->length == length && memcmp(entry->source, source, length) == 0) return entry;
+  }
+  return NULL;
+}
+
+static void serve_entry_destroy(ServeEntry **entry) {
+  if(!entry || !*entry) return;
+  parser_destroy(&(*entry)->program);
+  free((*entry)->source);
+  free(*entry);
+  *entry = NULL;
+}
+
+// Drop the least recently used programs no request is running until there
+// are at most keep left, with the lock held
+static void serve_cache_evict(ServeCache *cache, size_t keep) {
+  while(cache->count > keep) {
+    ServeEntry **oldest = NULL;
+    for(ServeEntry **link = &cache->entries; *link; link = &(*link)->next) {
+      if((*link)->users == 0 && (!oldest || (*link)->last_used < (*oldest)->last_used)) oldest = link;
+    }
+    if(!oldest) return;
+
+    ServeEntry *entry = *oldest;
+    *oldest = entry->next;
+    cache->count--;
+    serve_entry_destroy(&entry);
+  }
+}
+
+// Get a program from the cache, parsing it and adding it if it isn't there
+// source is stripped of its comments if it's parsed. The program stays in the
+// cache until serve_cache_release().
+static ServeEntry *serve_cache_get(ServeCache *cache, char *source, size_t length) {
+  uint64_t hash = cache_hash(source, length);
+  pthread_mutex_lock(&cache->lock);
+  cache->requests++;
+  ServeEntry *entry = serve_cache_find(cache, hash, source, length);
+  if(entry) {
+    cache->hits++;
+    entry->users++;
+    entry->last_used = iolog_now();
+  }
+  pthread_mutex_unlock(&cache->lock);
+  if(entry) return entry;
+
+  // Parse without the lock, so requests for other programs aren't held up
+  entry = calloc(1, sizeof(ServeEntry));
+  if(!entry) {
+    PERROR("calloc() failed.\n");
+    return NULL;
+  }
+  entry->source = malloc(length ? length : 1);
+  if(!entry->source) {
+    PERROR("malloc() failed.\n");
+    free(entry);
+    return NULL;
+  }
+  memcpy(entry->source, source, length);
+  entry->length = length;
+  entry->hash = hash;
+  entry->users = 1;
+  entry->program = source_parse(source);
+  if(!entry->program) {
+    serve_entry_destroy(&entry);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  // Another request may have parsed the same program meanwhile
+  ServeEntry *found = serve_cache_find(cache, hash, entry->source, length);
+  if(found) {
+    found->users++;
+    found->last_used = iolog_now();
+    pthread_mutex_unlock(&cache->lock);
+    serve_entry_destroy(&entry);
+    return found;
+  }
+  entry->last_used = iolog_now();
+  entry->next = cache->entries;
+  cache->entries = entry;
+  cache->count++;
+  serve_cache_evict(cache, SERVE_CACHE_SIZE);
+  pthread_mutex_unlock(&cache->lock);
+  return entry;
+}
+
+// Finish running a program from the cache
+static void serve_cache_release(ServeCache *cache, ServeEntry *entry) {
+  pthread_mutex_lock(&cache->lock);
+  entry->users--;
+  serve_cache_evict(cache, SERVE_CACHE_SIZE);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// DAEMON
+// Receive a request's header and the client's standard input, output and
+// error sent along with it
+static int serve_receive_header(int fd, char *header, int *fds) {
+  struct iovec iov = {header, SERVE_HEADER_SIZE};
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(int) * 3)];
+  } control;
+  struct msghdr message = {0};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  ssize_t got;
+  do {
+    got = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  } while(got < 0 && errno == EINTR);
+  if(got <= 0) return 1;
+
+  size_t count = 0;
+  for(struct cmsghdr *c = CMSG_FIRSTHDR(&message); c; c = CMSG_NXTHDR(&message, c)) {
+    if(c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+    size_t passed = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for(size_t n = 0; n < passed; n++) {
+      int received;
+      memcpy(&received, CMSG_DATA(c) + n * sizeof(int), sizeof(int));
+      if(count < 3) fds[count++] = received;
+      else close(received);
+    }
+  }
+
+  if(count != 3 || read_all(fd, header + got, SERVE_HEADER_SIZE - got) != 0) {
+    for(size_t n = 0; n < count; n++) close(fds[n]);
+    return 1;
+  }
+  return 0;
+}
+
+// Run a program for a client, feeding it the client's standard input
+// Other devices it RECEIVEs from without being bound to anything have no
+// input.
+static int serve_run(Parser *program, InterpreterConfig *config, int in_fd, int out_fd) {
+  int status;
+  Interpreter *interpreter = interpreter_start(program, config, out_fd, &status);
+  if(!interpreter) return status;
+
+  char *buffer = malloc(SERVE_READ_SIZE);
+  if(!buffer) {
+    PERROR("malloc() failed.\n");
+    interpreter_destroy(&interpreter);
+    return ERR_CREATE_FAIL;
+  }
+
+  int run;
+  while((run = interpreter_run(interpreter, SIZE_MAX)) == RUN_WAITING) {
+    ssize_t got = 0;
+    if(interpreter->waiting == DEVICE_KEYBOARD) {
+      do {
+        got = read(in_fd, buffer, SERVE_READ_SIZE);
+      } while(got < 0 && errno == EINTR);
+      if(got < 0) {
+        PERROR("read() failed: %s\n", strerror(errno));
+        got = 0;
+      }
+    }
+    if(interpreter_feed(interpreter, interpreter->devices[interpreter->waiting].name, buffer, got) != ERR_OKAY) break;
+  }
+  free(buffer);
+
+  status = ERR_DEVICE;
+  if(run == RUN_DONE) status = ERR_OKAY;
+  if(run == RUN_FAILED) status = interpreter->status;
+  interpreter_destroy(&interpreter);
+  return status;
+}
+
+// Read the program a client asked for, and run it
+static int serve_handle(ServeConnection *connection, const char *header, int in_fd, int out_fd) {
+  uint32_t length;
+  memcpy(&length, header + 1, sizeof(length));
+  if(header[0] != SERVE_SOURCE || length > SERVE_MAX_SOURCE) {
+    PERROR("Malformed request.\n");
+    return ERR_INVALID_ARGS;
+  }
+
+  char *data = malloc(length + 1);
+  if(!data) {
+    PERROR("malloc() failed.\n");
+    return ERR_CREATE_FAIL;
+  }
+  if(read_all(connection->fd, data, length) != 0) {
+    PERROR("The request was cut short.\n");
+    free(data);
+    return ERR_IO;
+  }
+  data[length] = '\0';
+
+  ServeEntry *entry = serve_cache_get(connection->cache, data, length);
+  free(data);
+  if(!entry) return ERR_CREATE_FAIL;
+
+  int status = serve_run(entry->program, connection->config, in_fd, out_fd);
+  serve_cache_release(connection->cache, entry);
+  return status;
+}
+
+// Finish with a client, freeing its slot for the next one
+static void serve_connection_end(ServeConnection *connection) {
+  ServeCache *cache = connection->cache;
+  close(connection->fd);
+  free(connection);
+  pthread_mutex_lock(&cache->lock);
+  cache->connections--;
+  pthread_cond_signal(&cache->ended);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+// Serve one client, replying with the status its program stopped with
+static void *serve_connection(void *arg) {
+  ServeConnection *connection = arg;
+  char header[SERVE_HEADER_SIZE];
+  int fds[3];
+  if(serve_receive_header(connection->fd, header, fds) != 0) {
+    serve_connection_end(connection);
+    return NULL;
+  }
+
+  // Diagnostics go to the client rather than the daemon's standard error
+  diag_out = fdopen(fds[2], "w");
+  if(diag_out) setvbuf(diag_out, NULL, _IOLBF, 0);
+  else close(fds[2]);
+
+  int32_t status = serve_handle(connection, header, fds[0], fds[1]);
+
+  close(fds[0]);
+  close(fds[1]);
+  if(diag_out) fclose(diag_out);
+  diag_out = NULL;
+  send_all(connection->fd, &status, sizeof(status));
+  serve_connection_end(connection);
+  return NULL;
+}
+
+// Start listening on a socket
+// A socket left behind by a daemon that didn't stop cleanly is replaced, but
+// not one that's still being served.
+static int serve_listen(const char *path, struct sockaddr_un *address) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    PERROR("socket() failed: %s\n", strerror(errno));
+    return -1;
+  }
+
+  int status = bind(fd, (struct sockaddr *)address, sizeof(*address));
+  if(status != 0 && errno == EADDRINUSE) {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(probe >= 0 && connect(probe, (struct sockaddr *)address, sizeof(*address)) != 0 && errno == ECONNREFUSED) {
+      unlink(path);
+      status = bind(fd, (struct sockaddr *)address, sizeof(*address));
+    } else {
+      errno = EADDRINUSE;
+    }
+    if(probe >= 0) close(probe);
+  }
+  if(status != 0 || listen(fd, SOMAXCONN) != 0) {
+    PERROR("Couldn't listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Wait until fewer than SERVE_MAX_CONNECTIONS clients are being served, or
+// the daemon is stopping, and count in the next one
+// Returns 1 if it's stopping.
+static int serve_wait_slot(ServeCache *cache) {
+  pthread_mutex_lock(&cache->lock);
+  while(cache->connections >= SERVE_MAX_CONNECTIONS && !serve_stopping) {
+    // Signals don't wake the wait, so it looks at serve_stopping now and then
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec++;
+    pthread_cond_timedwait(&cache->ended, &cache->lock, &until);
+  }
+  int stopping = serve_stopping;
+  if(!stopping) cache->connections++;
+  pthread_mutex_unlock(&cache->lock);
+  return stopping;
+}
+
+// Run the programs clients send to a socket until SIGINT or SIGTERM
+// Each client is served on a thread of its own, up to SERVE_MAX_CONNECTIONS
+// at once, with the rest left waiting to be accepted. Programs are kept
+// parsed, keyed by their source, so running one again skips straight to
+// running it. They can't use files, only the devices the daemon was started
+// with.
+int serve(const char *path, InterpreterConfig *config) {
+  struct sockaddr_un address;
+  if(serve_address(path, &address) != 0) return 1;
+  int fd = serve_listen(path, &address);
+  if(fd < 0) return 1;
+  config->no_files = 1;
+
+  struct sigaction action = {0};
+  action.sa_handler = serve_stop;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  // A client that connects and sends nothing only holds its slot so long
+  struct timeval timeout = {SERVE_REQUEST_TIMEOUT, 0};
+
+  ServeCache cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .ended = PTHREAD_COND_INITIALIZER};
+  fprintf(stderr, "Serving on %s\n", path);
+  while(serve_wait_slot(&cache) == 0) {
+    int client = accept(fd, NULL, NULL);
+    ServeConnection *connection = client >= 0 ? malloc(sizeof(ServeConnection)) : NULL;
+    if(connection) {
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      *connection = (ServeConnection){client, &cache, config};
+      pthread_t thread;
+      if(pthread_create(&thread, &attr, serve_connection, connection) == 0) continue;
+      PERROR("pthread_create() failed.\n");
+      free(connection);
+    } else if(client >= 0) {
+      PERROR("malloc() failed.\n");
+    } else if(errno != EINTR) {
+      PERROR("accept() failed: %s\n", strerror(errno));
+    }
+
+    if(client >= 0) close(client);
+    pthread_mutex_lock(&cache.lock);
+    cache.connections--;
+    pthread_mutex_unlock(&cache.lock);
+  }
+
+  // Clients still being served are cut off when the process exits, so the
+  // programs they're running are left for it to free
+  pthread_attr_destroy(&attr);
+  close(fd);
+  unlink(path);
+  pthread_mutex_lock(&cache.lock);
+  fprintf(stderr, "Served %zu requests, %zu from the cache\n", cache.requests, cache.hits);
+  serve_cache_evict(&cache, 0);
+  pthread_mutex_unlock(&cache.lock);
+  return 0;
+}
+
+// CLIENT
+// Run a program on a daemon started with --serve
+// The program's source is sent, so the daemon doesn't need to be able to read
+// it, along with this process's standard input, output and error. Returns
+// the status the program stopped with, or ERR_IO if the daemon couldn't run
+// it.
+int serve_request(const char *path, char *program_path) {
+  struct sockaddr_un address;
+  if(serve_address(path, &address) != 0) return ERR_INVALID_ARGS;
+
+  char *source = read_file_str(program_path);
+  if(!source) return ERR_IO;
+  size_t length = strlen(source);
+  if(length > SERVE_MAX_SOURCE) {
+    PERROR("%s is too big to send.\n", program_path);
+    free(source);
+    return ERR_INVALID_ARGS;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    PERROR("Couldn't connect to %s: %s\n", path, strerror(errno));
+    if(fd >= 0) close(fd);
+    free(source);
+    return ERR_IO;
+  }
+
+  char header[SERVE_HEADER_SIZE];
+  uint32_t size = length;
+  header[0] = SERVE_SOURCE;
+  memcpy(header + 1, &size, sizeof(size));
+
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  struct iovec iov = {header, SERVE_HEADER_SIZE};
+  union {
+    struct cmsghdr align;
+    char buffer[CMSG_SPACE(sizeof(fds))];
+  } control;
+  memset(&control, 0, sizeof(control));
+  struct msghdr message = {0};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  struct cmsghdr *c = CMSG_FIRSTHDR(&message);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+  } while(sent < 0 && errno == EINTR);
+  int failed = sent < 0 || send_all(fd, header + sent, SERVE_HEADER_SIZE - sent) != 0 || send_all(fd, source, length) != 0;
+  free(source);
+
+  int32_t status;
+  if(failed || read_all(fd, &status, sizeof(status)) != 0) {
+    PERROR("Lost the connection to %s.\n", path);
+    status = ERR_IO;
+  }
+  close(fd);
+  return status;
+}
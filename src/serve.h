@@ -0,0 +1,70 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+// Includes
+#include "interpreter.h"
+#include "parser.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+// A request is a header followed by its data. The header is sent with the
+// client's standard input, output and error attached as SCM_RIGHTS:
+//   kind      SERVE_SOURCE, one byte
+//   length    length of the data, a uint32_t in the machine's byte order
+//   data      the program's source
+// The program's KEYBOARD reads the client's standard input, DISPLAY writes to
+// its standard output and diagnostics go to its standard error. Once the
+// program has stopped, the reply is the status it stopped with, an int32_t.
+// Programs run by the daemon can't READ or WRITE files, which would be the
+// daemon's rather than the client's.
+#define SERVE_SOURCE 'S'
+#define SERVE_HEADER_SIZE 5
+// Largest program a request can hold
+#define SERVE_MAX_SOURCE (64u << 20)
+// Programs kept parsed between requests
+#define SERVE_CACHE_SIZE 256
+// Clients served at once, and how long one has to send its request, in seconds
+#define SERVE_MAX_CONNECTIONS 64
+#define SERVE_REQUEST_TIMEOUT 10
+
+// Structs
+// A parsed program, keyed by a hash of its source
+// users counts the requests running it, and it's only evicted once that's 0.
+typedef struct ServeEntry {
+  uint64_t hash;
+  char *source;
+  size_t length;
+  Parser *program;
+  size_t users;
+  uint64_t last_used;
+  struct ServeEntry *next;
+} ServeEntry;
+
+// The programs the daemon has parsed, shared by every connection
+// connections counts the clients being served, and ended is signalled as
+// each one finishes.
+typedef struct {
+  pthread_mutex_t lock;
+  ServeEntry *entries;
+  size_t count;
+  size_t connections;
+  pthread_cond_t ended;
+  // Totals, printed when the daemon stops
+  size_t requests;
+  size_t hits;
+} ServeCache;
+
+// A client the daemon is running a program for, on a thread of its own
+typedef struct {
+  int fd;
+  ServeCache *cache;
+  InterpreterConfig *config;
+} ServeConnection;
+
+// Function prototypes
+int serve(const char *path, InterpreterConfig *config);
+int serve_request(const char *path, char *program_path);
+
+#endif // serve.h
@@ -0,0 +1,89 @@
+#include "source.h"
+#include "def.h"
+#include "tokeniser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Read a file into a string
+char *read_file_str(char *file_dir) {
+  if(!file_dir) {
+    PERROR("NULL file_dir passed.\n");
+    return NULL;
+  }
+
+  FILE *file = fopen(file_dir, "rb");
+  if(!file) {
+    PERROR("Could not open file %s.\n", file_dir);
+    return NULL;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size_t file_len = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *out = malloc(sizeof(char) * (file_len + 1));
+  if(!out) {
+    PERROR("malloc() failed.\n");
+    fclose(file);
+    return NULL;
+  }
+
+  if(fread(out, sizeof(char), file_len, file) != file_len) {
+    PERROR("fread() failed.\n");
+    free(out);
+    fclose(file);
+    return NULL;
+  }
+
+  out[file_len] = '\0';
+  fclose(file);
+  return out;
+}
+
+// Strip comments from a string (# until \n)
+void strip_comments(char *src) {
+  if(!src) return;
+  char *read = src;
+  char *write = src;
+
+  int in_comment = 0;
+
+  while(*read != '\0') {
+    if(*read == '#') in_comment = 1;
+    if(*read == '\n') in_comment = 0;
+    if(!in_comment) *(write++) = (*read);
+    read++;
+  }
+  *write = '\0';
+}
+
+// Tokenise and parse a program's source
+// The source is modified, as its comments are stripped first.
+Parser *source_parse(char *source) {
+  strip_comments(source);
+
+  Tokeniser *tokeniser = tokenise(source);
+  if(!tokeniser) {
+    PERROR("Failed to tokenise the program.\n");
+    return NULL;
+  }
+
+  Parser *parser = parse(tokeniser);
+  tokeniser_destroy(&tokeniser);
+  if(!parser) PERROR("Failed to parse the program.\n");
+  return parser;
+}
+
+// Read, tokenise and parse a program
+Parser *source_parse_file(char *path) {
+  char *contents = read_file_str(path);
+  if(!contents) {
+    PERROR("Failed to read %s.\n", path);
+    return NULL;
+  }
+
+  Parser *parser = source_parse(contents);
+  free(contents);
+  if(!parser) PERROR("Failed to parse %s.\n", path);
+  return parser;
+}
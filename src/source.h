@@ -0,0 +1,13 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+// Includes
+#include "parser.h"
+
+// Function prototypes
+char *read_file_str(char *file_dir);
+void strip_comments(char *src);
+Parser *source_parse(char *source);
+Parser *source_parse_file(char *path);
+
+#endif // source.h
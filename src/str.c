@@ -0,0 +1,239 @@
+#include "str.h"
+#include "def.h"
+#include "pool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of string buffers that haven't been freed, on this thread
+static _Thread_local size_t live_bufs = 0;
+
+// Make an empty string
+void string_init(String *s) {
+  s->length = 0;
+  s->small[0] = '\0';
+}
+
+// Release a string's buffer, leaving it empty
+void string_destroy(String *s) {
+  if(s->length > STRING_SMALL_MAX && --s->buf->refs == 0) {
+    pool_free(s->buf);
+    live_bufs--;
+  }
+  string_init(s);
+}
+
+// Release a reference to a buffer
+static void buf_release(StringBuf *buf) {
+  if(--buf->refs > 0) return;
+  pool_free(buf);
+  live_bufs--;
+}
+
+// Number of string buffers allocated on this thread that haven't been freed
+size_t string_live_count(void) {
+  return live_bufs;
+}
+
+// Make a string hold a copy of some text
+int string_set(String *s, const char *data, size_t length) {
+  string_destroy(s);
+  return string_append(s, data, length);
+}
+
+// Make dst a copy of src
+// A long string's buffer is shared rather than copied.
+void string_copy(String *dst, String *src) {
+  *dst = *src;
+  if(dst->length > STRING_SMALL_MAX) dst->buf->refs++;
+}
+
+// Allocate a buffer with room for capacity bytes, holding length bytes of data
+static StringBuf *buf_create(size_t capacity, const char *data, size_t length) {
+  StringBuf *buf = pool_alloc(sizeof(StringBuf) + capacity);
+  if(!buf) {
+    PERROR("pool_alloc() failed.\n");
+    return NULL;
+  }
+  buf->refs = 1;
+  buf->capacity = capacity;
+  buf->hash = 0;
+  buf->interned = 0;
+  memcpy(buf->data, data, length);
+  live_bufs++;
+  return buf;
+}
+
+// Append text to a string
+// The buffer at least doubles whenever it grows, so appending to a string one
+// piece at a time is amortised O(1) per character. A shared buffer is copied
+// first. data may point into s.
+int string_append(String *s, const char *data, size_t length) {
+  if(length == 0) return 0;
+  if(length > SIZE_MAX - sizeof(StringBuf) - s->length - 1) {
+    PERROR("String is too long.\n");
+    return 1;
+  }
+
+  size_t new_length = s->length + length;
+  if(new_length <= STRING_SMALL_MAX) {
+    memmove(s->small + s->length, data, length);
+    s->small[new_length] = '\0';
+    s->length = new_length;
+    return 0;
+  }
+
+  StringBuf *buf = s->length > STRING_SMALL_MAX ? s->buf : NULL;
+  if(!buf || buf->refs > 1 || new_length + 1 > buf->capacity) {
+    size_t capacity = buf ? buf->capacity : 16;
+    while(capacity < new_length + 1) capacity *= 2;
+
+    if(buf && buf->refs == 1) {
+      // Appending the string to itself must survive the buffer moving
+      int aliased = data >= buf->data && data < buf->data + s->length;
+      size_t offset = aliased ? (size_t)(data - buf->data) : 0;
+      StringBuf *new = pool_realloc(buf, sizeof(StringBuf) + capacity);
+      if(!new) {
+        PERROR("pool_realloc() failed.\n");
+        return 1;
+      }
+      if(aliased) data = new->data + offset;
+      new->capacity = capacity;
+      buf = new;
+    } else {
+      // The old text stays alive until the new buffer is filled, whether it
+      // is in small or in a buffer that another string still holds
+      StringBuf *new = buf_create(capacity, string_data(s), s->length);
+      if(!new) return 1;
+      memcpy(new->data + s->length, data, length);
+      new->data[new_length] = '\0';
+      if(buf) buf_release(buf);
+      s->buf = new;
+      s->length = new_length;
+      return 0;
+    }
+    s->buf = buf;
+  }
+
+  memmove(buf->data + s->length, data, length);
+  buf->data[new_length] = '\0';
+  s->length = new_length;
+  return 0;
+}
+
+// Compare two strings byte by byte, a shorter prefix comes first
+int string_compare(String *a, String *b) {
+  if(a->length == b->length && a->length > STRING_SMALL_MAX && a->buf == b->buf) return 0;
+  size_t n = a->length < b->length ? a->length : b->length;
+  int cmp = memcmp(string_data(a), string_data(b), n);
+  if(cmp) return cmp;
+  return (a->length > b->length) - (a->length < b->length);
+}
+
+// Check whether two strings hold the same text
+// Copies sharing a buffer, and interned strings, are told apart without
+// looking at their text.
+int string_equal(String *a, String *b) {
+  if(a->length != b->length) return 0;
+  if(a->length > STRING_SMALL_MAX) {
+    if(a->buf == b->buf) return 1;
+    if(a->buf->interned && b->buf->interned) return 0;
+    if(a->buf->hash && b->buf->hash && a->buf->hash != b->buf->hash) return 0;
+  }
+  return memcmp(string_data(a), string_data(b), a->length) == 0;
+}
+
+// FNV-1a hash of some text, never 0 so that 0 can mean not cached
+uint32_t string_hash(const char *data, size_t length) {
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+// Create an empty string table
+StringTable *string_table_create(void) {
+  StringTable *table = pool_calloc(sizeof(StringTable));
+  if(!table) {
+    PERROR("pool_calloc() failed.\n");
+    return NULL;
+  }
+  return table;
+}
+
+// Destroy a string table, releasing its references to the buffers
+// Strings that outlive the table keep their buffers, which are no longer
+// interned.
+void string_table_destroy(StringTable **table) {
+  if(!table) return;
+  StringTable *t = *table;
+  if(!t) return;
+  for(size_t i = 0; i < t->capacity; i++) {
+    StringBuf *buf = t->entries[i].buf;
+    if(!buf) continue;
+    buf->interned = 0;
+    buf->hash = 0;
+    buf_release(buf);
+  }
+  pool_free(t->entries);
+  pool_free(t);
+  *table = NULL;
+}
+
+// Find the slot of some text in a table, or the empty slot it would go in
+static StringTableEntry *table_find(StringTable *table, const char *data, size_t length, uint32_t hash) {
+  size_t mask = table->capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask) {
+    StringTableEntry *entry = &table->entries[i];
+    if(!entry->buf) return entry;
+    if(entry->buf->hash == hash && entry->length == length && memcmp(entry->buf->data, data, length) == 0) return entry;
+  }
+}
+
+// Double the number of slots in a table
+static int table_grow(StringTable *table) {
+  size_t capacity = table->capacity ? table->capacity * 2 : 64;
+  StringTableEntry *entries = pool_calloc(sizeof(StringTableEntry) * capacity);
+  if(!entries) {
+    PERROR("pool_calloc() failed.\n");
+    return 1;
+  }
+
+  StringTable grown = {.entries = entries, .count = table->count, .capacity = capacity};
+  for(size_t i = 0; i < table->capacity; i++) {
+    StringTableEntry *entry = &table->entries[i];
+    if(entry->buf) *table_find(&grown, entry->buf->data, entry->length, entry->buf->hash) = *entry;
+  }
+  pool_free(table->entries);
+  *table = grown;
+  return 0;
+}
+
+// Replace a string with the interned copy of its text, adding it if needed
+// Short strings are left alone, comparing them is already cheap.
+int string_intern(StringTable *table, String *s) {
+  if(s->length <= STRING_SMALL_MAX || s->buf->interned) return 0;
+  if((table->count + 1) * 2 > table->capacity && table_grow(table) != 0) return 1;
+
+  uint32_t hash = string_hash(s->buf->data, s->length);
+  StringTableEntry *entry = table_find(table, s->buf->data, s->length, hash);
+  if(entry->buf) {
+    entry->buf->refs++;
+    buf_release(s->buf);
+    s->buf = entry->buf;
+    return 0;
+  }
+
+  // A buffer that other strings share can be interned as it is, the table's
+  // reference keeps it from changing under them
+  s->buf->hash = hash;
+  s->buf->interned = 1;
+  s->buf->refs++;
+  entry->buf = s->buf;
+  entry->length = s->length;
+  table->count++;
+  return 0;
+}
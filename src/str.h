@@ -0,0 +1,71 @@
+#ifndef STR_H
+#define STR_H
+
+// Includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Defines
+// Strings up to this many characters are stored inline, without allocating
+#define STRING_SMALL_MAX 15
+
+// Structs
+// Heap storage of a long string, shared between copies of it
+// hash is only cached for interned buffers, and is 0 otherwise.
+typedef struct {
+  size_t refs;
+  size_t capacity;
+  uint32_t hash;
+  uint32_t interned;
+  char data[];
+} StringBuf;
+
+// A length prefixed string of bytes, which may contain '\0'
+// Short strings are kept in small, longer ones in a reference counted buffer
+// that grows geometrically. Copies share the buffer until one of them is
+// appended to. Which storage is in use follows from the length alone, and the
+// text is always followed by a '\0' so it can be passed to C functions.
+typedef struct {
+  size_t length;
+  union {
+    StringBuf *buf;
+    char small[STRING_SMALL_MAX + 1];
+  };
+} String;
+
+// Hash-consed set of long strings
+// A string interned in a table shares the one buffer holding its text, so two
+// interned strings are equal exactly when their buffers are the same. The
+// table keeps a reference to each buffer, which also keeps them from being
+// appended to in place.
+typedef struct {
+  size_t length;
+  StringBuf *buf;
+} StringTableEntry;
+
+typedef struct {
+  StringTableEntry *entries;
+  size_t count;
+  size_t capacity;
+} StringTable;
+
+// Function prototypes
+void string_init(String *s);
+void string_destroy(String *s);
+int string_set(String *s, const char *data, size_t length);
+void string_copy(String *dst, String *src);
+int string_append(String *s, const char *data, size_t length);
+int string_compare(String *a, String *b);
+int string_equal(String *a, String *b);
+uint32_t string_hash(const char *data, size_t length);
+StringTable *string_table_create(void);
+void string_table_destroy(StringTable **table);
+int string_intern(StringTable *table, String *s);
+size_t string_live_count(void);
+
+// Text of a string
+static inline char *string_data(String *s) {
+  return s->length > STRING_SMALL_MAX ? s->buf->data : s->small;
+}
+
+#endif // str.h
@@ -173,6 +173,11 @@ static Token *tokenise_keyword(char *src) {
       {TokenProcedure, "PROCEDURE"},
       {TokenFunction, "FUNCTION"},
       {TokenReturn, "RETURN"},
+      {TokenFor, "FOR"},
+      {TokenForEach, "FOREACH"},
+      {TokenEach, "EACH"},
+      {TokenStep, "STEP"},
+      {TokenOf, "OF"},
       {TokenAdd, "+"},
       {TokenSubtract, "-"},
       {TokenDivide, "/"},
@@ -190,24 +195,37 @@ static Token *tokenise_keyword(char *src) {
       {TokenOr, "OR"},
       {TokenNot, "NOT"},
       {TokenAppend, "&"},
+      {TokenLBracket, "["},
+      {TokenRBracket, "]"},
+      {TokenLParen, "("},
+      {TokenRParen, ")"},
+      {TokenComma, ","},
+      {TokenBooleanLit, "TRUE"},
+      {TokenBooleanLit, "FALSE"},
   };
 
+  // Pick the longest matching keyword, so >= isn't read as > and FOREACH
+  // isn't read as FOR
   size_t num_keywords = sizeof(keywords) / sizeof(keywords[0]);
+  size_t best = num_keywords;
+  size_t best_len = 0;
   for(size_t i = 0; i < num_keywords; i++) {
     char *keyword_value = keywords[i].value;
-    TokenType keyword_type = keywords[i].type;
     size_t keyword_len = strlen(keyword_value);
 
-    if(strncmp(src, keyword_value, keyword_len) == 0) {
-      Token *tok = token_create(keyword_type, keyword_value);
-      if(!tok) {
-        PERROR("Failed to allocate a token.\n");
-        return NULL;
-      }
-      return tok;
+    if(keyword_len > best_len && strncmp(src, keyword_value, keyword_len) == 0) {
+      best = i;
+      best_len = keyword_len;
     }
   }
-  return NULL;
+  if(best == num_keywords) return NULL;
+
+  Token *tok = token_create(keywords[best].type, keywords[best].value);
+  if(!tok) {
+    PERROR("Failed to allocate a token.\n");
+    return NULL;
+  }
+  return tok;
 }
 
 // Helper function to check if a character is valid for an identifier
@@ -258,8 +276,8 @@ static Token *tokenise_int_lit(char *src) {
   // If only a negative sign without digits, return NULL
   if(negative && lit_len == 1) return NULL;
 
-  // Check that the next character is a space, newline, or end of string
-  if(!isspace((unsigned char)src[lit_len]) && src[lit_len] != '\0') return NULL;
+  // Check that the literal isn't running into an identifier or another dot
+  if(is_ident_char(src[lit_len]) || src[lit_len] == '.') return NULL;
 
   // Return a token with the integer value
   char before = src[lit_len];
@@ -300,8 +318,8 @@ static Token *tokenise_real_lit(char *src) {
   // If only a negative sign without digits, return NULL
   if(negative && lit_len == 1) return NULL;
 
-  // Check that the next character is a space, newline, or end of string
-  if(!isspace((unsigned char)src[lit_len]) && src[lit_len] != '\0') return NULL;
+  // Check that the literal isn't running into an identifier or another dot
+  if(is_ident_char(src[lit_len]) || src[lit_len] == '.') return NULL;
 
   // Return a token with the real value
   char before = src[lit_len];
@@ -346,12 +364,16 @@ static Token *tokenise_char_lit(char *src) {
 
 static Token *tokenise_str_lit(char *src) {
   if(!src || *src == '\0' || isspace((unsigned char)*src)) return NULL;
-  if(*src != '\"') return NULL;
+  // Strings are written in either kind of quote, a single character in single
+  // quotes is a character literal instead
+  char quote = *src;
+  if(quote != '\"' && quote != '\'') return NULL;
   size_t lit_len = 1;
   int closed = 0;
   while(*(src + lit_len) && !closed) {
-    if(*(src + lit_len) == '\"') closed = 1;
     if(*(src + lit_len) == '\n') break;
+    if(*(src + lit_len) == '\\' && *(src + lit_len + 1) && *(src + lit_len + 1) != '\n') lit_len++;
+    else if(*(src + lit_len) == quote) closed = 1;
     lit_len++;
   }
 
@@ -454,9 +476,10 @@ static const char *token_type_to_str(TokenType t) {
   static const char *token_type_strings[] = {
       "TokenInteger", "TokenReal", "TokenBoolean", "TokenCharacter", "TokenArray", "TokenString", "TokenConst", "TokenSet", "TokenTo", "TokenIf",
       "TokenThen", "TokenElse", "TokenEnd", "TokenWhile", "TokenDo", "TokenRepeat", "TokenUntil", "TokenTimes", "TokenReceive", "TokenSend",
-      "TokenFrom", "TokenRead", "TokenWrite", "TokenProcedure", "TokenFunction", "TokenReturn", "TokenAdd", "TokenSubtract", "TokenDivide", "TokenMultiply",
+      "TokenFrom", "TokenRead", "TokenWrite", "TokenProcedure", "TokenFunction", "TokenReturn", "TokenFor", "TokenForEach", "TokenEach", "TokenStep",
+      "TokenOf", "TokenAdd", "TokenSubtract", "TokenDivide", "TokenMultiply",
       "TokenExponent", "TokenModulo", "TokenIntDiv", "TokenEqualTo", "TokenNEqualTo", "TokenGreaterThan", "TokenGreaterThanEq", "TokenLessThan", "TokenLessThanEq", "TokenAnd",
-      "TokenOr", "TokenNot", "TokenAppend", "TokenIdentifier", "TokenIntLit", "TokenRealLit", "TokenBooleanLit", "TokenCharacterLit", "TokenStringLit"};
+      "TokenOr", "TokenNot", "TokenAppend", "TokenLBracket", "TokenRBracket", "TokenLParen", "TokenRParen", "TokenComma", "TokenIdentifier", "TokenIntLit", "TokenRealLit", "TokenBooleanLit", "TokenCharacterLit", "TokenStringLit"};
   if(t >= 0 && t < sizeof(token_type_strings) / sizeof(token_type_strings[0]))
     return token_type_strings[t];
   else
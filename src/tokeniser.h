@@ -34,6 +34,11 @@ typedef enum {
   TokenProcedure, // PROCEDURE
   TokenFunction,  // FUNCTION
   TokenReturn,    // RETURN
+  TokenFor,       // FOR
+  TokenForEach,   // FOREACH
+  TokenEach,      // EACH
+  TokenStep,      // STEP
+  TokenOf,        // OF
   // Operators
   // Arithmetic
   TokenAdd,      // +
@@ -56,13 +61,19 @@ typedef enum {
   TokenNot, // NOT
   // Array
   TokenAppend, // &
+  // Punctuation
+  TokenLBracket, // [
+  TokenRBracket, // ]
+  TokenLParen,   // (
+  TokenRParen,   // )
+  TokenComma,    // ,
   // Other things
   TokenIdentifier,   // MyValue, myValue, My_Value, Counter2
   TokenIntLit,       // 1, -1, 1234
   TokenRealLit,      // 1.0, 23.5, -0.007
   TokenBooleanLit,   // TRUE, FALSE
   TokenCharacterLit, // 'a', 'b', '0', '\n'
-  TokenStringLit,    // "hello!", "AKPDAOPS"
+  TokenStringLit,    // "hello!", 'AKPDAOPS', 
 } TokenType;
 
 typedef struct {
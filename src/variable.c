@@ -1,5 +1,6 @@
 #include "variable.h"
 #include "def.h"
+#include "real.h"
 #include <stdio.h>
 
 // Create a new variable with a type
@@ -19,6 +20,13 @@ Variable var_new(VarType type) {
   case VarCharacter:
     v.character_val = 0;
     break;
+  case VarString:
+    string_init(&v.string_val);
+    break;
+  case VarArray:
+    PERROR("Arrays must be created with var_new_array()\n");
+    v.type = -1;
+    return v;
   default:
     PERROR("Invalid variable type %d\n", type);
     v.type = -1;
@@ -28,23 +36,114 @@ Variable var_new(VarType type) {
   return v;
 }
 
+// Create a new array variable of zeroed elements
+Variable var_new_array(VarType elem_type, size_t length) {
+  Variable v = (Variable){0};
+  v.type = VarArray;
+  v.array_val = array_create(elem_type, length);
+  if(!v.array_val) {
+    PERROR("Failed to create array.\n");
+    v.type = -1;
+  }
+  return v;
+}
+
+// Create a new two-dimensional array variable of zeroed elements
+Variable var_new_array_2d(VarType elem_type, size_t rows, size_t columns) {
+  Variable v = (Variable){0};
+  v.type = VarArray;
+  v.array_val = array_create_2d(elem_type, rows, columns);
+  if(!v.array_val) {
+    PERROR("Failed to create array.\n");
+    v.type = -1;
+  }
+  return v;
+}
+
 // Destroy a variable
-// Unneeded for now, but i will need to free memory when i add arrays.
-static void variable_destroy(Variable *v) {
+void variable_destroy(Variable *v) {
+  if(v->type == VarArray) array_destroy(&v->array_val);
+  if(v->type == VarString) string_destroy(&v->string_val);
   v->type = -1;
   return;
 }
 
 // Copy a variable by value
-// Also unneeded until arrays
+// Arrays and strings share their storage with the original, which is copied
+// only when one of them is changed.
 Variable variable_copy(Variable b) {
+  if(b.type == VarArray) array_share(b.array_val);
+  if(b.type == VarString) {
+    Variable copy = {.type = VarString};
+    string_copy(&copy.string_val, &b.string_val);
+    return copy;
+  }
   return b;
 }
 
+// Name of a type, as it is written in pseudocode
+const char *var_type_name(VarType type) {
+  switch(type) {
+  case VarInteger:
+    return "INTEGER";
+  case VarReal:
+    return "REAL";
+  case VarBoolean:
+    return "BOOLEAN";
+  case VarCharacter:
+    return "CHARACTER";
+  case VarArray:
+    return "ARRAY";
+  case VarString:
+    return "STRING";
+  default:
+    return "?";
+  }
+}
+
+// Check whether a value of type from can be converted to type to
+// Only INTEGER to REAL and CHARACTER to STRING are done implicitly, anything
+// else must already match.
+int var_can_coerce(VarType from, VarType to) {
+  return from == to || (from == VarInteger && to == VarReal) || (from == VarCharacter && to == VarString);
+}
+
+// Convert a variable to a type in place, as var_can_coerce() allows
+int var_coerce(Variable *v, VarType type) {
+  if(v->type == type) return 0;
+  if(v->type == VarInteger && type == VarReal) {
+    v->real_val = (double)v->int_val;
+    v->type = VarReal;
+    return 0;
+  }
+  if(v->type == VarCharacter && type == VarString) {
+    char c = v->character_val;
+    string_init(&v->string_val);
+    string_append(&v->string_val, &c, 1);
+    v->type = VarString;
+    return 0;
+  }
+  PERROR("Type mismatch: expected %s, got %s\n", var_type_name(type), var_type_name(v->type));
+  return 1;
+}
+
 // Assign variable a = variable b
 int var_assign(Variable *a, Variable *b) {
+  if(b->type == -1) {
+    PERROR("Trying to assign with a null value\n");
+    return 1;
+  }
+
+  Variable copy = variable_copy(*b);
+  return var_move(a, &copy);
+}
+
+// Assign variable a = variable b, taking b's value rather than copying it
+// b is left empty, whether or not the assignment succeeds.
+int var_move(Variable *a, Variable *b) {
   if(a->type == -1) {
     PERROR("Trying to assign to a null variable\n");
+    variable_destroy(b);
     return 1;
   }
 
@@ -53,6 +152,209 @@ int var_assign(Variable *a, Variable *b) {
     return 1;
   }
 
+  if(var_coerce(b, a->type) != 0) {
+    variable_destroy(b);
+    return 1;
+  }
+
+  // An empty [] takes on the element type of the array it's assigned to
+  if(a->type == VarArray) {
+    Array *dst = a->array_val;
+    if(b->array_val->length == 0 && b->array_val->type == -1 && dst->type != -1) {
+      if(array_make_unique(&b->array_val) != 0) {
+        variable_destroy(b);
+        return 1;
+      }
+      b->array_val->type = dst->type;
+    }
+    Array *src = b->array_val;
+    if(src->type != dst->type) {
+      PERROR("Type mismatch: expected ARRAY OF %s, got ARRAY OF %s\n", var_type_name(dst->type), var_type_name(src->type));
+      variable_destroy(b);
+      return 1;
+    }
+  }
+
   variable_destroy(a);
-  *a = variable_copy(*b);
+  *a = *b;
+  b->type = -1;
+  return 0;
+}
+
+// Read an element of an array
+// The index must already be bounds checked. STRING elements share the array's
+// copy, so the result must be destroyed.
+Variable var_array_get(Array *array, size_t index) {
+  Variable v = (Variable){.type = array->type};
+  switch(array->type) {
+  case VarInteger:
+    v.int_val = array->ints[index];
+    break;
+  case VarReal:
+    v.real_val = array->reals[index];
+    break;
+  case VarBoolean:
+    v.boolean_val = array_get_bit(array, index);
+    break;
+  case VarCharacter:
+    v.character_val = array->chars[index];
+    break;
+  case VarString:
+    string_copy(&v.string_val, &array->strings[index]);
+    break;
+  default:
+    v.type = -1;
+    break;
+  }
+  return v;
+}
+
+// Write an element of an array
+// The index must already be bounds checked.
+int var_array_set(Array *array, size_t index, Variable *value) {
+  Variable v = *value;
+  if(var_coerce(&v, array->type) != 0) {
+    PERROR("Can't store %s in ARRAY OF %s\n", var_type_name(value->type), var_type_name(array->type));
+    return 1;
+  }
+
+  switch(array->type) {
+  case VarInteger:
+    array->ints[index] = v.int_val;
+    break;
+  case VarReal:
+    array->reals[index] = v.real_val;
+    break;
+  case VarBoolean:
+    array_set_bit(array, index, v.boolean_val != 0);
+    break;
+  case VarCharacter:
+    array->chars[index] = v.character_val;
+    break;
+  case VarString:
+    string_destroy(&array->strings[index]);
+    string_copy(&array->strings[index], &v.string_val);
+    break;
+  default:
+    return 1;
+  }
+  return 0;
+}
+
+// Set count elements of an array, starting at start, to a value
+// The range must already be bounds checked.
+int var_array_fill(Array *array, size_t start, size_t count, Variable *value) {
+  Variable v = *value;
+  if(var_coerce(&v, array->type) != 0) {
+    PERROR("Can't store %s in ARRAY OF %s\n", var_type_name(value->type), var_type_name(array->type));
+    return 1;
+  }
+
+  if(array->type == VarBoolean) {
+    array_fill_bits(array, start, count, v.boolean_val != 0);
+    return 0;
+  }
+
+  for(size_t i = 0; i < count; i++) {
+    if(var_array_set(array, start + i, &v) != 0) return 1;
+  }
+  return 0;
+}
+
+// Append an element to an array
+int var_array_push(Array *array, Variable *value) {
+  if(value->type == VarArray) {
+    PERROR("Can't store ARRAY in an ARRAY\n");
+    return 1;
+  }
+  if(array->type == -1 && array->length == 0) array->type = value->type;
+
+  if(array_reserve(array, array->length + 1) != 0) {
+    PERROR("Failed to grow array.\n");
+    return 1;
+  }
+
+  // The new slot is past the end, so there's no old string in it to free
+  if(array->type == VarString) string_init(&array->strings[array->length]);
+  if(var_array_set(array, array->length, value) != 0) return 1;
+  array->length++;
+  return 0;
+}
+
+// Append every element of other to array
+// Like array_extend, but INTEGER elements are converted when appended to an
+// ARRAY OF REAL.
+int var_array_extend(Array *array, Array *other) {
+  if(array->type == other->type || other->length == 0 || (array->type == -1 && array->length == 0)) {
+    return array_extend(array, other);
+  }
+
+  // other may be array itself, so remember its length before growing
+  size_t other_length = other->length;
+  if(array_reserve(array, array->length + other_length) != 0) {
+    PERROR("Failed to grow array.\n");
+    return 1;
+  }
+  for(size_t i = 0; i < other_length; i++) {
+    Variable elem = var_array_get(other, i);
+    int failed = var_array_push(array, &elem);
+    variable_destroy(&elem);
+    if(failed) return 1;
+  }
+  return 0;
+}
+
+// Print count elements of an array as a list, starting at start
+static void print_elems(Output *out, Array *array, size_t start, size_t count) {
+  output_putc(out, '[');
+  for(size_t i = 0; i < count; i++) {
+    if(i > 0) output_write(out, ", ", 2);
+    Variable elem = var_array_get(array, start + i);
+    var_print(out, &elem);
+    variable_destroy(&elem);
+  }
+  output_putc(out, ']');
+}
+
+// Print a variable's value
+void var_print(Output *out, Variable *v) {
+  switch(v->type) {
+  case VarInteger:
+    output_int(out, v->int_val);
+    break;
+  case VarReal: {
+    char buf[REAL_FORMAT_MAX];
+    output_write(out, buf, real_format(v->real_val, buf));
+    break;
+  }
+  case VarBoolean:
+    if(v->boolean_val) output_write(out, "TRUE", 4);
+    else output_write(out, "FALSE", 5);
+    break;
+  case VarCharacter:
+    output_putc(out, v->character_val);
+    break;
+  case VarString:
+    output_write(out, string_data(&v->string_val), v->string_val.length);
+    break;
+  case VarArray: {
+    Array *array = v->array_val;
+    if(!array->stride) {
+      print_elems(out, array, 0, array->length);
+      break;
+    }
+
+    // Two-dimensional arrays are printed as a list of rows
+    output_putc(out, '[');
+    for(size_t row = 0; row < array_rows(array); row++) {
+      if(row > 0) output_write(out, ", ", 2);
+      print_elems(out, array, row * array->stride, array->stride);
+    }
+    output_putc(out, ']');
+    break;
+  }
+  default:
+    output_putc(out, '?');
+    break;
+  }
 }
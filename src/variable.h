@@ -2,21 +2,41 @@
 #define VARIABLE_H
 
 // Includes
+#include "array.h"
+#include "output.h"
 #include "parser.h"
+#include "str.h"
+#include <stdio.h>
 
 // Structs
 typedef struct {
   VarType type;
   union {
     int int_val;
-    float real_val;
+    double real_val;
     int boolean_val;
     char character_val;
+    Array *array_val;
+    String string_val;
   };
 } Variable;
 
 // Function prototypes
 Variable var_new(VarType type);
+Variable var_new_array(VarType elem_type, size_t length);
+Variable var_new_array_2d(VarType elem_type, size_t rows, size_t columns);
+void variable_destroy(Variable *v);
+Variable variable_copy(Variable b);
 int var_assign(Variable *a, Variable *b);
+int var_move(Variable *a, Variable *b);
+int var_can_coerce(VarType from, VarType to);
+int var_coerce(Variable *v, VarType type);
+const char *var_type_name(VarType type);
+void var_print(Output *out, Variable *v);
+Variable var_array_get(Array *array, size_t index);
+int var_array_set(Array *array, size_t index, Variable *value);
+int var_array_fill(Array *array, size_t start, size_t count, Variable *value);
+int var_array_push(Array *array, Variable *value);
+int var_array_extend(Array *array, Array *other);
 
 #endif // variable.h
@@ -0,0 +1,101 @@
+// Check real_format() against strtod() and printf() for a spread of doubles
+// Every value must read back as itself, with no more digits than the
+// shortest %.*e that does, and those digits must be the correctly rounded
+// ones. With --dump, the values are written one a line as their bits in hex
+// and their text instead, for tests/real_repr.py to check against Python.
+// Usage: real_format [--dump] [count]
+#include "../src/real.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Values that are easy to get wrong, checked before the random ones
+static const double SPECIALS[] = {
+    0.0, -0.0, 1.0, 0.1, 0.2 + 0.1, 1e16, 1e15, 1e-4, 1e-5, 5e-324,
+    2.2250738585072014e-308, 1.7976931348623157e308, 123456789012345678.0,
+    9007199254740993.0, 1.5, 100.0, 2.5e-5};
+#define SPECIAL_COUNT (sizeof(SPECIALS) / sizeof(SPECIALS[0]))
+
+static uint64_t seed = 88172645463325252ull;
+
+static uint64_t next_random(void) {
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+// The k-th value to check: the specials, then random finite doubles, every
+// other one with a random exponent so they're spread over the whole range
+static double test_value(size_t k) {
+  if(k < SPECIAL_COUNT) return SPECIALS[k];
+  double value;
+  do {
+    uint64_t bits = next_random();
+    if(k & 1) bits = (bits & 0x800fffffffffffffull) | (next_random() % 2047) << 52;
+    memcpy(&value, &bits, sizeof(value));
+  } while(value != value || value - value != 0);
+  return value;
+}
+
+// Copy the significant digits of text, before any exponent, into digits
+// Trailing zeros are dropped, and the number of digits left is returned.
+static int significant_digits(const char *text, char *digits) {
+  int count = 0;
+  int started = 0;
+  for(const char *c = text; *c && *c != 'e'; c++) {
+    if(*c < '0' || *c > '9') continue;
+    if(*c != '0') started = 1;
+    if(started) digits[count++] = *c;
+  }
+  while(count > 1 && digits[count - 1] == '0') count--;
+  return count;
+}
+
+int main(int argc, char **argv) {
+  int dump = argc > 1 && strcmp(argv[1], "--dump") == 0;
+  size_t count = argc > 1 + dump ? strtoul(argv[1 + dump], NULL, 10) : 100000;
+  char buf[REAL_FORMAT_MAX];
+
+  if(dump) {
+    const double non_finite[] = {1.0 / 0.0, -1.0 / 0.0, 0.0 / 0.0};
+    for(size_t k = 0; k < SPECIAL_COUNT + count + 3; k++) {
+      double value = k < 3 ? non_finite[k] : test_value(k - 3);
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      real_format(value, buf);
+      printf("%016llx %s\n", (unsigned long long)bits, buf);
+    }
+    return 0;
+  }
+
+  size_t failures = 0;
+  for(size_t k = 0; k < SPECIAL_COUNT + count; k++) {
+    double value = test_value(k);
+    real_format(value, buf);
+    if(strtod(buf, NULL) != value) {
+      if(failures++ < 10) printf("%.17g: %s doesn't read back\n", value, buf);
+      continue;
+    }
+
+    // The fewest digits that read back, and what they are
+    char shortest[64];
+    int precision = 1;
+    for(; precision < 17; precision++) {
+      snprintf(shortest, sizeof(shortest), "%.*e", precision - 1, value);
+      if(strtod(shortest, NULL) == value) break;
+    }
+    if(precision == 17) snprintf(shortest, sizeof(shortest), "%.16e", value);
+
+    char digits[32], expected[32];
+    int length = significant_digits(buf, digits);
+    int expected_length = significant_digits(shortest, expected);
+    if(length != expected_length || memcmp(digits, expected, length) != 0) {
+      if(failures++ < 10) printf("%.17g: %s should have the digits of %s\n", value, buf, shortest);
+    }
+  }
+
+  printf("real_format: %zu of %zu values wrong\n", failures, SPECIAL_COUNT + count);
+  return failures != 0;
+}
@@ -0,0 +1,17 @@
+# Check that real_format() writes every REAL the way Python's repr() does,
+# reading the values from real_format --dump on standard input
+import struct
+import sys
+
+wrong = 0
+total = 0
+for line in sys.stdin:
+    bits, text = line.split()
+    value = struct.unpack('<d', bytes.fromhex(bits)[::-1])[0]
+    total += 1
+    if repr(value) != text:
+        wrong += 1
+        if wrong <= 10:
+            print('%s: real_format gave %s, repr gives %r' % (bits, text, value))
+print('real_format: %d of %d values unlike repr()' % (wrong, total))
+sys.exit(wrong != 0)
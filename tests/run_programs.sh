@@ -0,0 +1,36 @@
+#!/bin/sh
+# Run every program in tests/programs and compare its output with the .out
+# file next to it, then do the same for its Python translation if python3 is
+# installed
+# A .py.out file holds what the translation shows instead, where Python's
+# unbounded integers don't wrap around like INTEGER does.
+# Usage: tests/run_programs.sh [edxp]
+EDXP=$(realpath "${1:-./build/edxp}")
+PROGRAMS=$(cd "$(dirname "$0")/programs" && pwd)
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+command -v python3 > /dev/null && PYTHON=python3
+
+cd "$DIR"
+status=0
+for program in "$PROGRAMS"/*.edx; do
+  name=$(basename "$program" .edx)
+  if "$EDXP" "$program" > output.txt && cmp -s output.txt "$PROGRAMS/$name.out"; then
+    echo "ok    $name"
+  else
+    echo "FAIL  $name"
+    diff "$PROGRAMS/$name.out" output.txt
+    status=1
+  fi
+  [ -n "$PYTHON" ] || continue
+  expected=$PROGRAMS/$name.out
+  [ -f "$PROGRAMS/$name.py.out" ] && expected=$PROGRAMS/$name.py.out
+  if "$EDXP" -c "$program" > /dev/null && $PYTHON out.py > output.txt && cmp -s output.txt "$expected"; then
+    echo "ok    $name -c"
+  else
+    echo "FAIL  $name -c"
+    diff "$expected" output.txt
+    status=1
+  fi
+done
+exit $status
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Parse, dump and free programs nested 100k deep, which would overflow the C
+# stack if any of them recursed once per level
+# Usage: tests/stress_nesting.sh [edxp] [depth]
+EDXP=${1:-./build/edxp}
+DEPTH=${2:-100000}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# Nested blocks: <open> repeated DEPTH times, a statement, then <close>
+nest() {
+  awk -v depth="$DEPTH" -v head="$2" -v tail="$3" 'BEGIN {
+    for(i = 0; i < depth; i++) print head
+    print "SET x TO 1"
+    for(i = 0; i < depth; i++) print tail
+  }' > "$DIR/$1.edx"
+}
+nest if "IF TRUE THEN" "END IF"
+nest while "WHILE FALSE DO" "END WHILE"
+nest for "FOR i FROM 1 TO 0 DO" "END FOR"
+# Nested parentheses, and a chain of operators nested to the right
+awk -v depth="$DEPTH" 'BEGIN {
+  printf "SET x TO "
+  for(i = 0; i < depth; i++) printf "("
+  printf "1"
+  for(i = 0; i < depth; i++) printf ")"
+  print ""
+  printf "SET y TO "
+  for(i = 0; i < depth; i++) printf "1 + ("
+  printf "1"
+  for(i = 0; i < depth; i++) printf ")"
+  print ""
+}' > "$DIR/parens.edx"
+
+status=0
+for program in if while for parens; do
+  for flags in "-P" "-P -p"; do
+    if "$EDXP" $flags "$DIR/$program.edx" > /dev/null; then
+      echo "ok    $program $flags"
+    else
+      echo "FAIL  $program $flags (exit $?)"
+      status=1
+    fi
+  done
+done
+exit $status